@@ -0,0 +1,932 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "red black tree.hpp"
+
+
+/**
+ * B+ tree: a B-tree (CLRS chapter 18) that keeps every key in its leaves and links the leaves into a list.
+ *
+ * A node holds up to 2t - 1 keys for minimum degree t, chosen so that the keys of a node fill about `NodeBytes`.
+ * One node visit then costs a few adjacent cache lines instead of a cache miss per key, and the tree is only log_t(n) levels deep.
+ * Internal nodes only hold separators: the keys in child i are between separators i - 1 and i (inclusive, since duplicates are allowed).
+ * Range scans walk the leaf list sequentially.
+ *
+ * `int32_t` keys under `std::less` are searched within a node with SSE2 compares, counting every key less than the search key at once.
+ * Other built-in keys use a branchless binary search, and the rest `std::lower_bound`.
+ *
+ * Insertion splits full nodes on the way down, as B-TREE-INSERT does, so it never has to walk back up.
+ * Deletion fixes underflowing nodes on the way back up by borrowing from a sibling or merging with it.
+ */
+template <typename T, typename Compare = std::less<T>, std::size_t NodeBytes = 256>
+class BPlusTree {
+public:
+    /// CLRS minimum degree t: every node but the root holds between t - 1 and 2t - 1 keys.
+    static constexpr std::size_t minimumDegree = std::max<std::size_t>(2, (NodeBytes / sizeof(T) + 1) / 2);
+    static constexpr std::size_t maxKeyCount = 2 * minimumDegree - 1;
+    static constexpr std::size_t minKeyCount = minimumDegree - 1;
+
+private:
+    /// SIMD compares read whole blocks of 4 keys, so the key array is padded to a multiple of 4.
+    static constexpr std::size_t keySlotCount = (maxKeyCount + 3) / 4 * 4;
+
+#if defined(__SSE2__)
+    static constexpr bool isSIMDSearchable = std::is_same_v<T, std::int32_t> && (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>>) && (keySlotCount <= 64);
+#else
+    static constexpr bool isSIMDSearchable = false;
+#endif
+
+public:
+    class Node {
+    public:
+        bool isLeaf;
+        std::size_t keyCount = 0;
+
+        /// Only `keys[0, keyCount)` are meaningful. The rest are initialized so that SIMD compares never read indeterminate values.
+        T keys[keySlotCount] = {};
+
+    public:
+        explicit Node(bool isLeaf): isLeaf(isLeaf) {}
+    };
+
+    class LeafNode: public Node {
+    public:
+        LeafNode* previousLeaf = nullptr;
+        LeafNode* nextLeaf = nullptr;
+
+    public:
+        LeafNode(): Node(true) {}
+    };
+
+    class InternalNode: public Node {
+    public:
+        Node* children[maxKeyCount + 1] = {};
+
+    public:
+        InternalNode(): Node(false) {}
+    };
+
+    using ValueCompare = Compare;
+
+    static_assert(std::is_empty_v<Compare>, "Comparators are default-constructed at every comparison, so they must be stateless.");
+
+public:
+    Node* rootNode;
+
+private:
+    std::size_t size;
+
+public:
+    BPlusTree() {
+        rootNode = new LeafNode();
+        size = 0;
+    }
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    ~BPlusTree() {
+        deleteSubtree(rootNode);
+    }
+
+private:
+    static void deleteSubtree(Node* node) {
+        if (node->isLeaf) {
+            delete static_cast<LeafNode*>(node);
+        } else {
+            auto internalNode = static_cast<InternalNode*>(node);
+            for (std::size_t i = 0; i <= internalNode->keyCount; i += 1) {
+                deleteSubtree(internalNode->children[i]);
+            }
+            delete internalNode;
+        }
+    }
+
+    static LeafNode* asLeaf(Node* node) {
+        return static_cast<LeafNode*>(node);
+    }
+
+    static InternalNode* asInternal(Node* node) {
+        return static_cast<InternalNode*>(node);
+    }
+
+
+// MARK: Intra-Node Search
+private:
+    template <typename A, typename B>
+    static bool isLess(const A& a, const B& b) {
+        return Compare()(a, b);
+    }
+
+#if defined(__SSE2__)
+    /// Bit i is set if `keys[i] < value`, for every slot up to `keyCount` rounded up to a block.
+    static std::uint64_t getLessMask(const Node* node, std::int32_t value) {
+        auto needle = _mm_set1_epi32(value);
+
+        std::uint64_t returnValue = 0;
+        for (std::size_t i = 0; i < node->keyCount; i += 4) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node->keys + i));
+            auto isLessBlock = _mm_cmplt_epi32(block, needle);
+            returnValue |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(isLessBlock))) << i;
+        }
+
+        return returnValue;
+    }
+
+    static std::uint64_t getCountMask(std::size_t keyCount) {
+        return (keyCount >= 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << keyCount) - 1);
+    }
+#endif
+
+    /**
+     * Binary search for the first key for which `isBefore` is false, where `isBefore` holds for a prefix of the keys.
+     *
+     * The range halves every step no matter how the comparison goes, so built-in keys compile to conditional moves instead of unpredictable branches.
+     */
+    template <typename IsBefore>
+    static std::size_t getBranchlessBound(const Node* node, IsBefore isBefore) {
+        if (node->keyCount == 0) {
+            return 0;
+        }
+
+        auto base = node->keys;
+        auto count = node->keyCount;
+        while (count > 1) {
+            auto half = count / 2;
+            base = isBefore(base[half]) ? (base + half) : base;
+            count -= half;
+        }
+
+        return (base - node->keys) + (isBefore(*base) ? 1 : 0);
+    }
+
+    /// @return Index of the first key not less than `value`, which is also the number of keys less than it.
+    template <typename Key>
+    static std::size_t countKeysLess(const Node* node, const Key& value) {
+        if constexpr (isSIMDSearchable && std::is_same_v<Key, std::int32_t>) {
+#if defined(__SSE2__)
+            return __builtin_popcountll(getLessMask(node, value) & getCountMask(node->keyCount));
+#endif
+        }
+
+        if constexpr (std::is_arithmetic_v<T>) {
+            return getBranchlessBound(node, [&](const T& key) { return isLess(key, value); });
+        }
+
+        return std::lower_bound(node->keys, node->keys + node->keyCount, value, Compare()) - node->keys;
+    }
+
+    /// @return Index of the first key greater than `value`.
+    template <typename Key>
+    static std::size_t countKeysNotGreater(const Node* node, const Key& value) {
+        if constexpr (isSIMDSearchable && std::is_same_v<Key, std::int32_t>) {
+#if defined(__SSE2__)
+            // `keys[i] <= value` exactly when `keys[i] < value + 1`, except that `value + 1` overflows for the largest key.
+            if (value != std::numeric_limits<std::int32_t>::max()) {
+                return __builtin_popcountll(getLessMask(node, value + 1) & getCountMask(node->keyCount));
+            }
+            return node->keyCount;
+#endif
+        }
+
+        if constexpr (std::is_arithmetic_v<T>) {
+            return getBranchlessBound(node, [&](const T& key) { return !isLess(value, key); });
+        }
+
+        return std::upper_bound(node->keys, node->keys + node->keyCount, value, Compare()) - node->keys;
+    }
+
+
+// MARK: Iteration
+public:
+    /// Position of a key within a leaf. Leaves are linked, so stepping is O(1).
+    class Iterator {
+    private:
+        const BPlusTree* tree;
+        LeafNode* leaf;
+        std::size_t index;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        Iterator(): tree(nullptr), leaf(nullptr), index(0) {}
+
+        /// `leaf == nullptr` is the end.
+        Iterator(const BPlusTree* tree, LeafNode* leaf, std::size_t index): tree(tree), leaf(leaf), index(index) {
+            // Past the last key of a leaf is the first key of the next one.
+            while ((this->leaf != nullptr) && (this->index >= this->leaf->keyCount)) {
+                this->leaf = this->leaf->nextLeaf;
+                this->index = 0;
+            }
+        }
+
+        const T& operator*() const {
+            return leaf->keys[index];
+        }
+
+        const T* operator->() const {
+            return &(leaf->keys[index]);
+        }
+
+        LeafNode* getLeaf() const {
+            return leaf;
+        }
+
+        std::size_t getIndex() const {
+            return index;
+        }
+
+        Iterator& operator++() {
+            index += 1;
+            if (index == leaf->keyCount) {
+                leaf = leaf->nextLeaf;
+                index = 0;
+            }
+
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        /// Decrementing `end()` moves to the largest key.
+        Iterator& operator--() {
+            if (leaf == nullptr) {
+                leaf = BPlusTree::getMaxLeaf(tree->rootNode);
+                index = leaf->keyCount;
+            }
+            while (index == 0) {
+                leaf = leaf->previousLeaf;
+                index = leaf->keyCount;
+            }
+            index -= 1;
+
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto returnValue = *this;
+            --(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return (leaf == other.leaf) && (index == other.index);
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    Iterator begin() const {
+        return Iterator(this, getMinLeaf(rootNode), 0);
+    }
+
+    Iterator end() const {
+        return Iterator(this, nullptr, 0);
+    }
+
+private:
+    static LeafNode* getMinLeaf(Node* node) {
+        while (!node->isLeaf) {
+            node = asInternal(node)->children[0];
+        }
+        return asLeaf(node);
+    }
+
+    static LeafNode* getMaxLeaf(Node* node) {
+        while (!node->isLeaf) {
+            node = asInternal(node)->children[node->keyCount];
+        }
+        return asLeaf(node);
+    }
+
+
+// MARK: Queries
+public:
+    std::size_t getSize() const {
+        return size;
+    }
+
+    std::vector<T> inOrderWalk() const {
+        return std::vector<T>(begin(), end());
+    }
+
+    /// @return The smallest key, or `end()` if the tree is empty.
+    Iterator getMin() const {
+        return begin();
+    }
+
+    /// @return The largest key, or `end()` if the tree is empty.
+    Iterator getMax() const {
+        if (size == 0) {
+            return end();
+        }
+
+        auto leaf = getMaxLeaf(rootNode);
+        return Iterator(this, leaf, leaf->keyCount - 1);
+    }
+
+    Iterator getPredecessor(Iterator it) const {
+        return (it == begin()) ? end() : --it;
+    }
+
+    Iterator getSuccessor(Iterator it) const {
+        return ++it;
+    }
+
+    /// @return The first key not less than `value`, or `end()`. O(t log_t n) compares, in O(log_t n) node visits.
+    template <typename Key>
+    Iterator lowerBound(const Key& value) const {
+        auto node = rootNode;
+        while (!node->isLeaf) {
+            node = asInternal(node)->children[countKeysLess(node, value)];
+        }
+
+        return Iterator(this, asLeaf(node), countKeysLess(node, value));
+    }
+
+    /// @return The first key greater than `value`, or `end()`.
+    template <typename Key>
+    Iterator upperBound(const Key& value) const {
+        auto node = rootNode;
+        while (!node->isLeaf) {
+            node = asInternal(node)->children[countKeysNotGreater(node, value)];
+        }
+
+        return Iterator(this, asLeaf(node), countKeysNotGreater(node, value));
+    }
+
+    /// @return A key equivalent to `value`, or `end()`.
+    template <typename Key>
+    Iterator searchForValue(const Key& value) const {
+        auto it = lowerBound(value);
+        if ((it != end()) && !isLess(value, *it)) {
+            return it;
+        }
+
+        return end();
+    }
+
+    /// Calls `visitor(key)` for every key in `[lowValue, highValue)`, in order. Walks the leaf list after one descent.
+    template <typename Key, typename Visitor>
+    void forEachInRange(const Key& lowValue, const Key& highValue, Visitor visitor) const {
+        for (auto it = lowerBound(lowValue); (it != end()) && isLess(*it, highValue); ++it) {
+            visitor(*it);
+        }
+    }
+
+
+// MARK: Insertions
+private:
+    /**
+     * Splits the full child `parent->children[i]` in two and inserts the separator into `parent`, which is not full.
+     *
+     * Refer to B-TREE-SPLIT-CHILD in section 18.2 of "Introduction to Algorithms".
+     * A leaf keeps its t smallest keys and copies the smallest key of the new right leaf up.
+     * An internal node moves its median key up, as in a B-tree.
+     */
+    static void splitChild(InternalNode* parent, std::size_t i) {
+        auto child = parent->children[i];
+
+        Node* rightNode = nullptr;
+        T separator;
+        if (child->isLeaf) {
+            auto leftLeaf = asLeaf(child);
+            auto rightLeaf = new LeafNode();
+
+            rightLeaf->keyCount = maxKeyCount - minimumDegree;
+            std::copy(leftLeaf->keys + minimumDegree, leftLeaf->keys + maxKeyCount, rightLeaf->keys);
+            leftLeaf->keyCount = minimumDegree;
+
+            rightLeaf->nextLeaf = leftLeaf->nextLeaf;
+            rightLeaf->previousLeaf = leftLeaf;
+            if (leftLeaf->nextLeaf != nullptr) {
+                leftLeaf->nextLeaf->previousLeaf = rightLeaf;
+            }
+            leftLeaf->nextLeaf = rightLeaf;
+
+            separator = rightLeaf->keys[0];
+            rightNode = rightLeaf;
+        } else {
+            auto leftInternal = asInternal(child);
+            auto rightInternal = new InternalNode();
+
+            rightInternal->keyCount = minimumDegree - 1;
+            std::copy(leftInternal->keys + minimumDegree, leftInternal->keys + maxKeyCount, rightInternal->keys);
+            std::copy(leftInternal->children + minimumDegree, leftInternal->children + maxKeyCount + 1, rightInternal->children);
+            leftInternal->keyCount = minimumDegree - 1;
+
+            separator = leftInternal->keys[minimumDegree - 1];
+            rightNode = rightInternal;
+        }
+
+        std::copy_backward(parent->keys + i, parent->keys + parent->keyCount, parent->keys + parent->keyCount + 1);
+        std::copy_backward(parent->children + i + 1, parent->children + parent->keyCount + 1, parent->children + parent->keyCount + 2);
+        parent->keys[i] = separator;
+        parent->children[i + 1] = rightNode;
+        parent->keyCount += 1;
+    }
+
+public:
+    /// Equal keys go after the existing ones. O(t log_t n).
+    Iterator insertValue(const T& value) {
+        if (rootNode->keyCount == maxKeyCount) {
+            // The only way the tree grows taller: the old root becomes the child of a new root.
+            auto newRootNode = new InternalNode();
+            newRootNode->children[0] = rootNode;
+            splitChild(newRootNode, 0);
+            rootNode = newRootNode;
+        }
+
+        auto node = rootNode;
+        while (!node->isLeaf) {
+            auto internalNode = asInternal(node);
+            auto i = countKeysNotGreater(internalNode, value);
+            if (internalNode->children[i]->keyCount == maxKeyCount) {
+                splitChild(internalNode, i);
+                if (!isLess(value, internalNode->keys[i])) {
+                    i += 1;
+                }
+            }
+            node = internalNode->children[i];
+        }
+
+        auto leaf = asLeaf(node);
+        auto position = countKeysNotGreater(leaf, value);
+        std::copy_backward(leaf->keys + position, leaf->keys + leaf->keyCount, leaf->keys + leaf->keyCount + 1);
+        leaf->keys[position] = value;
+        leaf->keyCount += 1;
+        size += 1;
+
+        return Iterator(this, leaf, position);
+    }
+
+
+// MARK: Deletion
+private:
+    /// Refills `parent->children[i]`, which has t - 2 keys, from a sibling, or merges it with one.
+    static void fixUnderflow(InternalNode* parent, std::size_t i) {
+        if ((i > 0) && (parent->children[i - 1]->keyCount > minKeyCount)) {
+            borrowFromLeft(parent, i);
+        } else if ((i < parent->keyCount) && (parent->children[i + 1]->keyCount > minKeyCount)) {
+            borrowFromRight(parent, i);
+        } else if (i > 0) {
+            mergeChildren(parent, i - 1);
+        } else {
+            mergeChildren(parent, i);
+        }
+    }
+
+    static void borrowFromLeft(InternalNode* parent, std::size_t i) {
+        auto child = parent->children[i];
+        auto leftSibling = parent->children[i - 1];
+
+        std::copy_backward(child->keys, child->keys + child->keyCount, child->keys + child->keyCount + 1);
+        if (child->isLeaf) {
+            child->keys[0] = leftSibling->keys[leftSibling->keyCount - 1];
+            parent->keys[i - 1] = child->keys[0];
+        } else {
+            // Rotate through the parent: the separator comes down, the left sibling's largest key goes up.
+            auto childInternal = asInternal(child);
+            auto leftInternal = asInternal(leftSibling);
+            std::copy_backward(childInternal->children, childInternal->children + child->keyCount + 1, childInternal->children + child->keyCount + 2);
+            childInternal->children[0] = leftInternal->children[leftSibling->keyCount];
+            child->keys[0] = parent->keys[i - 1];
+            parent->keys[i - 1] = leftSibling->keys[leftSibling->keyCount - 1];
+        }
+
+        child->keyCount += 1;
+        leftSibling->keyCount -= 1;
+    }
+
+    static void borrowFromRight(InternalNode* parent, std::size_t i) {
+        auto child = parent->children[i];
+        auto rightSibling = parent->children[i + 1];
+
+        if (child->isLeaf) {
+            child->keys[child->keyCount] = rightSibling->keys[0];
+            std::copy(rightSibling->keys + 1, rightSibling->keys + rightSibling->keyCount, rightSibling->keys);
+            parent->keys[i] = rightSibling->keys[0];
+        } else {
+            auto childInternal = asInternal(child);
+            auto rightInternal = asInternal(rightSibling);
+            child->keys[child->keyCount] = parent->keys[i];
+            childInternal->children[child->keyCount + 1] = rightInternal->children[0];
+            parent->keys[i] = rightSibling->keys[0];
+            std::copy(rightSibling->keys + 1, rightSibling->keys + rightSibling->keyCount, rightSibling->keys);
+            std::copy(rightInternal->children + 1, rightInternal->children + rightSibling->keyCount + 1, rightInternal->children);
+        }
+
+        child->keyCount += 1;
+        rightSibling->keyCount -= 1;
+    }
+
+    /// Merges `parent->children[i + 1]` into `parent->children[i]` and removes separator `i` from `parent`.
+    static void mergeChildren(InternalNode* parent, std::size_t i) {
+        auto leftNode = parent->children[i];
+        auto rightNode = parent->children[i + 1];
+
+        if (leftNode->isLeaf) {
+            auto leftLeaf = asLeaf(leftNode);
+            auto rightLeaf = asLeaf(rightNode);
+            std::copy(rightLeaf->keys, rightLeaf->keys + rightLeaf->keyCount, leftLeaf->keys + leftLeaf->keyCount);
+            leftLeaf->keyCount += rightLeaf->keyCount;
+
+            leftLeaf->nextLeaf = rightLeaf->nextLeaf;
+            if (rightLeaf->nextLeaf != nullptr) {
+                rightLeaf->nextLeaf->previousLeaf = leftLeaf;
+            }
+            delete rightLeaf;
+        } else {
+            // The separator comes down between the two halves, as in B-TREE-DELETE.
+            auto leftInternal = asInternal(leftNode);
+            auto rightInternal = asInternal(rightNode);
+            leftInternal->keys[leftInternal->keyCount] = parent->keys[i];
+            std::copy(rightInternal->keys, rightInternal->keys + rightInternal->keyCount, leftInternal->keys + leftInternal->keyCount + 1);
+            std::copy(rightInternal->children, rightInternal->children + rightInternal->keyCount + 1, leftInternal->children + leftInternal->keyCount + 1);
+            leftInternal->keyCount += rightInternal->keyCount + 1;
+            delete rightInternal;
+        }
+
+        std::copy(parent->keys + i + 1, parent->keys + parent->keyCount, parent->keys + i);
+        std::copy(parent->children + i + 2, parent->children + parent->keyCount + 1, parent->children + i + 1);
+        parent->keyCount -= 1;
+    }
+
+    /// @return Whether a key equivalent to `value` was removed from the subtree. The subtree may be left with t - 2 keys in its root.
+    template <typename Key>
+    static bool deleteFromSubtree(Node* node, const Key& value) {
+        if (node->isLeaf) {
+            auto position = countKeysLess(node, value);
+            if ((position == node->keyCount) || isLess(value, node->keys[position])) {
+                return false;
+            }
+
+            std::copy(node->keys + position + 1, node->keys + node->keyCount, node->keys + position);
+            node->keyCount -= 1;
+            return true;
+        }
+
+        // Equal keys may continue in the next children while the separators equal `value`.
+        auto internalNode = asInternal(node);
+        auto i = countKeysLess(node, value);
+        for (auto j = i; j <= node->keyCount; j += 1) {
+            if ((j > i) && isLess(value, node->keys[j - 1])) {
+                break;
+            }
+
+            if (deleteFromSubtree(internalNode->children[j], value)) {
+                if (internalNode->children[j]->keyCount < minKeyCount) {
+                    fixUnderflow(internalNode, j);
+                }
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+    /// Removes one key equivalent to `value`. O(t log_t n).
+    template <typename Key>
+    bool deleteValue(const Key& value) {
+        if (!deleteFromSubtree(rootNode, value)) {
+            return false;
+        }
+
+        if ((!rootNode->isLeaf) && (rootNode->keyCount == 0)) {
+            // The only way the tree gets shorter.
+            auto oldRootNode = asInternal(rootNode);
+            rootNode = oldRootNode->children[0];
+            delete oldRootNode;
+        }
+
+        size -= 1;
+        return true;
+    }
+};
+
+
+// MARK: - Helpers
+/**
+ * Checks key counts, key order, separator bounds, uniform leaf depth and the leaf list of a subtree.
+ *
+ * @param lowValue, highValue Bounds from the separators above `node`, or `nullptr` for none.
+ * @return Depth of the leaves below `node`, or -1 if anything is wrong.
+ */
+template <typename Tree, typename T>
+int getLeafDepthIfValid(const typename Tree::Node* node, bool isRoot, const T* lowValue, const T* highValue, std::vector<const typename Tree::LeafNode*>& leaves) {
+    auto compare = typename Tree::ValueCompare();
+
+    if (((!isRoot) && (node->keyCount < Tree::minKeyCount)) || (node->keyCount > Tree::maxKeyCount)) {
+        return -1;
+    }
+    for (std::size_t i = 0; i < node->keyCount; i += 1) {
+        if ((i > 0) && compare(node->keys[i], node->keys[i - 1])) {
+            return -1;
+        }
+        if (((lowValue != nullptr) && compare(node->keys[i], *lowValue)) || ((highValue != nullptr) && compare(*highValue, node->keys[i]))) {
+            return -1;
+        }
+    }
+
+    if (node->isLeaf) {
+        leaves.push_back(static_cast<const typename Tree::LeafNode*>(node));
+        return 0;
+    }
+
+    auto internalNode = static_cast<const typename Tree::InternalNode*>(node);
+    int depth = -1;
+    for (std::size_t i = 0; i <= node->keyCount; i += 1) {
+        auto childLowValue = (i == 0) ? lowValue : &node->keys[i - 1];
+        auto childHighValue = (i == node->keyCount) ? highValue : &node->keys[i];
+        auto childDepth = getLeafDepthIfValid<Tree>(internalNode->children[i], false, childLowValue, childHighValue, leaves);
+        if ((childDepth == -1) || ((depth != -1) && (childDepth != depth))) {
+            return -1;
+        }
+        depth = childDepth;
+    }
+
+    return depth + 1;
+}
+
+template <typename Tree>
+bool isValidBPlusTree(const Tree& tree) {
+    using T = typename Tree::Iterator::value_type;
+
+    auto leaves = std::vector<const typename Tree::LeafNode*>();
+    if (getLeafDepthIfValid<Tree, T>(tree.rootNode, true, nullptr, nullptr, leaves) == -1) {
+        return false;
+    }
+
+    // The leaf list must visit the leaves in the same order as the tree does.
+    for (std::size_t i = 0; i < leaves.size(); i += 1) {
+        auto expectedPrevious = (i == 0) ? nullptr : leaves[i - 1];
+        auto expectedNext = (i + 1 == leaves.size()) ? nullptr : leaves[i + 1];
+        if ((leaves[i]->previousLeaf != expectedPrevious) || (leaves[i]->nextLeaf != expectedNext)) {
+            return false;
+        }
+    }
+
+    std::size_t keyCount = 0;
+    for (const auto& leaf: leaves) {
+        keyCount += leaf->keyCount;
+    }
+    return keyCount == tree.getSize();
+}
+
+
+// MARK: - Tests
+void testInsertionAndDeletion() {
+    auto generator = std::default_random_engine(11);
+    bool isSuccessful = true;
+
+    // 16 bytes of `int` keys make a 2-3-4 tree, which gets deep quickly. 256 bytes is the default node size.
+    auto runWorkload = [&](auto& tree) {
+        auto distribution = std::uniform_int_distribution(0, 3000);
+        auto reference = std::multiset<int>();
+
+        for (int i = 0; i < 30000; i += 1) {
+            auto num = distribution(generator);
+            if ((i / 5000) % 2 == 0) {
+                // Growing phase with some deletions, then a shrinking phase with some insertions.
+                if (i % 4 == 3) {
+                    isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+                    if (reference.count(num) > 0) {
+                        reference.erase(reference.find(num));
+                    }
+                } else {
+                    isSuccessful = isSuccessful && (*tree.insertValue(num) == num);
+                    reference.insert(num);
+                }
+            } else {
+                if (i % 4 == 3) {
+                    tree.insertValue(num);
+                    reference.insert(num);
+                } else {
+                    isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+                    if (reference.count(num) > 0) {
+                        reference.erase(reference.find(num));
+                    }
+                }
+            }
+
+            if (i % 500 == 0) {
+                isSuccessful = isSuccessful && isValidBPlusTree(tree) && (tree.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+            }
+        }
+
+        for (auto it = reference.begin(); it != reference.end(); it = reference.erase(it)) {
+            isSuccessful = isSuccessful && tree.deleteValue(*it);
+        }
+        isSuccessful = isSuccessful && isValidBPlusTree(tree) && (tree.getSize() == 0) && (tree.begin() == tree.end());
+    };
+
+    auto smallNodeTree = BPlusTree<int, std::less<int>, 16>();
+    runWorkload(smallNodeTree);
+    auto tree = BPlusTree<int>();
+    runWorkload(tree);
+
+    if (isSuccessful) {
+        std::cout << "Insertion and deletion success! (t = " << smallNodeTree.minimumDegree << " and t = " << tree.minimumDegree << ")" << std::endl;
+    } else {
+        std::cout << "Insertion and deletion failed." << std::endl;
+    }
+}
+
+void testQueries() {
+    auto generator = std::default_random_engine(12);
+    auto distribution = std::uniform_int_distribution(0, 500);
+
+    auto tree = BPlusTree<int, std::less<int>, 32>();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < 3000; i += 1) {
+        // Many duplicates, spanning several leaves each.
+        auto num = distribution(generator) * 2;
+        tree.insertValue(num);
+        reference.insert(num);
+    }
+
+    bool isSuccessful = isValidBPlusTree(tree);
+    isSuccessful = isSuccessful && (*tree.getMin() == *reference.begin()) && (*tree.getMax() == *reference.rbegin());
+
+    for (int value = -1; value <= 1002; value += 1) {
+        auto expectedLower = std::distance(reference.begin(), reference.lower_bound(value));
+        auto expectedUpper = std::distance(reference.begin(), reference.upper_bound(value));
+        isSuccessful = isSuccessful && (std::distance(tree.begin(), tree.lowerBound(value)) == expectedLower);
+        isSuccessful = isSuccessful && (std::distance(tree.begin(), tree.upperBound(value)) == expectedUpper);
+        isSuccessful = isSuccessful && ((tree.searchForValue(value) != tree.end()) == (reference.count(value) > 0));
+
+        auto rangeValues = std::vector<int>();
+        tree.forEachInRange(value, value + 9, [&](int key) {
+            rangeValues.push_back(key);
+        });
+        isSuccessful = isSuccessful && (rangeValues == std::vector<int>(reference.lower_bound(value), reference.lower_bound(value + 9)));
+    }
+
+    // Walking backwards through the leaf list.
+    auto reverseValues = std::vector<int>(std::make_reverse_iterator(tree.end()), std::make_reverse_iterator(tree.begin()));
+    isSuccessful = isSuccessful && std::equal(reverseValues.begin(), reverseValues.end(), reference.rbegin(), reference.rend());
+
+    auto it = tree.searchForValue(500);
+    isSuccessful = isSuccessful && (*tree.getSuccessor(it) >= 500) && (*tree.getPredecessor(it) <= 500);
+    isSuccessful = isSuccessful && (tree.getPredecessor(tree.getMin()) == tree.end()) && (tree.getSuccessor(tree.getMax()) == tree.end());
+
+    // Keys without SIMD search, in reverse order.
+    auto words = std::vector<std::string>({"tree", "red", "black", "node", "rotation", "sentinel", "successor", "leaf", "split", "merge"});
+    auto wordTree = BPlusTree<std::string, std::greater<>, 64>();
+    for (const auto& word: words) {
+        wordTree.insertValue(word);
+    }
+    std::sort(words.begin(), words.end(), std::greater<>());
+    isSuccessful = isSuccessful && isValidBPlusTree(wordTree) && (wordTree.inOrderWalk() == words);
+    isSuccessful = isSuccessful && (*wordTree.lowerBound("s") == "rotation") && wordTree.deleteValue("node") && (wordTree.searchForValue("node") == wordTree.end());
+
+    if (isSuccessful) {
+        std::cout << "Queries success!" << std::endl;
+    } else {
+        std::cout << "Queries failed." << std::endl;
+    }
+}
+
+
+// MARK: - Benchmarks
+template <typename Operation>
+double getNanosecondsPerOperation(std::size_t count, Operation operation) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i += 1) {
+        operation(i);
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(endTime - startTime).count() / count;
+}
+
+/// Random insertions, lookups, 100-key range scans and deletions in `BPlusTree`, `RBTree` and `std::multiset`.
+template <typename T>
+void compareContainers(const char* keyName, int count) {
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution<T>(0, std::numeric_limits<T>::max());
+    auto keys = std::vector<T>(count);
+    for (auto& key: keys) {
+        key = distribution(generator);
+    }
+    auto sortedKeys = keys;
+    std::sort(sortedKeys.begin(), sortedKeys.end());
+
+    const std::size_t scanCount = count / 100;
+    const int scanLength = 100;
+
+    // {insert, search, scan, delete} in ns per operation. Scans are per key visited.
+    auto measure = [&](auto& container, auto insert, auto search, auto scan, auto erase) {
+        long long checksum = 0;
+        auto insertTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            insert(container, keys[i]);
+        });
+        auto searchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            checksum += search(container, keys[count - 1 - i]);
+        });
+        auto scanTime = getNanosecondsPerOperation(scanCount, [&](std::size_t i) {
+            checksum += scan(container, sortedKeys[i * 97 % (count - scanLength)], sortedKeys[i * 97 % (count - scanLength) + scanLength]);
+        }) / scanLength;
+        auto deleteTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            erase(container, keys[i]);
+        });
+
+        return std::make_tuple(insertTime, searchTime, scanTime, deleteTime, checksum);
+    };
+
+    auto bPlusTree = BPlusTree<T>();
+    auto bPlusTreeResult = measure(
+        bPlusTree,
+        [](auto& tree, T key) { tree.insertValue(key); },
+        [](auto& tree, T key) { return tree.searchForValue(key) != tree.end(); },
+        [](auto& tree, T lowKey, T highKey) {
+            long long sum = 0;
+            tree.forEachInRange(lowKey, highKey, [&](T key) { sum += key & 1; });
+            return sum;
+        },
+        [](auto& tree, T key) { tree.deleteValue(key); }
+    );
+
+    auto rbTree = RBTree<T>();
+    auto rbTreeResult = measure(
+        rbTree,
+        [](auto& tree, T key) { tree.insertValue(key); },
+        [](auto& tree, T key) { return tree.searchForValue(key) != RBTree<T>::Node::nilNode; },
+        [](auto& tree, T lowKey, T highKey) {
+            long long sum = 0;
+            tree.forEachInRange(lowKey, highKey, [&](typename RBTree<T>::Node* node) { sum += node->value & 1; });
+            return sum;
+        },
+        [](auto& tree, T key) { tree.deleteValue(key); }
+    );
+
+    auto multiset = std::multiset<T>();
+    auto multisetResult = measure(
+        multiset,
+        [](auto& set, T key) { set.insert(key); },
+        [](auto& set, T key) { return set.find(key) != set.end(); },
+        [](auto& set, T lowKey, T highKey) {
+            long long sum = 0;
+            for (auto it = set.lower_bound(lowKey); (it != set.end()) && (*it < highKey); ++it) {
+                sum += *it & 1;
+            }
+            return sum;
+        },
+        [](auto& set, T key) { set.erase(set.find(key)); }
+    );
+
+    auto printResult = [](const char* name, const auto& result) {
+        std::cout << "  " << name << ": insert " << std::get<0>(result) << " ns, search " << std::get<1>(result) << " ns, ";
+        std::cout << "scan " << std::get<2>(result) << " ns/key, delete " << std::get<3>(result) << " ns" << std::endl;
+    };
+
+    bool isMatching = (std::get<4>(bPlusTreeResult) == std::get<4>(rbTreeResult)) && (std::get<4>(rbTreeResult) == std::get<4>(multisetResult));
+    std::cout << count << " random " << keyName << " keys" << (isMatching ? "" : " (mismatch!)") << std::endl;
+    printResult("BPlusTree", bPlusTreeResult);
+    printResult("RBTree", rbTreeResult);
+    printResult("std::multiset", multisetResult);
+}
+
+void benchmarkContainers() {
+    for (int count: {10000, 1000000}) {
+        compareContainers<std::int32_t>("int32_t", count);
+        compareContainers<std::int64_t>("int64_t", count);
+    }
+}
+
+
+int main() {
+    testInsertionAndDeletion();
+    testQueries();
+    // benchmarkContainers();
+
+    return 0;
+}
@@ -1,304 +1,880 @@
 #include <iostream>
 #include <random>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <set>
+#include <filesystem>
+
+#include "binary search tree.hpp"
+#include "eytzinger snapshot.hpp"
+#include "mapped tree.hpp"
 
 
-template <typename T>
-class SearchTreeNode {
-public:
-    T value;
-    SearchTreeNode* parent;
-    SearchTreeNode* leftChild;
-    SearchTreeNode* rightChild;
+void test1() {
+    auto rootNode = new SearchTreeNode<int>(8);
 
+    // SearchTreeNode<int>::insertRecursively(rootNode, 6);
+    // SearchTreeNode<int>::insertRecursively(rootNode, 12);
+    // SearchTreeNode<int>::insertRecursively(rootNode, 2);
+    // SearchTreeNode<int>::insertRecursively(rootNode, 4);
+    SearchTreeNode<int>::insertIteratively(rootNode, 6);
+    SearchTreeNode<int>::insertIteratively(rootNode, 12);
+    SearchTreeNode<int>::insertIteratively(rootNode, 2);
+    SearchTreeNode<int>::insertIteratively(rootNode, 4);
+
+    SearchTreeNode<int>::inorderTreeWalk(rootNode);
+    std::cout << std::endl;
+
+    auto searchResult1 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 8);
+    if (searchResult1) {
+        std::cout << "Result 1: " << searchResult1->value << std::endl;
+    }
+    SearchTreeNode<int>::deleteNode(&rootNode, searchResult1);
+    auto searchResult2 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 8);
+    if (searchResult2) {
+        std::cout << "Result 2: " << searchResult2->value << std::endl;
+    }
+    SearchTreeNode<int>::inorderTreeWalk(rootNode);
+    std::cout << std::endl;
 
-public:
-    SearchTreeNode(T value) {
-        this->value = value;
-        this->parent = nullptr;
-        this->leftChild = nullptr;
-        this->rightChild = nullptr;
+    auto searchResult3 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 4);
+    if (searchResult3) {
+        std::cout << "Result 3: " << searchResult3->value << std::endl;
+    }
+    SearchTreeNode<int>::deleteNode(&rootNode, searchResult3);
+    auto searchResult4 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 4);
+    if (searchResult4) {
+        std::cout << "Result 4: " << searchResult3->value << std::endl;
     }
+    SearchTreeNode<int>::inorderTreeWalk(rootNode);
+    std::cout << std::endl;
+}
 
+void test2() {
+    auto rootNode = new SearchTreeNode<int>(6);
 
-// MARK: Queries
-public:
-    // Call this function on the root node to walk the entire tree.
-    static void inorderTreeWalk(SearchTreeNode* currentNode) {
-        if (currentNode) {
-            SearchTreeNode::inorderTreeWalk(currentNode->leftChild);
-            std::cout << currentNode->value << " " << std::flush;
-            SearchTreeNode::inorderTreeWalk(currentNode->rightChild);
-        }
+    // Fixed, so that a failing run can be repeated.
+    auto randomSeed = 1;
+
+    auto uniformDistribution = std::uniform_int_distribution(1, 99);
+    auto generator = std::default_random_engine(randomSeed);
+
+    auto dice = std::bind(uniformDistribution, generator);
+
+    for (int i = 0; i < 10; i += 1) {
+        int num = dice();
+        SearchTreeNode<int>::insertIteratively(rootNode, num);
+        SearchTreeNode<int>::inorderTreeWalk(rootNode);
+        std::cout << std::endl;
     }
 
-    // Done in O(h) time. `h` represents the tree's height.
-    static SearchTreeNode* searchForValueRecursively(SearchTreeNode* rootNode, T value) {
-        if (rootNode == nullptr) {
-            return nullptr;
-        }
+    SearchTreeNode<int>::clear(&rootNode);
+}
 
-        if (value == rootNode->value) {
-            return rootNode;
-        } else if (value < rootNode->value) {
-            return searchForValueRecursively(rootNode->leftChild, value);
-        } else {
-            return searchForValueRecursively(rootNode->rightChild, value);
-        }
+void test3() {
+    auto nodePool = NodePool<SearchTreeNode<int>>();
+    auto rootNode = nodePool.allocate(500);
+
+    auto generator = std::default_random_engine(42);
+    auto uniformDistribution = std::uniform_int_distribution(1, 999);
+
+    for (int i = 0; i < 1000; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, uniformDistribution(generator), nodePool);
     }
 
-    static SearchTreeNode* searchForValueIteratively(SearchTreeNode* rootNode, T value) {
-        auto currentNode = rootNode;
-        while (currentNode != nullptr) {
-            if (currentNode->value == value) {
-                return currentNode;
-            } else if (value < currentNode->value) {
-                currentNode = currentNode->leftChild;
-            } else {
-                currentNode = currentNode->rightChild;
-            }
+    // Each node is visited in order; values must never decrease.
+    int previousValue = 0;
+    bool isSorted = true;
+    for (auto currentNode = SearchTreeNode<int>::getMin(rootNode); currentNode != nullptr; currentNode = SearchTreeNode<int>::getSuccessor(currentNode)) {
+        if (currentNode->value < previousValue) {
+            isSorted = false;
         }
-        
-        return nullptr;
+        previousValue = currentNode->value;
     }
 
-    static SearchTreeNode* getMin(SearchTreeNode* rootNode) {
-        if (rootNode == nullptr) {
-            return nullptr;
-        }
+    if (isSorted) {
+        std::cout << "Pooled insertion success! (" << nodePool.getSlabCount() << " slabs)" << std::endl;
+    } else {
+        std::cout << "Pooled insertion failed." << std::endl;
+    }
+    // All 1001 nodes are released together with `nodePool`.
+}
 
-        auto currentNode = rootNode;
-        while (currentNode->leftChild != nullptr) {
-            currentNode = currentNode->leftChild;
-        }
+void test4() {
+    auto rootNode = new SearchTreeNode<int>(50);
+    for (int i = 1; i < 100; i += 1) {
+        // Sorted insertions degenerate the tree into a list. Iteration must still work.
+        SearchTreeNode<int>::insertIteratively(rootNode, (i < 50) ? i : i + 1);
+    }
 
-        return currentNode;
+    auto forwardValues = std::vector<int>();
+    for (const auto& value: SearchTreeNode<int>::inorder(rootNode)) {
+        forwardValues.push_back(value);
     }
 
-    static SearchTreeNode* getMax(SearchTreeNode* rootNode) {
-        if (rootNode == nullptr) {
-            return nullptr;
-        }
+    auto range = SearchTreeNode<int>::inorder(rootNode);
+    auto reverseValues = std::vector<int>(range.rbegin(), range.rend());
+    std::reverse(reverseValues.begin(), reverseValues.end());
 
-        auto currentNode = rootNode;
-        while (currentNode->rightChild != nullptr) {
-            currentNode = currentNode->rightChild;
-        }
+    auto expectedValues = std::vector<int>(100);
+    std::iota(expectedValues.begin(), expectedValues.end(), 1);
 
-        return currentNode;
+    // Stop after 5 values.
+    int sum = 0;
+    auto it = range.begin();
+    for (int i = 0; i < 5; i += 1, ++it) {
+        sum += *it;
     }
 
-    static SearchTreeNode* getPredecessor(SearchTreeNode* currentNode) {
-        if (currentNode == nullptr) {
-            return nullptr;
-        }
+    SearchTreeNode<int>::clear(&rootNode);
 
-        if (currentNode->leftChild) {
-            return SearchTreeNode::getMax(currentNode->leftChild);
-        }
+    if ((forwardValues == expectedValues) && (reverseValues == expectedValues) && (sum == 15)) {
+        std::cout << "Iterators success!" << std::endl;
+    } else {
+        std::cout << "Iterators failed." << std::endl;
+    }
+}
 
-        // Find the first ancestor with the current node as right child.
-        auto ancestor = currentNode->parent;
-        while ((ancestor != nullptr) && (ancestor->leftChild == currentNode)) {
-            currentNode = ancestor;
-            ancestor = ancestor->parent;
-        }
+void test5() {
+    auto rootNode = new SearchTreeNode<int>(50);
 
-        return ancestor;
+    auto generator = std::default_random_engine(5);
+    auto uniformDistribution = std::uniform_int_distribution(0, 50);
+    auto values = std::vector<int>({50});
+    for (int i = 0; i < 500; i += 1) {
+        int num = uniformDistribution(generator) * 2;
+        SearchTreeNode<int>::insertIteratively(rootNode, num);
+        values.push_back(num);
+    }
+    std::sort(values.begin(), values.end());
+
+    bool isSuccessful = true;
+    for (int value = -1; value <= 102; value += 1) {
+        auto [lowerNode, upperNode] = SearchTreeNode<int>::equalRange(rootNode, value);
+        auto expectedLower = std::lower_bound(values.begin(), values.end(), value);
+        auto expectedUpper = std::upper_bound(values.begin(), values.end(), value);
+
+        isSuccessful = isSuccessful && ((lowerNode == nullptr) == (expectedLower == values.end()));
+        isSuccessful = isSuccessful && ((upperNode == nullptr) == (expectedUpper == values.end()));
+        isSuccessful = isSuccessful && ((lowerNode == nullptr) || (lowerNode->value == *expectedLower));
+        isSuccessful = isSuccessful && ((upperNode == nullptr) || (upperNode->value == *expectedUpper));
+
+        auto rangeValues = std::vector<int>();
+        SearchTreeNode<int>::forEachInRange(rootNode, value, value + 5, [&](SearchTreeNode<int>* node) {
+            rangeValues.push_back(node->value);
+        });
+        isSuccessful = isSuccessful && (rangeValues == std::vector<int>(expectedLower, std::lower_bound(values.begin(), values.end(), value + 5)));
     }
 
-    static SearchTreeNode* getSuccessor(SearchTreeNode* currentNode) {
-        if (currentNode == nullptr) {
-            return nullptr;
-        }
+    SearchTreeNode<int>::clear(&rootNode);
 
-        if (currentNode->rightChild) {
-            return SearchTreeNode::getMin(currentNode->rightChild);
-        }
+    if (isSuccessful) {
+        std::cout << "Bounds success!" << std::endl;
+    } else {
+        std::cout << "Bounds failed." << std::endl;
+    }
+}
+
+void test6() {
+    auto tree = ConcurrentSearchTree<int>();
+    auto reference = std::vector<char>(200, false);
 
-        // Find the first ancestor with the current node as left child.
-        auto ancestor = currentNode->parent;
-        while ((ancestor != nullptr) && (ancestor->rightChild == currentNode)) {
-            currentNode = ancestor;
-            ancestor = ancestor->parent;
+    auto generator = std::default_random_engine(6);
+    auto uniformDistribution = std::uniform_int_distribution(0, 199);
+
+    bool isSuccessful = true;
+    for (int i = 0; i < 20000; i += 1) {
+        int num = uniformDistribution(generator);
+        if (i % 2 == 0) {
+            isSuccessful = isSuccessful && (tree.insertValue(num) == !reference[num]);
+            reference[num] = true;
+        } else {
+            isSuccessful = isSuccessful && (tree.deleteValue(num) == reference[num]);
+            reference[num] = false;
         }
+        isSuccessful = isSuccessful && (tree.containsValue(num) == reference[num]);
+    }
 
-        return ancestor;
+    auto expectedValues = std::vector<int>();
+    for (int num = 0; num < 200; num += 1) {
+        if (reference[num]) {
+            expectedValues.push_back(num);
+        }
     }
 
+    isSuccessful = isSuccessful && (tree.inOrderWalk() == expectedValues);
 
-// MARK: Insertions
-public:
-    // The inserted node is surely a leaf node.
-    static SearchTreeNode* insertRecursively(SearchTreeNode* rootNode, const T& newValue) {
-        if (rootNode == nullptr) {
-            return nullptr;
+    // Sorted insertions build a chain, which the destructor tears down without recursion. It also frees the nodes this thread unlinked.
+    {
+        auto chainTree = ConcurrentSearchTree<int>();
+        for (int i = 0; i < 5000; i += 1) {
+            chainTree.insertValue(i);
         }
-
-        if (newValue <= rootNode->value) {
-            if (rootNode->leftChild == nullptr) {
-                auto newNode = new SearchTreeNode(newValue);
-                rootNode->leftChild = newNode;
-                newNode->parent = rootNode;
-                return newNode;
-            } else {
-                insertRecursively(rootNode->leftChild, newValue);
+        for (int i = 0; i < 5000; i += 2) {
+            chainTree.deleteValue(i);
+        }
+    }
+    isSuccessful = isSuccessful && (EpochReclamation::getPendingNodeCount() == 0);
+
+    // A reader that stays pinned does not hold up the destructor. The nodes it might still reach are left to later reclamations.
+    {
+        auto isPinned = std::atomic<bool>(false);
+        auto isReleased = std::atomic<bool>(false);
+        auto reader = std::thread([&]() {
+            auto guard = EpochReclamation::Guard();
+            isPinned = true;
+            while (!isReleased) {
+                std::this_thread::yield();
             }
-        } else {
-            if (rootNode->rightChild == nullptr) {
-                auto newNode = new SearchTreeNode(newValue);
-                rootNode->rightChild = newNode;
-                newNode->parent = rootNode;
-                return newNode;
-            } else {
-                insertRecursively(rootNode->rightChild, newValue);
+        });
+        while (!isPinned) {
+            std::this_thread::yield();
+        }
+
+        {
+            auto pinnedTree = ConcurrentSearchTree<int>();
+            for (int i = 0; i < 100; i += 1) {
+                pinnedTree.insertValue(i);
+                pinnedTree.deleteValue(i);
             }
         }
+        isSuccessful = isSuccessful && (EpochReclamation::getPendingNodeCount() == 0);
 
-        return nullptr;
+        isReleased = true;
+        reader.join();
     }
 
-    static SearchTreeNode* insertIteratively(SearchTreeNode* rootNode, const T& newValue) {
-        // This function does not handle an empty tree.
-        if (rootNode == nullptr) {
-            return nullptr;
-        }
+    if (isSuccessful) {
+        std::cout << "Concurrent tree success!" << std::endl;
+    } else {
+        std::cout << "Concurrent tree failed." << std::endl;
+    }
+}
 
-        auto currentNode = rootNode;
-        auto parentNode = rootNode;
+void test7() {
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
+    const int keysPerThread = 2000;
+
+    auto tree = ConcurrentSearchTree<int>();
+
+    // Every thread owns the keys `t`, `t + threadCount`, ... so it knows exactly which of them are present, while the tree is shared.
+    // It also looks up everybody else's keys, and those must always be valid keys.
+    auto results = std::vector<char>(threadCount, 0);
+    auto threads = std::vector<std::thread>();
+    for (int t = 0; t < threadCount; t += 1) {
+        threads.emplace_back([t, threadCount, &tree, &results]() {
+            auto generator = std::default_random_engine(t);
+            auto uniformDistribution = std::uniform_int_distribution(0, keysPerThread - 1);
+            auto isPresent = std::vector<char>(keysPerThread, false);
+
+            bool isSuccessful = true;
+            for (int i = 0; i < 50000; i += 1) {
+                auto index = uniformDistribution(generator);
+                auto key = index * threadCount + t;
+                switch (i % 4) {
+                    case 0:
+                        isSuccessful = isSuccessful && (tree.insertValue(key) == !isPresent[index]);
+                        isPresent[index] = true;
+                        break;
+                    case 1:
+                        isSuccessful = isSuccessful && (tree.deleteValue(key) == isPresent[index]);
+                        isPresent[index] = false;
+                        break;
+                    case 2:
+                        isSuccessful = isSuccessful && (tree.containsValue(key) == isPresent[index]);
+                        break;
+                    default:
+                        tree.containsValue(key + 1);
+                        break;
+                }
+            }
 
-        while (currentNode != nullptr) {
-            parentNode = currentNode;
-            if (newValue <= currentNode->value) {
-                currentNode = currentNode->leftChild;
-            } else {
-                currentNode = currentNode->rightChild;
+            // Leave only the even indices.
+            for (int index = 0; index < keysPerThread; index += 1) {
+                if (index % 2 == 0) {
+                    tree.insertValue(index * threadCount + t);
+                } else {
+                    tree.deleteValue(index * threadCount + t);
+                }
             }
-        }
 
-        auto newNode = new SearchTreeNode(newValue);
-        if (newValue <= parentNode->value) {
-            parentNode->leftChild = newNode;
-            newNode->parent = parentNode;
-        } else {
-            parentNode->rightChild = newNode;
-            newNode->parent = parentNode;
+            results[t] = isSuccessful;
+        });
+    }
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    auto expectedValues = std::vector<int>();
+    for (int index = 0; index < keysPerThread; index += 2) {
+        for (int t = 0; t < threadCount; t += 1) {
+            expectedValues.push_back(index * threadCount + t);
         }
-        return newNode;
     }
 
+    if (std::all_of(results.begin(), results.end(), [](char result) { return result; }) && (tree.inOrderWalk() == expectedValues)) {
+        std::cout << "Concurrent tree threads success! (" << threadCount << " threads)" << std::endl;
+    } else {
+        std::cout << "Concurrent tree threads failed." << std::endl;
+    }
+}
+
+void test8() {
+    auto rootNode = new SearchTreeNode<int>(500);
+
+    auto generator = std::default_random_engine(8);
+    auto uniformDistribution = std::uniform_int_distribution(0, 999);
+    auto values = std::vector<int>({500});
+    for (int i = 0; i < 1000; i += 1) {
+        int num = uniformDistribution(generator);
+        SearchTreeNode<int>::insertIteratively(rootNode, num);
+        values.push_back(num);
+    }
+    std::sort(values.begin(), values.end());
+
+    auto range = SearchTreeNode<int>::inorder(rootNode);
+    auto snapshot = EytzingerSnapshot<int>(range.begin(), range.end());
+
+    bool isSuccessful = (snapshot.inOrderWalk() == values);
+    for (int value = -1; value <= 1000; value += 1) {
+        auto key = snapshot.lowerBound(value);
+        auto expected = std::lower_bound(values.begin(), values.end(), value);
+        isSuccessful = isSuccessful && ((key == nullptr) ? (expected == values.end()) : (*key == *expected));
+        isSuccessful = isSuccessful && ((snapshot.searchForValue(value) != nullptr) == (SearchTreeNode<int>::searchForValueIteratively(rootNode, value) != nullptr));
+    }
+
+    SearchTreeNode<int>::clear(&rootNode);
+
+    if (isSuccessful) {
+        std::cout << "Eytzinger snapshot success!" << std::endl;
+    } else {
+        std::cout << "Eytzinger snapshot failed." << std::endl;
+    }
+}
+
+void test9() {
+    // A degenerate chain first: the file keeps the shape, whatever it is.
+    auto rootNode = new SearchTreeNode<int>(0);
+    for (int i = 1; i < 100; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, i);
+    }
+
+    auto generator = std::default_random_engine(9);
+    auto uniformDistribution = std::uniform_int_distribution(100, 999);
+    for (int i = 0; i < 1000; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, uniformDistribution(generator));
+    }
+
+    auto path = (std::filesystem::temp_directory_path() / "binary search tree test.map").string();
+    MappedTree<int>::writeFile(path, rootNode);
+    auto mappedTree = MappedTree<int>(path);
+
+    auto range = SearchTreeNode<int>::inorder(rootNode);
+    bool isSuccessful = (mappedTree.inOrderWalk() == std::vector<int>(range.begin(), range.end()));
+    for (int value = -1; value <= 1000; value += 1) {
+        isSuccessful = isSuccessful && ((mappedTree.searchForValue(value) != nullptr) == (SearchTreeNode<int>::searchForValueIteratively(rootNode, value) != nullptr));
+    }
+    std::filesystem::remove(path);
+
+    SearchTreeNode<int>::clear(&rootNode);
+
+    if (isSuccessful) {
+        std::cout << "Mapped tree success!" << std::endl;
+    } else {
+        std::cout << "Mapped tree failed." << std::endl;
+    }
+}
+
+void test10() {
+    TreeStats::reset();
+
+    // Sorted keys build a chain, so every count is known exactly.
+    auto rootNode = new SearchTreeNode<int>(0);
+    for (int i = 1; i < 100; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, i);
+    }
+    bool isSuccessful = (SearchTreeNode<int>::getHeight(rootNode) == 100);
+
+    auto afterInsertion = TreeStats::getSnapshot();
+    SearchTreeNode<int>::searchForValueIteratively(rootNode, 99);
+    auto afterSearch = TreeStats::getSnapshot();
+
+#ifdef TREE_STATS
+    // Inserting key `i` compares against `i` nodes on the way down and once more against the parent.
+    isSuccessful = isSuccessful && (afterInsertion.operationCounts[TreeStats::insertion] == 99) && (afterInsertion.comparisonCount == 99 * 100 / 2 + 99);
+    // `==` and `<` at each of the first 99 nodes, then the match.
+    isSuccessful = isSuccessful && (afterSearch.operationCounts[TreeStats::search] == 1) && (afterSearch.maxOperationComparisonCounts[TreeStats::search] == 199);
+#else
+    isSuccessful = isSuccessful && (afterInsertion.comparisonCount == 0) && (afterSearch.operationCounts[TreeStats::search] == 0);
+#endif
+
+    while (rootNode != nullptr) {
+        auto node = rootNode;
+        SearchTreeNode<int>::deleteNode(&rootNode, node);
+        delete node;
+    }
+    isSuccessful = isSuccessful && (SearchTreeNode<int>::getHeight(rootNode) == 0);
+
+#ifdef TREE_STATS
+    isSuccessful = isSuccessful && (TreeStats::getSnapshot().operationCounts[TreeStats::deletion] == 100);
+#endif
+
+    if (isSuccessful) {
+        std::cout << "Tree stats success!" << std::endl;
+    } else {
+        std::cout << "Tree stats failed." << std::endl;
+    }
+}
+
+/// In-order keys are sorted and every child points back at its parent. Iterative, since splay trees may be chains.
+template <typename Node>
+bool isValidSearchTree(Node* rootNode) {
+    if ((rootNode != nullptr) && (rootNode->parent != nullptr)) {
+        return false;
+    }
 
-// MARK: - Deletion
-private:
-    static void transplantSubtree(SearchTreeNode** rootNode, SearchTreeNode* oldSubtree, SearchTreeNode* newSubtree) {
-        if (oldSubtree->parent == nullptr) {
-            // The old subtree is the root.
-            *rootNode = newSubtree;
-            return;
+    auto pendingNodes = std::vector<Node*>();
+    if (rootNode != nullptr) {
+        pendingNodes.push_back(rootNode);
+    }
+    while (!pendingNodes.empty()) {
+        auto node = pendingNodes.back();
+        pendingNodes.pop_back();
+        for (auto child: {node->leftChild, node->rightChild}) {
+            if (child != nullptr) {
+                if (child->parent != node) {
+                    return false;
+                }
+                pendingNodes.push_back(child);
+            }
         }
+    }
 
-        if (oldSubtree == oldSubtree->parent->leftChild) {
-            oldSubtree->parent->leftChild = newSubtree;
-        } else {
-            oldSubtree->parent->rightChild = newSubtree;
+    auto range = Node::inorder(rootNode);
+    return std::is_sorted(range.begin(), range.end());
+}
+
+void test11() {
+    auto generator = std::default_random_engine(11);
+    auto distribution = std::uniform_int_distribution(0, 999);
+    bool isSuccessful = true;
+
+    auto tree = SplayTree<int>();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < 20000; i += 1) {
+        auto num = distribution(generator);
+        switch (i % 4) {
+            case 0:
+            case 1:
+                isSuccessful = isSuccessful && (tree.insertValue(num) == tree.rootNode);
+                reference.insert(num);
+                break;
+
+            case 2:
+                isSuccessful = isSuccessful && ((tree.searchForValue(num) != nullptr) == (reference.count(num) > 0));
+                // Hit or miss, the search ends at the root.
+                isSuccessful = isSuccessful && ((tree.rootNode == nullptr) || (reference.count(num) == 0) || (tree.rootNode->value == num));
+                break;
+
+            default:
+                isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+                if (auto it = reference.find(num); it != reference.end()) {
+                    reference.erase(it);
+                }
+                break;
         }
 
-        if (newSubtree) {
-            newSubtree->parent = oldSubtree->parent;
+        if ((i % 1000) == 0) {
+            isSuccessful = isSuccessful && isValidSearchTree(tree.rootNode);
         }
     }
+    isSuccessful = isSuccessful && isValidSearchTree(tree.rootNode) && (tree.getSize() == reference.size());
+    isSuccessful = isSuccessful && (tree.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+
+    // Ascending insertions leave a chain. Searching it in order again takes linear time in total, not quadratic.
+    auto chain = SplayTree<int>();
+    const int chainLength = 100000;
+    for (int i = 0; i < chainLength; i += 1) {
+        chain.insertValue(i);
+    }
+    isSuccessful = isSuccessful && (SearchTreeNode<int>::getHeight(chain.rootNode) == chainLength);
 
-public:
-    static void deleteNode(SearchTreeNode** rootNode, SearchTreeNode* nodeToDelete) {
-        // Note that `nodeToDelete` might be the root node.
-        if (nodeToDelete->leftChild == nullptr) {
-            // Simplest case. Use right node.
-            SearchTreeNode<int>::transplantSubtree(rootNode, nodeToDelete, nodeToDelete->rightChild);
-        } else if (nodeToDelete->rightChild == nullptr) {
-            // Only has left child. Also simple.
-            SearchTreeNode<int>::transplantSubtree(rootNode, nodeToDelete, nodeToDelete->leftChild);
-        } else {
-            // Has both left and right children.
-            // Find the successor of `nodeToDelete` from its right subtree.
-            auto replacementNode = SearchTreeNode<int>::getMin(nodeToDelete->rightChild);
-            if (replacementNode->parent != nodeToDelete) {
-                // `replacementNode` is not the direct right child of `nodeToDelete`.
-                // Apparently `replacementNode` has no left child, but may have a right child.
-                // Thus, we need to deal with `replacementNode`'s right child.
-                SearchTreeNode<int>::transplantSubtree(rootNode, replacementNode, replacementNode->rightChild);
-                replacementNode->rightChild = nodeToDelete->rightChild;
-                replacementNode->rightChild->parent = replacementNode;
-            }
-            // If `replacementNode` is the direct right child of `nodeToDelete`, we don't need to care about its right child.
+    TreeStats::reset();
+    for (int i = 0; i < chainLength; i += 1) {
+        isSuccessful = isSuccessful && (chain.searchForValue(i) == chain.rootNode) && (chain.rootNode->value == i);
+    }
+    isSuccessful = isSuccessful && isValidSearchTree(chain.rootNode);
+
+#ifdef TREE_STATS
+    auto stats = TreeStats::getSnapshot();
+    isSuccessful = isSuccessful && (stats.leftRotationCount + stats.rightRotationCount < 10 * static_cast<std::uint64_t>(chainLength));
+#endif
+
+    // In-order searches leave a chain again. Splaying its deepest node halves the depth of the path.
+    chain.searchForValue(0);
+    isSuccessful = isSuccessful && (SearchTreeNode<int>::getHeight(chain.rootNode) <= chainLength / 2 + 2);
+
+#ifdef TREE_STATS
+    // A hot key is found at the root.
+    chain.searchForValue(chainLength / 2);
+    TreeStats::reset();
+    chain.searchForValue(chainLength / 2);
+    isSuccessful = isSuccessful && (TreeStats::getSnapshot().comparisonCount == 1);
+#endif
+
+    // Keys that own memory.
+    auto wordTree = SplayTree<std::string, HeapNodeAllocator>();
+    for (auto word: {"splay", "zig", "zag", "rotation", "root"}) {
+        wordTree.insertValue(word);
+    }
+    isSuccessful = isSuccessful && wordTree.deleteValue("zig") && !wordTree.deleteValue("zig") && (wordTree.searchForValue("root") == wordTree.rootNode);
+    isSuccessful = isSuccessful && (wordTree.inOrderWalk() == std::vector<std::string>({"root", "rotation", "splay", "zag"}));
+
+    if (isSuccessful) {
+        std::cout << "Splay tree success!" << std::endl;
+    } else {
+        std::cout << "Splay tree failed." << std::endl;
+    }
+}
+
+void test12() {
+    auto generator = std::default_random_engine(12);
+    auto distribution = std::uniform_int_distribution(0, 3000);
 
-            SearchTreeNode<int>::transplantSubtree(rootNode, nodeToDelete, replacementNode);
-            replacementNode->leftChild = nodeToDelete->leftChild;
-            replacementNode->leftChild->parent = replacementNode;
+    auto rootNode = new SearchTreeNode<int>(1500);
+    for (int i = 0; i < 2000; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, distribution(generator));
+    }
+
+    bool isSuccessful = true;
+    for (std::size_t count: {0, 1, 16, 17, 1000}) {
+        auto values = std::vector<int>(count);
+        for (auto& value: values) {
+            value = distribution(generator);
+        }
+        auto results = std::vector<SearchTreeNode<int>*>(count);
+        SearchTreeNode<int>::searchForValuesIteratively(rootNode, values.data(), count, results.data());
+        for (std::size_t i = 0; i < count; i += 1) {
+            isSuccessful = isSuccessful && (results[i] == SearchTreeNode<int>::searchForValueIteratively(rootNode, values[i]));
         }
     }
-};
 
+    int value = 1;
+    SearchTreeNode<int>* result = rootNode;
+    SearchTreeNode<int>::searchForValuesIteratively(nullptr, &value, 1, &result);
+    isSuccessful = isSuccessful && (result == nullptr);
 
-void test1() {
-    auto rootNode = new SearchTreeNode<int>(8);
+    SearchTreeNode<int>::clear(&rootNode);
 
-    // SearchTreeNode<int>::insertRecursively(rootNode, 6);
-    // SearchTreeNode<int>::insertRecursively(rootNode, 12);
-    // SearchTreeNode<int>::insertRecursively(rootNode, 2);
-    // SearchTreeNode<int>::insertRecursively(rootNode, 4);
-    SearchTreeNode<int>::insertIteratively(rootNode, 6);
-    SearchTreeNode<int>::insertIteratively(rootNode, 12);
-    SearchTreeNode<int>::insertIteratively(rootNode, 2);
-    SearchTreeNode<int>::insertIteratively(rootNode, 4);
+    if (isSuccessful) {
+        std::cout << "Batched search success!" << std::endl;
+    } else {
+        std::cout << "Batched search failed." << std::endl;
+    }
+}
 
-    SearchTreeNode<int>::inorderTreeWalk(rootNode);
-    std::cout << std::endl;
+void test13() {
+    auto generator = std::default_random_engine(13);
+    auto distribution = std::uniform_int_distribution(0, 3000);
+
+    auto rootNode = new SearchTreeNode<int>(1500);
+    auto nodes = std::vector<SearchTreeNode<int>*>({rootNode});
+    auto values = std::vector<int>({1500});
+    for (int i = 0; i < 3000; i += 1) {
+        auto num = distribution(generator);
+        auto hint = nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(generator)];
+        nodes.push_back(SearchTreeNode<int>::insertNearHint(hint, num));
+        values.push_back(num);
+    }
+    std::sort(values.begin(), values.end());
+
+    auto range = SearchTreeNode<int>::inorder(rootNode);
+    bool isSuccessful = isValidSearchTree(rootNode) && (std::vector<int>(range.begin(), range.end()) == values);
+    for (int i = 0; i < 3000; i += 1) {
+        auto num = distribution(generator);
+        auto hint = nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(generator)];
+        auto result = SearchTreeNode<int>::searchForValueNearHint(hint, num);
+        isSuccessful = isSuccessful && ((result != nullptr) == std::binary_search(values.begin(), values.end(), num)) && ((result == nullptr) || (result->value == num));
+    }
 
-    auto searchResult1 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 8);
-    if (searchResult1) {
-        std::cout << "Result 1: " << searchResult1->value << std::endl;
+    // Descending keys, each hinted with the previous one, build a chain. The climb walks up it without comparing, then the new node goes right below the hint.
+    TreeStats::reset();
+    auto descendingRootNode = new SearchTreeNode<int>(0);
+    auto hint = descendingRootNode;
+    for (int i = 1; i < 1000; i += 1) {
+        hint = SearchTreeNode<int>::insertNearHint(hint, -i);
     }
-    SearchTreeNode<int>::deleteNode(&rootNode, searchResult1);
-    auto searchResult2 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 8);
-    if (searchResult2) {
-        std::cout << "Result 2: " << searchResult2->value << std::endl;
+    isSuccessful = isSuccessful && isValidSearchTree(descendingRootNode) && (SearchTreeNode<int>::getHeight(descendingRootNode) == 1000);
+#ifdef TREE_STATS
+    isSuccessful = isSuccessful && (TreeStats::getSnapshot().comparisonCount <= 4 * 1000);
+#endif
+
+    SearchTreeNode<int>::clear(&rootNode);
+    SearchTreeNode<int>::clear(&descendingRootNode);
+
+    if (isSuccessful) {
+        std::cout << "Hinted insertion success!" << std::endl;
+    } else {
+        std::cout << "Hinted insertion failed." << std::endl;
     }
-    SearchTreeNode<int>::inorderTreeWalk(rootNode);
-    std::cout << std::endl;
+}
 
-    auto searchResult3 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 4);
-    if (searchResult3) {
-        std::cout << "Result 3: " << searchResult3->value << std::endl;
+void test14() {
+    using Node = SearchTreeNode<std::unique_ptr<int>>;
+
+    auto nodePool = NodePool<Node>();
+    Node* firstRootNode = nullptr;
+    Node* secondRootNode = nullptr;
+
+    // Move-only values are constructed right inside their nodes.
+    auto generator = std::default_random_engine(14);
+    auto nums = std::vector<int>(2000);
+    std::iota(nums.begin(), nums.end(), 0);
+    std::shuffle(nums.begin(), nums.end(), generator);
+    auto nodes = std::vector<Node*>();
+    for (auto num: nums) {
+        nodes.push_back(Node::emplaceIteratively(&firstRootNode, nodePool, std::make_unique<int>(num)));
     }
-    SearchTreeNode<int>::deleteNode(&rootNode, searchResult3);
-    auto searchResult4 = SearchTreeNode<int>::searchForValueIteratively(rootNode, 4);
-    if (searchResult4) {
-        std::cout << "Result 4: " << searchResult3->value << std::endl;
+
+    // Every other node changes trees without being reallocated or having its value copied.
+    bool isSuccessful = true;
+    for (std::size_t i = 0; i < nodes.size(); i += 2) {
+        auto pointee = nodes[i]->value.get();
+        auto movedNode = Node::insertNode(&secondRootNode, Node::extractNode(&firstRootNode, nodes[i]));
+        isSuccessful = isSuccessful && (movedNode == nodes[i]) && (movedNode->value.get() == pointee);
+    }
+    isSuccessful = isSuccessful && isValidSearchTree(firstRootNode) && isValidSearchTree(secondRootNode);
+
+    auto sumValues = [](Node* rootNode) {
+        long long sum = 0;
+        for (const auto& value: Node::inorder(rootNode)) {
+            sum += *value;
+        }
+        return sum;
+    };
+    long long firstSum = 0;
+    long long secondSum = 0;
+    for (std::size_t i = 0; i < nums.size(); i += 1) {
+        ((i % 2 == 0) ? secondSum : firstSum) += nums[i];
+    }
+    isSuccessful = isSuccessful && (sumValues(firstRootNode) == firstSum) && (sumValues(secondRootNode) == secondSum);
+
+    for (auto node: nodes) {
+        node->value.reset();
+    }
+
+    if (isSuccessful) {
+        std::cout << "Node handles success!" << std::endl;
+    } else {
+        std::cout << "Node handles failed." << std::endl;
     }
-    SearchTreeNode<int>::inorderTreeWalk(rootNode);
-    std::cout << std::endl;
 }
 
-void test2() {
-    auto rootNode = new SearchTreeNode<int>(6);
+void test15() {
+    using Node = SearchTreeNode<int>;
+
+    // A chain this long would overflow the stack if torn down recursively.
+    const int chainLength = 1000000;
+    auto nodePool = NodePool<Node>();
+    Node* rootNode = nullptr;
+    auto lastNode = Node::emplaceIteratively(&rootNode, nodePool, 0);
+    for (int i = 1; i < chainLength; i += 1) {
+        // Linked by hand: inserting ascending keys one by one would take quadratic time.
+        auto newNode = nodePool.allocate(i);
+        lastNode->rightChild = newNode;
+        newNode->parent = lastNode;
+        lastNode = newNode;
+    }
+    bool isSuccessful = (Node::getHeight(rootNode) == chainLength) && (nodePool.getMemoryUsage().liveNodeCount == chainLength);
 
-    auto randomSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    Node::deleteNode(&rootNode, Node::getMax(rootNode), nodePool);
+    isSuccessful = isSuccessful && (nodePool.getMemoryUsage().liveNodeCount == chainLength - 1);
 
-    auto uniformDistribution = std::uniform_int_distribution(1, 99);
-    auto generator = std::default_random_engine(randomSeed);
+    Node::clear(&rootNode, nodePool);
+    auto usage = nodePool.getMemoryUsage();
+    isSuccessful = isSuccessful && (rootNode == nullptr) && (usage.liveNodeCount == 0) && (usage.usedByteCount == 0) && (usage.reservedByteCount >= chainLength * sizeof(Node));
 
-    auto dice = std::bind(uniformDistribution, generator);
+    // Nodes from `new`.
+    auto heapRootNode = new Node(50);
+    for (int i = 0; i < 100; i += 1) {
+        Node::insertIteratively(heapRootNode, (i * 37) % 100);
+    }
+    Node::clear(&heapRootNode);
+    isSuccessful = isSuccessful && (heapRootNode == nullptr);
 
-    for (int i = 0; i < 10; i += 1) {
-        int num = dice();
-        SearchTreeNode<int>::insertIteratively(rootNode, num);
-        SearchTreeNode<int>::inorderTreeWalk(rootNode);
-        std::cout << std::endl;
+    auto splayTree = SplayTree<int, HeapNodeAllocator>();
+    for (int i = 0; i < 1000; i += 1) {
+        splayTree.insertValue(i);
+    }
+    isSuccessful = isSuccessful && (splayTree.getMemoryUsage().liveNodeCount == 1000);
+    splayTree.clear();
+    isSuccessful = isSuccessful && (splayTree.getSize() == 0) && (splayTree.getMemoryUsage().liveNodeCount == 0) && splayTree.inOrderWalk().empty();
+
+    if (isSuccessful) {
+        std::cout << "Teardown and memory usage success!" << std::endl;
+    } else {
+        std::cout << "Teardown and memory usage failed." << std::endl;
     }
 }
 
 
+// MARK: - Benchmarks
+/**
+ * Throughput of mixed operations from 1 to N threads on one shared tree: 80% lookups, 10% insertions, 10% deletions.
+ *
+ * Compares `ConcurrentSearchTree` with `SearchTreeNode` behind a single mutex.
+ */
+
+void benchmarkConcurrentTree() {
+    const int keyRange = 1000000;
+    const auto duration = std::chrono::milliseconds(500);
+
+    const int maxThreadCount = std::max(4u, std::thread::hardware_concurrency());
+
+    // Half the keys, in random order so that the unbalanced tree stays shallow.
+    auto initialKeys = std::vector<int>();
+    for (int key = 0; key < keyRange; key += 2) {
+        initialKeys.push_back(key);
+    }
+    std::shuffle(initialKeys.begin(), initialKeys.end(), std::default_random_engine(42));
+
+    // @return Operations per second.
+    auto measure = [&](int threadCount, auto operation) {
+        std::atomic<bool> isDone = false;
+        std::atomic<long long> operationCount = 0;
+
+        auto threads = std::vector<std::thread>();
+        for (int t = 0; t < threadCount; t += 1) {
+            threads.emplace_back([&, t]() {
+                auto generator = std::default_random_engine(t);
+                auto keyDistribution = std::uniform_int_distribution(0, keyRange - 1);
+                auto operationDistribution = std::uniform_int_distribution(0, 9);
+
+                long long localCount = 0;
+                while (!isDone.load(std::memory_order_relaxed)) {
+                    operation(operationDistribution(generator), keyDistribution(generator));
+                    localCount += 1;
+                }
+                operationCount += localCount;
+            });
+        }
+
+        std::this_thread::sleep_for(duration);
+        isDone = true;
+        for (auto& thread: threads) {
+            thread.join();
+        }
+
+        return operationCount.load() / std::chrono::duration<double>(duration).count();
+    };
+
+    for (int threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        auto concurrentTree = ConcurrentSearchTree<int>();
+        for (const auto& key: initialKeys) {
+            concurrentTree.insertValue(key);
+        }
+        auto concurrentThroughput = measure(threadCount, [&](int operationType, int key) {
+            if (operationType == 0) {
+                concurrentTree.insertValue(key);
+            } else if (operationType == 1) {
+                concurrentTree.deleteValue(key);
+            } else {
+                concurrentTree.containsValue(key);
+            }
+        });
+
+        auto mutex = std::mutex();
+        auto nodePool = NodePool<SearchTreeNode<int>>();
+        auto rootNode = nodePool.allocate(initialKeys.front());
+        for (std::size_t i = 1; i < initialKeys.size(); i += 1) {
+            SearchTreeNode<int>::insertIteratively(rootNode, initialKeys[i], nodePool);
+        }
+        auto lockedThroughput = measure(threadCount, [&](int operationType, int key) {
+            auto lock = std::lock_guard<std::mutex>(mutex);
+            auto node = SearchTreeNode<int>::searchForValueIteratively(rootNode, key);
+            if ((operationType == 0) && (node == nullptr)) {
+                SearchTreeNode<int>::insertIteratively(rootNode, key, nodePool);
+            } else if ((operationType == 1) && (node != nullptr)) {
+                SearchTreeNode<int>::deleteNode(&rootNode, node);
+                nodePool.deallocate(node);
+            }
+        });
+
+        std::cout << threadCount << " threads: ConcurrentSearchTree " << (concurrentThroughput / 1e6) << " M ops/s, ";
+        std::cout << "mutex + SearchTreeNode " << (lockedThroughput / 1e6) << " M ops/s" << std::endl;
+    }
+}
+
+/// Random lookups on a tree far larger than the cache, one at a time versus in batches of 256.
+void benchmarkBatchedSearch() {
+    const int count = 1 << 22;
+    const int queryCount = 4000000;
+    const std::size_t batchSize = 256;
+
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, 2 * count);
+    auto rootNode = new SearchTreeNode<int>(count);
+    for (int i = 1; i < count; i += 1) {
+        SearchTreeNode<int>::insertIteratively(rootNode, distribution(generator));
+    }
+    auto queries = std::vector<int>(queryCount);
+    for (auto& query: queries) {
+        query = distribution(generator);
+    }
+
+    std::size_t scalarFoundCount = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    for (auto query: queries) {
+        scalarFoundCount += (SearchTreeNode<int>::searchForValueIteratively(rootNode, query) != nullptr);
+    }
+    auto scalarTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::size_t batchedFoundCount = 0;
+    auto results = std::vector<SearchTreeNode<int>*>(batchSize);
+    startTime = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i + batchSize <= queries.size(); i += batchSize) {
+        SearchTreeNode<int>::searchForValuesIteratively(rootNode, queries.data() + i, batchSize, results.data());
+        for (auto result: results) {
+            batchedFoundCount += (result != nullptr);
+        }
+    }
+    auto batchedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << count << " keys, M lookups/s: one at a time " << (queryCount / scalarTime / 1e6) << ", batched " << (queryCount / batchedTime / 1e6);
+    std::cout << (scalarFoundCount == batchedFoundCount ? "" : " (mismatch!)") << std::endl;
+
+    SearchTreeNode<int>::clear(&rootNode);
+}
+
+
 int main() {
     test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    // benchmarkConcurrentTree();
+    // benchmarkBatchedSearch();
 
     return 0;
 }
@@ -0,0 +1,1179 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "node pool.hpp"
+#include "epoch reclamation.hpp"
+#include "tree stats.hpp"
+
+
+template <typename T>
+class SearchTreeNode {
+public:
+    T value;
+    SearchTreeNode* parent;
+    SearchTreeNode* leftChild;
+    SearchTreeNode* rightChild;
+
+
+public:
+    SearchTreeNode(T value): value(std::move(value)) {
+        this->parent = nullptr;
+        this->leftChild = nullptr;
+        this->rightChild = nullptr;
+    }
+
+    // Constructs the value from `args` in place, e.g. for move-only or non-assignable types.
+    template <typename... Args>
+    explicit SearchTreeNode(std::in_place_t, Args&&... args): value(std::forward<Args>(args)...) {
+        this->parent = nullptr;
+        this->leftChild = nullptr;
+        this->rightChild = nullptr;
+    }
+
+
+// MARK: Queries
+public:
+    // Call this function on the root node to walk the entire tree.
+    // Iterative, so degenerate trees cannot overflow the stack.
+    static void inorderTreeWalk(SearchTreeNode* rootNode) {
+        for (const auto& value: SearchTreeNode::inorder(rootNode)) {
+            std::cout << value << " ";
+        }
+        std::cout << std::flush;
+    }
+
+    // Done in O(h) time. `h` represents the tree's height.
+    static SearchTreeNode* searchForValueRecursively(SearchTreeNode* rootNode, T value) {
+        if (rootNode == nullptr) {
+            return nullptr;
+        }
+
+        if (value == rootNode->value) {
+            return rootNode;
+        } else if (value < rootNode->value) {
+            return searchForValueRecursively(rootNode->leftChild, value);
+        } else {
+            return searchForValueRecursively(rootNode->rightChild, value);
+        }
+    }
+
+    static SearchTreeNode* searchForValueIteratively(SearchTreeNode* rootNode, T value) {
+        TREE_STATS_OPERATION(search);
+
+        auto currentNode = rootNode;
+        while (currentNode != nullptr) {
+            TREE_STATS_COUNT(comparisonCount);
+            if (currentNode->value == value) {
+                return currentNode;
+            }
+
+            TREE_STATS_COUNT(comparisonCount);
+            if (value < currentNode->value) {
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+        
+        return nullptr;
+    }
+
+    /**
+     * Looks up `count` keys at once: `results[i]` becomes the node `searchForValueIteratively(rootNode, values[i])` would return.
+     *
+     * Keeps up to 16 searches in flight and prefetches the next node of each, so that their cache misses overlap. See `RBTree::searchForValues`.
+     */
+    static void searchForValuesIteratively(SearchTreeNode* rootNode, const T* values, std::size_t count, SearchTreeNode** results) {
+        constexpr std::size_t width = 16;
+
+        struct Search {
+            std::size_t index;
+            SearchTreeNode* node;
+        };
+
+        Search searches[width];
+        std::size_t searchCount = (count < width) ? count : width;
+        std::size_t nextIndex = 0;
+        for (; nextIndex < searchCount; nextIndex += 1) {
+            searches[nextIndex] = {nextIndex, rootNode};
+        }
+
+        while (searchCount > 0) {
+            for (std::size_t i = 0; i < searchCount;) {
+                auto& search = searches[i];
+                const auto& value = values[search.index];
+
+                auto node = search.node;
+                if (node != nullptr) {
+                    TREE_STATS_COUNT(comparisonCount);
+                    if (!(node->value == value)) {
+                        TREE_STATS_COUNT(comparisonCount);
+                        search.node = (value < node->value) ? node->leftChild : node->rightChild;
+                    }
+                }
+
+                // A search that did not move has found its node or fallen off the tree.
+                if (search.node != node) {
+                    __builtin_prefetch(search.node);
+                    i += 1;
+                    continue;
+                }
+
+                results[search.index] = node;
+                if (nextIndex < count) {
+                    search = {nextIndex, rootNode};
+                    nextIndex += 1;
+                    i += 1;
+                } else {
+                    searchCount -= 1;
+                    search = searches[searchCount];
+                }
+            }
+        }
+    }
+
+    // Starts from `hint` (any node of the tree, e.g. the previous result) instead of the root.
+    // In a degenerate tree the climb back up may be as long as the chain.
+    static SearchTreeNode* searchForValueNearHint(SearchTreeNode* hint, T value) {
+        if ((hint == nullptr) || (hint->value == value)) {
+            return hint;
+        }
+
+        SearchTreeNode* boundNode = nullptr;
+        auto result = SearchTreeNode::searchForValueIteratively(SearchTreeNode::climbFromHint(hint, value, boundNode), value);
+        if ((result == nullptr) && (boundNode != nullptr) && (boundNode->value == value)) {
+            result = boundNode;
+        }
+        return result;
+    }
+
+    // Returns the first node whose value is not less than `value`, or `nullptr`.
+    // Duplicates may sit on either side of each other, so this never stops at the first match.
+    static SearchTreeNode* lowerBound(SearchTreeNode* rootNode, const T& value) {
+        SearchTreeNode* candidate = nullptr;
+        auto currentNode = rootNode;
+        while (currentNode != nullptr) {
+            if (!(currentNode->value < value)) {
+                candidate = currentNode;
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return candidate;
+    }
+
+    // Returns the first node whose value is greater than `value`, or `nullptr`.
+    static SearchTreeNode* upperBound(SearchTreeNode* rootNode, const T& value) {
+        SearchTreeNode* candidate = nullptr;
+        auto currentNode = rootNode;
+        while (currentNode != nullptr) {
+            if (value < currentNode->value) {
+                candidate = currentNode;
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return candidate;
+    }
+
+    // Nodes equal to `value` are `[first, second)` in order. `nullptr` stands for the end.
+    static std::pair<SearchTreeNode*, SearchTreeNode*> equalRange(SearchTreeNode* rootNode, const T& value) {
+        return {SearchTreeNode::lowerBound(rootNode, value), SearchTreeNode::upperBound(rootNode, value)};
+    }
+
+    // Calls `visitor(node)` for every node in `[lowValue, highValue)`, in order. O(h + k).
+    template <typename Visitor>
+    static void forEachInRange(SearchTreeNode* rootNode, const T& lowValue, const T& highValue, Visitor visitor) {
+        auto currentNode = SearchTreeNode::lowerBound(rootNode, lowValue);
+        while ((currentNode != nullptr) && (currentNode->value < highValue)) {
+            visitor(currentNode);
+            currentNode = SearchTreeNode::getSuccessor(currentNode);
+        }
+    }
+
+    static SearchTreeNode* getMin(SearchTreeNode* rootNode) {
+        if (rootNode == nullptr) {
+            return nullptr;
+        }
+
+        auto currentNode = rootNode;
+        while (currentNode->leftChild != nullptr) {
+            currentNode = currentNode->leftChild;
+        }
+
+        return currentNode;
+    }
+
+    static SearchTreeNode* getMax(SearchTreeNode* rootNode) {
+        if (rootNode == nullptr) {
+            return nullptr;
+        }
+
+        auto currentNode = rootNode;
+        while (currentNode->rightChild != nullptr) {
+            currentNode = currentNode->rightChild;
+        }
+
+        return currentNode;
+    }
+
+    // Number of nodes on the longest root-to-leaf path. Iterative like the walk, since degenerate trees are exactly the ones worth measuring.
+    static int getHeight(SearchTreeNode* rootNode) {
+        int height = 0;
+        std::vector<std::pair<SearchTreeNode*, int>> stack;
+        if (rootNode != nullptr) {
+            stack.emplace_back(rootNode, 1);
+        }
+
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            if (depth > height) {
+                height = depth;
+            }
+
+            if (node->leftChild != nullptr) {
+                stack.emplace_back(node->leftChild, depth + 1);
+            }
+            if (node->rightChild != nullptr) {
+                stack.emplace_back(node->rightChild, depth + 1);
+            }
+        }
+
+        return height;
+    }
+
+    static SearchTreeNode* getPredecessor(SearchTreeNode* currentNode) {
+        if (currentNode == nullptr) {
+            return nullptr;
+        }
+
+        if (currentNode->leftChild) {
+            return SearchTreeNode::getMax(currentNode->leftChild);
+        }
+
+        // Find the first ancestor with the current node as right child.
+        auto ancestor = currentNode->parent;
+        while ((ancestor != nullptr) && (ancestor->leftChild == currentNode)) {
+            currentNode = ancestor;
+            ancestor = ancestor->parent;
+        }
+
+        return ancestor;
+    }
+
+    static SearchTreeNode* getSuccessor(SearchTreeNode* currentNode) {
+        if (currentNode == nullptr) {
+            return nullptr;
+        }
+
+        if (currentNode->rightChild) {
+            return SearchTreeNode::getMin(currentNode->rightChild);
+        }
+
+        // Find the first ancestor with the current node as left child.
+        auto ancestor = currentNode->parent;
+        while ((ancestor != nullptr) && (ancestor->rightChild == currentNode)) {
+            currentNode = ancestor;
+            ancestor = ancestor->parent;
+        }
+
+        return ancestor;
+    }
+
+
+// MARK: Iteration
+public:
+    // Bidirectional in-order iterator. Steps with `getSuccessor`/`getPredecessor`, so there is no recursion and no allocation.
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+    private:
+        // Needed to step back from `end()`.
+        SearchTreeNode* rootNode;
+        // `nullptr` represents `end()`.
+        SearchTreeNode* currentNode;
+
+    public:
+        Iterator(SearchTreeNode* rootNode, SearchTreeNode* currentNode): rootNode(rootNode), currentNode(currentNode) {
+        }
+
+        SearchTreeNode* getNode() const {
+            return currentNode;
+        }
+
+        reference operator*() const {
+            return currentNode->value;
+        }
+
+        pointer operator->() const {
+            return &(currentNode->value);
+        }
+
+        Iterator& operator++() {
+            currentNode = SearchTreeNode::getSuccessor(currentNode);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        Iterator& operator--() {
+            if (currentNode == nullptr) {
+                currentNode = SearchTreeNode::getMax(rootNode);
+            } else {
+                currentNode = SearchTreeNode::getPredecessor(currentNode);
+            }
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto returnValue = *this;
+            --(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return currentNode == other.currentNode;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return currentNode != other.currentNode;
+        }
+    };
+
+    // What `inorder` returns. Usable in range-for.
+    class InorderRange {
+    private:
+        SearchTreeNode* rootNode;
+
+    public:
+        InorderRange(SearchTreeNode* rootNode): rootNode(rootNode) {
+        }
+
+        Iterator begin() const {
+            return Iterator(rootNode, SearchTreeNode::getMin(rootNode));
+        }
+
+        Iterator end() const {
+            return Iterator(rootNode, nullptr);
+        }
+
+        std::reverse_iterator<Iterator> rbegin() const {
+            return std::reverse_iterator<Iterator>(end());
+        }
+
+        std::reverse_iterator<Iterator> rend() const {
+            return std::reverse_iterator<Iterator>(begin());
+        }
+    };
+
+    // Call this function on the root node, e.g. `for (auto& value: SearchTreeNode<int>::inorder(rootNode))`.
+    static InorderRange inorder(SearchTreeNode* rootNode) {
+        return InorderRange(rootNode);
+    }
+
+
+// MARK: Insertions
+private:
+    // Plain `new` and `delete` for the overloads without an allocator. Their nodes are not counted by any `getMemoryUsage`: pass an allocator for that.
+    struct UncountedAllocator {
+        template <typename... Args>
+        SearchTreeNode* allocate(Args&&... args) {
+            return new SearchTreeNode(std::forward<Args>(args)...);
+        }
+
+        void deallocate(SearchTreeNode* node) {
+            delete node;
+        }
+    };
+
+public:
+    // The inserted node is surely a leaf node.
+    static SearchTreeNode* insertRecursively(SearchTreeNode* rootNode, const T& newValue) {
+        if (rootNode == nullptr) {
+            return nullptr;
+        }
+
+        if (newValue <= rootNode->value) {
+            if (rootNode->leftChild == nullptr) {
+                auto newNode = new SearchTreeNode(newValue);
+                rootNode->leftChild = newNode;
+                newNode->parent = rootNode;
+                return newNode;
+            } else {
+                insertRecursively(rootNode->leftChild, newValue);
+            }
+        } else {
+            if (rootNode->rightChild == nullptr) {
+                auto newNode = new SearchTreeNode(newValue);
+                rootNode->rightChild = newNode;
+                newNode->parent = rootNode;
+                return newNode;
+            } else {
+                insertRecursively(rootNode->rightChild, newValue);
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Starts from `hint` (any node of the tree, e.g. the previous insertion) instead of the root. Does not handle an empty tree.
+    static SearchTreeNode* insertNearHint(SearchTreeNode* hint, const T& newValue) {
+        auto uncountedAllocator = UncountedAllocator();
+        return SearchTreeNode::insertNearHint(hint, newValue, uncountedAllocator);
+    }
+
+    template <typename NodeAllocator>
+    static SearchTreeNode* insertNearHint(SearchTreeNode* hint, const T& newValue, NodeAllocator& nodeAllocator) {
+        if (hint == nullptr) {
+            return nullptr;
+        }
+
+        SearchTreeNode* boundNode = nullptr;
+        return SearchTreeNode::insertIteratively(SearchTreeNode::climbFromHint(hint, newValue, boundNode), newValue, nodeAllocator);
+    }
+
+    static SearchTreeNode* insertIteratively(SearchTreeNode* rootNode, const T& newValue) {
+        auto uncountedAllocator = UncountedAllocator();
+        return SearchTreeNode::insertIteratively(rootNode, newValue, uncountedAllocator);
+    }
+
+    /**
+     * @param nodeAllocator Provides the new node, e.g. a `NodePool<SearchTreeNode>` shared by all nodes of this tree.
+     */
+    template <typename NodeAllocator>
+    static SearchTreeNode* insertIteratively(SearchTreeNode* rootNode, const T& newValue, NodeAllocator& nodeAllocator) {
+        // This function does not handle an empty tree.
+        if (rootNode == nullptr) {
+            return nullptr;
+        }
+
+        TREE_STATS_OPERATION(insertion);
+
+        return SearchTreeNode::attachLeafBelow(rootNode, nodeAllocator.allocate(newValue));
+    }
+
+    // Constructs the new node's value from `args` in place, so move-only values can be inserted. Unlike `insertIteratively`, handles an empty tree.
+    template <typename NodeAllocator, typename... Args>
+    static SearchTreeNode* emplaceIteratively(SearchTreeNode** rootNode, NodeAllocator& nodeAllocator, Args&&... args) {
+        return SearchTreeNode::insertNode(rootNode, nodeAllocator.allocate(std::in_place, std::forward<Args>(args)...));
+    }
+
+    // Hangs a detached node (e.g. from `extractNode`, possibly of another tree) back in as a leaf. Allocates nothing and leaves its value alone.
+    static SearchTreeNode* insertNode(SearchTreeNode** rootNode, SearchTreeNode* newNode) {
+        TREE_STATS_OPERATION(insertion);
+
+        newNode->parent = nullptr;
+        newNode->leftChild = nullptr;
+        newNode->rightChild = nullptr;
+        if (*rootNode == nullptr) {
+            *rootNode = newNode;
+            return newNode;
+        }
+
+        return SearchTreeNode::attachLeafBelow(*rootNode, newNode);
+    }
+
+private:
+    static SearchTreeNode* attachLeafBelow(SearchTreeNode* rootNode, SearchTreeNode* newNode) {
+        const auto& newValue = newNode->value;
+
+        auto currentNode = rootNode;
+        auto parentNode = rootNode;
+
+        while (currentNode != nullptr) {
+            parentNode = currentNode;
+            TREE_STATS_COUNT(comparisonCount);
+            if (newValue <= currentNode->value) {
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        TREE_STATS_COUNT(comparisonCount);
+        if (newValue <= parentNode->value) {
+            parentNode->leftChild = newNode;
+            newNode->parent = parentNode;
+        } else {
+            parentNode->rightChild = newNode;
+            newNode->parent = parentNode;
+        }
+        return newNode;
+    }
+
+
+// MARK: Finger Search
+private:
+    /**
+     * Climbs from `hint` to the lowest ancestor whose subtree `value` belongs in. See `RBTree::climbFromHint`.
+     *
+     * `boundNode` becomes the nearest ancestor past that subtree on the side of `value`, or `nullptr`.
+     */
+    static SearchTreeNode* climbFromHint(SearchTreeNode* hint, const T& value, SearchTreeNode*& boundNode) {
+        auto isAfterHint = (hint->value < value);
+
+        auto node = hint;
+        while (true) {
+            auto child = node;
+            auto ancestor = node->parent;
+            while ((ancestor != nullptr) && ((isAfterHint ? ancestor->rightChild : ancestor->leftChild) == child)) {
+                child = ancestor;
+                ancestor = ancestor->parent;
+            }
+
+            TREE_STATS_COUNT(comparisonCount);
+            if ((ancestor == nullptr) || (isAfterHint ? !(ancestor->value < value) : !(value < ancestor->value))) {
+                boundNode = ancestor;
+                return node;
+            }
+            node = ancestor;
+        }
+    }
+
+
+// MARK: - Deletion
+private:
+    static void transplantSubtree(SearchTreeNode** rootNode, SearchTreeNode* oldSubtree, SearchTreeNode* newSubtree) {
+        if (oldSubtree->parent == nullptr) {
+            // The old subtree is the root.
+            *rootNode = newSubtree;
+        } else if (oldSubtree == oldSubtree->parent->leftChild) {
+            oldSubtree->parent->leftChild = newSubtree;
+        } else {
+            oldSubtree->parent->rightChild = newSubtree;
+        }
+
+        if (newSubtree) {
+            newSubtree->parent = oldSubtree->parent;
+        }
+    }
+
+public:
+    static void deleteNode(SearchTreeNode** rootNode, SearchTreeNode* nodeToDelete) {
+        TREE_STATS_OPERATION(deletion);
+
+        // Note that `nodeToDelete` might be the root node.
+        if (nodeToDelete->leftChild == nullptr) {
+            // Simplest case. Use right node.
+            SearchTreeNode::transplantSubtree(rootNode, nodeToDelete, nodeToDelete->rightChild);
+        } else if (nodeToDelete->rightChild == nullptr) {
+            // Only has left child. Also simple.
+            SearchTreeNode::transplantSubtree(rootNode, nodeToDelete, nodeToDelete->leftChild);
+        } else {
+            // Has both left and right children.
+            // Find the successor of `nodeToDelete` from its right subtree.
+            auto replacementNode = SearchTreeNode::getMin(nodeToDelete->rightChild);
+            if (replacementNode->parent != nodeToDelete) {
+                // `replacementNode` is not the direct right child of `nodeToDelete`.
+                // Apparently `replacementNode` has no left child, but may have a right child.
+                // Thus, we need to deal with `replacementNode`'s right child.
+                SearchTreeNode::transplantSubtree(rootNode, replacementNode, replacementNode->rightChild);
+                replacementNode->rightChild = nodeToDelete->rightChild;
+                replacementNode->rightChild->parent = replacementNode;
+            }
+            // If `replacementNode` is the direct right child of `nodeToDelete`, we don't need to care about its right child.
+
+            SearchTreeNode::transplantSubtree(rootNode, nodeToDelete, replacementNode);
+            replacementNode->leftChild = nodeToDelete->leftChild;
+            replacementNode->leftChild->parent = replacementNode;
+        }
+    }
+
+    // Unlinks `nodeToDelete` and frees it through `nodeAllocator`, which must be the one it came from.
+    template <typename NodeAllocator>
+    static void deleteNode(SearchTreeNode** rootNode, SearchTreeNode* nodeToDelete, NodeAllocator& nodeAllocator) {
+        SearchTreeNode::deleteNode(rootNode, nodeToDelete);
+        nodeAllocator.deallocate(nodeToDelete);
+    }
+
+    // Frees every node of a tree built with `new` (e.g. `insertIteratively` without an allocator) and empties it.
+    static void clear(SearchTreeNode** rootNode) {
+        auto uncountedAllocator = UncountedAllocator();
+        SearchTreeNode::clear(rootNode, uncountedAllocator);
+    }
+
+    /**
+     * Frees every node in O(n) time and O(1) space, so even a degenerate chain cannot overflow the stack, and empties the tree.
+     *
+     * Rotates right until the current node has no left child, then frees it and moves on to its right child. Parent pointers are left stale, since every node goes.
+     */
+    template <typename NodeAllocator>
+    static void clear(SearchTreeNode** rootNode, NodeAllocator& nodeAllocator) {
+        auto node = *rootNode;
+        while (node != nullptr) {
+            if (node->leftChild != nullptr) {
+                auto leftChild = node->leftChild;
+                node->leftChild = leftChild->rightChild;
+                leftChild->rightChild = node;
+                node = leftChild;
+            } else {
+                auto rightChild = node->rightChild;
+                nodeAllocator.deallocate(node);
+                node = rightChild;
+            }
+        }
+
+        *rootNode = nullptr;
+    }
+
+    // Unlinks `node` like `deleteNode` and detaches it completely, ready for `insertNode` into this or another tree.
+    static SearchTreeNode* extractNode(SearchTreeNode** rootNode, SearchTreeNode* node) {
+        SearchTreeNode::deleteNode(rootNode, node);
+
+        node->parent = nullptr;
+        node->leftChild = nullptr;
+        node->rightChild = nullptr;
+        return node;
+    }
+};
+
+
+// MARK: - Splay Tree
+/**
+ * Self-adjusting binary search tree on `SearchTreeNode`s.
+ *
+ * Refer to "Self-Adjusting Binary Search Trees" by Daniel Sleator and Robert Tarjan.
+ *
+ * Every access rotates the node it reached to the root, so each operation takes amortized O(log n) time, and keys that were accessed recently sit near the root.
+ * Under a skewed workload the hot keys are found within a few comparisons, where a balanced tree always walks about log n levels.
+ * The price is that searches write: a splay tree cannot be read by several threads at once.
+ *
+ * Like `insertIteratively`, equal keys go left, so duplicates are kept.
+ */
+template <typename T, template <typename> typename NodeAllocator = NodePool>
+class SplayTree {
+public:
+    using Node = SearchTreeNode<T>;
+
+public:
+    Node* rootNode = nullptr;
+
+private:
+    std::size_t size = 0;
+    NodeAllocator<Node> nodeAllocator;
+
+public:
+    SplayTree() = default;
+
+    SplayTree(const SplayTree&) = delete;
+    SplayTree& operator=(const SplayTree&) = delete;
+
+    SplayTree(SplayTree&& other) noexcept: rootNode(other.rootNode), size(other.size), nodeAllocator(std::move(other.nodeAllocator)) {
+        other.rootNode = nullptr;
+        other.size = 0;
+    }
+
+    ~SplayTree() {
+        if constexpr (!(NodeAllocator<Node>::releasesNodesInBulk && std::is_trivially_destructible_v<Node>)) {
+            // Stack-free: after ascending insertions the tree is a single chain.
+            Node::clear(&rootNode, nodeAllocator);
+        }
+    }
+
+    void clear() {
+        if constexpr (!(NodeAllocator<Node>::releasesNodesInBulk && std::is_trivially_destructible_v<Node>)) {
+            Node::clear(&rootNode, nodeAllocator);
+        }
+        rootNode = nullptr;
+        size = 0;
+        nodeAllocator = NodeAllocator<Node>();
+    }
+
+public:
+    std::size_t getSize() const {
+        return size;
+    }
+
+    NodeMemoryUsage getMemoryUsage() const {
+        return nodeAllocator.getMemoryUsage();
+    }
+
+    std::vector<T> inOrderWalk() const {
+        auto range = Node::inorder(rootNode);
+        return std::vector<T>(range.begin(), range.end());
+    }
+
+
+// MARK: Splaying
+private:
+    /// Rotates `node` above its parent, relinking the grandparent the way `transplantSubtree` does.
+    void rotateUp(Node* node) {
+        auto parent = node->parent;
+        auto grandparent = parent->parent;
+
+        if (node == parent->leftChild) {
+            TREE_STATS_COUNT(rightRotationCount);
+            parent->leftChild = node->rightChild;
+            if (node->rightChild != nullptr) {
+                node->rightChild->parent = parent;
+            }
+            node->rightChild = parent;
+        } else {
+            TREE_STATS_COUNT(leftRotationCount);
+            parent->rightChild = node->leftChild;
+            if (node->leftChild != nullptr) {
+                node->leftChild->parent = parent;
+            }
+            node->leftChild = parent;
+        }
+        parent->parent = node;
+
+        node->parent = grandparent;
+        if (grandparent == nullptr) {
+            rootNode = node;
+        } else if (parent == grandparent->leftChild) {
+            grandparent->leftChild = node;
+        } else {
+            grandparent->rightChild = node;
+        }
+    }
+
+    /// Moves `node` to the root. Roughly halves the depth of every node on the way.
+    void splay(Node* node) {
+        while (node->parent != nullptr) {
+            auto parent = node->parent;
+            auto grandparent = parent->parent;
+
+            if (grandparent == nullptr) {
+                // Zig.
+                rotateUp(node);
+            } else if ((node == parent->leftChild) == (parent == grandparent->leftChild)) {
+                // Zig-zig. Rotating the parent first is what makes the amortized bound hold.
+                rotateUp(parent);
+                rotateUp(node);
+            } else {
+                // Zig-zag.
+                rotateUp(node);
+                rotateUp(node);
+            }
+        }
+    }
+
+
+// MARK: Queries
+public:
+    /// Splays the found node, or the last node visited when the key is absent, so that misses also pay for their path.
+    Node* searchForValue(const T& value) {
+        TREE_STATS_OPERATION(search);
+
+        Node* lastNode = nullptr;
+        auto currentNode = rootNode;
+        while (currentNode != nullptr) {
+            lastNode = currentNode;
+
+            TREE_STATS_COUNT(comparisonCount);
+            if (currentNode->value == value) {
+                splay(currentNode);
+                return currentNode;
+            }
+
+            TREE_STATS_COUNT(comparisonCount);
+            if (value < currentNode->value) {
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        if (lastNode != nullptr) {
+            splay(lastNode);
+        }
+        return nullptr;
+    }
+
+
+// MARK: Insertions
+public:
+    Node* insertValue(const T& newValue) {
+        TREE_STATS_OPERATION(insertion);
+
+        auto newNode = nodeAllocator.allocate(newValue);
+        size += 1;
+
+        if (rootNode == nullptr) {
+            rootNode = newNode;
+            return newNode;
+        }
+
+        auto parentNode = rootNode;
+        auto currentNode = rootNode;
+        bool isLeftChild = false;
+        while (currentNode != nullptr) {
+            parentNode = currentNode;
+            TREE_STATS_COUNT(comparisonCount);
+            isLeftChild = (newValue <= currentNode->value);
+            currentNode = isLeftChild ? currentNode->leftChild : currentNode->rightChild;
+        }
+
+        newNode->parent = parentNode;
+        if (isLeftChild) {
+            parentNode->leftChild = newNode;
+        } else {
+            parentNode->rightChild = newNode;
+        }
+
+        splay(newNode);
+        return newNode;
+    }
+
+
+// MARK: - Deletion
+public:
+    void deleteNode(Node* node) {
+        TREE_STATS_OPERATION(deletion);
+
+        splay(node);
+
+        // `node` is the root now. Join its two subtrees: the maximum of the left one, splayed to its top, has no right child.
+        auto leftSubtree = node->leftChild;
+        auto rightSubtree = node->rightChild;
+        if (leftSubtree == nullptr) {
+            rootNode = rightSubtree;
+            if (rightSubtree != nullptr) {
+                rightSubtree->parent = nullptr;
+            }
+        } else {
+            leftSubtree->parent = nullptr;
+            rootNode = leftSubtree;
+
+            auto maxNode = Node::getMax(leftSubtree);
+            splay(maxNode);
+            maxNode->rightChild = rightSubtree;
+            if (rightSubtree != nullptr) {
+                rightSubtree->parent = maxNode;
+            }
+        }
+
+        nodeAllocator.deallocate(node);
+        size -= 1;
+    }
+
+    /// Removes one copy of `value`.
+    bool deleteValue(const T& value) {
+        auto node = searchForValue(value);
+        if (node == nullptr) {
+            return false;
+        }
+
+        deleteNode(node);
+        return true;
+    }
+};
+
+
+// MARK: - Concurrent Tree
+/**
+ * Lock-free binary search tree, for many threads doing lookups, insertions and deletions on one shared index.
+ *
+ * Refer to "Fast Concurrent Lock-Free Binary Search Trees" by Aravind Natarajan and Neeraj Mittal.
+ *
+ * The tree is external: keys live in leaves, and internal nodes only route searches (smaller keys go left).
+ * Searches never write. An insertion swings one child pointer with a CAS.
+ * A deletion flags the edge to its leaf, tags (freezes) the edge to the leaf's sibling, then splices the sibling into the grandparent with a CAS.
+ * A thread that runs into a flagged or tagged edge completes that deletion itself, so no thread ever waits for another.
+ *
+ * Unlinked nodes go to `EpochReclamation`, so nothing is freed while another thread may still be reading it.
+ * Duplicate keys are not stored.
+ */
+template <typename T>
+class ConcurrentSearchTree {
+private:
+    class Node {
+    public:
+        T key;
+
+        /// 0 for real keys. Sentinel keys are larger than every real key and ordered by this rank.
+        int infinityRank;
+
+        /// Child pointers carrying the flag and tag bits. Both are null in leaves.
+        std::atomic<std::uintptr_t> leftChild;
+        std::atomic<std::uintptr_t> rightChild;
+
+    public:
+        Node(const T& key, int infinityRank, Node* leftChild = nullptr, Node* rightChild = nullptr): key(key), infinityRank(infinityRank), leftChild(makeEdge(leftChild)), rightChild(makeEdge(rightChild)) {}
+    };
+
+    /// The leaf below this edge is being deleted.
+    static constexpr std::uintptr_t flagBit = 1;
+    /// This edge must not change any more: its parent is being removed.
+    static constexpr std::uintptr_t tagBit = 2;
+
+    /// Where a search ended, plus the last untagged edge (`ancestor` to `successor`) on the way there.
+    struct SeekRecord {
+        Node* ancestor;
+        Node* successor;
+        Node* parent;
+        Node* leaf;
+    };
+
+    /// Internal sentinel with the largest key. The real keys are in the left subtree of its left child.
+    Node* rootNode;
+
+public:
+    ConcurrentSearchTree() {
+        auto sNode = new Node(T(), 2, new Node(T(), 1), new Node(T(), 2));
+        rootNode = new Node(T(), 3, sNode, new Node(T(), 3));
+    }
+
+    ConcurrentSearchTree(const ConcurrentSearchTree&) = delete;
+    ConcurrentSearchTree& operator=(const ConcurrentSearchTree&) = delete;
+
+    /**
+     * No other thread may use the tree any more.
+     *
+     * Nodes unlinked earlier are freed by `EpochReclamation`: the calling thread's here (see `EpochReclamation::drain`), other threads' by their later reclamations.
+     * Never waits for other threads.
+     */
+    ~ConcurrentSearchTree() {
+        deleteSubtree(rootNode);
+        EpochReclamation::drain();
+    }
+
+private:
+    /// O(n) time and O(1) space like `SearchTreeNode::clear`, since sorted insertions build a chain.
+    static void deleteSubtree(Node* node) {
+        while (node != nullptr) {
+            auto leftChild = getAddress(node->leftChild.load(std::memory_order_relaxed));
+            if (leftChild != nullptr) {
+                node->leftChild.store(leftChild->rightChild.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                leftChild->rightChild.store(makeEdge(node), std::memory_order_relaxed);
+                node = leftChild;
+            } else {
+                auto rightChild = getAddress(node->rightChild.load(std::memory_order_relaxed));
+                delete node;
+                node = rightChild;
+            }
+        }
+    }
+
+
+// MARK: Edges
+private:
+    static Node* getAddress(std::uintptr_t edge) {
+        return reinterpret_cast<Node*>(edge & ~(flagBit | tagBit));
+    }
+
+    static std::uintptr_t makeEdge(Node* node) {
+        return reinterpret_cast<std::uintptr_t>(node);
+    }
+
+    static bool isLess(const T& key, const Node* node) {
+        return (node->infinityRank > 0) || (key < node->key);
+    }
+
+    static bool isKeyOf(const T& key, const Node* node) {
+        return (node->infinityRank == 0) && (key == node->key);
+    }
+
+    static std::atomic<std::uintptr_t>& getChildEdge(Node* node, const T& key) {
+        return isLess(key, node) ? node->leftChild : node->rightChild;
+    }
+
+
+// MARK: Queries
+private:
+    SeekRecord seek(const T& key) const {
+        auto sNode = getAddress(rootNode->leftChild.load(std::memory_order_acquire));
+        auto seekRecord = SeekRecord{rootNode, sNode, sNode, getAddress(sNode->leftChild.load(std::memory_order_acquire))};
+
+        auto parentEdge = sNode->leftChild.load(std::memory_order_acquire);
+        auto currentEdge = seekRecord.leaf->leftChild.load(std::memory_order_acquire);
+        auto currentNode = getAddress(currentEdge);
+
+        while (currentNode != nullptr) {
+            if (!(parentEdge & tagBit)) {
+                // Everything above this edge stays in the tree even if the nodes below get removed.
+                seekRecord.ancestor = seekRecord.parent;
+                seekRecord.successor = seekRecord.leaf;
+            }
+            seekRecord.parent = seekRecord.leaf;
+            seekRecord.leaf = currentNode;
+
+            parentEdge = currentEdge;
+            currentEdge = getChildEdge(currentNode, key).load(std::memory_order_acquire);
+            currentNode = getAddress(currentEdge);
+        }
+
+        return seekRecord;
+    }
+
+public:
+    /// Lock-free and read-only. O(h).
+    bool containsValue(const T& value) const {
+        auto guard = EpochReclamation::Guard();
+        return isKeyOf(value, seek(value).leaf);
+    }
+
+    /// Only meaningful while no other thread modifies the tree.
+    std::vector<T> inOrderWalk() const {
+        auto returnValue = std::vector<T>();
+
+        auto stack = std::vector<Node*>();
+        auto currentNode = rootNode;
+        while ((currentNode != nullptr) || (!stack.empty())) {
+            for (; currentNode != nullptr; currentNode = getAddress(currentNode->leftChild.load(std::memory_order_acquire))) {
+                stack.push_back(currentNode);
+            }
+
+            currentNode = stack.back();
+            stack.pop_back();
+            if ((currentNode->leftChild.load(std::memory_order_acquire) == 0) && (currentNode->infinityRank == 0)) {
+                returnValue.push_back(currentNode->key);
+            }
+            currentNode = getAddress(currentNode->rightChild.load(std::memory_order_acquire));
+        }
+
+        return returnValue;
+    }
+
+
+// MARK: Insertions
+public:
+    /// Lock-free. @return `false` if `value` is already present.
+    bool insertValue(const T& value) {
+        auto guard = EpochReclamation::Guard();
+
+        while (true) {
+            auto seekRecord = seek(value);
+            auto leaf = seekRecord.leaf;
+            if (isKeyOf(value, leaf)) {
+                return false;
+            }
+
+            // The leaf is replaced by an internal node over itself and the new leaf.
+            auto newLeaf = new Node(value, 0);
+            auto newInternalNode = isLess(value, leaf) ? new Node(leaf->key, leaf->infinityRank, newLeaf, leaf) : new Node(value, 0, leaf, newLeaf);
+
+            auto& childEdge = getChildEdge(seekRecord.parent, value);
+            auto expectedEdge = makeEdge(leaf);
+            if (childEdge.compare_exchange_strong(expectedEdge, makeEdge(newInternalNode), std::memory_order_acq_rel)) {
+                return true;
+            }
+
+            // Never published, so nobody else can hold them.
+            delete newLeaf;
+            delete newInternalNode;
+
+            if ((getAddress(expectedEdge) == leaf) && (expectedEdge & (flagBit | tagBit))) {
+                // A deletion got to this edge first. Finish it before retrying.
+                cleanUp(value, seekRecord);
+            }
+        }
+    }
+
+
+// MARK: - Deletion
+private:
+    /**
+     * Removes the flagged leaf near `seekRecord.leaf` together with its parent, by splicing the sibling of the leaf into `ancestor`.
+     *
+     * @return Whether this call did the splice.
+     */
+    bool cleanUp(const T& key, const SeekRecord& seekRecord) {
+        auto ancestor = seekRecord.ancestor;
+        auto successor = seekRecord.successor;
+        auto parent = seekRecord.parent;
+
+        auto& successorEdge = getChildEdge(ancestor, key);
+        auto* childEdge = &parent->leftChild;
+        auto* siblingEdge = &parent->rightChild;
+        if (!isLess(key, parent)) {
+            std::swap(childEdge, siblingEdge);
+        }
+        if (!(childEdge->load(std::memory_order_acquire) & flagBit)) {
+            // The leaf on the other side is the one being deleted (by another thread).
+            siblingEdge = childEdge;
+        }
+
+        auto siblingValue = siblingEdge->fetch_or(tagBit, std::memory_order_acq_rel) | tagBit;
+        auto expectedEdge = makeEdge(successor);
+        if (!successorEdge.compare_exchange_strong(expectedEdge, siblingValue & ~tagBit, std::memory_order_acq_rel)) {
+            return false;
+        }
+
+        retireRemovedNodes(key, successor, parent, getAddress(siblingValue));
+        return true;
+    }
+
+    /// After a splice, every node from `successor` down to `parent` is unreachable, and so is the flagged leaf hanging off each of them.
+    static void retireRemovedNodes(const T& key, Node* successor, Node* parent, Node* sibling) {
+        // The edges on this path are all tagged or flagged, so they no longer change.
+        auto currentNode = successor;
+        while (currentNode != parent) {
+            auto& nextEdge = getChildEdge(currentNode, key);
+            auto& otherEdge = (&nextEdge == &currentNode->leftChild) ? currentNode->rightChild : currentNode->leftChild;
+            EpochReclamation::retire(getAddress(otherEdge.load(std::memory_order_acquire)));
+
+            auto nextNode = getAddress(nextEdge.load(std::memory_order_acquire));
+            EpochReclamation::retire(currentNode);
+            currentNode = nextNode;
+        }
+
+        auto leftNode = getAddress(parent->leftChild.load(std::memory_order_acquire));
+        auto rightNode = getAddress(parent->rightChild.load(std::memory_order_acquire));
+        EpochReclamation::retire((leftNode == sibling) ? rightNode : leftNode);
+        EpochReclamation::retire(parent);
+    }
+
+public:
+    /// Lock-free. @return `false` if `value` is not present.
+    bool deleteValue(const T& value) {
+        auto guard = EpochReclamation::Guard();
+
+        // Injection: flag the edge to the leaf. After that the deletion is certain, and only the cleanup is left.
+        Node* leaf = nullptr;
+        while (true) {
+            auto seekRecord = seek(value);
+            leaf = seekRecord.leaf;
+            if (!isKeyOf(value, leaf)) {
+                return false;
+            }
+
+            auto& childEdge = getChildEdge(seekRecord.parent, value);
+            auto expectedEdge = makeEdge(leaf);
+            if (childEdge.compare_exchange_strong(expectedEdge, makeEdge(leaf) | flagBit, std::memory_order_acq_rel)) {
+                if (cleanUp(value, seekRecord)) {
+                    return true;
+                }
+                break;
+            }
+
+            if ((getAddress(expectedEdge) == leaf) && (expectedEdge & (flagBit | tagBit))) {
+                cleanUp(value, seekRecord);
+            }
+        }
+
+        // Cleanup: retry until this thread or a helper has removed the leaf.
+        while (true) {
+            auto seekRecord = seek(value);
+            if (seekRecord.leaf != leaf) {
+                return true;
+            }
+            if (cleanUp(value, seekRecord)) {
+                return true;
+            }
+        }
+    }
+};
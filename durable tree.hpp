@@ -0,0 +1,508 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "red black tree.hpp"
+#include "mapped tree.hpp"
+
+
+struct DurabilityOptions {
+    /// Modifications return only once their log record is on disk. Otherwise a crash loses at most about `groupCommitInterval` of them.
+    bool waitsForSync = true;
+
+    /// The log is written and synced at least this often while records are pending...
+    std::chrono::microseconds groupCommitInterval = std::chrono::microseconds(1000);
+    /// ...and as soon as this many bytes are pending.
+    std::size_t groupCommitBytes = 1 << 16;
+
+    /// A checkpoint is taken once the log grows this big. 0 disables automatic checkpoints.
+    std::size_t checkpointLogBytes = 64 << 20;
+};
+
+
+/**
+ * `RBTree` of keys that survives crashes, with a write-ahead log of its modifications.
+ *
+ * Every insertion and deletion appends a record (an opcode, the key bytes and a checksum) to a log file before it is acknowledged.
+ * Records are synced in groups: one `fdatasync` covers every record appended while the previous one ran, so concurrent writers share the cost.
+ * A checkpoint saves the whole tree as a `MappedTree` file and starts a new, empty log.
+ *
+ * A directory holds `checkpoint.<generation>` and `log.<generation>` files. Checkpoint `g` contains every operation of the logs before `g`.
+ * Recovery maps the newest complete checkpoint, rebuilds the tree from it by bulk construction, and replays the logs from its generation on.
+ * If the logs only insert, their keys are merged into the bulk construction instead of being inserted one by one.
+ * A record cut short or corrupted by a crash ends replay, and the log is truncated there.
+ *
+ * If writing or syncing the log fails, the modifications waiting for it throw `std::system_error`, but they stay in memory and may or may not have reached the disk.
+ * From then on every modification, `sync` and `checkpoint` throws without changing anything, and nothing more is written: reopen the tree to get back to the state on disk.
+ * Without `waitsForSync`, a failure is reported by the next modification or `sync`.
+ *
+ * Thread-safe: every method locks the tree. Keys must be trivially copyable.
+ */
+template <typename T, typename Compare = std::less<T>>
+class DurableRBTree {
+public:
+    using Tree = RBTree<T, RBNoPayload, Compare>;
+    using Node = typename Tree::Node;
+
+    static_assert(std::is_trivially_copyable_v<T>, "Keys are written to the log byte for byte.");
+
+private:
+    enum class Opcode: std::uint8_t {
+        insertion = 1,
+        deletion = 2,
+    };
+
+    static constexpr std::size_t recordSize = sizeof(Opcode) + sizeof(T) + sizeof(std::uint32_t);
+
+    const std::filesystem::path directory;
+    const DurabilityOptions options;
+
+    /// Guards `logDescriptor`, `logBytes` and `generation`. Taken before `mutex`, and held while writing the log, so that log files never change under a flush.
+    std::mutex logMutex;
+    int logDescriptor;
+    std::size_t logBytes;
+    std::uint64_t generation;
+
+    /// Guards everything below.
+    mutable std::mutex mutex;
+    Tree tree;
+
+    /// Records not written to the log yet.
+    std::vector<char> pendingRecords;
+    std::uint64_t appendedRecordCount;
+    std::uint64_t durableRecordCount;
+    std::error_code syncError;
+
+    int syncWaiterCount;
+    bool isStopping;
+    std::condition_variable flushNeeded;
+    std::condition_variable flushed;
+
+    std::thread flusher;
+
+public:
+    /// Opens the tree in `directory`, creating it if needed, and recovers its contents.
+    explicit DurableRBTree(const std::string& directory, DurabilityOptions options = DurabilityOptions()): directory(directory), options(options), logDescriptor(-1), logBytes(0), generation(0), tree(recoverTree()) {
+        appendedRecordCount = 0;
+        durableRecordCount = 0;
+        syncWaiterCount = 0;
+        isStopping = false;
+
+        openLog();
+        flusher = std::thread(&DurableRBTree::runFlusher, this);
+    }
+
+    DurableRBTree(const DurableRBTree&) = delete;
+    DurableRBTree& operator=(const DurableRBTree&) = delete;
+
+    /// Writes and syncs the remaining records.
+    ~DurableRBTree() {
+        {
+            auto lock = std::lock_guard(mutex);
+            isStopping = true;
+        }
+        flushNeeded.notify_one();
+        flusher.join();
+
+        ::close(logDescriptor);
+    }
+
+
+// MARK: Queries
+public:
+    bool containsValue(const T& value) {
+        auto lock = std::lock_guard(mutex);
+        return tree.searchForValue(value) != Node::nilNode;
+    }
+
+    /// @return A node with a key equivalent to `value`, or `Node::nilNode`. Another thread may delete it as soon as this returns, so it is only safe to use while no other thread modifies the tree.
+    Node* searchForValue(const T& value) {
+        auto lock = std::lock_guard(mutex);
+        return tree.searchForValue(value);
+    }
+
+    std::vector<T> inOrderWalk() const {
+        auto lock = std::lock_guard(mutex);
+        return tree.inOrderWalk();
+    }
+
+    /// Number of log generations so far, i.e. of checkpoints taken including the ones of earlier runs.
+    std::uint64_t getGeneration() {
+        auto lock = std::lock_guard(logMutex);
+        return generation;
+    }
+
+
+// MARK: Modification
+public:
+    void insertValue(const T& value) {
+        auto lock = std::unique_lock(mutex);
+        throwIfLogFailed();
+        tree.insertValue(value);
+        appendRecord(Opcode::insertion, value, lock);
+    }
+
+    bool deleteValue(const T& value) {
+        auto lock = std::unique_lock(mutex);
+        throwIfLogFailed();
+        if (!tree.deleteValue(value)) {
+            return false;
+        }
+        appendRecord(Opcode::deletion, value, lock);
+        return true;
+    }
+
+    /// Waits until every modification made so far is on disk. Only needed when `waitsForSync` is off.
+    void sync() {
+        auto lock = std::unique_lock(mutex);
+        throwIfLogFailed();
+        waitForFlush(appendedRecordCount, lock);
+    }
+
+private:
+    static std::uint32_t getChecksum(const char* bytes, std::size_t count) {
+        // 32-bit FNV-1a.
+        std::uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < count; i += 1) {
+            hash = (hash ^ static_cast<unsigned char>(bytes[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    /// Called before any change to the tree, so that it never gets ahead of the log once the log failed. Requires `mutex`.
+    void throwIfLogFailed() const {
+        if (syncError) {
+            throw std::system_error(syncError, "DurableRBTree: cannot write the log");
+        }
+    }
+
+    void appendRecord(Opcode opcode, const T& value, std::unique_lock<std::mutex>& lock) {
+        char record[recordSize];
+        record[0] = static_cast<char>(opcode);
+        std::memcpy(record + sizeof(Opcode), &value, sizeof(T));
+        auto checksum = getChecksum(record, sizeof(Opcode) + sizeof(T));
+        std::memcpy(record + sizeof(Opcode) + sizeof(T), &checksum, sizeof(checksum));
+
+        pendingRecords.insert(pendingRecords.end(), record, record + recordSize);
+        appendedRecordCount += 1;
+
+        if (options.waitsForSync) {
+            waitForFlush(appendedRecordCount, lock);
+        } else if (pendingRecords.size() >= options.groupCommitBytes) {
+            flushNeeded.notify_one();
+        }
+    }
+
+    /// Records appended while the flusher syncs pile up and go out together with the next sync: that is the group commit.
+    void waitForFlush(std::uint64_t recordCount, std::unique_lock<std::mutex>& lock) {
+        syncWaiterCount += 1;
+        flushNeeded.notify_one();
+        flushed.wait(lock, [&]() {
+            return (durableRecordCount >= recordCount) || syncError;
+        });
+        syncWaiterCount -= 1;
+
+        if (durableRecordCount < recordCount) {
+            throw std::system_error(syncError, "DurableRBTree: cannot write the log");
+        }
+    }
+
+
+// MARK: Log Files
+private:
+    std::filesystem::path getLogPath(std::uint64_t logGeneration) const {
+        return directory / ("log." + std::to_string(logGeneration));
+    }
+
+    std::filesystem::path getCheckpointPath(std::uint64_t checkpointGeneration) const {
+        return directory / ("checkpoint." + std::to_string(checkpointGeneration));
+    }
+
+    /// @return The generations of the files named `<prefix>.<generation>`, in increasing order. Leftover `.tmp` files are skipped.
+    std::vector<std::uint64_t> getGenerations(const std::string& prefix) const {
+        auto generations = std::vector<std::uint64_t>();
+        for (const auto& entry: std::filesystem::directory_iterator(directory)) {
+            auto name = entry.path().filename().string();
+            if ((name.size() > prefix.size() + 1) && (name.compare(0, prefix.size() + 1, prefix + ".") == 0)) {
+                auto suffix = name.substr(prefix.size() + 1);
+                if (std::all_of(suffix.begin(), suffix.end(), [](char c) { return (c >= '0') && (c <= '9'); })) {
+                    generations.push_back(std::stoull(suffix));
+                }
+            }
+        }
+        std::sort(generations.begin(), generations.end());
+        return generations;
+    }
+
+    /// Makes created, renamed and removed files in the directory durable.
+    void syncDirectory() const {
+        auto descriptor = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (descriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "DurableRBTree: cannot open " + directory.string());
+        }
+        auto result = ::fsync(descriptor);
+        auto error = errno;
+        ::close(descriptor);
+        if (result == -1) {
+            throw std::system_error(error, std::generic_category(), "DurableRBTree: cannot sync " + directory.string());
+        }
+    }
+
+    /// Opens the log of the current generation for appending. Requires `logMutex` or exclusive access.
+    void openLog() {
+        auto path = getLogPath(generation);
+        logDescriptor = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (logDescriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "DurableRBTree: cannot open " + path.string());
+        }
+        logBytes = static_cast<std::size_t>(std::filesystem::file_size(path));
+        syncDirectory();
+    }
+
+    /// Writes `records` to the log and syncs it. Requires `logMutex`.
+    std::error_code writeLog(const std::vector<char>& records) {
+        std::size_t writtenCount = 0;
+        while (writtenCount < records.size()) {
+            auto result = ::write(logDescriptor, records.data() + writtenCount, records.size() - writtenCount);
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return std::error_code(errno, std::generic_category());
+            }
+            writtenCount += static_cast<std::size_t>(result);
+        }
+        logBytes += records.size();
+
+        if (::fdatasync(logDescriptor) == -1) {
+            return std::error_code(errno, std::generic_category());
+        }
+        return std::error_code();
+    }
+
+    /// Writes and syncs everything appended so far. Once the log failed, drops the records instead: written after a gap, they would be replayed without the ones before them.
+    void flushLog() {
+        auto logLock = std::lock_guard(logMutex);
+
+        auto records = std::vector<char>();
+        std::uint64_t recordCount = 0;
+        {
+            auto lock = std::lock_guard(mutex);
+            records.swap(pendingRecords);
+            recordCount = appendedRecordCount;
+            if (syncError) {
+                records.clear();
+            }
+        }
+
+        auto error = records.empty() ? std::error_code() : writeLog(records);
+
+        {
+            auto lock = std::lock_guard(mutex);
+            if (error) {
+                syncError = error;
+            } else if (!syncError) {
+                durableRecordCount = std::max(durableRecordCount, recordCount);
+            }
+        }
+        flushed.notify_all();
+    }
+
+    void runFlusher() {
+        while (true) {
+            bool isLastFlush = false;
+            {
+                auto lock = std::unique_lock(mutex);
+                flushNeeded.wait_for(lock, options.groupCommitInterval, [&]() {
+                    return isStopping || (syncWaiterCount > 0) || (pendingRecords.size() >= options.groupCommitBytes);
+                });
+                isLastFlush = isStopping;
+            }
+
+            flushLog();
+            if (isLastFlush) {
+                return;
+            }
+
+            bool isCheckpointDue = false;
+            {
+                auto logLock = std::lock_guard(logMutex);
+                isCheckpointDue = (options.checkpointLogBytes > 0) && (logBytes >= options.checkpointLogBytes);
+            }
+            if (isCheckpointDue) {
+                try {
+                    checkpoint();
+                } catch (const std::system_error& error) {
+                    auto lock = std::lock_guard(mutex);
+                    syncError = error.code();
+                    flushed.notify_all();
+                }
+            }
+        }
+    }
+
+
+// MARK: Checkpoints
+public:
+    /**
+     * Saves the tree and starts an empty log. Modifications wait until it is done. O(n).
+     *
+     * The new log is created before the checkpoint is written. A crash in between leaves the previous checkpoint and all logs after it, which recover the same tree.
+     */
+    void checkpoint() {
+        auto logLock = std::lock_guard(logMutex);
+        auto lock = std::lock_guard(mutex);
+        throwIfLogFailed();
+
+        // Everything up to now belongs to the logs the new checkpoint replaces.
+        auto records = std::vector<char>();
+        records.swap(pendingRecords);
+        auto error = writeLog(records);
+        if (error) {
+            syncError = error;
+            flushed.notify_all();
+            throw std::system_error(error, "DurableRBTree: cannot write the log");
+        }
+        durableRecordCount = appendedRecordCount;
+        flushed.notify_all();
+
+        ::close(logDescriptor);
+        generation += 1;
+        openLog();
+
+        MappedTree<T, Compare>::writeFile(getCheckpointPath(generation).string(), tree.rootNode, Node::nilNode);
+        syncDirectory();
+
+        for (auto oldGeneration: getGenerations("log")) {
+            if (oldGeneration < generation) {
+                std::filesystem::remove(getLogPath(oldGeneration));
+            }
+        }
+        for (auto oldGeneration: getGenerations("checkpoint")) {
+            if (oldGeneration < generation) {
+                std::filesystem::remove(getCheckpointPath(oldGeneration));
+            }
+        }
+    }
+
+
+// MARK: Recovery
+private:
+    struct LogRecord {
+        Opcode opcode;
+        T value;
+    };
+
+    /// Reads the valid records of a log and cuts off whatever follows them.
+    std::vector<LogRecord> readLog(std::uint64_t logGeneration) const {
+        auto path = getLogPath(logGeneration);
+        auto bytes = std::vector<char>(std::filesystem::file_size(path));
+        {
+            auto descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (descriptor == -1) {
+                throw std::system_error(errno, std::generic_category(), "DurableRBTree: cannot open " + path.string());
+            }
+            std::size_t readCount = 0;
+            while (readCount < bytes.size()) {
+                auto result = ::read(descriptor, bytes.data() + readCount, bytes.size() - readCount);
+                if ((result == -1) && (errno == EINTR)) {
+                    continue;
+                }
+                if (result <= 0) {
+                    break;
+                }
+                readCount += static_cast<std::size_t>(result);
+            }
+            ::close(descriptor);
+            bytes.resize(readCount);
+        }
+
+        auto records = std::vector<LogRecord>();
+        records.reserve(bytes.size() / recordSize);
+        std::size_t offset = 0;
+        for (; offset + recordSize <= bytes.size(); offset += recordSize) {
+            auto record = bytes.data() + offset;
+            std::uint32_t checksum = 0;
+            std::memcpy(&checksum, record + sizeof(Opcode) + sizeof(T), sizeof(checksum));
+            auto opcode = static_cast<Opcode>(record[0]);
+            if ((checksum != getChecksum(record, sizeof(Opcode) + sizeof(T))) || ((opcode != Opcode::insertion) && (opcode != Opcode::deletion))) {
+                break;
+            }
+
+            records.push_back({opcode, T()});
+            std::memcpy(&records.back().value, record + sizeof(Opcode), sizeof(T));
+        }
+
+        if (offset != bytes.size()) {
+            std::filesystem::resize_file(path, offset);
+        }
+        return records;
+    }
+
+    /// Runs before the log is opened and the flusher starts, so it needs no locks.
+    Tree recoverTree() {
+        std::filesystem::create_directories(directory);
+
+        auto checkpointGenerations = getGenerations("checkpoint");
+        auto logGenerations = getGenerations("log");
+        generation = checkpointGenerations.empty() ? 0 : checkpointGenerations.back();
+
+        auto records = std::vector<LogRecord>();
+        for (auto logGeneration: logGenerations) {
+            if (logGeneration >= generation) {
+                auto logRecords = readLog(logGeneration);
+                records.insert(records.end(), logRecords.begin(), logRecords.end());
+            }
+        }
+        if (!logGenerations.empty()) {
+            generation = std::max(generation, logGenerations.back());
+        }
+
+        auto keys = std::vector<T>();
+        if (!checkpointGenerations.empty()) {
+            auto checkpoint = MappedTree<T, Compare>(getCheckpointPath(checkpointGenerations.back()).string());
+            keys.reserve(checkpoint.getSize() + records.size());
+            keys.insert(keys.end(), checkpoint.begin(), checkpoint.end());
+        }
+
+        bool isInsertionOnly = std::all_of(records.begin(), records.end(), [](const LogRecord& record) {
+            return record.opcode == Opcode::insertion;
+        });
+        if (isInsertionOnly) {
+            auto checkpointKeyCount = keys.size();
+            for (const auto& record: records) {
+                keys.push_back(record.value);
+            }
+            std::sort(keys.begin() + checkpointKeyCount, keys.end(), Compare());
+            std::inplace_merge(keys.begin(), keys.begin() + checkpointKeyCount, keys.end(), Compare());
+            return Tree(keys.begin(), keys.end());
+        }
+
+        auto recoveredTree = Tree(keys.begin(), keys.end());
+        for (const auto& record: records) {
+            if (record.opcode == Opcode::insertion) {
+                recoveredTree.insertValue(record.value);
+            } else {
+                recoveredTree.deleteValue(record.value);
+            }
+        }
+        return recoveredTree;
+    }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+
+/**
+ * Epoch-based memory reclamation for lock-free data structures.
+ *
+ * A thread pins itself (`EpochReclamation::Guard`) before reading shared nodes and unpins when it holds no more pointers to them.
+ * A node unlinked from a structure is passed to `retire` instead of being deleted.
+ * It is deleted once every thread that was pinned at that time has unpinned: then nobody can still hold a pointer to it.
+ *
+ * The global epoch only advances when every pinned thread has seen the current one.
+ * A node retired in epoch `e` is therefore unreachable for all pinned threads once the epoch reaches `e + 2`.
+ *
+ * One process-wide domain, so that each thread needs a single record no matter how many structures it touches.
+ * Records are never freed. A record left behind by a finished thread is reused by the next new thread.
+ * Nothing ever waits for other threads: nodes that are not safe to delete when a thread exits (or calls `drain`) become orphans, which later reclamations by any thread delete.
+ */
+class EpochReclamation {
+private:
+    struct RetiredNode {
+        void* node;
+        void (*deleter)(void*);
+        std::uint64_t epoch;
+    };
+
+    struct ThreadRecord {
+        /// `(epoch << 1) | 1` while pinned, `0` otherwise.
+        std::atomic<std::uint64_t> state = 0;
+        std::atomic<bool> isInUse = true;
+        ThreadRecord* next = nullptr;
+
+        /// Only touched by the owning thread.
+        int pinDepth = 0;
+        std::vector<RetiredNode> retiredNodes;
+        std::size_t retiredNodeCountAtLastReclamation = 0;
+    };
+
+    /// Owns the calling thread's record for the lifetime of the thread.
+    class RecordHolder {
+    public:
+        ThreadRecord* record;
+
+    public:
+        RecordHolder() {
+            record = acquireRecord();
+        }
+
+        ~RecordHolder() {
+            // `getRecord` must not be called any more: this holder is being destroyed.
+            drainRecord(record);
+            record->state.store(0, std::memory_order_release);
+            record->isInUse.store(false, std::memory_order_release);
+        }
+    };
+
+    /// Reclaiming scans every thread record, so it only runs after this many retirements.
+    static constexpr std::size_t reclamationInterval = 128;
+    /// Attempts `drain` makes before it gives up on the remaining nodes. Two epoch advances make every node safe if no other thread is pinned.
+    static constexpr int drainAttemptCount = 3;
+
+    static inline std::atomic<std::uint64_t> globalEpoch = 1;
+    static inline std::atomic<ThreadRecord*> records = nullptr;
+
+    /// Retired nodes whose threads gave up on them, in no particular epoch order.
+    static inline std::mutex orphanMutex;
+    static inline std::vector<RetiredNode> orphanedNodes;
+
+public:
+    /// Pins the calling thread for its lifetime. Guards may nest.
+    class Guard {
+    public:
+        Guard() {
+            EpochReclamation::pin();
+        }
+
+        ~Guard() {
+            EpochReclamation::unpin();
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+public:
+    /// Deletes `node` once no pinned thread can reach it. `node` must already be unlinked.
+    template <typename Node>
+    static void retire(Node* node) {
+        auto record = getRecord();
+        record->retiredNodes.push_back({node, [](void* pointer) { delete static_cast<Node*>(pointer); }, globalEpoch.load(std::memory_order_acquire)});
+
+        if (record->retiredNodes.size() >= record->retiredNodeCountAtLastReclamation + reclamationInterval) {
+            reclaim(record);
+        }
+    }
+
+    /**
+     * Deletes the nodes the calling thread retired, e.g. once the structure they came from is destroyed.
+     *
+     * Never blocks. If another thread stays pinned, the nodes it might still reach become orphans, deleted by a later reclamation of any thread.
+     */
+    static void drain() {
+        drainRecord(getRecord());
+    }
+
+    /// Number of nodes the calling thread retired that are not deleted yet.
+    static std::size_t getPendingNodeCount() {
+        return getRecord()->retiredNodes.size();
+    }
+
+private:
+    static ThreadRecord* getRecord() {
+        static thread_local RecordHolder holder;
+        return holder.record;
+    }
+
+    static ThreadRecord* acquireRecord() {
+        for (auto record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            bool isInUse = false;
+            if ((!record->isInUse.load(std::memory_order_relaxed)) && record->isInUse.compare_exchange_strong(isInUse, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+
+        auto record = new ThreadRecord();
+        auto head = records.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+        return record;
+    }
+
+    static void pin() {
+        auto record = getRecord();
+        if (record->pinDepth == 0) {
+            record->state.store((globalEpoch.load(std::memory_order_acquire) << 1) | 1, std::memory_order_relaxed);
+            // A store alone, even a sequentially consistent one, lets later acquire loads of the caller move above it.
+            // The fence keeps every shared read after the announcement, so `reclaim` sees the pin before the caller can load a node it might free.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        record->pinDepth += 1;
+    }
+
+    static void unpin() {
+        auto record = getRecord();
+        record->pinDepth -= 1;
+        if (record->pinDepth == 0) {
+            record->state.store(0, std::memory_order_release);
+        }
+    }
+
+    static void drainRecord(ThreadRecord* record) {
+        for (int i = 0; (i < drainAttemptCount) && !record->retiredNodes.empty(); i += 1) {
+            reclaim(record);
+        }
+
+        if (!record->retiredNodes.empty()) {
+            auto lock = std::lock_guard(orphanMutex);
+            orphanedNodes.insert(orphanedNodes.end(), record->retiredNodes.begin(), record->retiredNodes.end());
+        }
+        record->retiredNodes.clear();
+        record->retiredNodeCountAtLastReclamation = 0;
+    }
+
+    /// Advances the epoch if every pinned thread has seen it, then deletes the caller's nodes and the orphans that are 2 epochs old.
+    static void reclaim(ThreadRecord* ownRecord) {
+        // Pairs with the fence in `pin`: either this scan sees a thread's pin, or that thread's reads see the nodes already unlinked.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto epoch = globalEpoch.load(std::memory_order_seq_cst);
+
+        bool canAdvance = true;
+        for (auto record = records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            auto state = record->state.load(std::memory_order_seq_cst);
+            if ((state & 1) && ((state >> 1) != epoch)) {
+                canAdvance = false;
+                break;
+            }
+        }
+        if (canAdvance) {
+            globalEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+        }
+
+        // Nodes are retired in epoch order, so the reclaimable ones form a prefix.
+        auto safeEpoch = globalEpoch.load(std::memory_order_acquire);
+        auto& retiredNodes = ownRecord->retiredNodes;
+        std::size_t reclaimedCount = 0;
+        while ((reclaimedCount < retiredNodes.size()) && (retiredNodes[reclaimedCount].epoch + 2 <= safeEpoch)) {
+            retiredNodes[reclaimedCount].deleter(retiredNodes[reclaimedCount].node);
+            reclaimedCount += 1;
+        }
+        retiredNodes.erase(retiredNodes.begin(), retiredNodes.begin() + reclaimedCount);
+
+        ownRecord->retiredNodeCountAtLastReclamation = retiredNodes.size();
+
+        // Skipped rather than waited for if another thread is at it.
+        if (orphanMutex.try_lock()) {
+            auto lock = std::lock_guard(orphanMutex, std::adopt_lock);
+            std::size_t keptCount = 0;
+            for (const auto& orphanedNode: orphanedNodes) {
+                if (orphanedNode.epoch + 2 <= safeEpoch) {
+                    orphanedNode.deleter(orphanedNode.node);
+                } else {
+                    orphanedNodes[keptCount] = orphanedNode;
+                    keptCount += 1;
+                }
+            }
+            orphanedNodes.resize(keptCount);
+        }
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <vector>
+
+
+/// Allocates on cache line boundaries, so that a block of keys fetched together also sits in one cache line.
+template <typename T>
+class CacheAlignedAllocator {
+public:
+    using value_type = T;
+
+    static constexpr std::size_t cacheLineSize = 64;
+
+public:
+    CacheAlignedAllocator() = default;
+
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(cacheLineSize)));
+    }
+
+    void deallocate(T* pointer, std::size_t) {
+        ::operator delete(pointer, std::align_val_t(cacheLineSize));
+    }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const {
+        return false;
+    }
+};
+
+
+/**
+ * Immutable copy of a sorted sequence (e.g. an `RBTree` or a `SearchTreeNode` walk) laid out for fast searching.
+ *
+ * The keys are stored in Eytzinger (BFS) order: the root at index 1, and the children of index `k` at `2k` and `2k + 1`.
+ * The first few levels, which every search visits, stay hot in cache, and there are no pointers to chase.
+ *
+ * Searches are branchless: each step computes the next index from a comparison, so there is nothing to mispredict.
+ * The descendants of index `k` that are `d` levels down are the `2^d` consecutive indices from `k * 2^d`.
+ * So a search prefetches the cache line holding the level that many keys fill, e.g. 4 levels ahead for 4-byte keys.
+ *
+ * Refer to "Array Layouts for Comparison-Based Searching" by Paul-Virak Khuong and Pat Morin.
+ */
+template <typename T, typename Compare = std::less<T>>
+class EytzingerSnapshot {
+private:
+    /// 1-based: `keys[0]` is unused, so that the children of `k` are `2k` and `2k + 1`.
+    std::vector<T, CacheAlignedAllocator<T>> keys;
+    std::size_t size;
+
+    /// How many keys share a cache line, rounded down to a power of 2.
+    static constexpr std::size_t keysPerCacheLine = []() {
+        std::size_t count = 1;
+        while (count * 2 * sizeof(T) <= CacheAlignedAllocator<T>::cacheLineSize) {
+            count *= 2;
+        }
+        return count;
+    }();
+
+public:
+    EytzingerSnapshot(): size(0) {}
+
+    /// @param first Start of a range sorted by `Compare`. O(n).
+    template <typename Iterator>
+    EytzingerSnapshot(Iterator first, Iterator last) {
+        size = static_cast<std::size_t>(std::distance(first, last));
+        keys.resize(size + 1);
+        fill(first, 1);
+    }
+
+private:
+    /// An in-order walk over the implicit tree visits indices in sorted order.
+    template <typename Iterator>
+    void fill(Iterator& it, std::size_t index) {
+        if (index > size) {
+            return;
+        }
+
+        fill(it, 2 * index);
+        keys[index] = *it;
+        ++it;
+        fill(it, 2 * index + 1);
+    }
+
+    /// @return Eytzinger index of the first key not less than `value`, or 0.
+    template <typename Key>
+    std::size_t getLowerBoundIndex(const Key& value) const {
+        auto data = keys.data();
+
+        std::size_t index = 1;
+        while (index <= size) {
+            __builtin_prefetch(data + std::min(index * keysPerCacheLine, size));
+            // Go right if the key is too small. The comparison becomes part of the index rather than a branch.
+            index = 2 * index + static_cast<std::size_t>(Compare()(data[index], value));
+        }
+
+        // The path turned right after every key that was too small. Undo those turns and the last left turn, which was at the answer.
+        index >>= __builtin_ffsll(static_cast<long long>(~index));
+        return index;
+    }
+
+public:
+    std::size_t getSize() const {
+        return size;
+    }
+
+    /// @return The first key not less than `value`, or `nullptr`. O(log n).
+    template <typename Key>
+    const T* lowerBound(const Key& value) const {
+        auto index = getLowerBoundIndex(value);
+        return (index == 0) ? nullptr : &keys[index];
+    }
+
+    /// @return A key equivalent to `value`, or `nullptr`. O(log n).
+    template <typename Key>
+    const T* searchForValue(const Key& value) const {
+        auto key = lowerBound(value);
+        return ((key != nullptr) && !Compare()(value, *key)) ? key : nullptr;
+    }
+
+    /// Copies the keys back out in sorted order.
+    std::vector<T> inOrderWalk() const {
+        auto returnValue = std::vector<T>();
+        returnValue.reserve(size);
+        appendInOrder(1, returnValue);
+        return returnValue;
+    }
+
+private:
+    void appendInOrder(std::size_t index, std::vector<T>& values) const {
+        if (index > size) {
+            return;
+        }
+
+        appendInOrder(2 * index, values);
+        values.push_back(keys[index]);
+        appendInOrder(2 * index + 1, values);
+    }
+};
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * Read-only search tree in a file, queried straight from a memory mapping.
+ *
+ * Nodes refer to each other by distance rather than by address, so the file means the same wherever it is mapped.
+ * Opening a file maps it and checks the header: O(1), with no deserialization pass.
+ * Pages are read by the first lookups that touch them, so the first query is answered long before a multi-GB tree would have been rebuilt.
+ *
+ * The nodes are stored in preorder, which keeps the tree's shape (e.g. an `RBTree` or a `SearchTreeNode` tree) and makes every link a forward one:
+ * - The left child, if any, is the next node.
+ * - The right child is after the whole left subtree. Its distance is the one number a node stores.
+ *
+ * Keys must be trivially copyable, and a file is only read by programs with the same key type, byte order and alignment.
+ * To modify the contents, build an `RBTree` from `begin()` and `end()` (bulk construction, O(n)) and save it again.
+ */
+template <typename T, typename Compare = std::less<T>>
+class MappedTree {
+public:
+    class Node {
+    public:
+        T value;
+
+    private:
+        /// `(distance to the right child in nodes << 1) | hasLeftChild`. A distance of 0 means there is no right child.
+        std::uint64_t links;
+
+        friend class MappedTree;
+
+    public:
+        const Node* getLeftChild() const {
+            return (links & 1) ? (this + 1) : nullptr;
+        }
+
+        const Node* getRightChild() const {
+            return (links >> 1) ? (this + (links >> 1)) : nullptr;
+        }
+    };
+
+    using ValueCompare = Compare;
+
+    static_assert(std::is_trivially_copyable_v<T>, "Keys are written to the file byte for byte.");
+    static_assert(std::is_empty_v<Compare>, "The comparator must be stateless.");
+
+private:
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t nodeSize;
+        std::uint32_t valueSize;
+        std::uint64_t nodeCount;
+        /// Reads back differently on a machine with the other byte order.
+        std::uint64_t byteOrderMark;
+    };
+
+    static constexpr char fileMagic[8] = {'R', 'B', 'T', 'M', 'A', 'P', '0', '1'};
+    static constexpr std::uint64_t byteOrderMark = 0x0102030405060708;
+
+    /// Nodes start here, so that any key alignment up to a cache line holds in the mapping.
+    static constexpr std::size_t headerSize = 64;
+
+    static_assert(sizeof(FileHeader) <= headerSize);
+    static_assert(alignof(Node) <= headerSize);
+
+    /// Closes a file descriptor on every path out of a function.
+    class FileDescriptor {
+    public:
+        int descriptor;
+
+    public:
+        explicit FileDescriptor(int descriptor): descriptor(descriptor) {
+        }
+
+        ~FileDescriptor() {
+            if (descriptor != -1) {
+                ::close(descriptor);
+            }
+        }
+
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+    };
+
+private:
+    void* mapping;
+    std::size_t mappingSize;
+
+    const Node* nodes;
+    std::size_t size;
+
+public:
+    /// Maps `path`. Throws `std::system_error` if it cannot be read and `std::runtime_error` if it is not a tree of this type.
+    explicit MappedTree(const std::string& path) {
+        auto file = FileDescriptor(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (file.descriptor == -1) {
+            throw std::system_error(errno, std::generic_category(), "MappedTree: cannot open " + path);
+        }
+
+        struct stat fileStatus;
+        if (::fstat(file.descriptor, &fileStatus) == -1) {
+            throw std::system_error(errno, std::generic_category(), "MappedTree: cannot stat " + path);
+        }
+        mappingSize = static_cast<std::size_t>(fileStatus.st_size);
+        if (mappingSize < headerSize) {
+            throw std::runtime_error("MappedTree: " + path + " is too short.");
+        }
+
+        // The mapping outlives the descriptor.
+        mapping = ::mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, file.descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "MappedTree: cannot map " + path);
+        }
+
+        FileHeader header;
+        std::memcpy(&header, mapping, sizeof(FileHeader));
+        bool isValid = (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) == 0) && (header.byteOrderMark == byteOrderMark);
+        isValid = isValid && (header.nodeSize == sizeof(Node)) && (header.valueSize == sizeof(T));
+        isValid = isValid && (header.nodeCount <= (mappingSize - headerSize) / sizeof(Node)) && (mappingSize == headerSize + header.nodeCount * sizeof(Node));
+        if (!isValid) {
+            ::munmap(mapping, mappingSize);
+            throw std::runtime_error("MappedTree: " + path + " does not hold a tree of this key type.");
+        }
+
+        nodes = reinterpret_cast<const Node*>(static_cast<const char*>(mapping) + headerSize);
+        size = static_cast<std::size_t>(header.nodeCount);
+    }
+
+    MappedTree(const MappedTree&) = delete;
+    MappedTree& operator=(const MappedTree&) = delete;
+
+    MappedTree(MappedTree&& other) noexcept: mapping(other.mapping), mappingSize(other.mappingSize), nodes(other.nodes), size(other.size) {
+        other.mapping = nullptr;
+        other.mappingSize = 0;
+        other.nodes = nullptr;
+        other.size = 0;
+    }
+
+    ~MappedTree() {
+        if (mapping != nullptr) {
+            ::munmap(mapping, mappingSize);
+        }
+    }
+
+
+// MARK: Saving
+public:
+    /**
+     * Writes the tree below `rootNode` to `path` in this format, replacing any existing file only once the new one is complete.
+     *
+     * `SourceNode` needs `value`, `leftChild` and `rightChild` members, e.g. `RBNode` or `SearchTreeNode`.
+     * Iterative, so degenerate trees cannot overflow the stack. O(n).
+     *
+     * @param nilNode What stands for a missing child: `RBTree::Node::nilNode`, or `nullptr` for `SearchTreeNode`.
+     */
+    template <typename SourceNode>
+    static void writeFile(const std::string& path, const SourceNode* rootNode, const SourceNode* nilNode = nullptr) {
+        std::size_t nodeCount = 0;
+        auto pendingNodes = std::vector<const SourceNode*>();
+        if (rootNode != nilNode) {
+            pendingNodes.push_back(rootNode);
+        }
+        while (!pendingNodes.empty()) {
+            auto node = pendingNodes.back();
+            pendingNodes.pop_back();
+            nodeCount += 1;
+
+            if (node->leftChild != nilNode) {
+                pendingNodes.push_back(node->leftChild);
+            }
+            if (node->rightChild != nilNode) {
+                pendingNodes.push_back(node->rightChild);
+            }
+        }
+
+        auto temporaryPath = path + ".tmp";
+        auto fileSize = headerSize + nodeCount * sizeof(Node);
+        {
+            auto file = FileDescriptor(::open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+            if (file.descriptor == -1) {
+                throw std::system_error(errno, std::generic_category(), "MappedTree: cannot create " + temporaryPath);
+            }
+            if (::ftruncate(file.descriptor, static_cast<off_t>(fileSize)) == -1) {
+                throw std::system_error(errno, std::generic_category(), "MappedTree: cannot resize " + temporaryPath);
+            }
+
+            auto output = ::mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, file.descriptor, 0);
+            if (output == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(), "MappedTree: cannot map " + temporaryPath);
+            }
+
+            auto header = FileHeader();
+            std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+            header.nodeSize = sizeof(Node);
+            header.valueSize = sizeof(T);
+            header.nodeCount = nodeCount;
+            header.byteOrderMark = byteOrderMark;
+            std::memcpy(output, &header, sizeof(FileHeader));
+
+            auto outputNodes = reinterpret_cast<Node*>(static_cast<char*>(output) + headerSize);
+            fillInPreorder(outputNodes, rootNode, nilNode);
+
+            auto syncResult = ::msync(output, fileSize, MS_SYNC);
+            auto syncError = errno;
+            ::munmap(output, fileSize);
+            if (syncResult == -1) {
+                throw std::system_error(syncError, std::generic_category(), "MappedTree: cannot write " + temporaryPath);
+            }
+        }
+
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::system_error(errno, std::generic_category(), "MappedTree: cannot replace " + path);
+        }
+    }
+
+private:
+    template <typename SourceNode>
+    static void fillInPreorder(Node* outputNodes, const SourceNode* rootNode, const SourceNode* nilNode) {
+        struct PendingNode {
+            const SourceNode* node;
+            /// Output index of the parent if this is its right child, so that the parent learns the distance once it is known.
+            std::size_t leftParentIndex;
+        };
+        static constexpr std::size_t noParent = SIZE_MAX;
+
+        auto pendingNodes = std::vector<PendingNode>();
+        if (rootNode != nilNode) {
+            pendingNodes.push_back({rootNode, noParent});
+        }
+
+        std::size_t index = 0;
+        while (!pendingNodes.empty()) {
+            auto pendingNode = pendingNodes.back();
+            pendingNodes.pop_back();
+
+            auto node = pendingNode.node;
+            if (pendingNode.leftParentIndex != noParent) {
+                outputNodes[pendingNode.leftParentIndex].links |= static_cast<std::uint64_t>(index - pendingNode.leftParentIndex) << 1;
+            }
+
+            auto outputNode = new (&outputNodes[index]) Node();
+            outputNode->value = node->value;
+            outputNode->links = (node->leftChild != nilNode) ? 1 : 0;
+
+            // Popped in reverse: the left subtree is emitted right after this node, then the right one.
+            if (node->rightChild != nilNode) {
+                pendingNodes.push_back({node->rightChild, index});
+            }
+            if (node->leftChild != nilNode) {
+                pendingNodes.push_back({node->leftChild, noParent});
+            }
+
+            index += 1;
+        }
+    }
+
+
+// MARK: Comparison
+private:
+    template <typename A, typename B>
+    static bool isLess(const A& a, const B& b) {
+        return Compare()(a, b);
+    }
+
+
+// MARK: Iteration
+public:
+    /// In-order iterator. Keeps the path to the current node on a stack since nodes have no parents.
+    class Iterator {
+    private:
+        std::vector<const Node*> path;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        Iterator() = default;
+
+        explicit Iterator(const Node* rootNode) {
+            pushLeftPath(rootNode);
+        }
+
+        const T& operator*() const {
+            return path.back()->value;
+        }
+
+        const T* operator->() const {
+            return &(path.back()->value);
+        }
+
+        const Node* getNode() const {
+            return path.empty() ? nullptr : path.back();
+        }
+
+        Iterator& operator++() {
+            auto node = path.back();
+            path.pop_back();
+            pushLeftPath(node->getRightChild());
+
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return getNode() == other.getNode();
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return getNode() != other.getNode();
+        }
+
+    private:
+        void pushLeftPath(const Node* node) {
+            for (; node != nullptr; node = node->getLeftChild()) {
+                path.push_back(node);
+            }
+        }
+    };
+
+    const Node* getRootNode() const {
+        return (size == 0) ? nullptr : nodes;
+    }
+
+    std::size_t getSize() const {
+        return size;
+    }
+
+    Iterator begin() const {
+        return Iterator(getRootNode());
+    }
+
+    Iterator end() const {
+        return Iterator();
+    }
+
+    std::vector<T> inOrderWalk() const {
+        auto returnValue = std::vector<T>();
+        returnValue.reserve(size);
+        returnValue.insert(returnValue.end(), begin(), end());
+        return returnValue;
+    }
+
+
+// MARK: Search
+public:
+    /// @return A key equivalent to `value`, or `nullptr`. O(h).
+    template <typename Key>
+    const T* searchForValue(const Key& value) const {
+        auto currentNode = getRootNode();
+        while (currentNode != nullptr) {
+            if (isLess(value, currentNode->value)) {
+                currentNode = currentNode->getLeftChild();
+            } else if (isLess(currentNode->value, value)) {
+                currentNode = currentNode->getRightChild();
+            } else {
+                return &(currentNode->value);
+            }
+        }
+
+        return nullptr;
+    }
+
+    /// @return The first key not less than `value`, or `nullptr`. O(h).
+    template <typename Key>
+    const T* lowerBound(const Key& value) const {
+        const Node* candidate = nullptr;
+        auto currentNode = getRootNode();
+        while (currentNode != nullptr) {
+            if (!isLess(currentNode->value, value)) {
+                candidate = currentNode;
+                currentNode = currentNode->getLeftChild();
+            } else {
+                currentNode = currentNode->getRightChild();
+            }
+        }
+
+        return (candidate == nullptr) ? nullptr : &(candidate->value);
+    }
+
+    /// Calls `visitor(key)` for every key in `[lowValue, highValue)`, in order. O(h + k).
+    template <typename Key, typename Visitor>
+    void forEachInRange(const Key& lowValue, const Key& highValue, Visitor visitor) const {
+        // The path to the first key in range, as an iterator would keep it.
+        auto path = std::vector<const Node*>();
+        for (auto currentNode = getRootNode(); currentNode != nullptr;) {
+            if (!isLess(currentNode->value, lowValue)) {
+                path.push_back(currentNode);
+                currentNode = currentNode->getLeftChild();
+            } else {
+                currentNode = currentNode->getRightChild();
+            }
+        }
+
+        while (!path.empty()) {
+            auto node = path.back();
+            path.pop_back();
+            if (!isLess(node->value, highValue)) {
+                return;
+            }
+            visitor(node->value);
+
+            for (auto child = node->getRightChild(); child != nullptr; child = child->getLeftChild()) {
+                path.push_back(child);
+            }
+        }
+    }
+};
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+/// Memory held by the nodes of one tree, e.g. for bounding or monitoring it in long-running services.
+struct NodeMemoryUsage {
+    std::size_t liveNodeCount = 0;
+    /// `liveNodeCount` nodes' worth.
+    std::size_t usedByteCount = 0;
+    /// Everything the allocator holds for nodes, in use or not.
+    std::size_t reservedByteCount = 0;
+};
+
+
+/**
+ * Slab allocator for tree nodes.
+ *
+ * Nodes are carved out of slabs of `NodesPerSlab` nodes each.
+ * A deallocated node goes onto a free list and is handed out again before any new slab is requested.
+ * All slabs are released at once when the pool is destroyed, so nodes that are still alive at that point must be trivially destructible or destroyed by the owner beforehand.
+ *
+ * Slabs are reference counted so that trees can hand nodes to each other (see `adoptSlabs`, `shareSlabs` and `retainSlabs`).
+ * A reference covers a pool's slab list as a whole, not the slabs in it at the time: it also keeps alive every slab the pool allocates afterwards, until the pool is destroyed or adopted.
+ *
+ * Not thread-safe: each tree owns its own pool, and a pool must only be used by one thread at a time.
+ * Pools that share slabs may still be used from different threads.
+ * Each pool only ever reuses slots it deallocated itself and only ever reads and grows its own slab list, so all that other pools and node handles touch is reference counts.
+ */
+template <typename Node, std::size_t NodesPerSlab = 512>
+class NodePool {
+private:
+    union Slot {
+        Slot* nextFreeSlot;
+        alignas(Node) unsigned char storage[sizeof(Node)];
+    };
+
+    using Slabs = std::vector<std::shared_ptr<Slot[]>>;
+    using SlabLists = std::vector<std::shared_ptr<const Slabs>>;
+
+public:
+    /// Keeps a set of slab lists alive. See `getSlabsReference`.
+    using SlabsReference = std::shared_ptr<const SlabLists>;
+
+private:
+    /// Slabs this pool allocated or adopted. Shared with the node handles and pools that keep them alive, so it is replaced rather than cleared. Created with the first slab.
+    std::shared_ptr<Slabs> slabs;
+    /// Slab lists of other pools that nodes of this pool's tree live in. Each list appears once.
+    SlabLists retainedSlabs;
+    /// `slabs` and `retainedSlabs` together, built by `getSlabsReference` and dropped whenever either of them is replaced or grows.
+    mutable SlabsReference slabsReference;
+
+    /// Head of the singly linked list of deallocated slots.
+    Slot* freeList;
+
+    /// Never-used slots at the end of the slab this pool allocated last.
+    Slot* nextUnusedSlot;
+    std::size_t unusedSlotCount;
+
+    /// Nodes allocated or acquired and not yet deallocated or released.
+    std::size_t liveNodeCount;
+    /// False after a split, until the tree counts its nodes again.
+    bool isLiveNodeCountKnown;
+
+public:
+    /// Destroying the pool frees every node without visiting it.
+    static constexpr bool releasesNodesInBulk = true;
+
+public:
+    NodePool() {
+        this->freeList = nullptr;
+        this->nextUnusedSlot = nullptr;
+        this->unusedSlotCount = 0;
+        this->liveNodeCount = 0;
+        this->isLiveNodeCountKnown = true;
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    NodePool(NodePool&& other) noexcept {
+        this->slabs = std::move(other.slabs);
+        this->retainedSlabs = std::move(other.retainedSlabs);
+        this->slabsReference = std::move(other.slabsReference);
+        this->freeList = other.freeList;
+        this->nextUnusedSlot = other.nextUnusedSlot;
+        this->unusedSlotCount = other.unusedSlotCount;
+        this->liveNodeCount = other.liveNodeCount;
+        this->isLiveNodeCountKnown = other.isLiveNodeCountKnown;
+
+        other.retainedSlabs.clear();
+        other.slabsReference = nullptr;
+        other.freeList = nullptr;
+        other.nextUnusedSlot = nullptr;
+        other.unusedSlotCount = 0;
+        other.liveNodeCount = 0;
+        other.isLiveNodeCountKnown = true;
+    }
+
+    NodePool& operator=(NodePool&& other) noexcept {
+        if (this != &other) {
+            slabs = std::move(other.slabs);
+            retainedSlabs = std::move(other.retainedSlabs);
+            slabsReference = std::move(other.slabsReference);
+            freeList = other.freeList;
+            nextUnusedSlot = other.nextUnusedSlot;
+            unusedSlotCount = other.unusedSlotCount;
+            liveNodeCount = other.liveNodeCount;
+            isLiveNodeCountKnown = other.isLiveNodeCountKnown;
+
+            other.retainedSlabs.clear();
+            other.slabsReference = nullptr;
+            other.freeList = nullptr;
+            other.nextUnusedSlot = nullptr;
+            other.unusedSlotCount = 0;
+            other.liveNodeCount = 0;
+            other.isLiveNodeCountKnown = true;
+        }
+
+        return *this;
+    }
+
+public:
+    template <typename... Args>
+    Node* allocate(Args&&... args) {
+        Slot* slot = nullptr;
+
+        if (freeList != nullptr) {
+            // Reuse a deallocated node first. It is likely still in cache.
+            slot = freeList;
+            freeList = freeList->nextFreeSlot;
+        } else {
+            if (unusedSlotCount == 0) {
+                if (slabs == nullptr) {
+                    slabs = std::make_shared<Slabs>();
+                    slabsReference = nullptr;
+                }
+                // `new Slot[]` rather than `std::make_shared` to skip zero-filling the slab.
+                slabs->push_back(std::shared_ptr<Slot[]>(new Slot[NodesPerSlab]));
+                nextUnusedSlot = slabs->back().get();
+                unusedSlotCount = NodesPerSlab;
+            }
+
+            slot = nextUnusedSlot;
+            nextUnusedSlot += 1;
+            unusedSlotCount -= 1;
+        }
+
+        auto node = new (slot->storage) Node(std::forward<Args>(args)...);
+        liveNodeCount += 1;
+        return node;
+    }
+
+    void deallocate(Node* node) {
+        node->~Node();
+        liveNodeCount -= 1;
+
+        auto slot = reinterpret_cast<Slot*>(node);
+        slot->nextFreeSlot = freeList;
+        freeList = slot;
+    }
+
+    /**
+     * Destroys a node that left its tree (e.g. an abandoned node handle) without a pool at hand.
+     *
+     * Its slot is not reused. It is freed together with its slab.
+     */
+    static void destroyDetached(Node* node) {
+        node->~Node();
+    }
+
+    std::size_t getSlabCount() const {
+        return (slabs == nullptr) ? 0 : slabs->size();
+    }
+
+
+public:
+    /**
+     * Live nodes take `sizeof(Node)` bytes each. Reserved bytes are the slabs this pool allocated or adopted.
+     *
+     * Nodes this pool's tree received from other trees (through node handles or splits) live in slabs that the other trees' pools report,
+     * so reserved bytes can fall short of used bytes after such moves.
+     */
+    NodeMemoryUsage getMemoryUsage() const {
+        auto returnValue = NodeMemoryUsage();
+        returnValue.liveNodeCount = liveNodeCount;
+        returnValue.usedByteCount = liveNodeCount * sizeof(Node);
+        returnValue.reservedByteCount = getSlabCount() * NodesPerSlab * sizeof(Slot);
+        return returnValue;
+    }
+
+    bool hasLiveNodeCount() const {
+        return isLiveNodeCountKnown;
+    }
+
+    /// Called when the nodes change pools in a way this pool cannot count, e.g. when its tree is split.
+    void invalidateLiveNodeCount() {
+        isLiveNodeCountKnown = false;
+    }
+
+    void setLiveNodeCount(std::size_t count) {
+        liveNodeCount = count;
+        isLiveNodeCountKnown = true;
+    }
+
+    /// `node` leaves this pool's tree without being deallocated, e.g. in a node handle.
+    void releaseNode(Node*) {
+        liveNodeCount -= 1;
+    }
+
+    /// `node`, released by the pool behind `slabsReference`, joins this pool's tree.
+    void acquireNode(Node*, const SlabsReference& slabsReference) {
+        retainSlabs(slabsReference);
+        liveNodeCount += 1;
+    }
+
+public:
+    /**
+     * Takes over every slab of `other`, e.g. when its nodes are moved into this pool's tree.
+     *
+     * `other`'s free and never-used slots become reusable here. O(slabs + free slots of `other`).
+     */
+    void adoptSlabs(NodePool&& other) {
+        if (this == &other) {
+            return;
+        }
+
+        if (other.slabs != nullptr) {
+            if (slabs == nullptr) {
+                slabs = std::make_shared<Slabs>();
+                slabsReference = nullptr;
+            }
+            // Copied rather than moved: node handles and other pools may still hold `other`'s list.
+            slabs->insert(slabs->end(), other.slabs->begin(), other.slabs->end());
+        }
+        for (const auto& slabList: other.retainedSlabs) {
+            retainSlabList(slabList);
+        }
+        liveNodeCount += other.liveNodeCount;
+        isLiveNodeCountKnown = isLiveNodeCountKnown && other.isLiveNodeCountKnown;
+
+        while (other.freeList != nullptr) {
+            auto slot = other.freeList;
+            other.freeList = slot->nextFreeSlot;
+
+            slot->nextFreeSlot = freeList;
+            freeList = slot;
+        }
+        for (; other.unusedSlotCount > 0; other.unusedSlotCount -= 1) {
+            other.nextUnusedSlot->nextFreeSlot = freeList;
+            freeList = other.nextUnusedSlot;
+            other.nextUnusedSlot += 1;
+        }
+
+        other.slabs = nullptr;
+        other.retainedSlabs.clear();
+        other.slabsReference = nullptr;
+        other.nextUnusedSlot = nullptr;
+        other.liveNodeCount = 0;
+        other.isLiveNodeCountKnown = true;
+    }
+
+    /**
+     * @return A new pool that keeps all of this pool's slabs alive, e.g. for the second half of a split tree.
+     *
+     * The new pool starts with no free slots, so the two pools never hand out the same slot.
+     * It also keeps alive the slabs this pool allocates after the split (see the class doc).
+     */
+    NodePool shareSlabs() const {
+        auto returnValue = NodePool();
+        returnValue.retainSlabs(getSlabsReference());
+        return returnValue;
+    }
+
+    /**
+     * @return A reference that keeps alive every slab any node of this pool's tree may live in, e.g. while one of its nodes is in a node handle.
+     *
+     * That is this pool's own slab list and every list it retains, so a node that came from another tree stays covered when it moves on.
+     * O(1), except right after the set of lists changed, when it is O(number of lists).
+     */
+    SlabsReference getSlabsReference() const {
+        if (slabsReference == nullptr) {
+            auto slabLists = std::make_shared<SlabLists>();
+            slabLists->reserve(retainedSlabs.size() + 1);
+            if (slabs != nullptr) {
+                slabLists->push_back(slabs);
+            }
+            slabLists->insert(slabLists->end(), retainedSlabs.begin(), retainedSlabs.end());
+            slabsReference = std::move(slabLists);
+        }
+        return slabsReference;
+    }
+
+    /**
+     * Keeps the slabs behind `slabsReference` alive as long as this pool, e.g. once a node handle from another tree is inserted into this pool's tree.
+     *
+     * O(lists in `slabsReference` × lists this pool already retains). Both stay small since each list is retained once.
+     */
+    void retainSlabs(const SlabsReference& slabsReference) {
+        if (slabsReference == nullptr) {
+            return;
+        }
+        for (const auto& slabList: *slabsReference) {
+            retainSlabList(slabList);
+        }
+    }
+
+private:
+    void retainSlabList(const std::shared_ptr<const Slabs>& slabList) {
+        if (slabList == slabs) {
+            return;
+        }
+        for (const auto& retainedList: retainedSlabs) {
+            if (retainedList == slabList) {
+                return;
+            }
+        }
+        retainedSlabs.push_back(slabList);
+        slabsReference = nullptr;
+    }
+};
+
+
+/// Drop-in replacement for `NodePool` that calls the global `new` and `delete` for every node.
+template <typename Node>
+class HeapNodeAllocator {
+private:
+    std::size_t liveNodeCount = 0;
+    bool isLiveNodeCountKnown = true;
+
+public:
+    static constexpr bool releasesNodesInBulk = false;
+
+public:
+    HeapNodeAllocator() = default;
+
+    HeapNodeAllocator(HeapNodeAllocator&& other) noexcept: liveNodeCount(other.liveNodeCount), isLiveNodeCountKnown(other.isLiveNodeCountKnown) {
+        other.liveNodeCount = 0;
+        other.isLiveNodeCountKnown = true;
+    }
+
+    HeapNodeAllocator& operator=(HeapNodeAllocator&& other) noexcept {
+        if (this != &other) {
+            liveNodeCount = other.liveNodeCount;
+            isLiveNodeCountKnown = other.isLiveNodeCountKnown;
+            other.liveNodeCount = 0;
+            other.isLiveNodeCountKnown = true;
+        }
+        return *this;
+    }
+
+public:
+    template <typename... Args>
+    Node* allocate(Args&&... args) {
+        auto node = new Node(std::forward<Args>(args)...);
+        liveNodeCount += 1;
+        return node;
+    }
+
+    void deallocate(Node* node) {
+        delete node;
+        liveNodeCount -= 1;
+    }
+
+    static void destroyDetached(Node* node) {
+        delete node;
+    }
+
+    /// Every node owns its own memory, so there is nothing to hand over or keep alive.
+    using SlabsReference = std::nullptr_t;
+
+    void adoptSlabs(HeapNodeAllocator&& other) {
+        liveNodeCount += other.liveNodeCount;
+        isLiveNodeCountKnown = isLiveNodeCountKnown && other.isLiveNodeCountKnown;
+        other.liveNodeCount = 0;
+        other.isLiveNodeCountKnown = true;
+    }
+
+    HeapNodeAllocator shareSlabs() const {
+        return HeapNodeAllocator();
+    }
+
+    SlabsReference getSlabsReference() const {
+        return nullptr;
+    }
+
+    void retainSlabs(SlabsReference) {
+    }
+
+public:
+    /// Reserved bytes leave out the heap's own overhead per node, so they equal used bytes.
+    NodeMemoryUsage getMemoryUsage() const {
+        auto returnValue = NodeMemoryUsage();
+        returnValue.liveNodeCount = liveNodeCount;
+        returnValue.usedByteCount = liveNodeCount * sizeof(Node);
+        returnValue.reservedByteCount = returnValue.usedByteCount;
+        return returnValue;
+    }
+
+    bool hasLiveNodeCount() const {
+        return isLiveNodeCountKnown;
+    }
+
+    void invalidateLiveNodeCount() {
+        isLiveNodeCountKnown = false;
+    }
+
+    void setLiveNodeCount(std::size_t count) {
+        liveNodeCount = count;
+        isLiveNodeCountKnown = true;
+    }
+
+    void releaseNode(Node*) {
+        liveNodeCount -= 1;
+    }
+
+    void acquireNode(Node*, SlabsReference) {
+        liveNodeCount += 1;
+    }
+};
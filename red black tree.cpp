@@ -1,620 +1,2613 @@
 #include <iostream>
+#include <cmath>
 #include <vector>
-#include <stack>
-#include <memory>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <thread>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <set>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <filesystem>
+#include <fstream>
+
+#include "red black tree.hpp"
+#include "eytzinger snapshot.hpp"
+#include "mapped tree.hpp"
+#include "durable tree.hpp"
+
+
+#pragma mark - Helpers
+void printVector(std::vector<int> v) {
+    for (const int& num: v) {
+        std::cout << num << " ";
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Checks the binary search tree order and the red black properties of a subtree.
+ *
+ * @return The black height of the subtree, or -1 if any property is violated.
+ */
+template <typename Node, typename Compare>
+int getBlackHeightIfValid(Node* node, Compare compare) {
+    if (node == Node::nilNode) {
+        return 0;
+    }
+
+    if (node->isRed && (node->leftChild->isRed || node->rightChild->isRed)) {
+        return -1;
+    }
+    if ((node->leftChild != Node::nilNode) && (compare(node->value, node->leftChild->value) || (node->leftChild->parent != node))) {
+        return -1;
+    }
+    if ((node->rightChild != Node::nilNode) && (compare(node->rightChild->value, node->value) || (node->rightChild->parent != node))) {
+        return -1;
+    }
+
+    auto leftBlackHeight = getBlackHeightIfValid(node->leftChild, compare);
+    auto rightBlackHeight = getBlackHeightIfValid(node->rightChild, compare);
+    if ((leftBlackHeight == -1) || (leftBlackHeight != rightBlackHeight)) {
+        return -1;
+    }
+
+    return leftBlackHeight + (node->isRed ? 0 : 1);
+}
+
+template <typename Tree>
+bool isValidRBTree(const Tree& tree) {
+    if (tree.rootNode->isRed) {
+        return false;
+    }
+    return getBlackHeightIfValid(tree.rootNode, typename Tree::ValueCompare()) != -1;
+}
+
+/// Same checks as `getBlackHeightIfValid`, for `PersistentRBTree` nodes whose leaves are `nullptr`.
+template <typename Node, typename Compare>
+int getPersistentBlackHeightIfValid(const Node* node, Compare compare) {
+    if (node == nullptr) {
+        return 0;
+    }
+
+    auto leftChild = node->leftChild.get();
+    auto rightChild = node->rightChild.get();
+    if (node->isRed && (((leftChild != nullptr) && leftChild->isRed) || ((rightChild != nullptr) && rightChild->isRed))) {
+        return -1;
+    }
+    if (((leftChild != nullptr) && compare(node->value, leftChild->value)) || ((rightChild != nullptr) && compare(rightChild->value, node->value))) {
+        return -1;
+    }
+
+    auto leftBlackHeight = getPersistentBlackHeightIfValid(leftChild, compare);
+    auto rightBlackHeight = getPersistentBlackHeightIfValid(rightChild, compare);
+    if ((leftBlackHeight == -1) || (leftBlackHeight != rightBlackHeight)) {
+        return -1;
+    }
+
+    return leftBlackHeight + (node->isRed ? 0 : 1);
+}
+
+template <typename Tree>
+bool isValidSnapshot(const typename Tree::Snapshot& snapshot) {
+    auto rootNode = snapshot.getRootNode();
+    if ((rootNode != nullptr) && rootNode->isRed) {
+        return false;
+    }
+    return getPersistentBlackHeightIfValid(rootNode, typename Tree::ValueCompare()) != -1;
+}
+
+
+/// Same checks as `getBlackHeightIfValid`, for `CompactRBTree` nodes that refer to each other by index.
+template <typename Tree>
+int getCompactBlackHeightIfValid(const Tree& tree, typename Tree::Index index) {
+    if (index == Tree::nilIndex) {
+        return 0;
+    }
+
+    const auto& node = tree.getNode(index);
+    const auto& leftChild = tree.getNode(node.leftChild);
+    const auto& rightChild = tree.getNode(node.rightChild);
+    auto compare = typename Tree::ValueCompare();
+    if (node.isRed() && (leftChild.isRed() || rightChild.isRed())) {
+        return -1;
+    }
+    if ((node.leftChild != Tree::nilIndex) && (compare(node.value, leftChild.value) || (leftChild.getParent() != index))) {
+        return -1;
+    }
+    if ((node.rightChild != Tree::nilIndex) && (compare(rightChild.value, node.value) || (rightChild.getParent() != index))) {
+        return -1;
+    }
+
+    auto leftBlackHeight = getCompactBlackHeightIfValid(tree, node.leftChild);
+    auto rightBlackHeight = getCompactBlackHeightIfValid(tree, node.rightChild);
+    if ((leftBlackHeight == -1) || (leftBlackHeight != rightBlackHeight)) {
+        return -1;
+    }
+
+    return leftBlackHeight + (node.isRed() ? 0 : 1);
+}
+
+template <typename T, typename Compare>
+bool isValidRBTree(const CompactRBTree<T, Compare>& tree) {
+    const auto& sentinel = tree.getNode(CompactRBTree<T, Compare>::nilIndex);
+    if (tree.getNode(tree.getRootIndex()).isRed() || sentinel.isRed() || (sentinel.leftChild != 0) || (sentinel.rightChild != 0)) {
+        return false;
+    }
+    return getCompactBlackHeightIfValid(tree, tree.getRootIndex()) != -1;
+}
+
+
+/// Following `nextNode` from the minimum visits the same nodes as an in-order walk, and `previousNode` mirrors it.
+template <typename Tree>
+bool isThreadingConsistent(Tree& tree) {
+    using Node = typename Tree::Node;
+
+    auto nodes = std::vector<Node*>();
+    auto pendingNodes = std::vector<Node*>();
+    for (auto node = tree.rootNode; (node != Node::nilNode) || !pendingNodes.empty(); node = node->rightChild) {
+        for (; node != Node::nilNode; node = node->leftChild) {
+            pendingNodes.push_back(node);
+        }
+        node = pendingNodes.back();
+        pendingNodes.pop_back();
+        nodes.push_back(node);
+    }
+
+    auto previousNode = Node::nilNode;
+    auto node = tree.getMinNode();
+    for (auto expectedNode: nodes) {
+        if ((node != expectedNode) || (node->previousNode != previousNode)) {
+            return false;
+        }
+        previousNode = node;
+        node = node->nextNode;
+    }
+
+    return (node == Node::nilNode) && (tree.getMaxNode() == previousNode);
+}
+
+#pragma mark - Tests
+#pragma mark Rotation
+void testRotation() {
+}
+
+#pragma mark Insertion
+void testInsertion1() {
+    // Fixed, so that a failing run can be repeated.
+    auto randomSeed = 1;
+    auto generator = std::default_random_engine(randomSeed);
+
+    std::vector<int> nums = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    std::shuffle(nums.begin(), nums.end(), generator);
+
+    // auto tree = std::unique_ptr<RBTree>(new RBTree<int>());
+    auto tree = new RBTree<int>();
+    for (const int& num: nums) {
+        auto newNode = tree->insertValue(num);
+        std::cout << "New value: " << newNode->value << std::endl;
+
+        auto result = tree->inOrderWalk();
+        printVector(result);
+    }
+
+    std::cout << "Min value: " << tree->getMinNode()->value << std::endl;
+    std::cout << "Max value: " << tree->getMaxNode()->value << std::endl;
+
+    auto node6 = tree->searchForValue(6);
+    auto predecessor = tree->getPredecessor(node6);
+    auto successor = tree->getSuccessor(node6);
+    std::cout << "Found value 6: " << node6->value << std::endl;
+    std::cout << "Predecessor: " << predecessor->value << std::endl;
+    std::cout << "Successor: " << successor->value << std::endl;
+
+    delete tree;
+}
+
+void testInsertion2() {
+    auto distribution = std::uniform_int_distribution(1, 21);
+
+    auto randomSeed = 2;
+    auto generator = std::default_random_engine(randomSeed);
+
+    auto dice = std::bind(distribution, generator);
+
+    auto tree = new RBTree<int>();
+
+    for (int i = 0; i < 20; i += 1) {
+        const auto num = dice();
+        auto newNode = tree->insertValue(num);
+
+        std::cout << "New value: (" << num << ", " << newNode->value << ")" << std::endl;
+
+        auto result = tree->inOrderWalk();
+        printVector(result);
+    }
+
+    delete tree;
+}
+
+#pragma mark Insertion and Deletion
+void testInsertionAndDeletion() {
+    auto tree = new RBTree<int>();
+
+    auto nums = std::vector<int>(1000);
+    std::iota(nums.begin(), nums.end(), 1);    // 1 ~ 1000
+
+    auto randomSeed = 3;
+    auto generator = std::default_random_engine(randomSeed);
+
+    for (int i = 0; i < 100; i += 1) {
+        auto numsCopy = nums;
+
+        std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
+        for (const auto& num: numsCopy) {
+            tree->insertValue(num);
+            // printVector(tree->inOrderWalk());
+        }
+        auto result1 = tree->inOrderWalk();
+        if (result1 == nums) {
+            std::cout << "Insertion success! ";
+        } else {
+            std::cout << "Insertion failed. ";
+        }
+
+        std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
+        for (const auto& num: numsCopy) {
+            tree->deleteValue(num);
+            // printVector(tree->inOrderWalk());
+        }
+        auto result2 = tree->inOrderWalk();
+        if (result2.size() == 0) {
+            std::cout << "Deletion success!" << std::endl;
+        } else {
+            std::cout << "Deletion failed." << std::endl;
+        }
+    }
+
+    delete tree;
+}
+
+#pragma mark Generic Keys
+void testGenericKeys() {
+    bool isSuccessful = true;
+
+    // 64-bit keys with payloads.
+    auto accountTree = RBTree<std::uint64_t, std::string>();
+    for (std::uint64_t key = 1; key <= 100; key += 1) {
+        accountTree.insertValue(key << 40, "account " + std::to_string(key));
+    }
+    auto account = accountTree.searchForValue(std::uint64_t(42) << 40);
+    isSuccessful = isSuccessful && (account != RBTree<std::uint64_t, std::string>::Node::nilNode) && (account->payload == "account 42");
+    isSuccessful = isSuccessful && isValidRBTree(accountTree);
+
+    // `std::string` keys probed with `std::string_view` through the transparent `std::less<>`.
+    auto nameTree = RBTree<std::string, int, std::less<>>();
+    for (const auto& name: {"delta", "alpha", "echo", "charlie", "bravo"}) {
+        nameTree.insertValue(name, static_cast<int>(std::string(name).size()));
+    }
+    const auto buffer = std::string("xxcharliexx");
+    auto charlie = nameTree.searchForValue(std::string_view(buffer).substr(2, 7));
+    isSuccessful = isSuccessful && (charlie->value == "charlie") && (charlie->payload == 7);
+    isSuccessful = isSuccessful && nameTree.deleteValue(std::string_view("alpha"));
+    isSuccessful = isSuccessful && (nameTree.inOrderWalk() == std::vector<std::string>({"bravo", "charlie", "delta", "echo"}));
+
+    // Custom ordering.
+    auto descendingTree = RBTree<int, RBNoPayload, std::greater<int>>();
+    for (int num = 1; num <= 9; num += 1) {
+        descendingTree.insertValue(num);
+    }
+    isSuccessful = isSuccessful && (descendingTree.inOrderWalk() == std::vector<int>({9, 8, 7, 6, 5, 4, 3, 2, 1}));
+    isSuccessful = isSuccessful && isValidRBTree(descendingTree);
+
+    if (isSuccessful) {
+        std::cout << "Generic keys success!" << std::endl;
+    } else {
+        std::cout << "Generic keys failed." << std::endl;
+    }
+}
+
+#pragma mark Bulk Construction
+void testBulkConstruction() {
+    bool isSuccessful = true;
+
+    for (int count = 0; count <= 300; count += 1) {
+        auto nums = std::vector<int>(count);
+        std::iota(nums.begin(), nums.end(), 1);
+
+        auto tree = RBTree<int>(nums.begin(), nums.end());
+        isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.inOrderWalk() == nums);
+
+        // The built tree must keep working as a normal tree.
+        tree.insertValue(count / 2);
+        tree.deleteValue(1);
+        isSuccessful = isSuccessful && isValidRBTree(tree);
+    }
+
+    // Duplicates and payloads.
+    auto pairs = std::vector<std::pair<int, std::string>>();
+    for (int i = 0; i < 1000; i += 1) {
+        pairs.emplace_back(i / 10, std::to_string(i));
+    }
+    auto pairTree = RBTree<int, std::string>(pairs.begin(), pairs.end());
+    isSuccessful = isSuccessful && isValidRBTree(pairTree) && (pairTree.searchForValue(42)->payload.substr(0, 2) == "42");
+
+    // Large enough to build subtrees on other threads.
+    auto manyNums = std::vector<int>(300000);
+    std::iota(manyNums.begin(), manyNums.end(), 0);
+    auto largeTree = RBTree<int>(manyNums.begin(), manyNums.end());
+    isSuccessful = isSuccessful && isValidRBTree(largeTree) && (largeTree.inOrderWalk() == manyNums);
+
+    if (isSuccessful) {
+        std::cout << "Bulk construction success!" << std::endl;
+    } else {
+        std::cout << "Bulk construction failed." << std::endl;
+    }
+}
+
+#pragma mark Order Statistics
+/// @return Size of the subtree, or -1 if any `size` field disagrees with its subtree.
+template <typename Node>
+long long getSizeIfConsistent(Node* node) {
+    if (node == Node::nilNode) {
+        return 0;
+    }
+
+    auto leftSize = getSizeIfConsistent(node->leftChild);
+    auto rightSize = getSizeIfConsistent(node->rightChild);
+    if ((leftSize == -1) || (rightSize == -1) || (static_cast<long long>(node->size) != leftSize + rightSize + 1)) {
+        return -1;
+    }
+
+    return leftSize + rightSize + 1;
+}
+
+void testOrderStatistics() {
+    auto generator = std::default_random_engine(7);
+    auto distribution = std::uniform_int_distribution(1, 200);
+
+    auto tree = OrderStatisticTree<int>();
+    auto reference = std::vector<int>();    // Kept sorted.
+    bool isSuccessful = true;
+
+    for (int i = 0; i < 5000; i += 1) {
+        auto num = distribution(generator);
+        if ((i % 3 == 2) && tree.deleteValue(num)) {
+            reference.erase(std::lower_bound(reference.begin(), reference.end(), num));
+        } else if (i % 3 != 2) {
+            tree.insertValue(num);
+            reference.insert(std::upper_bound(reference.begin(), reference.end(), num), num);
+        }
+
+        if (i % 100 == 0) {
+            isSuccessful = isSuccessful && isValidRBTree(tree) && (getSizeIfConsistent(tree.rootNode) == static_cast<long long>(reference.size()));
+            for (std::size_t k = 0; k < reference.size(); k += 1) {
+                auto node = tree.select(k);
+                isSuccessful = isSuccessful && (node->value == reference[k]) && (reference[OrderStatisticTree<int>::getRankOfNode(node)] == node->value);
+            }
+            for (int value = 0; value <= 201; value += 1) {
+                auto expectedRank = std::lower_bound(reference.begin(), reference.end(), value) - reference.begin();
+                isSuccessful = isSuccessful && (tree.rank(value) == static_cast<std::size_t>(expectedRank));
+            }
+        }
+    }
+
+    auto expectedCount = std::lower_bound(reference.begin(), reference.end(), 150) - std::lower_bound(reference.begin(), reference.end(), 50);
+    isSuccessful = isSuccessful && (tree.countInRange(50, 150) == static_cast<std::size_t>(expectedCount));
+    isSuccessful = isSuccessful && (tree.select(reference.size()) == OrderStatisticTree<int>::Node::nilNode);
+    isSuccessful = isSuccessful && (tree.getPercentile(1.0)->value == reference.back());
 
+    // Bulk construction fills in the sizes as well.
+    auto bulkTree = OrderStatisticTree<int>(reference.begin(), reference.end());
+    isSuccessful = isSuccessful && (getSizeIfConsistent(bulkTree.rootNode) == static_cast<long long>(reference.size())) && (bulkTree.getPercentile(0.5)->value == reference[static_cast<std::size_t>(0.5 * (reference.size() - 1) + 0.5)]);
+
+    if (isSuccessful) {
+        std::cout << "Order statistics success!" << std::endl;
+    } else {
+        std::cout << "Order statistics failed." << std::endl;
+    }
+}
+
+#pragma mark Interval Tree
+/// @return Whether every `maxHighEndpoint` field matches its subtree.
+template <typename Node>
+bool isMaxHighEndpointConsistent(Node* node) {
+    if (node == Node::nilNode) {
+        return true;
+    }
+
+    auto expectedValue = std::max({node->payload.highEndpoint, node->leftChild->maxHighEndpoint, node->rightChild->maxHighEndpoint});
+    return (node->maxHighEndpoint == expectedValue) && isMaxHighEndpointConsistent(node->leftChild) && isMaxHighEndpointConsistent(node->rightChild);
+}
+
+void testIntervalTree() {
+    auto generator = std::default_random_engine(11);
+    auto startDistribution = std::uniform_int_distribution(0, 1000);
+    auto lengthDistribution = std::uniform_int_distribution(0, 30);
+
+    auto tree = IntervalTree<int, int>();
+    auto intervals = std::vector<std::pair<int, int>>();    // Index is the payload.
+    auto nodes = std::vector<IntervalTree<int, int>::Node*>();
+    bool isSuccessful = true;
+
+    for (int i = 0; i < 2000; i += 1) {
+        auto low = startDistribution(generator);
+        auto high = low + lengthDistribution(generator);
+        intervals.emplace_back(low, high);
+        nodes.push_back(tree.insertInterval(low, high, i));
+    }
+
+    // Delete every third interval so that fix-ups run with the augmentation in place.
+    for (std::size_t i = 0; i < nodes.size(); i += 3) {
+        tree.deleteNode(nodes[i]);
+        intervals[i] = {-1, -1};
+    }
+    isSuccessful = isSuccessful && isValidRBTree(tree) && isMaxHighEndpointConsistent(tree.rootNode);
+
+    for (int query = 0; query < 500; query += 1) {
+        auto low = startDistribution(generator);
+        auto high = low + lengthDistribution(generator);
+
+        auto expectedPayloads = std::vector<int>();
+        for (std::size_t i = 0; i < intervals.size(); i += 1) {
+            if ((intervals[i].first != -1) && (intervals[i].first <= high) && (low <= intervals[i].second)) {
+                expectedPayloads.push_back(static_cast<int>(i));
+            }
+        }
+
+        auto payloads = std::vector<int>();
+        tree.forEachOverlap(low, high, [&](IntervalTree<int, int>::Node* node) {
+            payloads.push_back(node->payload.data);
+        });
+        std::sort(payloads.begin(), payloads.end());
+
+        auto anyNode = tree.searchForOverlap(low, high);
+        isSuccessful = isSuccessful && (payloads == expectedPayloads);
+        isSuccessful = isSuccessful && ((anyNode == IntervalTree<int, int>::Node::nilNode) == expectedPayloads.empty());
+        isSuccessful = isSuccessful && ((anyNode == IntervalTree<int, int>::Node::nilNode) || IntervalTree<int, int>::isOverlapping(anyNode, low, high));
+    }
+
+    if (isSuccessful) {
+        std::cout << "Interval tree success!" << std::endl;
+    } else {
+        std::cout << "Interval tree failed." << std::endl;
+    }
+}
+
+#pragma mark Iteration
+void testIterators() {
+    auto nums = std::vector<int>(500);
+    std::iota(nums.begin(), nums.end(), 1);
+    std::shuffle(nums.begin(), nums.end(), std::default_random_engine(3));
+
+    auto tree = RBTree<int>();
+    for (const auto& num: nums) {
+        tree.insertValue(num);
+    }
+    std::sort(nums.begin(), nums.end());
+
+    bool isSuccessful = true;
+
+    auto forwardValues = std::vector<int>();
+    for (const auto& value: tree) {
+        forwardValues.push_back(value);
+    }
+    isSuccessful = isSuccessful && (forwardValues == nums);
+
+    auto reverseValues = std::vector<int>(tree.rbegin(), tree.rend());
+    isSuccessful = isSuccessful && std::equal(reverseValues.begin(), reverseValues.end(), nums.rbegin());
+
+    // Stepping back from `end()` and forth again.
+    auto it = tree.end();
+    --it;
+    isSuccessful = isSuccessful && (*it == 500);
+    --it;
+    ++it;
+    ++it;
+    isSuccessful = isSuccessful && (it == tree.end());
+
+    // Early termination.
+    int sum = 0;
+    for (auto it = tree.getIterator(tree.searchForValue(100)); (it != tree.end()) && (*it < 110); ++it) {
+        sum += *it;
+    }
+    isSuccessful = isSuccessful && (sum == 1045);
+
+    auto emptyTree = RBTree<int>();
+    isSuccessful = isSuccessful && (emptyTree.begin() == emptyTree.end()) && (emptyTree.rbegin() == emptyTree.rend());
+
+    if (isSuccessful) {
+        std::cout << "Iterators success!" << std::endl;
+    } else {
+        std::cout << "Iterators failed." << std::endl;
+    }
+}
+
+#pragma mark Bounds
+void testBounds() {
+    auto generator = std::default_random_engine(5);
+    auto distribution = std::uniform_int_distribution(0, 100);
+
+    auto tree = RBTree<int>();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < 2000; i += 1) {
+        // Many duplicates, spread over both sides of their subtrees by rotations.
+        auto num = distribution(generator) * 2;
+        tree.insertValue(num);
+        reference.insert(num);
+    }
+
+    bool isSuccessful = true;
+    for (int value = -1; value <= 202; value += 1) {
+        auto expectedLower = std::distance(reference.begin(), reference.lower_bound(value));
+        auto expectedUpper = std::distance(reference.begin(), reference.upper_bound(value));
+        auto [lower, upper] = tree.equalRange(value);
+
+        isSuccessful = isSuccessful && (std::distance(tree.begin(), lower) == expectedLower);
+        isSuccessful = isSuccessful && (std::distance(tree.begin(), upper) == expectedUpper);
+        isSuccessful = isSuccessful && (std::distance(lower, upper) == static_cast<long>(reference.count(value)));
+
+        auto rangeValues = std::vector<int>();
+        tree.forEachInRange(value, value + 7, [&](RBTree<int>::Node* node) {
+            rangeValues.push_back(node->value);
+        });
+        isSuccessful = isSuccessful && std::equal(rangeValues.begin(), rangeValues.end(), reference.lower_bound(value), reference.lower_bound(value + 7));
+        isSuccessful = isSuccessful && (static_cast<long>(rangeValues.size()) == std::distance(reference.lower_bound(value), reference.lower_bound(value + 7)));
+    }
+
+    if (isSuccessful) {
+        std::cout << "Bounds success!" << std::endl;
+    } else {
+        std::cout << "Bounds failed." << std::endl;
+    }
+}
+
+#pragma mark Hinted Insertion
+void testHintedInsertion() {
+    using ThreadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>;
+
+    auto generator = std::default_random_engine(22);
+    auto distribution = std::uniform_int_distribution(0, 3000);
+    bool isSuccessful = true;
+
+    // Arbitrary hints, far from where the keys land, must still give valid trees.
+    auto checkRandomHints = [&](auto& tree) {
+        using Node = typename std::remove_reference_t<decltype(tree)>::Node;
+
+        auto reference = std::multiset<int>();
+        auto nodes = std::vector<Node*>({Node::nilNode});
+        for (int i = 0; i < 5000; i += 1) {
+            auto num = distribution(generator);
+            auto hint = nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(generator)];
+            nodes.push_back(tree.insertValue(hint, num));
+            reference.insert(num);
+        }
+        isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+
+        for (int i = 0; i < 5000; i += 1) {
+            auto num = distribution(generator);
+            auto hint = nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(generator)];
+            auto result = tree.searchForValue(hint, num);
+            isSuccessful = isSuccessful && ((result != Node::nilNode) == (reference.count(num) > 0)) && ((result == Node::nilNode) || (result->value == num));
+        }
+    };
+    auto tree = RBTree<int>();
+    checkRandomHints(tree);
+    auto threadedTree = ThreadedTree();
+    checkRandomHints(threadedTree);
+    isSuccessful = isSuccessful && isThreadingConsistent(threadedTree);
+
+    // The previous insertion as the hint, in both directions and with duplicates.
+    for (int step: {1, -1, 0}) {
+        TreeStats::reset();
+
+        const int count = 10000;
+        auto sortedTree = RBTree<int>();
+        auto hint = RBTree<int>::Node::nilNode;
+        for (int i = 0; i < count; i += 1) {
+            hint = sortedTree.insertValue(hint, i * step);
+        }
+        isSuccessful = isSuccessful && isValidRBTree(sortedTree) && (sortedTree.getHeight() <= 2 * std::log2(count + 1));
+
+#ifdef TREE_STATS
+        // The hint and at most the bounding ancestor, then the empty child slot below the hint: a few comparisons each, not log n.
+        isSuccessful = isSuccessful && (TreeStats::getSnapshot().operationComparisonCounts[TreeStats::insertion] <= 4 * count);
+#endif
+    }
+
+    if (isSuccessful) {
+        std::cout << "Hinted insertion success!" << std::endl;
+    } else {
+        std::cout << "Hinted insertion failed." << std::endl;
+    }
+}
+
+#pragma mark Batched Search
+void testBatchedSearch() {
+    auto generator = std::default_random_engine(21);
+    auto distribution = std::uniform_int_distribution(0, 3000);
+    bool isSuccessful = true;
+
+    auto tree = RBTree<int>();
+    for (int i = 0; i < 2000; i += 1) {
+        tree.insertValue(distribution(generator));
+    }
+
+    // Fewer keys than searches in flight, exactly as many, and many more. Half of the keys are missing.
+    for (std::size_t count: {0, 1, 15, 16, 17, 1000}) {
+        auto values = std::vector<int>(count);
+        for (auto& value: values) {
+            value = distribution(generator);
+        }
+        auto results = std::vector<RBTree<int>::Node*>(count);
+        tree.searchForValues(values.data(), count, results.data());
+        for (std::size_t i = 0; i < count; i += 1) {
+            isSuccessful = isSuccessful && (results[i] == tree.searchForValue(values[i]));
+        }
+    }
+
+    auto emptyTree = RBTree<int>();
+    int value = 1;
+    RBTree<int>::Node* result = nullptr;
+    emptyTree.searchForValues(&value, 1, &result);
+    isSuccessful = isSuccessful && (result == RBTree<int>::Node::nilNode);
+
+    // Keys that are not built-in types take the general path.
+    auto wordTree = RBTree<std::string>();
+    for (auto word: {"batch", "prefetch", "lane", "miss"}) {
+        wordTree.insertValue(word);
+    }
+    auto words = std::vector<std::string>({"lane", "hit", "batch"});
+    auto wordResults = std::vector<RBTree<std::string>::Node*>(words.size());
+    wordTree.searchForValues(words.data(), words.size(), wordResults.data());
+    isSuccessful = isSuccessful && (wordResults[0]->value == "lane") && (wordResults[1] == RBTree<std::string>::Node::nilNode) && (wordResults[2]->value == "batch");
+
+    if (isSuccessful) {
+        std::cout << "Batched search success!" << std::endl;
+    } else {
+        std::cout << "Batched search failed." << std::endl;
+    }
+}
+
+#pragma mark Threaded Tree
+void testThreadedTree() {
+    using ThreadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>;
+
+    auto generator = std::default_random_engine(20);
+    auto distribution = std::uniform_int_distribution(0, 2000);
+    bool isSuccessful = true;
+
+    auto tree = ThreadedTree();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < 20000; i += 1) {
+        auto num = distribution(generator);
+        if ((i % 3) == 2) {
+            isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+            if (auto it = reference.find(num); it != reference.end()) {
+                reference.erase(it);
+            }
+        } else {
+            tree.insertValue(num);
+            reference.insert(num);
+        }
+
+        if ((i % 1000) == 0) {
+            isSuccessful = isSuccessful && isValidRBTree(tree) && isThreadingConsistent(tree);
+        }
+    }
+    isSuccessful = isSuccessful && isValidRBTree(tree) && isThreadingConsistent(tree);
+    isSuccessful = isSuccessful && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+    isSuccessful = isSuccessful && std::equal(tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend());
+
+    auto nums = std::vector<int>(1000);
+    std::iota(nums.begin(), nums.end(), 0);
+    auto bulkTree = ThreadedTree(nums.begin(), nums.end());
+    isSuccessful = isSuccessful && isThreadingConsistent(bulkTree);
+
+    // Joins and splits relink only the seams between subtrees.
+    auto [leftTree, isFound, rightTree] = ThreadedTree::split(std::move(bulkTree), 500);
+    isSuccessful = isSuccessful && isFound && isThreadingConsistent(leftTree) && isThreadingConsistent(rightTree);
+    auto joinedTree = ThreadedTree::join(std::move(leftTree), 500, ThreadedTree::join(std::move(rightTree), 2000, ThreadedTree()));
+    isSuccessful = isSuccessful && isThreadingConsistent(joinedTree) && (joinedTree.getMaxNode()->value == 2000);
+
+    auto oddNums = std::vector<int>();
+    for (int i = 1; i < 3000; i += 2) {
+        oddNums.push_back(i);
+    }
+    auto makeTrees = [&]() {
+        return std::make_pair(ThreadedTree(nums.begin(), nums.end()), ThreadedTree(oddNums.begin(), oddNums.end()));
+    };
+    {
+        auto [first, second] = makeTrees();
+        auto unionTree = ThreadedTree::setUnion(std::move(first), std::move(second));
+        isSuccessful = isSuccessful && isValidRBTree(unionTree) && isThreadingConsistent(unionTree);
+    }
+    {
+        auto [first, second] = makeTrees();
+        auto intersectionTree = ThreadedTree::setIntersection(std::move(first), std::move(second));
+        isSuccessful = isSuccessful && isThreadingConsistent(intersectionTree) && (intersectionTree.inOrderWalk().size() == 500);
+    }
+    {
+        auto [first, second] = makeTrees();
+        auto differenceTree = ThreadedTree::setDifference(std::move(first), std::move(second));
+        isSuccessful = isSuccessful && isThreadingConsistent(differenceTree) && (differenceTree.inOrderWalk().size() == 500);
+    }
+
+    if (isSuccessful) {
+        std::cout << "Threaded tree success!" << std::endl;
+    } else {
+        std::cout << "Threaded tree failed." << std::endl;
+    }
+}
+
+#pragma mark Counted Tree
+void testCountedTree() {
+    auto generator = std::default_random_engine(23);
+    auto distribution = std::uniform_int_distribution(0, 50);
+    bool isSuccessful = true;
+
+    auto tree = CountedRBTree<int>();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < 20000; i += 1) {
+        auto num = distribution(generator);
+        if ((i % 3) == 2) {
+            isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+            if (auto it = reference.find(num); it != reference.end()) {
+                reference.erase(it);
+            }
+        } else {
+            tree.insertValue(num);
+            reference.insert(num);
+        }
+    }
+    isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.getSize() == reference.size());
+    for (int num = -1; num <= 51; num += 1) {
+        isSuccessful = isSuccessful && (tree.count(num) == reference.count(num));
+    }
+
+    // One node per distinct key, every copy when iterating.
+    isSuccessful = isSuccessful && (tree.getHeight() <= 2 * std::log2(51 + 1));
+    isSuccessful = isSuccessful && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+    isSuccessful = isSuccessful && std::equal(tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend());
+    auto walk = tree.inOrderWalk();
+    isSuccessful = isSuccessful && std::equal(walk.begin(), walk.end(), reference.begin(), reference.end());
+
+    auto node = tree.searchForValue(25);
+    if (node != decltype(tree)::Node::nilNode) {
+        tree.deleteNode(node);
+        reference.erase(25);
+    }
+    isSuccessful = isSuccessful && (tree.count(25) == 0) && (tree.getSize() == reference.size());
+
+    auto sortedNums = std::vector<int>(reference.begin(), reference.end());
+    auto bulkTree = CountedRBTree<int>(sortedNums.begin(), sortedNums.end());
+    isSuccessful = isSuccessful && isValidRBTree(bulkTree) && (bulkTree.getSize() == reference.size());
+    isSuccessful = isSuccessful && std::equal(bulkTree.begin(), bulkTree.end(), reference.begin(), reference.end());
+
+    auto emptyTree = CountedRBTree<int>();
+    isSuccessful = isSuccessful && (emptyTree.begin() == emptyTree.end()) && (emptyTree.count(0) == 0) && !emptyTree.deleteValue(0);
+
+    // Counts looked up without building a key.
+    auto wordTree = CountedRBTree<std::string, std::less<>>();
+    for (auto word: {"red", "black", "red", "red"}) {
+        wordTree.insertValue(word);
+    }
+    isSuccessful = isSuccessful && (wordTree.count(std::string_view("red")) == 3) && (wordTree.count(std::string_view("node")) == 0);
+
+    if (isSuccessful) {
+        std::cout << "Counted tree success!" << std::endl;
+    } else {
+        std::cout << "Counted tree failed." << std::endl;
+    }
+}
+
+#pragma mark Node Handles
+void testNodeHandles() {
+    using PayloadTree = RBTree<int, std::unique_ptr<std::string>>;
+    bool isSuccessful = true;
+
+    // Rebalances two shards: nodes and their move-only payloads change trees as they are.
+    auto firstTree = PayloadTree();
+    auto secondTree = PayloadTree();
+    auto payloadAddresses = std::vector<const std::string*>();
+    for (int i = 0; i < 1000; i += 1) {
+        auto node = firstTree.emplaceValue(i, std::make_unique<std::string>(std::to_string(i)));
+        payloadAddresses.push_back(node->payload.get());
+    }
+    for (int i = 500; i < 1000; i += 1) {
+        auto node = firstTree.searchForValue(i);
+        auto movedNode = secondTree.insertNode(firstTree.extractNode(node));
+        isSuccessful = isSuccessful && (movedNode == node) && (movedNode->payload.get() == payloadAddresses[i]);
+    }
+    isSuccessful = isSuccessful && isValidRBTree(firstTree) && isValidRBTree(secondTree);
+    isSuccessful = isSuccessful && (firstTree.getMaxNode()->value == 499) && (secondTree.getMinNode()->value == 500);
+    isSuccessful = isSuccessful && (secondTree.searchForValue(750)->payload->compare("750") == 0);
+    isSuccessful = isSuccessful && firstTree.extractValue(2000).isEmpty() && (firstTree.insertNode(PayloadTree::NodeHandle()) == PayloadTree::Node::nilNode);
+
+    // Handles keep the slabs of their original tree alive.
+    auto handle = PayloadTree::NodeHandle();
+    {
+        auto shortLivedTree = PayloadTree();
+        for (int i = 0; i < 100; i += 1) {
+            shortLivedTree.emplaceValue(-i, std::make_unique<std::string>("short-lived"));
+        }
+        handle = shortLivedTree.extractValue(-50);
+    }
+    handle.getValue() = 1500;
+    auto adoptedNode = secondTree.insertNode(std::move(handle));
+    isSuccessful = isSuccessful && handle.isEmpty() && isValidRBTree(secondTree) && (*adoptedNode->payload == "short-lived");
+
+    // ... also once the node moved on from a tree that only received it.
+    {
+        auto originalTree = PayloadTree();
+        auto receivingTree = PayloadTree();
+        originalTree.emplaceValue(7, std::make_unique<std::string>("round trip"));
+        receivingTree.insertNode(originalTree.extractValue(7));
+        handle = receivingTree.extractValue(7);
+    }
+    isSuccessful = isSuccessful && (handle.getValue() == 7) && (*handle.getPayload() == "round trip");
+    handle = PayloadTree::NodeHandle();
+
+    // An abandoned handle destroys its node.
+    firstTree.extractValue(0);
+    isSuccessful = isSuccessful && (firstTree.searchForValue(0) == PayloadTree::Node::nilNode) && isValidRBTree(firstTree);
+
+    // Augmentations are recomputed for the node's new place.
+    auto threadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>();
+    auto otherThreadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>();
+    auto orderStatisticTree = OrderStatisticTree<int>();
+    auto otherOrderStatisticTree = OrderStatisticTree<int>();
+    for (int i = 0; i < 200; i += 1) {
+        threadedTree.insertValue(i);
+        orderStatisticTree.insertValue(i);
+    }
+    for (int i = 0; i < 200; i += 3) {
+        otherThreadedTree.insertNode(threadedTree.extractValue(i));
+        otherOrderStatisticTree.insertNode(orderStatisticTree.extractValue(i));
+    }
+    isSuccessful = isSuccessful && isThreadingConsistent(threadedTree) && isThreadingConsistent(otherThreadedTree);
+    isSuccessful = isSuccessful && (orderStatisticTree.getSize() == 133) && (otherOrderStatisticTree.getSize() == 67) && (otherOrderStatisticTree.select(66)->value == 198);
+
+    // Counted trees merge the counts of equal keys.
+    auto countedTree = CountedRBTree<int>();
+    auto otherCountedTree = CountedRBTree<int>();
+    for (int i = 0; i < 10; i += 1) {
+        countedTree.insertValue(i % 2);
+        otherCountedTree.insertValue(1);
+    }
+    otherCountedTree.insertNode(countedTree.extractValue(1));
+    isSuccessful = isSuccessful && (countedTree.getSize() == 5) && (otherCountedTree.getSize() == 15) && (otherCountedTree.count(1) == 15);
+
+    // Heap-allocated nodes move the same way.
+    auto heapTree = RBTree<int, RBNoPayload, std::less<int>, RBNoAugmentation, HeapNodeAllocator>();
+    auto otherHeapTree = RBTree<int, RBNoPayload, std::less<int>, RBNoAugmentation, HeapNodeAllocator>();
+    for (int i = 0; i < 100; i += 1) {
+        heapTree.insertValue(i);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        otherHeapTree.insertNode(heapTree.extractValue(i));
+    }
+    isSuccessful = isSuccessful && isValidRBTree(heapTree) && isValidRBTree(otherHeapTree) && (otherHeapTree.inOrderWalk().size() == 50);
+
+    if (isSuccessful) {
+        std::cout << "Node handles success!" << std::endl;
+    } else {
+        std::cout << "Node handles failed." << std::endl;
+    }
+}
+
+#pragma mark Memory
+void testMemoryUsage() {
+    using Node = RBTree<int>::Node;
+    bool isSuccessful = true;
+
+    auto tree = RBTree<int>();
+    for (int i = 0; i < 10000; i += 1) {
+        tree.insertValue(i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        tree.deleteValue(i);
+    }
+    auto usage = tree.getMemoryUsage();
+    isSuccessful = isSuccessful && (usage.liveNodeCount == 5000) && (usage.usedByteCount == 5000 * sizeof(Node)) && (usage.reservedByteCount >= 10000 * sizeof(Node));
+
+    // Node handles move a node from one account to the other.
+    auto otherTree = RBTree<int>();
+    otherTree.insertNode(tree.extractValue(1));
+    isSuccessful = isSuccessful && (tree.getMemoryUsage().liveNodeCount == 4999) && (otherTree.getMemoryUsage().liveNodeCount == 1);
+
+    // The halves of a split are counted again on demand.
+    auto [leftTree, isFound, rightTree] = RBTree<int>::split(std::move(tree), 3001);
+    isSuccessful = isSuccessful && isFound && (leftTree.getMemoryUsage().liveNodeCount == 1499) && (rightTree.getMemoryUsage().liveNodeCount == 3499);
+    auto joinedTree = RBTree<int>::join(std::move(leftTree), 3001, std::move(rightTree));
+    isSuccessful = isSuccessful && (joinedTree.getMemoryUsage().liveNodeCount == 4999);
+
+    joinedTree.clear();
+    usage = joinedTree.getMemoryUsage();
+    isSuccessful = isSuccessful && (joinedTree.rootNode == Node::nilNode) && (usage.liveNodeCount == 0) && (usage.reservedByteCount == 0);
+    joinedTree.insertValue(1);
+    isSuccessful = isSuccessful && isValidRBTree(joinedTree) && (joinedTree.getMemoryUsage().liveNodeCount == 1);
+
+    // Nodes owning resources are visited and destroyed, without recursion.
+    auto stringTree = RBTree<std::string>();
+    for (int i = 0; i < 100000; i += 1) {
+        stringTree.insertValue("key number " + std::to_string(i));
+    }
+    stringTree.clear();
+    isSuccessful = isSuccessful && (stringTree.getMemoryUsage().liveNodeCount == 0) && stringTree.inOrderWalk().empty();
+
+    auto heapTree = RBTree<int, RBNoPayload, std::less<int>, RBNoAugmentation, HeapNodeAllocator>();
+    for (int i = 0; i < 1000; i += 1) {
+        heapTree.insertValue(i);
+    }
+    usage = heapTree.getMemoryUsage();
+    isSuccessful = isSuccessful && (usage.liveNodeCount == 1000) && (usage.reservedByteCount == usage.usedByteCount);
+    heapTree.clear();
+    isSuccessful = isSuccessful && (heapTree.getMemoryUsage().liveNodeCount == 0);
+
+    if (isSuccessful) {
+        std::cout << "Memory usage success!" << std::endl;
+    } else {
+        std::cout << "Memory usage failed." << std::endl;
+    }
+}
+
+#pragma mark Split & Join
+void testSplitAndJoin() {
+    using SizedTree = RBTree<int, RBNoPayload, std::less<int>, RBSubtreeSize>;
+
+    auto generator = std::default_random_engine(6);
+    bool isSuccessful = true;
+
+    for (int count: {0, 1, 2, 10, 100, 1000}) {
+        auto nums = std::vector<int>(count);
+        for (int i = 0; i < count; i += 1) {
+            nums[i] = i * 2;
+        }
+
+        for (int splitValue = -1; splitValue <= 2 * count; splitValue += std::max(1, count / 10)) {
+            // Built by random insertion so that red nodes and uneven subtrees are all over the place.
+            auto shuffledNums = nums;
+            std::shuffle(shuffledNums.begin(), shuffledNums.end(), generator);
+            auto tree = SizedTree();
+            for (const auto& num: shuffledNums) {
+                tree.insertValue(num);
+            }
+
+            auto [leftTree, isFound, rightTree] = SizedTree::split(std::move(tree), splitValue);
+
+            auto firstGreater = std::upper_bound(nums.begin(), nums.end(), splitValue);
+            auto lastLess = std::lower_bound(nums.begin(), nums.end(), splitValue);
+            isSuccessful = isSuccessful && isValidRBTree(leftTree) && isValidRBTree(rightTree);
+            isSuccessful = isSuccessful && (leftTree.inOrderWalk() == std::vector<int>(nums.begin(), lastLess));
+            isSuccessful = isSuccessful && (rightTree.inOrderWalk() == std::vector<int>(firstGreater, nums.end()));
+            isSuccessful = isSuccessful && (isFound == std::binary_search(nums.begin(), nums.end(), splitValue));
+            isSuccessful = isSuccessful && (getSizeIfConsistent(leftTree.rootNode) >= 0) && (getSizeIfConsistent(rightTree.rootNode) >= 0);
+
+            auto joinedTree = SizedTree::join(std::move(leftTree), splitValue, std::move(rightTree));
+            auto expected = std::vector<int>(nums.begin(), lastLess);
+            expected.push_back(splitValue);
+            expected.insert(expected.end(), firstGreater, nums.end());
+            isSuccessful = isSuccessful && isValidRBTree(joinedTree) && (joinedTree.inOrderWalk() == expected);
+            isSuccessful = isSuccessful && (getSizeIfConsistent(joinedTree.rootNode) == static_cast<long long>(expected.size()));
+            isSuccessful = isSuccessful && (leftTree.rootNode == SizedTree::Node::nilNode) && (rightTree.rootNode == SizedTree::Node::nilNode);
+        }
+    }
+
+    // Duplicates of the split key are all removed.
+    auto tree = RBTree<int>();
+    for (int i = 0; i < 300; i += 1) {
+        tree.insertValue(i % 3);
+    }
+    auto [leftTree, isFound, rightTree] = RBTree<int>::split(std::move(tree), 1);
+    isSuccessful = isSuccessful && isFound && isValidRBTree(leftTree) && isValidRBTree(rightTree);
+    isSuccessful = isSuccessful && (leftTree.inOrderWalk() == std::vector<int>(100, 0)) && (rightTree.inOrderWalk() == std::vector<int>(100, 2));
+
+    // Order statistic trees stay order statistic trees.
+    auto orderStatisticTree = OrderStatisticTree<int>();
+    auto otherOrderStatisticTree = OrderStatisticTree<int>();
+    for (int i = 0; i < 100; i += 1) {
+        orderStatisticTree.insertValue(i);
+        otherOrderStatisticTree.insertValue(i + 50);
+    }
+    auto [lowerTree, isSplitValueFound, upperTree] = OrderStatisticTree<int>::split(std::move(orderStatisticTree), 40);
+    isSuccessful = isSuccessful && isSplitValueFound && (lowerTree.getSize() == 40) && (upperTree.select(0)->value == 41) && (upperTree.rank(60) == 19);
+    auto unionTree = OrderStatisticTree<int>::setUnion(std::move(upperTree), std::move(otherOrderStatisticTree));
+    isSuccessful = isSuccessful && (unionTree.getSize() == 109) && (unionTree.countInRange(41, 150) == 109);
+    auto rejoinedTree = OrderStatisticTree<int>::join(std::move(lowerTree), 40, std::move(unionTree));
+    isSuccessful = isSuccessful && isValidRBTree(rejoinedTree) && (rejoinedTree.getSize() == 150) && (rejoinedTree.select(149)->value == 149);
+
+    if (isSuccessful) {
+        std::cout << "Split and join success!" << std::endl;
+    } else {
+        std::cout << "Split and join failed." << std::endl;
+    }
+}
+
+#pragma mark Set Operations
+void testSetOperations() {
+    using SizedTree = RBTree<int, RBNoPayload, std::less<int>, RBSubtreeSize>;
+
+    auto generator = std::default_random_engine(7);
+    bool isSuccessful = true;
+
+    // {first tree size, second tree size, key range}
+    const std::vector<std::tuple<int, int, int>> configurations = {
+        {0, 0, 10}, {0, 50, 100}, {50, 0, 100}, {1, 1, 2}, {100, 100, 150}, {1000, 30, 2000}, {30, 1000, 2000}, {5000, 5000, 8000}, {20000, 20000, 1000000},
+    };
+    for (const auto& [firstCount, secondCount, keyRange]: configurations) {
+        auto distribution = std::uniform_int_distribution(0, keyRange - 1);
+        auto makeKeys = [&](int count) {
+            auto keys = std::set<int>();
+            while (static_cast<int>(keys.size()) < count) {
+                keys.insert(distribution(generator));
+            }
+            return std::vector<int>(keys.begin(), keys.end());
+        };
+        auto makeTree = [](const std::vector<int>& keys, bool isBulk) {
+            if (isBulk) {
+                return SizedTree(keys.begin(), keys.end());
+            }
+
+            auto tree = SizedTree();
+            for (const auto& key: keys) {
+                tree.insertValue(key);
+            }
+            return tree;
+        };
+
+        auto firstKeys = makeKeys(firstCount);
+        auto secondKeys = makeKeys(secondCount);
+
+        auto expectedUnion = std::vector<int>();
+        auto expectedIntersection = std::vector<int>();
+        auto expectedDifference = std::vector<int>();
+        std::set_union(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expectedUnion));
+        std::set_intersection(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expectedIntersection));
+        std::set_difference(firstKeys.begin(), firstKeys.end(), secondKeys.begin(), secondKeys.end(), std::back_inserter(expectedDifference));
+
+        // Bulk-built trees are perfectly balanced, inserted ones are not. Both shapes are tested.
+        for (bool isBulk: {false, true}) {
+            auto unionTree = SizedTree::setUnion(makeTree(firstKeys, isBulk), makeTree(secondKeys, !isBulk));
+            auto intersectionTree = SizedTree::setIntersection(makeTree(firstKeys, isBulk), makeTree(secondKeys, !isBulk));
+            auto differenceTree = SizedTree::setDifference(makeTree(firstKeys, isBulk), makeTree(secondKeys, !isBulk));
+
+            isSuccessful = isSuccessful && isValidRBTree(unionTree) && (unionTree.inOrderWalk() == expectedUnion);
+            isSuccessful = isSuccessful && isValidRBTree(intersectionTree) && (intersectionTree.inOrderWalk() == expectedIntersection);
+            isSuccessful = isSuccessful && isValidRBTree(differenceTree) && (differenceTree.inOrderWalk() == expectedDifference);
+            isSuccessful = isSuccessful && (getSizeIfConsistent(unionTree.rootNode) == static_cast<long long>(expectedUnion.size()));
+            isSuccessful = isSuccessful && (getSizeIfConsistent(intersectionTree.rootNode) == static_cast<long long>(expectedIntersection.size()));
+            isSuccessful = isSuccessful && (getSizeIfConsistent(differenceTree.rootNode) == static_cast<long long>(expectedDifference.size()));
+
+            // The result owns the nodes of both inputs, so it keeps working as a normal tree.
+            // Every key of the second tree is replaced, so the size stays the same.
+            for (const auto& key: secondKeys) {
+                unionTree.deleteValue(key);
+                unionTree.insertValue(-key - 1);
+            }
+            isSuccessful = isSuccessful && isValidRBTree(unionTree) && (getSizeIfConsistent(unionTree.rootNode) == static_cast<long long>(expectedUnion.size()));
+        }
+    }
+
+    // Payloads come from the first tree.
+    auto firstTree = RBTree<int, std::string>();
+    auto secondTree = RBTree<int, std::string>();
+    for (int i = 0; i < 100; i += 1) {
+        firstTree.insertValue(i, "first");
+        secondTree.insertValue(i + 50, "second");
+    }
+    auto unionTree = RBTree<int, std::string>::setUnion(std::move(firstTree), std::move(secondTree));
+    isSuccessful = isSuccessful && (unionTree.searchForValue(70)->payload == "first") && (unionTree.searchForValue(120)->payload == "second");
+
+    if (isSuccessful) {
+        std::cout << "Set operations success!" << std::endl;
+    } else {
+        std::cout << "Set operations failed." << std::endl;
+    }
+}
+
+#pragma mark Persistent Tree
+void testPersistentTree() {
+    using Tree = PersistentRBTree<int, int>;
+
+    auto generator = std::default_random_engine(8);
+    auto distribution = std::uniform_int_distribution(0, 300);
+
+    auto tree = Tree();
+    auto reference = std::multiset<int>();
+
+    // Old versions must stay exactly as they were while the tree moves on.
+    auto snapshots = std::vector<std::pair<Tree::Snapshot, std::vector<int>>>();
+
+    bool isSuccessful = true;
+    for (int i = 0; i < 20000; i += 1) {
+        auto num = distribution(generator);
+        if ((i % 3 == 2) || (reference.size() > 500)) {
+            auto isDeleted = tree.deleteValue(num);
+            isSuccessful = isSuccessful && (isDeleted == (reference.count(num) > 0));
+            if (isDeleted) {
+                reference.erase(reference.find(num));
+            }
+        } else {
+            tree.insertValue(num, -num);
+            reference.insert(num);
+        }
+
+        if (i % 100 == 0) {
+            auto snapshot = tree.getSnapshot();
+            isSuccessful = isSuccessful && isValidSnapshot<Tree>(snapshot);
+            isSuccessful = isSuccessful && (snapshot.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+            snapshots.emplace_back(snapshot, snapshot.inOrderWalk());
+        }
+    }
+
+    for (const auto& [snapshot, values]: snapshots) {
+        isSuccessful = isSuccessful && isValidSnapshot<Tree>(snapshot) && (snapshot.inOrderWalk() == values);
+    }
+
+    // Lookups and range reads on the latest version.
+    auto snapshot = tree.getSnapshot();
+    for (int value = -1; value <= 302; value += 1) {
+        auto node = snapshot.searchForValue(value);
+        isSuccessful = isSuccessful && ((node != nullptr) == (reference.count(value) > 0));
+        isSuccessful = isSuccessful && ((node == nullptr) || (node->payload == -value));
+
+        auto rangeValues = std::vector<int>();
+        snapshot.forEachInRange(value, value + 7, [&](const Tree::Node* node) {
+            rangeValues.push_back(node->value);
+        });
+        isSuccessful = isSuccessful && (rangeValues == std::vector<int>(reference.lower_bound(value), reference.lower_bound(value + 7)));
+    }
+
+    // Drain the tree, then check that a snapshot taken before is still complete.
+    auto fullSnapshot = tree.getSnapshot();
+    for (const auto& num: reference) {
+        isSuccessful = isSuccessful && tree.deleteValue(num);
+    }
+    isSuccessful = isSuccessful && tree.getSnapshot().isEmpty() && (fullSnapshot.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+
+    // Duplicates come out in the same order as from `RBTree`.
+    auto duplicateTree = Tree();
+    auto mutableDuplicateTree = RBTree<int, int>();
+    for (int i = 0; i < 50; i += 1) {
+        duplicateTree.insertValue(i % 3, i);
+        mutableDuplicateTree.insertValue(i % 3, i);
+    }
+    auto persistentPayloads = std::vector<int>();
+    auto mutablePayloads = std::vector<int>();
+    duplicateTree.getSnapshot().forEachInRange(0, 3, [&](const Tree::Node* node) {
+        persistentPayloads.push_back(node->payload);
+    });
+    mutableDuplicateTree.forEachInRange(0, 3, [&](const RBTree<int, int>::Node* node) {
+        mutablePayloads.push_back(node->payload);
+    });
+    isSuccessful = isSuccessful && (persistentPayloads == mutablePayloads);
+
+    if (isSuccessful) {
+        std::cout << "Persistent tree success!" << std::endl;
+    } else {
+        std::cout << "Persistent tree failed." << std::endl;
+    }
+}
+
+#pragma mark Eytzinger Snapshot
+void testEytzingerSnapshot() {
+    auto generator = std::default_random_engine(10);
+    bool isSuccessful = true;
+
+    // Sizes around powers of 2 leave the last level full, nearly empty, or anything between.
+    for (int count: {0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 100, 1000, 1023, 1024, 1025}) {
+        auto distribution = std::uniform_int_distribution(0, 2 * count);
+
+        auto tree = RBTree<int>();
+        auto reference = std::vector<int>();
+        for (int i = 0; i < count; i += 1) {
+            auto num = distribution(generator);
+            tree.insertValue(num);
+            reference.push_back(num);
+        }
+        std::sort(reference.begin(), reference.end());
+
+        auto snapshot = EytzingerSnapshot<int>(tree.begin(), tree.end());
+        isSuccessful = isSuccessful && (snapshot.getSize() == static_cast<std::size_t>(count)) && (snapshot.inOrderWalk() == reference);
+
+        for (int value = -1; value <= 2 * count + 1; value += 1) {
+            auto expected = std::lower_bound(reference.begin(), reference.end(), value);
+            auto key = snapshot.lowerBound(value);
+            isSuccessful = isSuccessful && ((key == nullptr) == (expected == reference.end()));
+            isSuccessful = isSuccessful && ((key == nullptr) || (*key == *expected));
+
+            auto isPresent = std::binary_search(reference.begin(), reference.end(), value);
+            isSuccessful = isSuccessful && ((snapshot.searchForValue(value) != nullptr) == isPresent);
+        }
+    }
+
+    // Keys larger than a cache line, and a reversed order.
+    auto words = std::vector<std::string>({"tree", "red", "black", "node", "rotation", "sentinel", "successor"});
+    auto wordTree = RBTree<std::string, RBNoPayload, std::greater<>>();
+    for (const auto& word: words) {
+        wordTree.insertValue(word);
+    }
+    auto wordSnapshot = EytzingerSnapshot<std::string, std::greater<>>(wordTree.begin(), wordTree.end());
+    isSuccessful = isSuccessful && (wordSnapshot.inOrderWalk() == wordTree.inOrderWalk());
+    isSuccessful = isSuccessful && (*wordSnapshot.lowerBound(std::string_view("s")) == "rotation") && (wordSnapshot.searchForValue("node") != nullptr);
+    isSuccessful = isSuccessful && (wordSnapshot.lowerBound("a") == nullptr);
+
+    if (isSuccessful) {
+        std::cout << "Eytzinger snapshot success!" << std::endl;
+    } else {
+        std::cout << "Eytzinger snapshot failed." << std::endl;
+    }
+}
+
+#pragma mark Compact Tree
+void testCompactTree() {
+    auto generator = std::default_random_engine(14);
+    auto distribution = std::uniform_int_distribution(0, 2000);
+    bool isSuccessful = true;
+
+    auto tree = CompactRBTree<int>();
+    auto reference = std::multiset<int>();
+
+    // Deleting about as often as inserting keeps recycling slots through the free list.
+    for (int i = 0; i < 20000; i += 1) {
+        auto num = distribution(generator);
+        if ((i % 3) == 2) {
+            isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+            if (auto it = reference.find(num); it != reference.end()) {
+                reference.erase(it);
+            }
+        } else {
+            isSuccessful = isSuccessful && (*tree.insertValue(num) == num);
+            reference.insert(num);
+        }
+
+        if ((i % 1000) == 0) {
+            isSuccessful = isSuccessful && isValidRBTree(tree);
+        }
+    }
+    isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.getSize() == reference.size());
+    isSuccessful = isSuccessful && (tree.inOrderWalk() == std::vector<int>(reference.begin(), reference.end()));
+    isSuccessful = isSuccessful && std::equal(reference.rbegin(), reference.rend(), std::make_reverse_iterator(tree.end()), std::make_reverse_iterator(tree.begin()));
 
-class RBNode {
-public:
-    int value;
+    for (int value = -1; value <= 2001; value += 1) {
+        isSuccessful = isSuccessful && ((tree.searchForValue(value) != tree.end()) == (reference.count(value) > 0));
 
-    RBNode* parent;
-    RBNode* leftChild;
-    RBNode* rightChild;
+        auto expected = reference.lower_bound(value);
+        auto actual = tree.lowerBound(value);
+        isSuccessful = isSuccessful && ((actual == tree.end()) == (expected == reference.end()));
+        isSuccessful = isSuccessful && ((actual == tree.end()) || (*actual == *expected));
+    }
 
-    bool isRed;
+    // Two 32-bit links and the parent index with its color bit next to a 4-byte key.
+    isSuccessful = isSuccessful && (sizeof(CompactRBTree<int>::Node) == 16);
 
-public:
-    /// Black-colored sentinel `nil` node. Initialization after class definition.
-    static RBNode* nilNode;
+    // Keys that own memory, ordered in reverse.
+    auto wordTree = CompactRBTree<std::string, std::greater<>>();
+    for (auto word: {"tree", "red", "black", "node", "rotation", "sentinel"}) {
+        wordTree.insertValue(word);
+    }
+    wordTree.deleteValue(std::string_view("node"));
+    isSuccessful = isSuccessful && isValidRBTree(wordTree);
+    isSuccessful = isSuccessful && (wordTree.inOrderWalk() == std::vector<std::string>({"tree", "sentinel", "rotation", "red", "black"}));
 
-public:
-    RBNode(int value, bool isRed) {
-        this->value = value;
-        this->parent = RBNode::nilNode;
-        this->leftChild = RBNode::nilNode;
-        this->rightChild = RBNode::nilNode;
-        this->isRed = isRed;
+    // A key of the tree itself stays readable while the node array grows under it.
+    auto selfInsertedTree = CompactRBTree<int>();
+    selfInsertedTree.insertValue(7);
+    for (int i = 0; i < 100; i += 1) {
+        selfInsertedTree.insertValue(*selfInsertedTree.begin());
     }
+    isSuccessful = isSuccessful && isValidRBTree(selfInsertedTree) && (selfInsertedTree.inOrderWalk() == std::vector<int>(101, 7));
 
-    RBNode(int value, RBNode* parent, RBNode* leftChild, RBNode* rightChild, bool isRed) {
-        this->value = value;
-        this->parent = parent;
-        this->leftChild = leftChild;
-        this->rightChild = rightChild;
-        this->isRed = isRed;
+    while (tree.getSize() > 0) {
+        tree.deleteNode(tree.begin().getIndex());
     }
-};
+    isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.begin() == tree.end());
 
-RBNode* RBNode::nilNode = new RBNode(0, nullptr, nullptr, nullptr, false);
+    if (isSuccessful) {
+        std::cout << "Compact tree success!" << std::endl;
+    } else {
+        std::cout << "Compact tree failed." << std::endl;
+    }
+}
 
+#pragma mark Mapped Tree
+void testMappedTree() {
+    auto path = (std::filesystem::temp_directory_path() / "red black tree test.map").string();
+    auto generator = std::default_random_engine(15);
+    bool isSuccessful = true;
+
+    for (int count: {0, 1, 2, 10, 1000, 100000}) {
+        auto distribution = std::uniform_int_distribution(0, 2 * count);
+        auto tree = RBTree<int>();
+        for (int i = 0; i < count; i += 1) {
+            tree.insertValue(distribution(generator));
+        }
+        auto reference = tree.inOrderWalk();
 
-class RBTree {
-public:
-    RBNode* rootNode;
+        MappedTree<int>::writeFile(path, tree.rootNode, RBTree<int>::Node::nilNode);
+        auto mappedTree = MappedTree<int>(path);
+        isSuccessful = isSuccessful && (mappedTree.getSize() == reference.size()) && (mappedTree.inOrderWalk() == reference);
 
-public:
-    RBTree() {
-        rootNode = RBNode::nilNode;
-        // nilNode = new RBNode(0, false);
-    }
+        for (int value = -1; value <= std::min(2 * count + 1, 3000); value += 1) {
+            auto isPresent = std::binary_search(reference.begin(), reference.end(), value);
+            isSuccessful = isSuccessful && ((mappedTree.searchForValue(value) != nullptr) == isPresent);
 
+            auto expected = std::lower_bound(reference.begin(), reference.end(), value);
+            auto key = mappedTree.lowerBound(value);
+            isSuccessful = isSuccessful && ((key == nullptr) ? (expected == reference.end()) : (*key == *expected));
 
-#pragma mark Walk
-private:
-    static void inOrderWalkRecursively(RBNode* currentNode, std::vector<int>& returnValue) {
-        if (currentNode == RBNode::nilNode) {
-            return;
+            auto keysInRange = std::vector<int>();
+            mappedTree.forEachInRange(value, value + 5, [&](int key) {
+                keysInRange.push_back(key);
+            });
+            isSuccessful = isSuccessful && (keysInRange == std::vector<int>(expected, std::lower_bound(reference.begin(), reference.end(), value + 5)));
         }
 
-        inOrderWalkRecursively(currentNode->leftChild, returnValue);
-        returnValue.push_back(currentNode->value);
-        inOrderWalkRecursively(currentNode->rightChild, returnValue);
+        // Back into a mutable tree by bulk construction.
+        auto reloadedTree = RBTree<int>(mappedTree.begin(), mappedTree.end());
+        isSuccessful = isSuccessful && isValidRBTree(reloadedTree) && (reloadedTree.inOrderWalk() == reference);
     }
 
-public:
-    std::vector<int> inOrderWalk() {
-        if (rootNode == RBNode::nilNode) {
-            return {};
-        }
+    // Another key type must not be read from the file.
+    MappedTree<int>::writeFile(path, RBTree<int>::Node::nilNode, RBTree<int>::Node::nilNode);
+    try {
+        auto mappedTree = MappedTree<double>(path);
+        isSuccessful = false;
+    } catch (const std::runtime_error&) {
+    }
+    // Neither may a truncated file.
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "RBTMAP01";
+    try {
+        auto mappedTree = MappedTree<int>(path);
+        isSuccessful = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::filesystem::remove(path);
 
-        auto returnValue = std::vector<int>();
+    if (isSuccessful) {
+        std::cout << "Mapped tree success!" << std::endl;
+    } else {
+        std::cout << "Mapped tree failed." << std::endl;
+    }
+}
 
-        inOrderWalkRecursively(rootNode, returnValue);
-        
-        return returnValue;
+#pragma mark Durable Tree
+void testDurableTree() {
+    auto directory = std::filesystem::temp_directory_path() / "red black tree durable test";
+    std::filesystem::remove_all(directory);
+
+    auto generator = std::default_random_engine(16);
+    auto distribution = std::uniform_int_distribution(0, 500);
+    auto reference = std::multiset<int>();
+    bool isSuccessful = true;
+
+    auto isRecovered = [&](DurableRBTree<int>& tree) {
+        return tree.inOrderWalk() == std::vector<int>(reference.begin(), reference.end());
+    };
+
+    // Insertions and deletions: replayed one by one on recovery.
+    {
+        auto tree = DurableRBTree<int>(directory.string());
+        for (int i = 0; i < 300; i += 1) {
+            auto num = distribution(generator);
+            if ((i % 4) == 3) {
+                isSuccessful = isSuccessful && (tree.deleteValue(num) == (reference.count(num) > 0));
+                if (auto it = reference.find(num); it != reference.end()) {
+                    reference.erase(it);
+                }
+            } else {
+                tree.insertValue(num);
+                reference.insert(num);
+            }
+        }
+        isSuccessful = isSuccessful && tree.deleteValue(*reference.begin());
+        reference.erase(reference.begin());
+    }
+    {
+        auto tree = DurableRBTree<int>(directory.string());
+        isSuccessful = isSuccessful && isRecovered(tree);
+
+        // A checkpoint followed by insertions only: recovered by one bulk construction.
+        tree.checkpoint();
+        for (int i = 0; i < 300; i += 1) {
+            auto num = distribution(generator);
+            tree.insertValue(num);
+            reference.insert(num);
+        }
+    }
+    isSuccessful = isSuccessful && std::filesystem::exists(directory / "checkpoint.1") && !std::filesystem::exists(directory / "log.0");
+
+    // A record torn by a crash is dropped together with everything after it.
+    std::ofstream(directory / "log.1", std::ios::binary | std::ios::app) << "torn";
+    {
+        auto tree = DurableRBTree<int>(directory.string());
+        isSuccessful = isSuccessful && isRecovered(tree) && (tree.getGeneration() == 1);
+        tree.insertValue(1000);
+        reference.insert(1000);
     }
 
+    // Concurrent writers share syncs.
+    {
+        auto tree = DurableRBTree<int>(directory.string());
+        isSuccessful = isSuccessful && isRecovered(tree);
 
-#pragma mark Min & Max
-public:
-    static RBNode* getMinNodeOfSubtree(RBNode* rootNode) {
-        if (rootNode == RBNode::nilNode) {
-            return RBNode::nilNode;
+        auto threads = std::vector<std::thread>();
+        for (int t = 0; t < 4; t += 1) {
+            threads.emplace_back([&tree, t]() {
+                for (int i = 0; i < 100; i += 1) {
+                    tree.insertValue(2000 + 4 * i + t);
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
         }
+        for (int i = 2000; i < 2400; i += 1) {
+            reference.insert(i);
+        }
+    }
 
-        auto currentNode = rootNode;
-        while (currentNode->leftChild != RBNode::nilNode) {
-            currentNode = currentNode->leftChild;
+    // Asynchronous syncs and automatic checkpoints.
+    auto options = DurabilityOptions();
+    options.waitsForSync = false;
+    options.checkpointLogBytes = 4096;
+    {
+        auto tree = DurableRBTree<int>(directory.string(), options);
+        isSuccessful = isSuccessful && isRecovered(tree);
+        for (int i = 0; i < 20000; i += 1) {
+            auto num = distribution(generator);
+            tree.insertValue(num);
+            reference.insert(num);
+            if ((i % 3) == 0) {
+                tree.deleteValue(num);
+                reference.erase(reference.find(num));
+            }
         }
+        tree.sync();
+    }
+    {
+        auto tree = DurableRBTree<int>(directory.string(), options);
+        isSuccessful = isSuccessful && isRecovered(tree) && (tree.getGeneration() > 1);
+    }
+    std::filesystem::remove_all(directory);
 
-        return currentNode;
+    if (isSuccessful) {
+        std::cout << "Durable tree success!" << std::endl;
+    } else {
+        std::cout << "Durable tree failed." << std::endl;
     }
+}
 
-    static RBNode* getMaxNodeOfSubtree(RBNode* rootNode) {
-        if (rootNode == RBNode::nilNode) {
-            return RBNode::nilNode;
-        }
+#pragma mark Statistics
+void testTreeStats() {
+    auto generator = std::default_random_engine(18);
+    auto distribution = std::uniform_int_distribution(0, 1000000);
+    bool isSuccessful = true;
 
-        auto currentNode = rootNode;
-        while (currentNode->rightChild != RBNode::nilNode) {
-            currentNode = currentNode->rightChild;
-        }
+    TreeStats::reset();
 
-        return currentNode;
+    const int count = 20000;
+    auto tree = RBTree<int>();
+    auto nums = std::vector<int>();
+    for (int i = 0; i < count; i += 1) {
+        nums.push_back(distribution(generator));
+        tree.insertValue(nums.back());
     }
 
-public:
-    RBNode* getMinNode() {
-        return RBTree::getMinNodeOfSubtree(rootNode);
+    // Refer to Lemma 13.1 of "Introduction to Algorithms".
+    auto height = tree.getHeight();
+    isSuccessful = isSuccessful && (height <= 2 * std::log2(count + 1)) && (tree.getBlackHeight() == getBlackHeightIfValid(tree.rootNode, std::less<int>()));
+
+    for (auto num: nums) {
+        isSuccessful = isSuccessful && (tree.searchForValue(num) != RBTree<int>::Node::nilNode);
+    }
+    for (int i = 0; i < count; i += 2) {
+        isSuccessful = isSuccessful && tree.deleteValue(nums[i]);
+    }
+    isSuccessful = isSuccessful && isValidRBTree(tree);
+
+    auto stats = TreeStats::getSnapshot();
+
+#ifdef TREE_STATS
+    // Cases 2 and 3 of insertion and cases 1, 3 and 4 of deletion rotate once each. Nothing else in these operations does.
+    const auto& insertionCases = stats.insertionFixUpCaseCounts;
+    const auto& deletionCases = stats.deletionFixUpCaseCounts;
+    isSuccessful = isSuccessful && (stats.leftRotationCount + stats.rightRotationCount == insertionCases[2] + insertionCases[3] + deletionCases[1] + deletionCases[3] + deletionCases[4]);
+    // Case 3 ends every insertion fix-up it appears in, and case 4 every deletion fix-up.
+    isSuccessful = isSuccessful && (insertionCases[3] <= count) && (deletionCases[4] <= count / 2) && (insertionCases[1] > 0) && (deletionCases[2] > 0);
+
+    // `deleteValue` looks its key up first.
+    isSuccessful = isSuccessful && (stats.operationCounts[TreeStats::search] == count + count / 2);
+    isSuccessful = isSuccessful && (stats.operationCounts[TreeStats::insertion] == count) && (stats.operationCounts[TreeStats::deletion] == count / 2);
+    for (int operation = 0; operation < TreeStats::operationCount; operation += 1) {
+        const auto& histogram = stats.latencyHistograms[operation];
+        isSuccessful = isSuccessful && (std::accumulate(histogram.begin(), histogram.end(), std::uint64_t(0)) == stats.operationCounts[operation]);
     }
 
-    RBNode* getMaxNode() {
-        return RBTree::getMaxNodeOfSubtree(rootNode);
+    // `==` and `<` at each node on the path.
+    isSuccessful = isSuccessful && (stats.maxOperationComparisonCounts[TreeStats::search] <= static_cast<std::uint64_t>(2 * height));
+    isSuccessful = isSuccessful && (stats.operationComparisonCounts[TreeStats::search] >= static_cast<std::uint64_t>(count));
+#else
+    isSuccessful = isSuccessful && (stats.comparisonCount == 0) && (stats.leftRotationCount + stats.rightRotationCount == 0) && (stats.operationCounts[TreeStats::insertion] == 0);
+#endif
+
+    if (isSuccessful) {
+        std::cout << "Tree stats success!" << std::endl;
+    } else {
+        std::cout << "Tree stats failed." << std::endl;
     }
+}
 
+#pragma mark Threads
+void testParallelTrees() {
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
 
-#pragma mark Search
-public:
-    RBNode* searchForValue(int value) {
-        auto currentNode = rootNode;
-        while (currentNode != RBNode::nilNode) {
-            if (currentNode->value == value) {
-                return currentNode;
-            } else if (currentNode->value > value) {
-                currentNode = currentNode->leftChild;
-            } else {
-                currentNode = currentNode->rightChild;
+    auto nums = std::vector<int>(1000);
+    std::iota(nums.begin(), nums.end(), 1);
+
+    // One flag per thread. `char` rather than `bool` so that the threads write to separate objects.
+    auto results = std::vector<char>(threadCount, 0);
+    auto threads = std::vector<std::thread>();
+
+    for (int t = 0; t < threadCount; t += 1) {
+        threads.emplace_back([t, &nums, &results]() {
+            auto generator = std::default_random_engine(t);
+            auto numsCopy = nums;
+            auto tree = RBTree<int>();
+            bool isSuccessful = true;
+
+            for (int i = 0; i < 20; i += 1) {
+                std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
+                for (const auto& num: numsCopy) {
+                    tree.insertValue(num);
+                }
+                isSuccessful = isSuccessful && isValidRBTree(tree) && (tree.inOrderWalk() == nums);
+
+                std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
+                for (const auto& num: numsCopy) {
+                    tree.deleteValue(num);
+                }
+                isSuccessful = isSuccessful && tree.inOrderWalk().empty();
             }
-        }
-        
-        return RBNode::nilNode;
+
+            results[t] = isSuccessful;
+        });
     }
 
+    for (auto& thread: threads) {
+        thread.join();
+    }
 
-#pragma mark Predecessor & Successor
-public:
-    static RBNode* getPredecessor(RBNode* node) {
-        if (node == RBNode::nilNode) {
-            return RBNode::nilNode;
-        }
+    auto sentinel = RBTree<int>::Node::nilNode;
+    bool isSentinelUntouched = (sentinel->parent == nullptr) && (sentinel->leftChild == nullptr) && (sentinel->rightChild == nullptr) && (!sentinel->isRed);
 
-        if (node->leftChild != RBNode::nilNode) {
-            return RBTree::getMaxNodeOfSubtree(node->leftChild);
-        }
+    if (std::all_of(results.begin(), results.end(), [](char result) { return result; }) && isSentinelUntouched) {
+        std::cout << "Parallel trees success! (" << threadCount << " threads)" << std::endl;
+    } else {
+        std::cout << "Parallel trees failed." << std::endl;
+    }
+}
 
-        // Find the first ancestor with the current node as right child.
-        auto currentNode = node;
-        auto ancestor = node->parent;
-        while ((ancestor != RBNode::nilNode) && (ancestor->leftChild == currentNode)) {
-            currentNode = ancestor;
-            ancestor = ancestor->parent;
-        }
-        
-        return ancestor;
+/// Readers scan snapshots while a writer keeps changing the tree. Every snapshot must be a complete, valid version.
+void testPersistentTreeReaders() {
+    const int readerCount = std::max(3u, std::thread::hardware_concurrency());
+    const int windowSize = 1000;
+    const int writeCount = 20000;
+
+    // The writer slides a window of consecutive keys: it inserts the next key, then deletes the oldest one.
+    // So every version holds `[low, high)` for some `low` and `high` that never decrease, and anything else is a torn read.
+    auto tree = PersistentRBTree<int>();
+    for (int i = 0; i < windowSize; i += 1) {
+        tree.insertValue(i);
     }
 
-    static RBNode* getSuccessor(RBNode* node) {
-        if (node == RBNode::nilNode) {
-            return RBNode::nilNode;
-        }
+    std::atomic<bool> isWriterDone = false;
+    auto results = std::vector<char>(readerCount, 0);
+    auto readers = std::vector<std::thread>();
+    for (int t = 0; t < readerCount; t += 1) {
+        readers.emplace_back([t, &tree, &isWriterDone, &results]() {
+            bool isSuccessful = true;
+            int previousLow = 0;
+            int scanCount = 0;
+
+            do {
+                auto snapshot = tree.getSnapshot();
+                isSuccessful = isSuccessful && isValidSnapshot<PersistentRBTree<int>>(snapshot);
+
+                auto values = snapshot.inOrderWalk();
+                isSuccessful = isSuccessful && (values.size() >= windowSize) && (values.size() <= windowSize + 1);
+                isSuccessful = isSuccessful && (values.front() >= previousLow) && (values.back() - values.front() + 1 == static_cast<int>(values.size()));
+                previousLow = values.front();
+                scanCount += 1;
+            } while (!isWriterDone);
+
+            results[t] = isSuccessful && (scanCount > 0);
+        });
+    }
 
-        if (node->rightChild != RBNode::nilNode) {
-            return RBTree::getMinNodeOfSubtree(node->rightChild);
-        }
+    for (int i = windowSize; i < windowSize + writeCount; i += 1) {
+        tree.insertValue(i);
+        tree.deleteValue(i - windowSize);
+    }
+    isWriterDone = true;
 
-        // Find the first ancestor with the current node as left child.
-        auto currentNode = node;
-        auto ancestor = node->parent;
-        while ((ancestor != RBNode::nilNode) && (ancestor->rightChild == currentNode)) {
-            currentNode = ancestor;
-            ancestor = ancestor->parent;
-        }
-        
-        return ancestor;
+    for (auto& reader: readers) {
+        reader.join();
     }
 
+    auto values = tree.getSnapshot().inOrderWalk();
+    bool isFinalVersionCorrect = (values.size() == windowSize) && (values.front() == writeCount) && (values.back() == writeCount + windowSize - 1);
 
-#pragma mark Rotation
-private:
-    /// Refer to page 334 of "Introduction to Algorithms".
-    void rotateLeft(RBNode* x) {
-        auto y = x->rightChild;
-        
-        // Move beta.
-        x->rightChild = y->leftChild;
-        if (y->leftChild != RBNode::nilNode) {
-            y->leftChild->parent = x;
-        }
-
-        // Move x and y.
-        y->parent = x->parent;
-        if (x->parent == RBNode::nilNode) {
-            rootNode = y;
-        } else {
-            if (x == x->parent->leftChild) {
-                x->parent->leftChild = y;
-            } else {
-                x->parent->rightChild = y;
-            }
-        }
-        
-        x->parent = y;
-        y->leftChild = x;
+    if (std::all_of(results.begin(), results.end(), [](char result) { return result; }) && isFinalVersionCorrect) {
+        std::cout << "Persistent tree readers success! (" << readerCount << " readers)" << std::endl;
+    } else {
+        std::cout << "Persistent tree readers failed." << std::endl;
     }
+}
+
+
+#pragma mark - Benchmarks
+/// Same churn as `testInsertionAndDeletion`, with a fixed seed and a full walk after every insertion round.
+template <template <typename> typename NodeAllocator>
+double measureInsertionAndDeletion(int rounds, int count) {
+    auto nums = std::vector<int>(count);
+    std::iota(nums.begin(), nums.end(), 1);
 
-    void rotateRight(RBNode* y) {
-        auto x = y->leftChild;
+    auto generator = std::default_random_engine(42);
+    auto tree = RBTree<int, RBNoPayload, std::less<int>, RBNoAugmentation, NodeAllocator>();
 
-        // Move beta.
-        y->leftChild = x->rightChild;
-        if (x->rightChild != RBNode::nilNode) {
-            x->rightChild->parent = y;
+    auto startTime = std::chrono::steady_clock::now();
+
+    long long checksum = 0;
+    for (int i = 0; i < rounds; i += 1) {
+        std::shuffle(nums.begin(), nums.end(), generator);
+        for (const auto& num: nums) {
+            tree.insertValue(num);
         }
 
-        // Move x and y.
-        x->parent = y->parent;
-        if (y->parent == RBNode::nilNode) {
-            rootNode = x;
-        } else {
-            if (y == y->parent->leftChild) {
-                y->parent->leftChild = x;
-            } else {
-                y->parent->rightChild = x;
-            }
+        checksum += tree.inOrderWalk().back();
+
+        std::shuffle(nums.begin(), nums.end(), generator);
+        for (const auto& num: nums) {
+            tree.deleteValue(num);
         }
+    }
 
-        y->parent = x;
-        x->rightChild = y;
+    auto endTime = std::chrono::steady_clock::now();
+    if (checksum != static_cast<long long>(rounds) * count) {
+        std::cout << "Benchmark walk failed." << std::endl;
     }
 
+    return std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
 
-#pragma mark Insertion
-private:
-    /**
-     * @param z The newly inserted red node.
-     */
-    void fixUpInsertion(RBNode* z) {
-        // Root node's parent is RBNode::nilNode, which is black.
-        while (z->parent->isRed) {
-            // Both z and z->parent are red.
-            // z->parent->parent must be black when z->parent is a red node.
-            if (z->parent == z->parent->parent->leftChild) {
-                // z's parent on left, uncle on right.
-                
-                /// Uncle of z.
-                auto y = z->parent->parent->rightChild;
-
-                if (y->isRed) {
-                    // Case 1. Parent and uncle are red.
-                    z->parent->isRed = false;
-                    y->isRed = false;
-                    z->parent->parent->isRed = true;
-                    z = z->parent->parent;
-
-                    continue;
-                } else {
-                    if (z == z->parent->rightChild) {
-                        // Case 2. z is the right child.
-                        // Rotate and treat z's parent as the new z.
-                        z = z->parent;
-                        RBTree::rotateLeft(z);
-                    }
+void benchmarkNodePool() {
+    // {node count, rounds}
+    const std::vector<std::pair<int, int>> configurations = {{1000, 100}, {100000, 10}};
 
-                    // Case 3.
-                    z->parent->isRed = false;
-                    z->parent->parent->isRed = true;
-                    RBTree::rotateRight(z->parent->parent);
+    for (const auto& [count, rounds]: configurations) {
+        auto heapTime = measureInsertionAndDeletion<HeapNodeAllocator>(rounds, count);
+        auto poolTime = measureInsertionAndDeletion<NodePool>(rounds, count);
 
-                    break;
-                }
-            } else {
-                // z's parent on right, uncle on left.
-
-                /// Uncle of z.
-                auto y = z->parent->parent->leftChild;
-
-                if (y->isRed) {
-                    // Case 1. Parent and uncle are red.
-                    z->parent->isRed = false;
-                    y->isRed = false;
-                    z->parent->parent->isRed = true;
-                    z = z->parent->parent;
-
-                    continue;
-                } else {
-                    if (z == z->parent->leftChild) {
-                        // Case 2. z is the left child.
-                        // Rotate and treat z's parent as the new z.
-                        z = z->parent;
-                        RBTree::rotateRight(z);
-                    }
+        std::cout << count << " nodes x " << rounds << " rounds: ";
+        std::cout << "new/delete " << heapTime << " ms, ";
+        std::cout << "NodePool " << poolTime << " ms, ";
+        std::cout << "speedup " << (heapTime / poolTime) << "x" << std::endl;
+    }
+}
+
+/// Every thread churns its own tree. With no shared state, throughput should grow with the thread count.
+void benchmarkParallelScaling() {
+    const int operationsPerThread = 1000000;
+    const int maxThreadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    double singleThreadThroughput = 0;
 
-                    // Case 3.
-                    z->parent->isRed = false;
-                    z->parent->parent->isRed = true;
-                    RBTree::rotateLeft(z->parent->parent);
+    for (int threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        auto threads = std::vector<std::thread>();
 
-                    break;
+        auto startTime = std::chrono::steady_clock::now();
+        for (int t = 0; t < threadCount; t += 1) {
+            threads.emplace_back([t]() {
+                auto generator = std::default_random_engine(t);
+                auto distribution = std::uniform_int_distribution(1, 10000);
+                auto tree = RBTree<int>();
+
+                // Alternate insertions and deletions so that the tree stays at about 5000 nodes.
+                for (int i = 0; i < operationsPerThread / 2; i += 1) {
+                    tree.insertValue(distribution(generator));
+                    tree.deleteValue(distribution(generator));
                 }
-            }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        auto endTime = std::chrono::steady_clock::now();
+
+        auto seconds = std::chrono::duration<double>(endTime - startTime).count();
+        auto throughput = threadCount * operationsPerThread / seconds;
+        if (threadCount == 1) {
+            singleThreadThroughput = throughput;
         }
 
-        // Red node propagation may convert the root node into a red node.
-        // In this case, we simply set it to black.
-        rootNode->isRed = false;
+        std::cout << threadCount << " threads: " << (throughput / 1e6) << " M ops/s, ";
+        std::cout << "scaling " << (throughput / singleThreadThroughput) << "x" << std::endl;
     }
+}
 
-public:
-    RBNode* insertValue(int newValue) {
-        // 1. Create the new node.
-        // The new node is by default red.
-        auto newNode = new RBNode(newValue, true);
+template <typename Operation>
+double getNanosecondsPerOperation(std::size_t count, Operation operation) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i += 1) {
+        operation(i);
+    }
+    auto endTime = std::chrono::steady_clock::now();
 
-        // 2. Insert the new node.
-        if (rootNode == RBNode::nilNode) {
-            rootNode = newNode;
-            rootNode->isRed = false;
-            return newNode;
-        }
+    return std::chrono::duration<double, std::nano>(endTime - startTime).count() / count;
+}
 
-        auto parentNode = RBNode::nilNode;
-        auto currentNode = rootNode;
+/**
+ * Inserts then searches for every key, in an order shuffled with a fixed seed.
+ *
+ * @param makeProbe Turns a stored key into the lookup argument, e.g. `std::string` into `std::string_view`.
+ */
+template <typename Tree, typename StdContainer, typename Key, typename MakeProbe>
+void compareKeyType(const char* name, std::vector<Key> keys, MakeProbe makeProbe) {
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(42));
+
+    auto tree = Tree();
+    auto container = StdContainer();
+    std::size_t foundCount = 0;
+
+    auto treeInsertTime = getNanosecondsPerOperation(keys.size(), [&](std::size_t i) {
+        tree.insertValue(keys[i]);
+    });
+    auto treeSearchTime = getNanosecondsPerOperation(keys.size(), [&](std::size_t i) {
+        foundCount += (tree.searchForValue(makeProbe(keys[i])) != Tree::Node::nilNode);
+    });
+
+    auto containerInsertTime = getNanosecondsPerOperation(keys.size(), [&](std::size_t i) {
+        container.emplace_hint(container.end(), keys[i], typename StdContainer::mapped_type());
+    });
+    auto containerSearchTime = getNanosecondsPerOperation(keys.size(), [&](std::size_t i) {
+        foundCount += (container.find(makeProbe(keys[i])) != container.end());
+    });
+
+    if (foundCount != 2 * keys.size()) {
+        std::cout << "Benchmark lookup failed." << std::endl;
+    }
 
-        while (currentNode != RBNode::nilNode) {
-            parentNode = currentNode;
+    std::cout << name << ": RBTree insert " << treeInsertTime << " ns, search " << treeSearchTime << " ns; ";
+    std::cout << "std::multimap insert " << containerInsertTime << " ns, search " << containerSearchTime << " ns" << std::endl;
+}
 
-            if (newValue <= currentNode->value) {
-                currentNode = currentNode->leftChild;
-            } else {
-                currentNode = currentNode->rightChild;
-            }
-        }
+struct Payload16 {
+    std::uint64_t words[2];
+};
 
-        newNode->parent = parentNode;
-        if (newValue <= parentNode->value) {
-            parentNode->leftChild = newNode;
-        } else {
-            parentNode->rightChild = newNode;
-        }
+void benchmarkKeyTypes() {
+    const std::size_t count = 1000000;
+    auto identity = [](const auto& key) -> const auto& { return key; };
 
-        // 3. Fix up colors.
-        fixUpInsertion(newNode);
+    auto intKeys = std::vector<int>(count);
+    std::iota(intKeys.begin(), intKeys.end(), 0);
+    compareKeyType<RBTree<int>, std::multimap<int, RBNoPayload>>("int", intKeys, identity);
 
-        return newNode;
+    auto wideKeys = std::vector<std::uint64_t>(count);
+    for (std::size_t i = 0; i < count; i += 1) {
+        wideKeys[i] = i * 0x9E3779B97F4A7C15ull;
     }
+    compareKeyType<RBTree<std::uint64_t, Payload16>, std::multimap<std::uint64_t, Payload16>>("uint64_t + 16 byte payload", wideKeys, identity);
 
+    auto stringKeys = std::vector<std::string>(count);
+    for (std::size_t i = 0; i < count; i += 1) {
+        stringKeys[i] = "user-" + std::to_string(wideKeys[i]);
+    }
+    auto toStringView = [](const std::string& key) { return std::string_view(key); };
+    compareKeyType<RBTree<std::string, RBNoPayload, std::less<>>, std::multimap<std::string, RBNoPayload, std::less<>>>("std::string via std::string_view", stringKeys, toStringView);
+}
 
-#pragma mark - Deletion
-private:
-    void transplantDuringDeletion(RBNode* oldNode, RBNode* newNode) {
-        if (oldNode->parent == RBNode::nilNode) {
-            rootNode = newNode;
-        } else if (oldNode == oldNode->parent->leftChild) {
-            oldNode->parent->leftChild = newNode;
-        } else {
-            oldNode->parent->rightChild = newNode;
+/// Startup from a sorted dump: one `insertValue` per key versus the bulk constructor.
+void benchmarkBulkConstruction() {
+    const int count = 10000000;
+
+    auto nums = std::vector<int>(count);
+    std::iota(nums.begin(), nums.end(), 0);
+
+    auto insertionStartTime = std::chrono::steady_clock::now();
+    {
+        auto tree = RBTree<int>();
+        for (const auto& num: nums) {
+            tree.insertValue(num);
         }
+    }
+    auto insertionEndTime = std::chrono::steady_clock::now();
+
+    auto bulkStartTime = std::chrono::steady_clock::now();
+    bool isValid = false;
+    {
+        auto tree = RBTree<int>(nums.begin(), nums.end());
+        auto bulkEndTime = std::chrono::steady_clock::now();
+        std::cout << count << " sorted keys: bulk construction " << std::chrono::duration<double, std::milli>(bulkEndTime - bulkStartTime).count() << " ms, ";
 
-        newNode->parent = oldNode->parent;    // This also assigns the shared sentinel as the parent of the root node.
+        isValid = isValidRBTree(tree);
     }
 
-    void fixUpDeletion(RBNode* x) {
-        while ((x != rootNode) && (!x->isRed)) {
-            if (x == x->parent->leftChild) {
-                /// Called `w` in the textbook.
-                auto sibling = x->parent->rightChild;
-                
-                if (sibling->isRed) {
-                    // Case 1 in textbook.
-                    // Preprocess. Rotate to produce a black sibling.
-                    // Sibling is red. Thus parent must be black. Sibling's children must be black.
+    std::cout << "insertValue loop " << std::chrono::duration<double, std::milli>(insertionEndTime - insertionStartTime).count() << " ms";
+    std::cout << (isValid ? "" : " (invalid tree!)") << std::endl;
+}
 
-                    sibling->isRed = false;
-                    x->parent->isRed = true;
-                    rotateLeft(x->parent);
-                    // The new black sibling.
-                    sibling = x->parent->rightChild;
-                }
+/// Percentile queries over live data: materializing `inOrderWalk()` per query versus `select`.
+void benchmarkOrderStatistics() {
+    const int count = 1000000;
+    const int queryCount = 100;
 
-                if ((!sibling->leftChild->isRed) && (!sibling->rightChild->isRed)) {
-                    // Case 2 in textbook.
-                    sibling->isRed = true;
-                    x = x->parent;
-                    continue;
-                } else {
-                    if (!sibling->rightChild->isRed) {
-                        // Case 3 in textbook.
-                        // Preprocess. Turns the sibling's right child into a red node.
-                        sibling->leftChild->isRed = false;
-                        sibling->isRed = true;
-                        rotateRight(sibling);
-                        sibling = x->parent->rightChild;
-                    }
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, count);
 
-                    // Case 4 in textbook.
-                    sibling->isRed = x->parent->isRed;
-                    x->parent->isRed = false;    // This adds an additional black node to the left subtree.
-                    sibling->rightChild->isRed = false;    // Adds a new black node on the right subtree as compensation.
-                    rotateLeft(x->parent);
-                    
-                    x = rootNode;    // This makes no sense but to terminate the while loop...
-                }
-            } else {
-                auto sibling = x->parent->leftChild;
+    auto plainTree = RBTree<int>();
+    auto orderStatisticTree = OrderStatisticTree<int>();
+    for (int i = 0; i < count; i += 1) {
+        auto num = distribution(generator);
+        plainTree.insertValue(num);
+        orderStatisticTree.insertValue(num);
+    }
 
-                if (sibling->isRed) {
-                    sibling->isRed = false;
-                    x->parent->isRed = true;
-                    rotateRight(x->parent);
-                    sibling = x->parent->leftChild;
-                }
+    long long checksum = 0;
+    auto walkTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        auto values = plainTree.inOrderWalk();
+        checksum += values[(values.size() - 1) * i / queryCount];
+    });
+    auto selectTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        checksum -= orderStatisticTree.select((count - 1) * i / queryCount)->value;
+    });
+
+    std::cout << count << " keys, percentile query: inOrderWalk " << (walkTime / 1e3) << " us, select " << (selectTime / 1e3) << " us";
+    std::cout << (checksum == 0 ? "" : " (mismatch!)") << std::endl;
+}
 
-                if ((!sibling->leftChild->isRed) && (!sibling->rightChild->isRed)) {
-                    sibling->isRed = true;
-                    x = x->parent;
-                    continue;
-                } else {
-                    if (!sibling->leftChild->isRed) {
-                        sibling->rightChild->isRed = false;
-                        sibling->isRed = true;
-                        rotateLeft(sibling);
-                        sibling = x->parent->leftChild;
-                    }
+/// Reservation overlap checks: `IntervalTree` versus scanning every interval.
+void benchmarkIntervalTree() {
+    const int count = 1000000;
+    const int queryCount = 1000;
+
+    auto generator = std::default_random_engine(42);
+    auto startDistribution = std::uniform_int_distribution(0, 1000000000);
+    auto lengthDistribution = std::uniform_int_distribution(0, 2000);
+
+    auto tree = IntervalTree<int>();
+    auto intervals = std::vector<std::pair<int, int>>();
+    for (int i = 0; i < count; i += 1) {
+        auto low = startDistribution(generator);
+        auto high = low + lengthDistribution(generator);
+        tree.insertInterval(low, high);
+        intervals.emplace_back(low, high);
+    }
 
-                    sibling->isRed = x->parent->isRed;
-                    x->parent->isRed = false;
-                    sibling->leftChild->isRed = false;
-                    rotateRight(x->parent);
+    auto queries = std::vector<std::pair<int, int>>();
+    for (int i = 0; i < queryCount; i += 1) {
+        auto low = startDistribution(generator);
+        queries.emplace_back(low, low + lengthDistribution(generator));
+    }
 
-                    x = rootNode;
-                }
+    std::size_t treeCount = 0;
+    std::size_t scanCount = 0;
+
+    auto anyTreeTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        treeCount += (tree.searchForOverlap(queries[i].first, queries[i].second) != IntervalTree<int>::Node::nilNode);
+    });
+    auto allTreeTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        tree.forEachOverlap(queries[i].first, queries[i].second, [&](IntervalTree<int>::Node*) {
+            treeCount += 1;
+        });
+    });
+    auto scanTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        bool hasOverlap = false;
+        for (const auto& [low, high]: intervals) {
+            if ((low <= queries[i].second) && (queries[i].first <= high)) {
+                hasOverlap = true;
+                scanCount += 1;
             }
         }
+        scanCount += hasOverlap;
+    });
 
-        x->isRed = false;    // x is either root or a red node that compensates for black loss.
-    }
+    std::cout << count << " intervals: any overlap " << anyTreeTime << " ns, all overlaps " << allTreeTime << " ns, ";
+    std::cout << "brute-force scan " << (scanTime / 1e3) << " us";
+    std::cout << (treeCount == scanCount ? "" : " (mismatch!)") << std::endl;
+}
 
-public:
-    void deleteNode(RBNode* z) {
-        /// The node that moves into `y`'s original location.
-        RBNode* x = nullptr;
+/// Reading the 10 smallest keys: `inOrderWalk()` versus iterators.
+void benchmarkIterators() {
+    const int count = 1000000;
+    const int queryCount = 100;
+
+    auto nums = std::vector<int>(count);
+    std::iota(nums.begin(), nums.end(), 0);
+    auto tree = RBTree<int>(nums.begin(), nums.end());
+
+    long long checksum = 0;
+    auto walkTime = getNanosecondsPerOperation(queryCount, [&](std::size_t) {
+        auto values = tree.inOrderWalk();
+        checksum += std::accumulate(values.begin(), values.begin() + 10, 0);
+    });
+    auto iteratorTime = getNanosecondsPerOperation(queryCount, [&](std::size_t) {
+        auto it = tree.begin();
+        for (int i = 0; i < 10; i += 1, ++it) {
+            checksum -= *it;
+        }
+    });
 
-        /**
-         * The removed node or the replacement node, depending on the case.
-         * 
-         * If this is a black node, we'll need to re-evaluate the Red Black Tree properties.
-         */
-        auto y = z;
-        bool isYOriginallyRed = y->isRed;
+    std::cout << count << " keys, first 10 in order: inOrderWalk " << (walkTime / 1e3) << " us, iterators " << iteratorTime << " ns";
+    std::cout << (checksum == 0 ? "" : " (mismatch!)") << std::endl;
+}
 
-        if (z->leftChild == RBNode::nilNode) {
-            // y represents the removed node (the same as z).
-            x = z->rightChild;
-            transplantDuringDeletion(z, z->rightChild);
-        } else if (z->rightChild == RBNode::nilNode) {
-            // y represents the removed node (the same as z).
-            x = z->leftChild;
-            transplantDuringDeletion(z, z->leftChild);
-        } else {
-            // y represents the node that replaces z.
-            y = RBTree::getMinNodeOfSubtree(z->rightChild);
-            isYOriginallyRed = y->isRed;
+/// Insertion of timestamp-like streams from the root versus from the previous insertion, with and without in-order links.
+void benchmarkHintedInsertion() {
+    using ThreadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>;
 
-            // We are sure here that y must not have a left child.
-            // So x here is either y's right child or the nil sentinel.
-            x = y->rightChild;
+    const int count = 4000000;
 
-            if (y->parent == z) {
-                x->parent = y;
-            } else {
-                transplantDuringDeletion(y, y->rightChild);
-                y->rightChild = z->rightChild;
-                y->rightChild->parent = y;
-            }
+    auto generator = std::default_random_engine(42);
+    auto jitterDistribution = std::uniform_int_distribution(-64, 64);
+    auto streams = std::vector<std::pair<std::string, std::vector<int>>>({{"sorted", {}}, {"reverse-sorted", {}}, {"jittered", {}}});
+    for (int i = 0; i < count; i += 1) {
+        streams[0].second.push_back(i);
+        streams[1].second.push_back(count - i);
+        // Roughly ascending: each key lands among the last ~100 insertions.
+        streams[2].second.push_back(i + jitterDistribution(generator));
+    }
 
-            transplantDuringDeletion(z, y);
-            y->leftChild = z->leftChild;
-            y->leftChild->parent = y;
-            y->isRed = z->isRed;
-        }
+    for (const auto& [name, keys]: streams) {
+        auto measure = [&](auto tree, bool isHinted) {
+            using Node = typename decltype(tree)::Node;
 
-        if (!isYOriginallyRed) {
-            fixUpDeletion(x);
-        }
+            auto hint = Node::nilNode;
+            return getNanosecondsPerOperation(keys.size(), [&](std::size_t i) {
+                hint = isHinted ? tree.insertValue(hint, keys[i]) : tree.insertValue(keys[i]);
+            });
+        };
 
-        delete z;
+        std::cout << name << ", " << count << " keys, ns per insertion: root " << measure(RBTree<int>(), false);
+        std::cout << ", hinted " << measure(RBTree<int>(), true) << "; with in-order links: root " << measure(ThreadedTree(), false) << ", hinted " << measure(ThreadedTree(), true) << std::endl;
     }
+}
 
-    bool deleteValue(int value) {
-        auto node = searchForValue(value);
-        if (node == RBNode::nilNode) {
-            return false;
-        } else {
-            deleteNode(node);
-            return true;
+/// Random lookups, one at a time versus in batches of 256, on a tree that fits in the cache and on one far larger than it.
+void benchmarkBatchedSearch() {
+    const int queryCount = 4000000;
+    const std::size_t batchSize = 256;
+
+    for (int count: {1 << 16, 1 << 24}) {
+        auto nums = std::vector<int>(count);
+        std::iota(nums.begin(), nums.end(), 0);
+        auto tree = RBTree<int>(nums.begin(), nums.end());
+
+        auto generator = std::default_random_engine(42);
+        auto distribution = std::uniform_int_distribution(0, 2 * count);
+        auto queries = std::vector<int>(queryCount);
+        for (auto& query: queries) {
+            query = distribution(generator);
         }
+
+        std::size_t scalarFoundCount = 0;
+        std::size_t batchedFoundCount = 0;
+        auto scalarTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            scalarFoundCount += (tree.searchForValue(queries[i]) != RBTree<int>::Node::nilNode);
+        });
+        auto results = std::vector<RBTree<int>::Node*>(batchSize);
+        auto batchedTime = getNanosecondsPerOperation(queryCount / batchSize, [&](std::size_t i) {
+            tree.searchForValues(queries.data() + i * batchSize, batchSize, results.data());
+            for (auto result: results) {
+                batchedFoundCount += (result != RBTree<int>::Node::nilNode);
+            }
+        }) / batchSize;
+
+        std::cout << count << " keys, M lookups/s: one at a time " << (1e3 / scalarTime) << ", batched " << (1e3 / batchedTime);
+        std::cout << (scalarFoundCount == batchedFoundCount ? "" : " (mismatch!)") << std::endl;
     }
-};
+}
 
+/// Full in-order scans of a tree built by random insertion, so that nodes are scattered: parent climbs versus in-order links.
+void benchmarkThreadedIteration() {
+    using ThreadedTree = RBTree<int, RBNoPayload, std::less<int>, RBInOrderLinks<int>>;
+
+    const int count = 1000000;
+    const int scanCount = 10;
+
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, 10 * count);
+    auto tree = RBTree<int>();
+    auto threadedTree = ThreadedTree();
+    for (int i = 0; i < count; i += 1) {
+        auto num = distribution(generator);
+        tree.insertValue(num);
+        threadedTree.insertValue(num);
+    }
 
-#pragma mark - Helpers
-void printVector(std::vector<int> v) {
-    for (const int& num: v) {
-        std::cout << num << " ";
+    long long plainSum = 0;
+    long long threadedSum = 0;
+    auto plainTime = getNanosecondsPerOperation(scanCount, [&](std::size_t) {
+        plainSum += std::accumulate(tree.begin(), tree.end(), 0LL);
+    });
+    auto threadedTime = getNanosecondsPerOperation(scanCount, [&](std::size_t) {
+        threadedSum += std::accumulate(threadedTree.begin(), threadedTree.end(), 0LL);
+    });
+    auto plainReverseTime = getNanosecondsPerOperation(scanCount, [&](std::size_t) {
+        plainSum -= std::accumulate(tree.rbegin(), tree.rend(), 0LL);
+    });
+    auto threadedReverseTime = getNanosecondsPerOperation(scanCount, [&](std::size_t) {
+        threadedSum -= std::accumulate(threadedTree.rbegin(), threadedTree.rend(), 0LL);
+    });
+
+    std::cout << count << " keys, ns per step: forward " << (plainTime / count) << " -> " << (threadedTime / count);
+    std::cout << ", reverse " << (plainReverseTime / count) << " -> " << (threadedReverseTime / count);
+    std::cout << ((plainSum == 0) && (threadedSum == 0) ? "" : " (mismatch!)") << std::endl;
+}
+
+/// Few distinct keys, many copies: one node per copy versus one node per key.
+void benchmarkCountedTree() {
+    const int count = 4000000;
+    const int distinctCount = 1000;
+
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, distinctCount - 1);
+    auto nums = std::vector<int>(count);
+    for (auto& num: nums) {
+        num = distribution(generator);
     }
-    std::cout << std::endl;
+
+    auto tree = RBTree<int>();
+    auto countedTree = CountedRBTree<int>();
+    auto insertionTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+        tree.insertValue(nums[i]);
+    });
+    auto countedInsertionTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+        countedTree.insertValue(nums[i]);
+    });
+
+    std::size_t foundCount = 0;
+    std::size_t countedFoundCount = 0;
+    auto searchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+        foundCount += (tree.searchForValue(nums[count - 1 - i]) != RBTree<int>::Node::nilNode);
+    });
+    auto countedSearchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+        countedFoundCount += (countedTree.searchForValue(nums[count - 1 - i]) != CountedRBTree<int>::Node::nilNode);
+    });
+
+    std::cout << count << " keys, " << distinctCount << " distinct: height " << tree.getHeight() << " -> " << countedTree.getHeight();
+    std::cout << ", node bytes " << (sizeof(RBTree<int>::Node) * static_cast<std::size_t>(count)) << " -> " << (sizeof(CountedRBTree<int>::Node) * distinctCount);
+    std::cout << ", ns per insertion " << insertionTime << " -> " << countedInsertionTime;
+    std::cout << ", ns per search " << searchTime << " -> " << countedSearchTime;
+    std::cout << ((foundCount == countedFoundCount) ? "" : " (mismatch!)") << std::endl;
 }
 
+/// Moving half the entries, with string payloads, from one shard to another: delete and insert again versus node handles.
+void benchmarkNodeHandles() {
+    using PayloadTree = RBTree<int, std::string>;
 
-#pragma mark - Tests
-#pragma mark Rotation
-void testRotation() {
+    const int count = 100000;
+
+    auto nums = std::vector<int>(count);
+    std::iota(nums.begin(), nums.end(), 0);
+    std::shuffle(nums.begin(), nums.end(), std::default_random_engine(42));
+    auto makeShard = [&]() {
+        auto tree = PayloadTree();
+        for (auto num: nums) {
+            tree.insertValue(num, "payload of key " + std::to_string(num));
+        }
+        return tree;
+    };
+
+    auto sourceTree = makeShard();
+    auto targetTree = PayloadTree();
+    auto copyTime = getNanosecondsPerOperation(count / 2, [&](std::size_t i) {
+        auto node = sourceTree.searchForValue(nums[i]);
+        targetTree.insertValue(node->value, node->payload);
+        sourceTree.deleteNode(node);
+    });
+
+    auto handleSourceTree = makeShard();
+    auto handleTargetTree = PayloadTree();
+    auto handleTime = getNanosecondsPerOperation(count / 2, [&](std::size_t i) {
+        handleTargetTree.insertNode(handleSourceTree.extractValue(nums[i]));
+    });
+
+    std::cout << (count / 2) << " of " << count << " entries moved, ns per entry: delete and insert " << copyTime << ", node handles " << handleTime;
+    std::cout << ((targetTree.inOrderWalk() == handleTargetTree.inOrderWalk()) ? "" : " (mismatch!)") << std::endl;
 }
 
-#pragma mark Insertion
-void testInsertion1() {
-    auto randomSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    auto generator = std::default_random_engine(randomSeed);
+/// Memory reported for 1M keys, and the cost of tearing them down: pooled integer nodes are dropped with their slabs, string nodes are visited one by one.
+void benchmarkTeardown() {
+    const int count = 1000000;
 
-    std::vector<int> nums = {1, 2, 3, 4, 5, 6, 7, 8, 9};
-    std::shuffle(nums.begin(), nums.end(), generator);
+    auto intTree = RBTree<int>();
+    auto stringTree = RBTree<std::string>();
+    for (int i = 0; i < count; i += 1) {
+        intTree.insertValue(i);
+        stringTree.insertValue("key number " + std::to_string(i));
+    }
 
-    // auto tree = std::unique_ptr<RBTree>(new RBTree());
-    auto tree = new RBTree();
-    for (const int& num: nums) {
-        auto newNode = tree->insertValue(num);
-        std::cout << "New value: " << newNode->value << std::endl;
+    for (auto [name, usage]: {std::make_pair("int", intTree.getMemoryUsage()), std::make_pair("string", stringTree.getMemoryUsage())}) {
+        std::cout << name << " keys: " << usage.liveNodeCount << " nodes, " << usage.usedByteCount << " bytes used, " << usage.reservedByteCount << " reserved" << std::endl;
+    }
 
-        auto result = tree->inOrderWalk();
-        printVector(result);
+    auto intTime = getNanosecondsPerOperation(1, [&](std::size_t) {
+        intTree.clear();
+    });
+    auto stringTime = getNanosecondsPerOperation(1, [&](std::size_t) {
+        stringTree.clear();
+    });
+    std::cout << "clear(), ns per node: int " << (intTime / count) << ", string " << (stringTime / count) << std::endl;
+}
+
+/// Range reads of about 100 keys: filtering `inOrderWalk()` versus `forEachInRange`.
+void benchmarkRangeScans() {
+    const int count = 1000000;
+    const int queryCount = 1000;
+
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, 10 * count);
+
+    auto tree = RBTree<int>();
+    auto reference = std::multiset<int>();
+    for (int i = 0; i < count; i += 1) {
+        auto num = distribution(generator);
+        tree.insertValue(num);
+        reference.insert(num);
     }
 
-    std::cout << "Min value: " << tree->getMinNode()->value << std::endl;
-    std::cout << "Max value: " << tree->getMaxNode()->value << std::endl;
+    auto queries = std::vector<int>();
+    for (int i = 0; i < queryCount; i += 1) {
+        queries.push_back(distribution(generator));
+    }
 
-    auto node6 = tree->searchForValue(6);
-    auto predecessor = tree->getPredecessor(node6);
-    auto successor = tree->getSuccessor(node6);
-    std::cout << "Found value 6: " << node6->value << std::endl;
-    std::cout << "Predecessor: " << predecessor->value << std::endl;
-    std::cout << "Successor: " << successor->value << std::endl;
+    // A full walk per query is slow, so it only runs for the first 1% of the queries.
+    long long walkSum = 0;
+    long long rangeSum = 0;
+    long long setSum = 0;
 
-    delete tree;
+    auto walkTime = getNanosecondsPerOperation(queryCount / 100, [&](std::size_t i) {
+        for (const auto& value: tree.inOrderWalk()) {
+            if ((value >= queries[i]) && (value < queries[i] + 1000)) {
+                walkSum += value;
+            }
+        }
+    });
+    auto rangeTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        tree.forEachInRange(queries[i], queries[i] + 1000, [&](RBTree<int>::Node* node) {
+            rangeSum += node->value;
+        });
+    });
+    auto setTime = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+        auto last = reference.lower_bound(queries[i] + 1000);
+        for (auto it = reference.lower_bound(queries[i]); it != last; ++it) {
+            setSum += *it;
+        }
+    });
+
+    std::cout << count << " keys, [x, x + 1000) range read: inOrderWalk " << (walkTime / 1e3) << " us, forEachInRange " << rangeTime << " ns, ";
+    std::cout << "std::multiset " << setTime << " ns" << ((rangeSum == setSum) && (walkSum <= rangeSum) ? "" : " (mismatch!)") << std::endl;
 }
 
-void testInsertion2() {
-    auto distribution = std::uniform_int_distribution(1, 21);
+/// Merging two large trees: `setUnion` versus inserting every key of the smaller tree into the larger one.
+void benchmarkSetOperations() {
+    const int count = 10000000;
 
-    auto randomSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    auto generator = std::default_random_engine(randomSeed);
+    auto generator = std::default_random_engine(42);
+    auto distribution = std::uniform_int_distribution(0, 4 * count);
 
-    auto dice = std::bind(distribution, generator);
+    auto makeKeys = [&](int keyCount) {
+        auto keys = std::vector<int>(keyCount);
+        for (auto& key: keys) {
+            key = distribution(generator);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    };
+
+    for (int secondCount: {count / 1000, count / 10, count}) {
+        auto firstKeys = makeKeys(count);
+        auto secondKeys = makeKeys(secondCount);
+
+        auto insertionTree = RBTree<int>(firstKeys.begin(), firstKeys.end());
+        auto insertionStartTime = std::chrono::steady_clock::now();
+        for (const auto& key: secondKeys) {
+            if (insertionTree.searchForValue(key) == RBTree<int>::Node::nilNode) {
+                insertionTree.insertValue(key);
+            }
+        }
+        auto insertionEndTime = std::chrono::steady_clock::now();
+
+        auto firstTree = RBTree<int>(firstKeys.begin(), firstKeys.end());
+        auto secondTree = RBTree<int>(secondKeys.begin(), secondKeys.end());
+        auto unionStartTime = std::chrono::steady_clock::now();
+        auto unionTree = RBTree<int>::setUnion(std::move(firstTree), std::move(secondTree));
+        auto unionEndTime = std::chrono::steady_clock::now();
+
+        auto differenceTime = 0.0;
+        {
+            auto firstTree = RBTree<int>(firstKeys.begin(), firstKeys.end());
+            auto secondTree = RBTree<int>(secondKeys.begin(), secondKeys.end());
+            auto startTime = std::chrono::steady_clock::now();
+            auto differenceTree = RBTree<int>::setDifference(std::move(firstTree), std::move(secondTree));
+            differenceTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        }
 
-    auto tree = new RBTree();
+        bool isMatching = std::equal(unionTree.begin(), unionTree.end(), insertionTree.begin(), insertionTree.end());
 
-    for (int i = 0; i < 20; i += 1) {
-        const auto num = dice();
-        auto newNode = tree->insertValue(num);
+        std::cout << firstKeys.size() << " + " << secondKeys.size() << " keys: setUnion " << std::chrono::duration<double, std::milli>(unionEndTime - unionStartTime).count() << " ms, ";
+        std::cout << "insertValue loop " << std::chrono::duration<double, std::milli>(insertionEndTime - insertionStartTime).count() << " ms, ";
+        std::cout << "setDifference " << differenceTime << " ms (" << std::thread::hardware_concurrency() << " threads)" << (isMatching ? "" : " (mismatch!)") << std::endl;
+    }
+}
 
-        std::cout << "New value: (" << num << ", " << newNode->value << ")" << std::endl;
+/**
+ * Full scans on reader threads while one writer churns the tree, for one second each.
+ *
+ * A mutex around `RBTree` stalls the writer for the length of every scan. Snapshots of `PersistentRBTree` let both run at once.
+ */
+void benchmarkSnapshotReads() {
+    const int count = 100000;
+    const auto duration = std::chrono::seconds(1);
+
+    auto nums = std::vector<int>(count);
+    std::iota(nums.begin(), nums.end(), 0);
+
+    for (int readerCount: {1, 2, 4}) {
+        auto lockedTree = RBTree<int>(nums.begin(), nums.end());
+        auto mutex = std::mutex();
+        auto persistentTree = PersistentRBTree<int>();
+        for (const auto& num: nums) {
+            persistentTree.insertValue(num);
+        }
 
-        auto result = tree->inOrderWalk();
-        printVector(result);
+        // {scans, writes} per second.
+        auto measure = [&](auto scan, auto write) {
+            std::atomic<bool> isDone = false;
+            std::atomic<long long> scanCount = 0;
+            auto readers = std::vector<std::thread>();
+            for (int t = 0; t < readerCount; t += 1) {
+                readers.emplace_back([&]() {
+                    while (!isDone) {
+                        scan();
+                        scanCount += 1;
+                    }
+                });
+            }
+
+            long long writeCount = 0;
+            auto endTime = std::chrono::steady_clock::now() + duration;
+            auto generator = std::default_random_engine(42);
+            auto distribution = std::uniform_int_distribution(0, count - 1);
+            while (std::chrono::steady_clock::now() < endTime) {
+                write(distribution(generator));
+                writeCount += 1;
+            }
+
+            isDone = true;
+            for (auto& reader: readers) {
+                reader.join();
+            }
+
+            return std::make_pair(scanCount.load(), writeCount);
+        };
+
+        long long checksum = 0;
+        auto [lockedScans, lockedWrites] = measure(
+            [&]() {
+                auto lock = std::lock_guard<std::mutex>(mutex);
+                long long sum = 0;
+                for (const auto& value: lockedTree) {
+                    sum += value;
+                }
+                checksum += (sum > 0);
+            },
+            [&](int key) {
+                auto lock = std::lock_guard<std::mutex>(mutex);
+                lockedTree.deleteValue(key);
+                lockedTree.insertValue(key);
+            }
+        );
+        std::atomic<long long> snapshotChecksum = 0;
+        auto [snapshotScans, snapshotWrites] = measure(
+            [&]() {
+                auto snapshot = persistentTree.getSnapshot();
+                long long sum = 0;
+                for (const auto& value: snapshot) {
+                    sum += value;
+                }
+                snapshotChecksum += (sum > 0);
+            },
+            [&](int key) {
+                persistentTree.deleteValue(key);
+                persistentTree.insertValue(key);
+            }
+        );
+
+        std::cout << count << " keys, " << readerCount << " readers: mutex + RBTree " << lockedScans << " scans/s, " << lockedWrites << " writes/s; ";
+        std::cout << "PersistentRBTree snapshots " << snapshotScans << " scans/s, " << snapshotWrites << " writes/s";
+        std::cout << ((checksum == lockedScans) && (snapshotChecksum == snapshotScans) ? "" : " (mismatch!)") << std::endl;
     }
+}
 
-    delete tree;
+/**
+ * Lookups in a frozen copy versus the live tree, for random keys of which half are present.
+ *
+ * Throughput runs independent lookups back to back, so the CPU overlaps their cache misses.
+ * Latency makes every key depend on the previous result, so each lookup waits for the last one.
+ * 100M keys need about 6 GB for the live tree alone, so the largest size is left out.
+ */
+void benchmarkEytzingerSnapshot() {
+    const int queryCount = 1000000;
+
+    for (int count: {1000, 10000, 100000, 1000000, 10000000 /*, 100000000 */}) {
+        auto keys = std::vector<int>(count);
+        for (int i = 0; i < count; i += 1) {
+            keys[i] = 2 * i;
+        }
+
+        auto tree = RBTree<int>(keys.begin(), keys.end());
+        auto snapshot = EytzingerSnapshot<int>(tree.begin(), tree.end());
+
+        auto generator = std::default_random_engine(42);
+        auto distribution = std::uniform_int_distribution(0, 2 * count - 1);
+        auto queries = std::vector<int>(queryCount);
+        for (auto& query: queries) {
+            query = distribution(generator);
+        }
+
+        long long treeSum = 0;
+        long long snapshotSum = 0;
+        long long vectorSum = 0;
+        auto treeThroughput = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            treeSum += (tree.searchForValue(queries[i]) != RBTree<int>::Node::nilNode);
+        });
+        auto snapshotThroughput = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            snapshotSum += (snapshot.searchForValue(queries[i]) != nullptr);
+        });
+        auto vectorThroughput = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            vectorSum += std::binary_search(keys.begin(), keys.end(), queries[i]);
+        });
+
+        int treeFeedback = 0;
+        int snapshotFeedback = 0;
+        auto treeLatency = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            treeFeedback = (tree.searchForValue(queries[i] ^ treeFeedback) != RBTree<int>::Node::nilNode);
+        });
+        auto snapshotLatency = getNanosecondsPerOperation(queryCount, [&](std::size_t i) {
+            snapshotFeedback = (snapshot.searchForValue(queries[i] ^ snapshotFeedback) != nullptr);
+        });
+
+        std::cout << count << " keys: RBTree " << treeThroughput << " ns/op (latency " << treeLatency << " ns), ";
+        std::cout << "EytzingerSnapshot " << snapshotThroughput << " ns/op (latency " << snapshotLatency << " ns), ";
+        std::cout << "std::binary_search " << vectorThroughput << " ns/op";
+        std::cout << (((treeSum == snapshotSum) && (snapshotSum == vectorSum) && (treeFeedback == snapshotFeedback)) ? "" : " (mismatch!)") << std::endl;
+    }
 }
 
-#pragma mark Insertion and Deletion
-void testInsertionAndDeletion() {
-    auto tree = new RBTree();
 
-    auto nums = std::vector<int>(1000);
-    std::iota(nums.begin(), nums.end(), 1);    // 1 ~ 1000
+/// Bytes per key and the speed of random inserts and lookups, `RBTree` against `CompactRBTree`.
+void benchmarkCompactNodes() {
+    std::cout << "sizeof(RBTree<int>::Node) " << sizeof(RBTree<int>::Node) << ", sizeof(CompactRBTree<int>::Node) " << sizeof(CompactRBTree<int>::Node) << std::endl;
+
+    for (int count: {1000, 100000, 1000000, 10000000}) {
+        auto keys = std::vector<int>(count);
+        std::iota(keys.begin(), keys.end(), 0);
+        std::shuffle(keys.begin(), keys.end(), std::default_random_engine(42));
+        auto queries = keys;
+        std::shuffle(queries.begin(), queries.end(), std::default_random_engine(43));
+
+        std::size_t treeFoundCount = 0;
+        std::size_t compactFoundCount = 0;
+
+        auto tree = RBTree<int>();
+        auto treeInsertTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            tree.insertValue(keys[i]);
+        });
+        auto treeSearchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            treeFoundCount += (tree.searchForValue(queries[i]) != RBTree<int>::Node::nilNode);
+        });
+
+        auto compactTree = CompactRBTree<int>();
+        auto compactInsertTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            compactTree.insertValue(keys[i]);
+        });
+        auto compactSearchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            compactFoundCount += (compactTree.searchForValue(queries[i]) != compactTree.end());
+        });
+
+        // The pool hands out whole slabs, the compact tree a geometrically grown array.
+        auto treeBytesPerKey = static_cast<double>(sizeof(RBTree<int>::Node)) * ((count + 511) / 512 * 512) / count;
+        auto compactBytesPerKey = static_cast<double>(compactTree.getNodeBytes()) / count;
+
+        std::cout << count << " keys: RBTree " << treeBytesPerKey << " B/key, insert " << treeInsertTime << " ns, search " << treeSearchTime << " ns; ";
+        std::cout << "CompactRBTree " << compactBytesPerKey << " B/key, insert " << compactInsertTime << " ns, search " << compactSearchTime << " ns";
+        std::cout << (((treeFoundCount == compactFoundCount) && (compactFoundCount == static_cast<std::size_t>(count))) ? "" : " (mismatch!)") << std::endl;
+    }
+}
 
-    auto randomSeed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    auto generator = std::default_random_engine(randomSeed);
 
-    for (int i = 0; i < 100; i += 1) {
-        auto numsCopy = nums;
+/**
+ * Time from start to the first answered query: re-inserting every key, bulk construction from a sorted array, and mapping a saved file.
+ *
+ * The file is still in the page cache here. Drop the cache between saving and mapping (`echo 3 > /proc/sys/vm/drop_caches`) to measure a true cold start.
+ */
+void benchmarkMappedTree() {
+    auto path = (std::filesystem::temp_directory_path() / "red black tree benchmark.map").string();
+
+    for (int count: {1000000, 10000000 /*, 100000000 */}) {
+        auto keys = std::vector<int>(count);
+        std::iota(keys.begin(), keys.end(), 0);
+        auto shuffledKeys = keys;
+        std::shuffle(shuffledKeys.begin(), shuffledKeys.end(), std::default_random_engine(42));
+        const int probe = count / 3;
+
+        auto startTime = std::chrono::steady_clock::now();
+        {
+            auto tree = RBTree<int>();
+            for (auto key: shuffledKeys) {
+                tree.insertValue(key);
+            }
+            if (tree.searchForValue(probe) == RBTree<int>::Node::nilNode) {
+                std::cout << "Benchmark lookup failed." << std::endl;
+            }
+        }
+        auto insertionTime = std::chrono::steady_clock::now() - startTime;
 
-        std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
-        for (const auto& num: numsCopy) {
-            tree->insertValue(num);
-            // printVector(tree->inOrderWalk());
+        startTime = std::chrono::steady_clock::now();
+        {
+            auto tree = RBTree<int>(keys.begin(), keys.end());
+            if (tree.searchForValue(probe) == RBTree<int>::Node::nilNode) {
+                std::cout << "Benchmark lookup failed." << std::endl;
+            }
+            MappedTree<int>::writeFile(path, tree.rootNode, RBTree<int>::Node::nilNode);
         }
-        auto result1 = tree->inOrderWalk();
-        if (result1 == nums) {
-            std::cout << "Insertion success! ";
-        } else {
-            std::cout << "Insertion failed. ";
+        auto bulkConstructionTime = std::chrono::steady_clock::now() - startTime;
+
+        startTime = std::chrono::steady_clock::now();
+        auto mappedTree = MappedTree<int>(path);
+        if (mappedTree.searchForValue(probe) == nullptr) {
+            std::cout << "Benchmark lookup failed." << std::endl;
         }
+        auto mappingTime = std::chrono::steady_clock::now() - startTime;
+
+        // Lookups once every page has been touched.
+        std::size_t foundCount = 0;
+        auto searchTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            foundCount += (mappedTree.searchForValue(shuffledKeys[i]) != nullptr);
+        });
+
+        using Microseconds = std::chrono::duration<double, std::micro>;
+        std::cout << count << " keys (" << std::filesystem::file_size(path) / (1 << 20) << " MiB file): first query after ";
+        std::cout << "insertValue " << Microseconds(insertionTime).count() << " us, ";
+        std::cout << "bulk construction + save " << Microseconds(bulkConstructionTime).count() << " us, ";
+        std::cout << "mapping " << Microseconds(mappingTime).count() << " us; mapped search " << searchTime << " ns";
+        std::cout << ((foundCount == static_cast<std::size_t>(count)) ? "" : " (mismatch!)") << std::endl;
+    }
 
-        std::shuffle(numsCopy.begin(), numsCopy.end(), generator);
-        for (const auto& num: numsCopy) {
-            tree->deleteValue(num);
-            // printVector(tree->inOrderWalk());
+    std::filesystem::remove(path);
+}
+
+
+/// Insertions per second without a log, with asynchronous syncs, and with a sync per acknowledged insertion from 1 to 16 threads.
+void benchmarkDurableTree() {
+    auto directory = std::filesystem::temp_directory_path() / "red black tree durable benchmark";
+    const int count = 200000;
+
+    auto keys = std::vector<int>(count);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(42));
+
+    auto plainTime = getNanosecondsPerOperation(count, [&, tree = RBTree<int>()](std::size_t i) mutable {
+        tree.insertValue(keys[i]);
+    });
+    std::cout << "RBTree: " << 1e9 / plainTime << " insertions/s" << std::endl;
+
+    auto asynchronousOptions = DurabilityOptions();
+    asynchronousOptions.waitsForSync = false;
+    std::filesystem::remove_all(directory);
+    {
+        auto tree = DurableRBTree<int>(directory.string(), asynchronousOptions);
+        auto asynchronousTime = getNanosecondsPerOperation(count, [&](std::size_t i) {
+            tree.insertValue(keys[i]);
+        });
+        std::cout << "DurableRBTree, asynchronous syncs: " << 1e9 / asynchronousTime << " insertions/s" << std::endl;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    {
+        auto tree = DurableRBTree<int>(directory.string(), asynchronousOptions);
+        if (tree.inOrderWalk().size() != static_cast<std::size_t>(count)) {
+            std::cout << "Benchmark recovery failed." << std::endl;
         }
-        auto result2 = tree->inOrderWalk();
-        if (result2.size() == 0) {
-            std::cout << "Deletion success!" << std::endl;
-        } else {
-            std::cout << "Deletion failed." << std::endl;
+    }
+    std::cout << "Recovery of " << count << " logged insertions: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() << " ms" << std::endl;
+
+    for (int threadCount: {1, 4, 16}) {
+        std::filesystem::remove_all(directory);
+        auto tree = DurableRBTree<int>(directory.string());
+        const int countPerThread = 2000;
+
+        auto startTime = std::chrono::steady_clock::now();
+        auto threads = std::vector<std::thread>();
+        for (int t = 0; t < threadCount; t += 1) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < countPerThread; i += 1) {
+                    tree.insertValue(keys[t * countPerThread + i]);
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
         }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::cout << "DurableRBTree, sync per insertion, " << threadCount << " threads: " << threadCount * countPerThread / seconds << " insertions/s" << std::endl;
     }
 
-    delete tree;
+    std::filesystem::remove_all(directory);
 }
 
 
 int main() {
-    // auto tree = new RBTree();
+    // auto tree = new RBTree<int>();
     // std::cout << RBNode::nilNode->isRed << std::endl;
     // testInsertion1();
     testInsertionAndDeletion();
+    testParallelTrees();
+    testGenericKeys();
+    testBulkConstruction();
+    testOrderStatistics();
+    testIntervalTree();
+    testIterators();
+    testBounds();
+    testHintedInsertion();
+    testBatchedSearch();
+    testThreadedTree();
+    testCountedTree();
+    testNodeHandles();
+    testMemoryUsage();
+    testSplitAndJoin();
+    testSetOperations();
+    testPersistentTree();
+    testPersistentTreeReaders();
+    testEytzingerSnapshot();
+    testCompactTree();
+    testMappedTree();
+    testDurableTree();
+    testTreeStats();
+    // benchmarkNodePool();
+    // benchmarkParallelScaling();
+    // benchmarkKeyTypes();
+    // benchmarkBulkConstruction();
+    // benchmarkOrderStatistics();
+    // benchmarkIntervalTree();
+    // benchmarkIterators();
+    // benchmarkHintedInsertion();
+    // benchmarkBatchedSearch();
+    // benchmarkThreadedIteration();
+    // benchmarkCountedTree();
+    // benchmarkNodeHandles();
+    // benchmarkTeardown();
+    // benchmarkRangeScans();
+    // benchmarkSetOperations();
+    // benchmarkSnapshotReads();
+    // benchmarkEytzingerSnapshot();
+    // benchmarkCompactNodes();
+    // benchmarkMappedTree();
+    // benchmarkDurableTree();
 
     return 0;
 }
@@ -0,0 +1,3299 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "node pool.hpp"
+#include "tree stats.hpp"
+
+
+/// Payload type of trees that store keys only. Fits into the padding after small keys.
+struct RBNoPayload {
+};
+
+
+/**
+ * Per-subtree data that is recomputed from a node and its two children (CLRS 14.2).
+ *
+ * `Fields` becomes a base class of every node. The sentinel keeps its default-constructed fields, which must be the identity of `update`.
+ */
+struct RBNoAugmentation {
+    struct Fields {
+    };
+
+    static constexpr bool isEnabled = false;
+
+    template <typename Node>
+    static void update(Node*) {
+    }
+};
+
+/// Subtree sizes for order statistics (CLRS 14.1).
+struct RBSubtreeSize {
+    struct Fields {
+        std::size_t size = 0;
+    };
+
+    static constexpr bool isEnabled = true;
+
+    template <typename Node>
+    static void update(Node* node) {
+        node->size = node->leftChild->size + node->rightChild->size + 1;
+    }
+};
+
+/// Largest high endpoint in each subtree of an interval tree (CLRS 14.3). Nodes carry an `RBIntervalPayload`.
+template <typename T>
+struct RBMaxHighEndpoint {
+    struct Fields {
+        T maxHighEndpoint = std::numeric_limits<T>::lowest();
+    };
+
+    static constexpr bool isEnabled = true;
+
+    template <typename Node>
+    static void update(Node* node) {
+        node->maxHighEndpoint = std::max({node->payload.highEndpoint, node->leftChild->maxHighEndpoint, node->rightChild->maxHighEndpoint});
+    }
+};
+
+
+template <typename T, typename Payload, typename Augmentation>
+class RBNode;
+
+/**
+ * Threads the nodes into a doubly linked list in key order, so that `getSuccessor` and `getPredecessor` take O(1) time and iterators never climb parent chains.
+ *
+ * Costs 2 pointers per node. Insertions and deletions link and unlink in O(1); joins, splits and set operations find the ends of each subtree they link, in O(log n).
+ * The list ends at the sentinel on both sides. Rotations keep the key order, so they leave it alone.
+ */
+template <typename T, typename Payload = RBNoPayload>
+struct RBInOrderLinks {
+    struct Fields {
+        RBNode<T, Payload, RBInOrderLinks>* previousNode = nullptr;
+        RBNode<T, Payload, RBInOrderLinks>* nextNode = nullptr;
+    };
+
+    /// Nothing is recomputed from children.
+    static constexpr bool isEnabled = false;
+
+    template <typename Node>
+    static void update(Node*) {
+    }
+};
+
+
+template <typename T, typename Payload, typename Augmentation = RBNoAugmentation>
+class RBNode: public Augmentation::Fields {
+public:
+    T value;
+    Payload payload;
+
+    RBNode* parent;
+    RBNode* leftChild;
+    RBNode* rightChild;
+
+    bool isRed;
+
+public:
+    /**
+     * Black-colored sentinel `nil` node. Initialization after class definition.
+     *
+     * Shared by every tree with the same node type but never written to after initialization, so independent trees can be used from different threads.
+     */
+    static RBNode* nilNode;
+
+public:
+    RBNode(T value, Payload payload, bool isRed): value(std::move(value)), payload(std::move(payload)) {
+        this->parent = RBNode::nilNode;
+        this->leftChild = RBNode::nilNode;
+        this->rightChild = RBNode::nilNode;
+        this->isRed = isRed;
+    }
+
+    /// Constructs the key from `value` and the payload from `payloadArgs` in place, e.g. for move-only payloads. The node starts red.
+    template <typename Key, typename... PayloadArgs>
+    RBNode(std::in_place_t, Key&& value, PayloadArgs&&... payloadArgs): value(std::forward<Key>(value)), payload(std::forward<PayloadArgs>(payloadArgs)...) {
+        this->parent = RBNode::nilNode;
+        this->leftChild = RBNode::nilNode;
+        this->rightChild = RBNode::nilNode;
+        this->isRed = true;
+    }
+
+    RBNode(T value, Payload payload, RBNode* parent, RBNode* leftChild, RBNode* rightChild, bool isRed): value(std::move(value)), payload(std::move(payload)) {
+        this->parent = parent;
+        this->leftChild = leftChild;
+        this->rightChild = rightChild;
+        this->isRed = isRed;
+    }
+};
+
+template <typename T, typename Payload, typename Augmentation>
+RBNode<T, Payload, Augmentation>* RBNode<T, Payload, Augmentation>::nilNode = new RBNode(T(), Payload(), nullptr, nullptr, nullptr, false);
+
+
+/**
+ * @tparam T Key type. Duplicate keys are allowed.
+ * @tparam Payload Mapped value stored next to each key.
+ * @tparam Compare Stateless strict weak ordering on `T`. Transparent comparators (e.g. `std::less<>`) enable heterogeneous lookup.
+ * @tparam Augmentation Per-subtree data kept up to date through insertions, deletions and rotations, e.g. `RBSubtreeSize`, or `RBInOrderLinks` for O(1) neighbor steps.
+ * @tparam NodeAllocator Where nodes come from. `NodePool` (the default) keeps nodes in per-tree slabs and recycles deleted ones; `HeapNodeAllocator` calls `new` and `delete` for every node.
+ */
+template <typename T, typename Payload = RBNoPayload, typename Compare = std::less<T>, typename Augmentation = RBNoAugmentation, template <typename> typename NodeAllocator = NodePool>
+class RBTree {
+public:
+    using Node = RBNode<T, Payload, Augmentation>;
+    using ValueCompare = Compare;
+
+    static_assert(std::is_empty_v<Compare>, "The comparator must be stateless.");
+
+public:
+    Node* rootNode;
+
+private:
+    NodeAllocator<Node> nodeAllocator;
+
+public:
+    RBTree() {
+        rootNode = Node::nilNode;
+        // nilNode = new RBNode(0, false);
+    }
+
+    /**
+     * Builds the tree from keys that are already sorted by `Compare`, in O(n) time.
+     *
+     * Elements are either keys or `(key, payload)` pairs. Large inputs build their subtrees on several threads.
+     */
+    template <typename Iterator>
+    RBTree(Iterator first, Iterator last) {
+        rootNode = Node::nilNode;
+        buildFromSortedRange(first, last);
+    }
+
+    RBTree(const RBTree&) = delete;
+    RBTree& operator=(const RBTree&) = delete;
+
+    RBTree(RBTree&& other) noexcept: nodeAllocator(std::move(other.nodeAllocator)) {
+        rootNode = other.rootNode;
+        other.rootNode = Node::nilNode;
+    }
+
+    ~RBTree() {
+        // A node pool frees its slabs in bulk. Nodes only need visiting when they own resources (e.g. `std::string` keys) or come from the heap.
+        if constexpr (!(NodeAllocator<Node>::releasesNodesInBulk && std::is_trivially_destructible_v<Node>)) {
+            deallocateSubtree(rootNode);
+        }
+    }
+
+    /// Deletes every node in O(n) time and O(1) space, without rebalancing, and returns the pool's slabs.
+    void clear() {
+        if constexpr (!(NodeAllocator<Node>::releasesNodesInBulk && std::is_trivially_destructible_v<Node>)) {
+            deallocateSubtree(rootNode);
+        }
+        rootNode = Node::nilNode;
+        nodeAllocator = NodeAllocator<Node>();
+    }
+
+private:
+    /**
+     * Deallocates every node of the subtree of `node` without recursion or a stack.
+     *
+     * Rotates right until the current node has no left child, then frees it and moves on to its right child. Each rotation takes one node off the left spine for good, so this is O(n).
+     * The tree is discarded, so parents, colors and augmentations are left stale.
+     */
+    void deallocateSubtree(Node* node) {
+        while (node != Node::nilNode) {
+            if (node->leftChild != Node::nilNode) {
+                auto leftChild = node->leftChild;
+                node->leftChild = leftChild->rightChild;
+                leftChild->rightChild = node;
+                node = leftChild;
+            } else {
+                auto rightChild = node->rightChild;
+                nodeAllocator.deallocate(node);
+                node = rightChild;
+            }
+        }
+    }
+
+
+#pragma mark Memory
+public:
+    /**
+     * Live nodes, the bytes they use and the bytes the allocator reserves for this tree, e.g. to bound or monitor memory in long-running services.
+     *
+     * O(1), except for the first call after a `split`, which counts the nodes once. See `NodePool::getMemoryUsage` for what is reserved.
+     */
+    NodeMemoryUsage getMemoryUsage() {
+        if (!nodeAllocator.hasLiveNodeCount()) {
+            nodeAllocator.setLiveNodeCount(static_cast<std::size_t>(std::distance(begin(), end())));
+        }
+        return nodeAllocator.getMemoryUsage();
+    }
+
+
+#pragma mark Bulk Construction
+private:
+    /// Subtrees smaller than this are never handed to another thread.
+    static constexpr std::size_t minParallelSubtreeSize = 1 << 15;
+
+    /// How many levels of recursion may fork, so that there is roughly one branch per hardware thread.
+    static int getParallelDepth() {
+        int parallelDepth = 0;
+        for (unsigned int threadCount = 1; threadCount < std::thread::hardware_concurrency(); threadCount *= 2) {
+            parallelDepth += 1;
+        }
+
+        return parallelDepth;
+    }
+
+    template <typename Iterator>
+    void buildFromSortedRange(Iterator first, Iterator last) {
+        auto count = static_cast<std::size_t>(std::distance(first, last));
+        if (count == 0) {
+            return;
+        }
+
+        // Nodes are allocated on this thread since the allocator is not thread-safe.
+        // They come out in key order, so in-order walks later touch memory sequentially.
+        auto nodes = std::vector<Node*>();
+        nodes.reserve(count);
+        for (auto it = first; it != last; ++it) {
+            if constexpr (std::is_convertible_v<decltype(*it), const T&>) {
+                nodes.push_back(nodeAllocator.allocate(*it, Payload(), false));
+            } else {
+                nodes.push_back(nodeAllocator.allocate((*it).first, (*it).second, false));
+            }
+        }
+
+        // Splitting at the middle keeps every nil within the last two levels: depth `redDepth` and `redDepth + 1`.
+        // Coloring the nodes at depth `redDepth` (the only partially filled level) red gives every path the same black height.
+        int redDepth = 0;
+        while ((std::size_t(2) << redDepth) <= count + 1) {
+            redDepth += 1;
+        }
+
+        rootNode = RBTree::linkSortedNodes(nodes.data(), 0, count, 0, redDepth, RBTree::getParallelDepth());
+        rootNode->parent = Node::nilNode;
+
+        if constexpr (isThreaded) {
+            RBTree::linkInOrder(Node::nilNode, nodes.front());
+            for (std::size_t i = 1; i < count; i += 1) {
+                RBTree::linkInOrder(nodes[i - 1], nodes[i]);
+            }
+            RBTree::linkInOrder(nodes.back(), Node::nilNode);
+        }
+    }
+
+    /**
+     * Links `nodes[begin, end)` into a perfectly balanced subtree.
+     *
+     * @param parallelDepth How many more levels may fork the left subtree onto another thread.
+     * @return Root of the subtree.
+     */
+    static Node* linkSortedNodes(Node** nodes, std::size_t begin, std::size_t end, int depth, int redDepth, int parallelDepth) {
+        if (begin == end) {
+            return Node::nilNode;
+        }
+
+        auto middle = begin + (end - begin) / 2;
+        auto node = nodes[middle];
+
+        Node* leftChild = nullptr;
+        Node* rightChild = nullptr;
+        if ((parallelDepth > 0) && (end - begin >= 2 * minParallelSubtreeSize)) {
+            auto leftFuture = std::async(std::launch::async, RBTree::linkSortedNodes, nodes, begin, middle, depth + 1, redDepth, parallelDepth - 1);
+            rightChild = RBTree::linkSortedNodes(nodes, middle + 1, end, depth + 1, redDepth, parallelDepth - 1);
+            leftChild = leftFuture.get();
+        } else {
+            leftChild = RBTree::linkSortedNodes(nodes, begin, middle, depth + 1, redDepth, 0);
+            rightChild = RBTree::linkSortedNodes(nodes, middle + 1, end, depth + 1, redDepth, 0);
+        }
+
+        node->leftChild = leftChild;
+        node->rightChild = rightChild;
+        if (leftChild != Node::nilNode) {
+            leftChild->parent = node;
+        }
+        if (rightChild != Node::nilNode) {
+            rightChild->parent = node;
+        }
+        node->isRed = (depth == redDepth);
+        Augmentation::update(node);
+
+        return node;
+    }
+
+
+#pragma mark Comparison
+protected:
+    /// `Compare` is stateless, so constructing it here costs nothing and the call inlines.
+    template <typename A, typename B>
+    static bool isLess(const A& a, const B& b) {
+        TREE_STATS_COUNT(comparisonCount);
+        return Compare()(a, b);
+    }
+
+    /// Built-in keys under the standard orderings are equivalent exactly when they are `==`.
+    static constexpr bool isEquivalenceEquality = std::is_arithmetic_v<T> && (
+        std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>> ||
+        std::is_same_v<Compare, std::greater<T>> || std::is_same_v<Compare, std::greater<>>
+    );
+
+
+#pragma mark Walk
+public:
+    /// Copies every key in order. Prefer iterating the tree directly when only part of it is needed.
+    std::vector<T> inOrderWalk() const {
+        return std::vector<T>(begin(), end());
+    }
+
+
+#pragma mark Min & Max
+public:
+    static Node* getMinNodeOfSubtree(Node* rootNode) {
+        if (rootNode == Node::nilNode) {
+            return Node::nilNode;
+        }
+
+        auto currentNode = rootNode;
+        while (currentNode->leftChild != Node::nilNode) {
+            currentNode = currentNode->leftChild;
+        }
+
+        return currentNode;
+    }
+
+    static Node* getMaxNodeOfSubtree(Node* rootNode) {
+        if (rootNode == Node::nilNode) {
+            return Node::nilNode;
+        }
+
+        auto currentNode = rootNode;
+        while (currentNode->rightChild != Node::nilNode) {
+            currentNode = currentNode->rightChild;
+        }
+
+        return currentNode;
+    }
+
+public:
+    Node* getMinNode() {
+        return RBTree::getMinNodeOfSubtree(rootNode);
+    }
+
+    Node* getMaxNode() {
+        return RBTree::getMaxNodeOfSubtree(rootNode);
+    }
+
+
+#pragma mark Height
+public:
+    /// Number of nodes on the longest root-to-leaf path, 0 for an empty tree. Visits every node, so O(n).
+    int getHeight() const {
+        int height = 0;
+        std::vector<std::pair<Node*, int>> stack;
+        if (rootNode != Node::nilNode) {
+            stack.emplace_back(rootNode, 1);
+        }
+
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            height = std::max(height, depth);
+
+            if (node->leftChild != Node::nilNode) {
+                stack.emplace_back(node->leftChild, depth + 1);
+            }
+            if (node->rightChild != Node::nilNode) {
+                stack.emplace_back(node->rightChild, depth + 1);
+            }
+        }
+
+        return height;
+    }
+
+    /// Black nodes on any root-to-leaf path, the root included. O(log n).
+    int getBlackHeight() const {
+        return RBTree::getBlackHeight(rootNode);
+    }
+
+
+#pragma mark Search
+public:
+    Node* searchForValue(const T& value) {
+        return searchForKey(value);
+    }
+
+    /// Heterogeneous lookup, e.g. a `std::string_view` against `std::string` keys without building a temporary key.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    Node* searchForValue(const Key& value) {
+        return searchForKey(value);
+    }
+
+private:
+    template <typename Key>
+    Node* searchForKey(const Key& value) {
+        TREE_STATS_OPERATION(search);
+
+        return RBTree::searchBelow(rootNode, value);
+    }
+
+    template <typename Key>
+    static Node* searchBelow(Node* subtreeRootNode, const Key& value) {
+        auto currentNode = subtreeRootNode;
+        while (currentNode != Node::nilNode) {
+            if constexpr (isEquivalenceEquality && std::is_same_v<Key, T>) {
+                // Testing for a match first leaves a two-way choice, which compiles to a conditional move instead of an unpredictable branch.
+                TREE_STATS_COUNT(comparisonCount);
+                if (currentNode->value == value) {
+                    return currentNode;
+                } else if (isLess(value, currentNode->value)) {
+                    currentNode = currentNode->leftChild;
+                } else {
+                    currentNode = currentNode->rightChild;
+                }
+            } else {
+                if (isLess(value, currentNode->value)) {
+                    currentNode = currentNode->leftChild;
+                } else if (isLess(currentNode->value, value)) {
+                    currentNode = currentNode->rightChild;
+                } else {
+                    return currentNode;
+                }
+            }
+        }
+        
+        return Node::nilNode;
+    }
+
+#pragma mark Finger Search
+private:
+    /**
+     * Climbs from `hint` to the lowest ancestor whose subtree `value` belongs in, so that a search or an insertion can descend from there instead of from the root.
+     *
+     * When `value` comes after `hint`, the subtree of the returned node ends right before `boundNode`: the nearest ancestor above it that is not less than `value`, or the sentinel.
+     * Symmetrically when `value` comes before `hint`. Only `hint` and these ancestors are compared: O(log d) comparisons for `d` keys between `hint` and `value`.
+     * The climb itself follows up to O(log n) parent links, e.g. the whole right spine from the maximum.
+     */
+    template <typename Key>
+    static Node* climbFromHint(Node* hint, const Key& value, Node*& boundNode) {
+        auto isAfterHint = isLess(hint->value, value);
+
+        auto node = hint;
+        while (true) {
+            // The nearest ancestor on the side of `value`: past the ancestors whose subtree `node` is on the other side of.
+            auto child = node;
+            auto ancestor = node->parent;
+            while ((ancestor != Node::nilNode) && ((isAfterHint ? ancestor->rightChild : ancestor->leftChild) == child)) {
+                child = ancestor;
+                ancestor = ancestor->parent;
+            }
+
+            if ((ancestor == Node::nilNode) || (isAfterHint ? !isLess(ancestor->value, value) : !isLess(value, ancestor->value))) {
+                boundNode = ancestor;
+                return node;
+            }
+            node = ancestor;
+        }
+    }
+
+public:
+    /**
+     * Like `searchForValue`, but starts from `hint` (e.g. the previous result) rather than from the root.
+     *
+     * Any node of this tree is a valid hint, and the sentinel means the root. Finds a key `d` positions away from `hint` with O(log d) comparisons.
+     */
+    Node* searchForValue(Node* hint, const T& value) {
+        if (hint == Node::nilNode) {
+            return searchForKey(value);
+        }
+
+        TREE_STATS_OPERATION(search);
+
+        if (!isLess(hint->value, value) && !isLess(value, hint->value)) {
+            return hint;
+        }
+
+        Node* boundNode = nullptr;
+        auto result = RBTree::searchBelow(RBTree::climbFromHint(hint, value, boundNode), value);
+        if ((result == Node::nilNode) && (boundNode != Node::nilNode) && !isLess(boundNode->value, value) && !isLess(value, boundNode->value)) {
+            result = boundNode;
+        }
+
+        return result;
+    }
+
+
+#pragma mark Batched Search
+public:
+    /// Searches in flight at once in `searchForValues`: enough to keep several misses to memory outstanding.
+    static constexpr std::size_t batchSearchWidth = 16;
+
+    /**
+     * Looks up `count` keys at once: `results[i]` becomes the node `searchForValue(values[i])` would return.
+     *
+     * A lone search waits for each node's cache miss before it can pick the next node.
+     * Here up to `batchSearchWidth` searches are in flight, as in AMAC ("Asynchronous Memory Access Chaining" by Kocberber, Falsafi and Grot):
+     * each step moves one search down one level and prefetches the node it moves to, then turns to the next search while that line loads.
+     * A finished search hands its slot to the next key, so short and long paths do not hold each other up.
+     *
+     * Pays off once the tree is much larger than the cache. On trees that fit in it, the bookkeeping makes it slower than a plain loop.
+     */
+    void searchForValues(const T* values, std::size_t count, Node** results) {
+        struct Search {
+            std::size_t index;
+            Node* node;
+        };
+
+        Search searches[batchSearchWidth];
+        std::size_t searchCount = std::min(count, batchSearchWidth);
+        std::size_t nextIndex = 0;
+        for (; nextIndex < searchCount; nextIndex += 1) {
+            searches[nextIndex] = {nextIndex, rootNode};
+        }
+
+        while (searchCount > 0) {
+            for (std::size_t i = 0; i < searchCount;) {
+                auto& search = searches[i];
+                const auto& value = values[search.index];
+
+                // The same steps as `searchForKey`, one level at a time.
+                auto node = search.node;
+                if (node != Node::nilNode) {
+                    if (isLess(value, node->value)) {
+                        search.node = node->leftChild;
+                    } else if (isLess(node->value, value)) {
+                        search.node = node->rightChild;
+                    }
+                }
+
+                // A search that did not move has found its node or fallen off the tree.
+                if (search.node != node) {
+                    __builtin_prefetch(search.node);
+                    i += 1;
+                    continue;
+                }
+
+                results[search.index] = node;
+                if (nextIndex < count) {
+                    search = {nextIndex, rootNode};
+                    nextIndex += 1;
+                    i += 1;
+                } else {
+                    // Fill the slot with the last search, which has not moved yet in this round.
+                    searchCount -= 1;
+                    search = searches[searchCount];
+                }
+            }
+        }
+    }
+
+
+#pragma mark Predecessor & Successor
+public:
+    static Node* getPredecessor(Node* node) {
+        if (node == Node::nilNode) {
+            return Node::nilNode;
+        }
+
+        if constexpr (isThreaded) {
+            return node->previousNode;
+        }
+
+        if (node->leftChild != Node::nilNode) {
+            return RBTree::getMaxNodeOfSubtree(node->leftChild);
+        }
+
+        // Find the first ancestor with the current node as right child.
+        auto currentNode = node;
+        auto ancestor = node->parent;
+        while ((ancestor != Node::nilNode) && (ancestor->leftChild == currentNode)) {
+            currentNode = ancestor;
+            ancestor = ancestor->parent;
+        }
+        
+        return ancestor;
+    }
+
+    static Node* getSuccessor(Node* node) {
+        if (node == Node::nilNode) {
+            return Node::nilNode;
+        }
+
+        if constexpr (isThreaded) {
+            return node->nextNode;
+        }
+
+        if (node->rightChild != Node::nilNode) {
+            return RBTree::getMinNodeOfSubtree(node->rightChild);
+        }
+
+        // Find the first ancestor with the current node as left child.
+        auto currentNode = node;
+        auto ancestor = node->parent;
+        while ((ancestor != Node::nilNode) && (ancestor->rightChild == currentNode)) {
+            currentNode = ancestor;
+            ancestor = ancestor->parent;
+        }
+        
+        return ancestor;
+    }
+
+
+#pragma mark Iteration
+public:
+    /**
+     * Bidirectional in-order iterator over the keys.
+     *
+     * Steps with `getSuccessor`/`getPredecessor`: no recursion, no allocation, amortized O(1) per step.
+     * Stays valid until its node is deleted.
+     */
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+    private:
+        const RBTree* tree;
+        /// The sentinel represents `end()`.
+        Node* node;
+
+    public:
+        Iterator(const RBTree* tree, Node* node): tree(tree), node(node) {
+        }
+
+        Node* getNode() const {
+            return node;
+        }
+
+        reference operator*() const {
+            return node->value;
+        }
+
+        pointer operator->() const {
+            return &(node->value);
+        }
+
+        Iterator& operator++() {
+            node = RBTree::getSuccessor(node);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        Iterator& operator--() {
+            if (node == Node::nilNode) {
+                node = RBTree::getMaxNodeOfSubtree(tree->rootNode);
+            } else {
+                node = RBTree::getPredecessor(node);
+            }
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto returnValue = *this;
+            --(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return node != other.node;
+        }
+    };
+
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const {
+        return Iterator(this, RBTree::getMinNodeOfSubtree(rootNode));
+    }
+
+    Iterator end() const {
+        return Iterator(this, Node::nilNode);
+    }
+
+    ReverseIterator rbegin() const {
+        return ReverseIterator(end());
+    }
+
+    ReverseIterator rend() const {
+        return ReverseIterator(begin());
+    }
+
+    /// @param node A node of this tree, or the sentinel for `end()`.
+    Iterator getIterator(Node* node) const {
+        return Iterator(this, node);
+    }
+
+
+#pragma mark Bounds
+public:
+    /// @return The first key not less than `value`. Works wherever rotations have moved duplicates.
+    template <typename Key>
+    Iterator lowerBound(const Key& value) const {
+        auto candidate = Node::nilNode;
+        auto currentNode = rootNode;
+        while (currentNode != Node::nilNode) {
+            if (!isLess(currentNode->value, value)) {
+                candidate = currentNode;
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return Iterator(this, candidate);
+    }
+
+    /// @return The first key greater than `value`.
+    template <typename Key>
+    Iterator upperBound(const Key& value) const {
+        auto candidate = Node::nilNode;
+        auto currentNode = rootNode;
+        while (currentNode != Node::nilNode) {
+            if (isLess(value, currentNode->value)) {
+                candidate = currentNode;
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return Iterator(this, candidate);
+    }
+
+    /// @return All keys equivalent to `value`, as `[first, second)`.
+    template <typename Key>
+    std::pair<Iterator, Iterator> equalRange(const Key& value) const {
+        return {lowerBound(value), upperBound(value)};
+    }
+
+    /// Calls `visitor(node)` for every key in `[lowValue, highValue)`, in order. O(log n + k).
+    template <typename Key, typename Visitor>
+    void forEachInRange(const Key& lowValue, const Key& highValue, Visitor visitor) const {
+        for (auto it = lowerBound(lowValue); (it != end()) && isLess(*it, highValue); ++it) {
+            visitor(it.getNode());
+        }
+    }
+
+
+#pragma mark In-Order Links
+private:
+    static constexpr bool isThreaded = std::is_same_v<Augmentation, RBInOrderLinks<T, Payload>>;
+
+    /// Makes `nextNode` follow `previousNode` in the in-order list. Either may be the sentinel, which is never written.
+    static void linkInOrder(Node* previousNode, Node* nextNode) {
+        if constexpr (isThreaded) {
+            if (previousNode != Node::nilNode) {
+                previousNode->nextNode = nextNode;
+            }
+            if (nextNode != Node::nilNode) {
+                nextNode->previousNode = previousNode;
+            }
+        }
+    }
+
+
+#pragma mark Rotation
+private:
+    // Rotations and `fixUpInsertion` take the root by reference rather than using the member, so that `joinNodes` can run them on detached subtrees.
+
+    /// Refer to page 334 of "Introduction to Algorithms".
+    static void rotateLeft(Node*& rootNode, Node* x) {
+        TREE_STATS_COUNT(leftRotationCount);
+
+        auto y = x->rightChild;
+        
+        // Move beta.
+        x->rightChild = y->leftChild;
+        if (y->leftChild != Node::nilNode) {
+            y->leftChild->parent = x;
+        }
+
+        // Move x and y.
+        y->parent = x->parent;
+        if (x->parent == Node::nilNode) {
+            rootNode = y;
+        } else {
+            if (x == x->parent->leftChild) {
+                x->parent->leftChild = y;
+            } else {
+                x->parent->rightChild = y;
+            }
+        }
+        
+        x->parent = y;
+        y->leftChild = x;
+
+        // x is y's child now, so it is recomputed first.
+        Augmentation::update(x);
+        Augmentation::update(y);
+    }
+
+    static void rotateRight(Node*& rootNode, Node* y) {
+        TREE_STATS_COUNT(rightRotationCount);
+
+        auto x = y->leftChild;
+
+        // Move beta.
+        y->leftChild = x->rightChild;
+        if (x->rightChild != Node::nilNode) {
+            x->rightChild->parent = y;
+        }
+
+        // Move x and y.
+        x->parent = y->parent;
+        if (y->parent == Node::nilNode) {
+            rootNode = x;
+        } else {
+            if (y == y->parent->leftChild) {
+                y->parent->leftChild = x;
+            } else {
+                y->parent->rightChild = x;
+            }
+        }
+
+        y->parent = x;
+        x->rightChild = y;
+
+        Augmentation::update(y);
+        Augmentation::update(x);
+    }
+
+
+#pragma mark Augmentation
+private:
+    /// Recomputes the augmentation of `node` and all its ancestors after the subtree below `node` changed.
+    static void updateAugmentationUpward(Node* node) {
+        if constexpr (Augmentation::isEnabled) {
+            while (node != Node::nilNode) {
+                Augmentation::update(node);
+                node = node->parent;
+            }
+        }
+    }
+
+
+#pragma mark Insertion
+private:
+    /**
+     * @param z The newly inserted red node.
+     * @return Whether the root had turned red and was blackened, which adds 1 to the black height.
+     */
+    static bool fixUpInsertion(Node*& rootNode, Node* z) {
+        // Root node's parent is Node::nilNode, which is black.
+        while (z->parent->isRed) {
+            // Both z and z->parent are red.
+            // z->parent->parent must be black when z->parent is a red node.
+            if (z->parent == z->parent->parent->leftChild) {
+                // z's parent on left, uncle on right.
+                
+                /// Uncle of z.
+                auto y = z->parent->parent->rightChild;
+
+                if (y->isRed) {
+                    // Case 1. Parent and uncle are red.
+                    TREE_STATS_COUNT(insertionFixUpCaseCounts[1]);
+                    z->parent->isRed = false;
+                    y->isRed = false;
+                    z->parent->parent->isRed = true;
+                    z = z->parent->parent;
+
+                    continue;
+                } else {
+                    if (z == z->parent->rightChild) {
+                        // Case 2. z is the right child.
+                        TREE_STATS_COUNT(insertionFixUpCaseCounts[2]);
+                        // Rotate and treat z's parent as the new z.
+                        z = z->parent;
+                        RBTree::rotateLeft(rootNode, z);
+                    }
+
+                    // Case 3.
+                    TREE_STATS_COUNT(insertionFixUpCaseCounts[3]);
+                    z->parent->isRed = false;
+                    z->parent->parent->isRed = true;
+                    RBTree::rotateRight(rootNode, z->parent->parent);
+
+                    break;
+                }
+            } else {
+                // z's parent on right, uncle on left.
+
+                /// Uncle of z.
+                auto y = z->parent->parent->leftChild;
+
+                if (y->isRed) {
+                    // Case 1. Parent and uncle are red.
+                    TREE_STATS_COUNT(insertionFixUpCaseCounts[1]);
+                    z->parent->isRed = false;
+                    y->isRed = false;
+                    z->parent->parent->isRed = true;
+                    z = z->parent->parent;
+
+                    continue;
+                } else {
+                    if (z == z->parent->leftChild) {
+                        // Case 2. z is the left child.
+                        TREE_STATS_COUNT(insertionFixUpCaseCounts[2]);
+                        // Rotate and treat z's parent as the new z.
+                        z = z->parent;
+                        RBTree::rotateRight(rootNode, z);
+                    }
+
+                    // Case 3.
+                    TREE_STATS_COUNT(insertionFixUpCaseCounts[3]);
+                    z->parent->isRed = false;
+                    z->parent->parent->isRed = true;
+                    RBTree::rotateLeft(rootNode, z->parent->parent);
+
+                    break;
+                }
+            }
+        }
+
+        // Red node propagation may convert the root node into a red node.
+        // In this case, we simply set it to black.
+        auto wasRootRed = rootNode->isRed;
+        rootNode->isRed = false;
+
+        return wasRootRed;
+    }
+
+public:
+    Node* insertValue(const T& newValue, const Payload& payload = Payload()) {
+        TREE_STATS_OPERATION(insertion);
+
+        return insertValueBelow(rootNode, newValue, payload);
+    }
+
+    /**
+     * Like `insertValue`, but starts from `hint` rather than from the root, e.g. the node the previous insertion returned.
+     *
+     * Any node of this tree is a valid hint, and the sentinel means the root. The closer `newValue` lands to `hint`, the fewer comparisons: O(1) for sorted or reverse-sorted streams.
+     * With `RBInOrderLinks`, a key that lands right next to `hint` is attached without climbing at all.
+     */
+    Node* insertValue(Node* hint, const T& newValue, const Payload& payload = Payload()) {
+        TREE_STATS_OPERATION(insertion);
+
+        if (hint == Node::nilNode) {
+            return insertValueBelow(rootNode, newValue, payload);
+        }
+
+        if constexpr (isThreaded) {
+            // Between `hint` and its neighbor, the free child slot is on whichever of the two is lower in the tree.
+            if (isLess(hint->value, newValue)) {
+                auto nextNode = hint->nextNode;
+                if ((nextNode == Node::nilNode) || !isLess(nextNode->value, newValue)) {
+                    auto newNode = nodeAllocator.allocate(newValue, payload, true);
+                    if (hint->rightChild == Node::nilNode) {
+                        attachLeaf(newNode, hint, false);
+                    } else {
+                        attachLeaf(newNode, nextNode, true);
+                    }
+                    return newNode;
+                }
+            } else {
+                auto previousNode = hint->previousNode;
+                if ((previousNode == Node::nilNode) || !isLess(newValue, previousNode->value)) {
+                    auto newNode = nodeAllocator.allocate(newValue, payload, true);
+                    if (hint->leftChild == Node::nilNode) {
+                        attachLeaf(newNode, hint, true);
+                    } else {
+                        attachLeaf(newNode, previousNode, false);
+                    }
+                    return newNode;
+                }
+            }
+        }
+
+        Node* boundNode = nullptr;
+        return insertValueBelow(RBTree::climbFromHint(hint, newValue, boundNode), newValue, payload);
+    }
+
+    /// Constructs the key from `newValue` and the payload from `payloadArgs` right inside the new node, without copying either. Payloads may be move-only.
+    template <typename Key, typename... PayloadArgs>
+    Node* emplaceValue(Key&& newValue, PayloadArgs&&... payloadArgs) {
+        TREE_STATS_OPERATION(insertion);
+
+        return insertNodeBelow(rootNode, nodeAllocator.allocate(std::in_place, std::forward<Key>(newValue), std::forward<PayloadArgs>(payloadArgs)...));
+    }
+
+private:
+    /// Inserts `newValue` into the subtree of `subtreeRootNode`, which it must belong in.
+    Node* insertValueBelow(Node* subtreeRootNode, const T& newValue, const Payload& payload) {
+        // 1. Create the new node.
+        // The new node is by default red.
+        return insertNodeBelow(subtreeRootNode, nodeAllocator.allocate(newValue, payload, true));
+    }
+
+    /// Inserts the new red `newNode`, which has no children, into the subtree of `subtreeRootNode`.
+    Node* insertNodeBelow(Node* subtreeRootNode, Node* newNode) {
+        const auto& newValue = newNode->value;
+
+        // 2. Insert the new node.
+        if (rootNode == Node::nilNode) {
+            rootNode = newNode;
+            rootNode->isRed = false;
+            RBTree::linkInOrder(Node::nilNode, newNode);
+            RBTree::linkInOrder(newNode, Node::nilNode);
+            updateAugmentationUpward(newNode);
+            return newNode;
+        }
+
+        auto parentNode = Node::nilNode;
+        auto currentNode = subtreeRootNode;
+
+        while (currentNode != Node::nilNode) {
+            parentNode = currentNode;
+
+            if (!isLess(currentNode->value, newValue)) {
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        attachLeaf(newNode, parentNode, !isLess(parentNode->value, newValue));
+
+        return newNode;
+    }
+
+    /// Hangs the new red `newNode` from an empty child slot of `parentNode` and restores the red-black properties.
+    void attachLeaf(Node* newNode, Node* parentNode, bool isLeftChild) {
+        newNode->parent = parentNode;
+        if (isLeftChild) {
+            parentNode->leftChild = newNode;
+        } else {
+            parentNode->rightChild = newNode;
+        }
+        if constexpr (isThreaded) {
+            // A new leaf sits right before its parent in key order when it is a left child, and right after it otherwise.
+            if (newNode == parentNode->leftChild) {
+                RBTree::linkInOrder(parentNode->previousNode, newNode);
+                RBTree::linkInOrder(newNode, parentNode);
+            } else {
+                RBTree::linkInOrder(newNode, parentNode->nextNode);
+                RBTree::linkInOrder(parentNode, newNode);
+            }
+        }
+        updateAugmentationUpward(newNode);
+
+        // 3. Fix up colors.
+        // Rotations keep the augmentation up to date from here on.
+        RBTree::fixUpInsertion(rootNode, newNode);
+    }
+
+
+#pragma mark - Deletion
+private:
+    void transplantDuringDeletion(Node* oldNode, Node* newNode) {
+        if (oldNode->parent == Node::nilNode) {
+            rootNode = newNode;
+        } else if (oldNode == oldNode->parent->leftChild) {
+            oldNode->parent->leftChild = newNode;
+        } else {
+            oldNode->parent->rightChild = newNode;
+        }
+
+        // The textbook assigns `newNode->parent` unconditionally, which writes into the shared sentinel.
+        // The sentinel is never written instead. `deleteNode` keeps track of x's parent itself.
+        if (newNode != Node::nilNode) {
+            newNode->parent = oldNode->parent;
+        }
+    }
+
+    /**
+     * @param x The node that moved into the removed black node's location. May be the sentinel.
+     * @param xParent Parent of `x`. Passed separately because the sentinel's `parent` field is never set.
+     */
+    void fixUpDeletion(Node* x, Node* xParent) {
+        while ((x != rootNode) && (!x->isRed)) {
+            if (x == xParent->leftChild) {
+                /// Called `w` in the textbook.
+                auto sibling = xParent->rightChild;
+                
+                if (sibling->isRed) {
+                    // Case 1 in textbook.
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[1]);
+                    // Preprocess. Rotate to produce a black sibling.
+                    // Sibling is red. Thus parent must be black. Sibling's children must be black.
+
+                    sibling->isRed = false;
+                    xParent->isRed = true;
+                    rotateLeft(rootNode, xParent);
+                    // The new black sibling.
+                    sibling = xParent->rightChild;
+                }
+
+                if ((!sibling->leftChild->isRed) && (!sibling->rightChild->isRed)) {
+                    // Case 2 in textbook.
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[2]);
+                    sibling->isRed = true;
+                    x = xParent;
+                    xParent = x->parent;
+                    continue;
+                } else {
+                    if (!sibling->rightChild->isRed) {
+                        // Case 3 in textbook.
+                        TREE_STATS_COUNT(deletionFixUpCaseCounts[3]);
+                        // Preprocess. Turns the sibling's right child into a red node.
+                        sibling->leftChild->isRed = false;
+                        sibling->isRed = true;
+                        rotateRight(rootNode, sibling);
+                        sibling = xParent->rightChild;
+                    }
+
+                    // Case 4 in textbook.
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[4]);
+                    sibling->isRed = xParent->isRed;
+                    xParent->isRed = false;    // This adds an additional black node to the left subtree.
+                    sibling->rightChild->isRed = false;    // Adds a new black node on the right subtree as compensation.
+                    rotateLeft(rootNode, xParent);
+                    
+                    x = rootNode;    // This makes no sense but to terminate the while loop...
+                }
+            } else {
+                auto sibling = xParent->leftChild;
+
+                if (sibling->isRed) {
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[1]);
+                    sibling->isRed = false;
+                    xParent->isRed = true;
+                    rotateRight(rootNode, xParent);
+                    sibling = xParent->leftChild;
+                }
+
+                if ((!sibling->leftChild->isRed) && (!sibling->rightChild->isRed)) {
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[2]);
+                    sibling->isRed = true;
+                    x = xParent;
+                    xParent = x->parent;
+                    continue;
+                } else {
+                    if (!sibling->leftChild->isRed) {
+                        TREE_STATS_COUNT(deletionFixUpCaseCounts[3]);
+                        sibling->rightChild->isRed = false;
+                        sibling->isRed = true;
+                        rotateLeft(rootNode, sibling);
+                        sibling = xParent->leftChild;
+                    }
+
+                    TREE_STATS_COUNT(deletionFixUpCaseCounts[4]);
+                    sibling->isRed = xParent->isRed;
+                    xParent->isRed = false;
+                    sibling->leftChild->isRed = false;
+                    rotateRight(rootNode, xParent);
+
+                    x = rootNode;
+                }
+            }
+        }
+
+        // x is either root or a red node that compensates for black loss.
+        // An empty tree leaves x at the sentinel, which is black already.
+        if (x != Node::nilNode) {
+            x->isRed = false;
+        }
+    }
+
+public:
+    void deleteNode(Node* z) {
+        TREE_STATS_OPERATION(deletion);
+
+        unlinkNode(z);
+        nodeAllocator.deallocate(z);
+    }
+
+    bool deleteValue(const T& value) {
+        return deleteKey(value);
+    }
+
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool deleteValue(const Key& value) {
+        return deleteKey(value);
+    }
+
+private:
+    /// Takes `z` out of the tree and restores the red-black properties, leaving `z` itself untouched.
+    void unlinkNode(Node* z) {
+        if constexpr (isThreaded) {
+            RBTree::linkInOrder(z->previousNode, z->nextNode);
+        }
+
+        /// The node that moves into `y`'s original location.
+        Node* x = nullptr;
+        /// `x->parent` after the removal. Tracked here since `x` may be the sentinel.
+        Node* xParent = nullptr;
+
+        /**
+         * The removed node or the replacement node, depending on the case.
+         * 
+         * If this is a black node, we'll need to re-evaluate the Red Black Tree properties.
+         */
+        auto y = z;
+        bool isYOriginallyRed = y->isRed;
+
+        if (z->leftChild == Node::nilNode) {
+            // y represents the removed node (the same as z).
+            x = z->rightChild;
+            xParent = z->parent;
+            transplantDuringDeletion(z, z->rightChild);
+        } else if (z->rightChild == Node::nilNode) {
+            // y represents the removed node (the same as z).
+            x = z->leftChild;
+            xParent = z->parent;
+            transplantDuringDeletion(z, z->leftChild);
+        } else {
+            // y represents the node that replaces z.
+            y = RBTree::getMinNodeOfSubtree(z->rightChild);
+            isYOriginallyRed = y->isRed;
+
+            // We are sure here that y must not have a left child.
+            // So x here is either y's right child or the nil sentinel.
+            x = y->rightChild;
+
+            if (y->parent == z) {
+                xParent = y;
+            } else {
+                xParent = y->parent;
+                transplantDuringDeletion(y, y->rightChild);
+                y->rightChild = z->rightChild;
+                y->rightChild->parent = y;
+            }
+
+            transplantDuringDeletion(z, y);
+            y->leftChild = z->leftChild;
+            y->leftChild->parent = y;
+            y->isRed = z->isRed;
+        }
+
+        // Every node whose subtree lost a node lies on the path from `xParent` to the root.
+        updateAugmentationUpward(xParent);
+
+        if (!isYOriginallyRed) {
+            fixUpDeletion(x, xParent);
+        }
+    }
+
+    template <typename Key>
+    bool deleteKey(const Key& value) {
+        auto node = searchForKey(value);
+        if (node == Node::nilNode) {
+            return false;
+        } else {
+            deleteNode(node);
+            return true;
+        }
+    }
+
+
+#pragma mark Node Handles
+public:
+    /**
+     * Owns a node taken out of a tree with `extractNode`, until `insertNode` hangs it into this or another tree of the same type.
+     *
+     * Moving entries between trees this way allocates nothing and neither copies nor moves keys and payloads.
+     * The handle keeps the slabs the node lives in alive, and the receiving tree keeps them alive from then on, so the original tree may be destroyed at any time.
+     * An abandoned handle destroys its node.
+     */
+    class NodeHandle {
+    private:
+        Node* node = nullptr;
+        typename NodeAllocator<Node>::SlabsReference slabsReference = {};
+
+    public:
+        NodeHandle() = default;
+
+        NodeHandle(Node* node, typename NodeAllocator<Node>::SlabsReference slabsReference): node(node), slabsReference(std::move(slabsReference)) {
+        }
+
+        NodeHandle(const NodeHandle&) = delete;
+        NodeHandle& operator=(const NodeHandle&) = delete;
+
+        NodeHandle(NodeHandle&& other) noexcept: node(other.node), slabsReference(std::move(other.slabsReference)) {
+            other.node = nullptr;
+        }
+
+        NodeHandle& operator=(NodeHandle&& other) noexcept {
+            if (this != &other) {
+                reset();
+                node = other.node;
+                slabsReference = std::move(other.slabsReference);
+                other.node = nullptr;
+            }
+            return *this;
+        }
+
+        ~NodeHandle() {
+            reset();
+        }
+
+    public:
+        bool isEmpty() const {
+            return node == nullptr;
+        }
+
+        explicit operator bool() const {
+            return !isEmpty();
+        }
+
+        /// The key may be changed before the node is inserted again, as long as `Compare` can still order it.
+        T& getValue() const {
+            return node->value;
+        }
+
+        Payload& getPayload() const {
+            return node->payload;
+        }
+
+    private:
+        void reset() {
+            if (node != nullptr) {
+                NodeAllocator<Node>::destroyDetached(node);
+                node = nullptr;
+            }
+        }
+
+        /// Hands the node over to a tree, leaving the handle empty.
+        std::pair<Node*, typename NodeAllocator<Node>::SlabsReference> release() {
+            auto returnValue = std::make_pair(node, std::move(slabsReference));
+            node = nullptr;
+            return returnValue;
+        }
+
+        friend class RBTree;
+    };
+
+    /// Takes `node` out of the tree without deallocating it. O(log n).
+    NodeHandle extractNode(Node* node) {
+        TREE_STATS_OPERATION(deletion);
+
+        unlinkNode(node);
+        nodeAllocator.releaseNode(node);
+        return NodeHandle(node, nodeAllocator.getSlabsReference());
+    }
+
+    /// Takes out one node with key `value`. The handle is empty if there is none.
+    NodeHandle extractValue(const T& value) {
+        auto node = searchForKey(value);
+        if (node == Node::nilNode) {
+            return NodeHandle();
+        }
+        return extractNode(node);
+    }
+
+    /// Inserts the node owned by `handle`, which may come from any tree of this type, and leaves `handle` empty. O(log n), no allocation.
+    /// @return The inserted node, or the sentinel if `handle` was empty.
+    Node* insertNode(NodeHandle&& handle) {
+        if (handle.isEmpty()) {
+            return Node::nilNode;
+        }
+
+        TREE_STATS_OPERATION(insertion);
+
+        auto [node, slabsReference] = handle.release();
+        nodeAllocator.acquireNode(node, std::move(slabsReference));
+
+        node->parent = Node::nilNode;
+        node->leftChild = Node::nilNode;
+        node->rightChild = Node::nilNode;
+        node->isRed = true;
+        return insertNodeBelow(rootNode, node);
+    }
+
+
+#pragma mark Split & Join
+private:
+    /// A detached subtree together with its black height (nil counts 0, a black root counts itself), so that joins never have to measure it.
+    struct Subtree {
+        Node* rootNode;
+        int blackHeight;
+    };
+
+    struct SplitResult {
+        Subtree left;
+        bool isFound;
+        Subtree right;
+    };
+
+    /// Branches with a smaller black height (at most 4^10 nodes) are never handed to another thread.
+    static constexpr int minParallelBlackHeight = 10;
+
+    static Subtree getLeftSubtree(Subtree tree) {
+        return {tree.rootNode->leftChild, tree.blackHeight - (tree.rootNode->isRed ? 0 : 1)};
+    }
+
+    static Subtree getRightSubtree(Subtree tree) {
+        return {tree.rootNode->rightChild, tree.blackHeight - (tree.rootNode->isRed ? 0 : 1)};
+    }
+
+    /// Every path has the same number of black nodes, so following the left spine is enough. O(log n).
+    static int getBlackHeight(Node* node) {
+        int blackHeight = 0;
+        for (; node != Node::nilNode; node = node->leftChild) {
+            blackHeight += node->isRed ? 0 : 1;
+        }
+
+        return blackHeight;
+    }
+
+    /// Turns the root of a split or joined subtree into a tree root.
+    static Node* detachAsRoot(Node* node) {
+        if (node != Node::nilNode) {
+            node->parent = Node::nilNode;
+            node->isRed = false;
+
+            if constexpr (isThreaded) {
+                // Joins link everything inside the tree. Its ends may still point at nodes that went elsewhere.
+                RBTree::linkInOrder(Node::nilNode, RBTree::getMinNodeOfSubtree(node));
+                RBTree::linkInOrder(RBTree::getMaxNodeOfSubtree(node), Node::nilNode);
+            }
+        }
+
+        return node;
+    }
+
+    static void collectSubtree(Node* node, std::vector<Node*>& nodes) {
+        if (node == Node::nilNode) {
+            return;
+        }
+
+        collectSubtree(node->leftChild, nodes);
+        collectSubtree(node->rightChild, nodes);
+        nodes.push_back(node);
+    }
+
+    /**
+     * Joins `left`, `middle` and `right` into one tree, where keys in `left` <= `middle` <= keys in `right`.
+     *
+     * `middle` is hung from the spine of the taller tree at the first black node as high as the other tree, then fixed up like a newly inserted node.
+     * O(difference in black heights + 1).
+     *
+     * Refer to "Just Join for Parallel Ordered Sets" by Blelloch, Ferizovic and Sun.
+     */
+    static Subtree joinNodes(Subtree left, Node* middle, Subtree right) {
+        if constexpr (isThreaded) {
+            RBTree::linkInOrder(RBTree::getMaxNodeOfSubtree(left.rootNode), middle);
+            RBTree::linkInOrder(middle, RBTree::getMinNodeOfSubtree(right.rootNode));
+        }
+
+        // Blackening a red root keeps a tree valid and adds 1 to its black height.
+        for (auto subtree: {&left, &right}) {
+            if (subtree->rootNode != Node::nilNode) {
+                subtree->rootNode->parent = Node::nilNode;
+                if (subtree->rootNode->isRed) {
+                    subtree->rootNode->isRed = false;
+                    subtree->blackHeight += 1;
+                }
+            }
+        }
+
+        if (left.blackHeight == right.blackHeight) {
+            RBTree::linkChildren(middle, left.rootNode, right.rootNode);
+            middle->parent = Node::nilNode;
+            middle->isRed = false;
+            Augmentation::update(middle);
+
+            return {middle, left.blackHeight + 1};
+        }
+
+        auto isLeftTaller = (left.blackHeight > right.blackHeight);
+        auto tallerTree = isLeftTaller ? left : right;
+        auto shorterTree = isLeftTaller ? right : left;
+
+        auto parent = Node::nilNode;
+        auto currentNode = tallerTree.rootNode;
+        auto blackHeight = tallerTree.blackHeight;
+        while (currentNode->isRed || (blackHeight > shorterTree.blackHeight)) {
+            blackHeight -= currentNode->isRed ? 0 : 1;
+            parent = currentNode;
+            currentNode = isLeftTaller ? currentNode->rightChild : currentNode->leftChild;
+        }
+
+        // `middle` is red with two children of equal black height, so the only possible violation is a red parent.
+        if (isLeftTaller) {
+            RBTree::linkChildren(middle, currentNode, right.rootNode);
+            parent->rightChild = middle;
+        } else {
+            RBTree::linkChildren(middle, left.rootNode, currentNode);
+            parent->leftChild = middle;
+        }
+        middle->parent = parent;
+        middle->isRed = true;
+        Augmentation::update(middle);
+        updateAugmentationUpward(parent);
+
+        auto rootNode = tallerTree.rootNode;
+        auto isRootBlackened = RBTree::fixUpInsertion(rootNode, middle);
+
+        return {rootNode, tallerTree.blackHeight + (isRootBlackened ? 1 : 0)};
+    }
+
+    static void linkChildren(Node* node, Node* leftChild, Node* rightChild) {
+        node->leftChild = leftChild;
+        node->rightChild = rightChild;
+        if (leftChild != Node::nilNode) {
+            leftChild->parent = node;
+        }
+        if (rightChild != Node::nilNode) {
+            rightChild->parent = node;
+        }
+    }
+
+    /**
+     * Splits `tree` into keys less than `value` and keys greater than `value`.
+     *
+     * Nodes equivalent to `value` are appended to `droppedNodes`. O(log n).
+     */
+    template <typename Key>
+    static SplitResult splitNodes(Subtree tree, const Key& value, std::vector<Node*>& droppedNodes) {
+        if (tree.rootNode == Node::nilNode) {
+            return {{Node::nilNode, 0}, false, {Node::nilNode, 0}};
+        }
+
+        auto node = tree.rootNode;
+        auto leftSubtree = getLeftSubtree(tree);
+        auto rightSubtree = getRightSubtree(tree);
+
+        if (isLess(node->value, value)) {
+            auto result = splitNodes(rightSubtree, value, droppedNodes);
+            result.left = joinNodes(leftSubtree, node, result.left);
+            return result;
+        } else if (isLess(value, node->value)) {
+            auto result = splitNodes(leftSubtree, value, droppedNodes);
+            result.right = joinNodes(result.right, node, rightSubtree);
+            return result;
+        } else {
+            // Duplicates of `value` may sit on both sides, next to `node`. Only split a side when it has one: reassembling it costs O(log n) joins.
+            if ((leftSubtree.rootNode != Node::nilNode) && !isLess(getMaxNodeOfSubtree(leftSubtree.rootNode)->value, value)) {
+                leftSubtree = splitNodes(leftSubtree, value, droppedNodes).left;
+            }
+            if ((rightSubtree.rootNode != Node::nilNode) && !isLess(value, getMinNodeOfSubtree(rightSubtree.rootNode)->value)) {
+                rightSubtree = splitNodes(rightSubtree, value, droppedNodes).right;
+            }
+            droppedNodes.push_back(node);
+
+            return {leftSubtree, true, rightSubtree};
+        }
+    }
+
+    /// Detaches the node with the largest key. `tree` must not be empty. O(log n).
+    static std::pair<Subtree, Node*> splitLast(Subtree tree) {
+        auto node = tree.rootNode;
+        if (node->rightChild == Node::nilNode) {
+            return {getLeftSubtree(tree), node};
+        }
+
+        auto [remainingSubtree, lastNode] = splitLast(getRightSubtree(tree));
+        return {joinNodes(getLeftSubtree(tree), node, remainingSubtree), lastNode};
+    }
+
+    /// Joins two trees without a middle node, where keys in `left` <= keys in `right`. O(log n).
+    static Subtree joinSubtrees(Subtree left, Subtree right) {
+        if (left.rootNode == Node::nilNode) {
+            return right;
+        }
+
+        auto [remainingSubtree, lastNode] = splitLast(left);
+        return joinNodes(remainingSubtree, lastNode, right);
+    }
+
+public:
+    /**
+     * Joins `leftTree`, a new node and `rightTree`, where keys in `leftTree` <= `value` <= keys in `rightTree`.
+     *
+     * Consumes both trees. O(log n).
+     */
+    static RBTree join(RBTree&& leftTree, const T& value, RBTree&& rightTree, const Payload& payload = Payload()) {
+        auto returnValue = RBTree(std::move(leftTree));
+        returnValue.nodeAllocator.adoptSlabs(std::move(rightTree.nodeAllocator));
+
+        auto middle = returnValue.nodeAllocator.allocate(value, payload, false);
+        auto result = joinNodes(
+            {returnValue.rootNode, getBlackHeight(returnValue.rootNode)},
+            middle,
+            {rightTree.rootNode, getBlackHeight(rightTree.rootNode)}
+        );
+        returnValue.rootNode = detachAsRoot(result.rootNode);
+        rightTree.rootNode = Node::nilNode;
+
+        return returnValue;
+    }
+
+    /**
+     * Splits `tree` at `value`.
+     *
+     * Consumes `tree`. Nodes equivalent to `value` are deleted. O(log n).
+     *
+     * @return Tree of keys less than `value`, whether `value` was present, and tree of keys greater than `value`.
+     */
+    template <typename Key>
+    static std::tuple<RBTree, bool, RBTree> split(RBTree&& tree, const Key& value) {
+        auto leftTree = RBTree(std::move(tree));
+        auto rightTree = RBTree();
+        rightTree.nodeAllocator = leftTree.nodeAllocator.shareSlabs();
+        // Which nodes end up on which side is not known without counting them.
+        leftTree.nodeAllocator.invalidateLiveNodeCount();
+        rightTree.nodeAllocator.invalidateLiveNodeCount();
+
+        auto droppedNodes = std::vector<Node*>();
+        auto result = splitNodes(Subtree{leftTree.rootNode, getBlackHeight(leftTree.rootNode)}, value, droppedNodes);
+        leftTree.rootNode = detachAsRoot(result.left.rootNode);
+        rightTree.rootNode = detachAsRoot(result.right.rootNode);
+
+        for (auto node: droppedNodes) {
+            leftTree.nodeAllocator.deallocate(node);
+        }
+
+        return {std::move(leftTree), result.isFound, std::move(rightTree)};
+    }
+
+
+#pragma mark Set Operations
+private:
+    /**
+     * Runs two independent branches of a set operation, forking `leftBranch` onto another thread while `parallelDepth` allows it.
+     *
+     * Each branch is called as `branch(droppedNodes, parallelDepth)` and collects its dropped nodes separately, since vectors are not thread-safe.
+     */
+    template <typename LeftBranch, typename RightBranch>
+    static std::pair<Subtree, Subtree> runBranches(int parallelDepth, std::vector<Node*>& droppedNodes, LeftBranch leftBranch, RightBranch rightBranch) {
+        if (parallelDepth <= 0) {
+            auto leftResult = leftBranch(droppedNodes, 0);
+            auto rightResult = rightBranch(droppedNodes, 0);
+            return {leftResult, rightResult};
+        }
+
+        auto leftDroppedNodes = std::vector<Node*>();
+        auto leftFuture = std::async(std::launch::async, [&]() {
+            return leftBranch(leftDroppedNodes, parallelDepth - 1);
+        });
+        auto rightResult = rightBranch(droppedNodes, parallelDepth - 1);
+        auto leftResult = leftFuture.get();
+        droppedNodes.insert(droppedNodes.end(), leftDroppedNodes.begin(), leftDroppedNodes.end());
+
+        return {leftResult, rightResult};
+    }
+
+    /// `first`'s root is the pivot: split `second` at its key, recurse on both sides in parallel, then join.
+    static Subtree unionNodes(Subtree first, Subtree second, std::vector<Node*>& droppedNodes, int parallelDepth) {
+        if (first.rootNode == Node::nilNode) {
+            return second;
+        } else if (second.rootNode == Node::nilNode) {
+            return first;
+        }
+
+        auto node = first.rootNode;
+        auto firstLeft = getLeftSubtree(first);
+        auto firstRight = getRightSubtree(first);
+        auto secondSplit = splitNodes(second, node->value, droppedNodes);
+
+        auto [leftResult, rightResult] = runBranches(
+            (first.blackHeight >= minParallelBlackHeight) ? parallelDepth : 0,
+            droppedNodes,
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return unionNodes(firstLeft, secondSplit.left, branchDroppedNodes, branchParallelDepth);
+            },
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return unionNodes(firstRight, secondSplit.right, branchDroppedNodes, branchParallelDepth);
+            }
+        );
+
+        return joinNodes(leftResult, node, rightResult);
+    }
+
+    static Subtree intersectionNodes(Subtree first, Subtree second, std::vector<Node*>& droppedNodes, int parallelDepth) {
+        if ((first.rootNode == Node::nilNode) || (second.rootNode == Node::nilNode)) {
+            collectSubtree(first.rootNode, droppedNodes);
+            collectSubtree(second.rootNode, droppedNodes);
+            return {Node::nilNode, 0};
+        }
+
+        auto node = first.rootNode;
+        auto firstLeft = getLeftSubtree(first);
+        auto firstRight = getRightSubtree(first);
+        auto secondSplit = splitNodes(second, node->value, droppedNodes);
+
+        auto [leftResult, rightResult] = runBranches(
+            (first.blackHeight >= minParallelBlackHeight) ? parallelDepth : 0,
+            droppedNodes,
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return intersectionNodes(firstLeft, secondSplit.left, branchDroppedNodes, branchParallelDepth);
+            },
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return intersectionNodes(firstRight, secondSplit.right, branchDroppedNodes, branchParallelDepth);
+            }
+        );
+
+        if (secondSplit.isFound) {
+            return joinNodes(leftResult, node, rightResult);
+        } else {
+            droppedNodes.push_back(node);
+            return joinSubtrees(leftResult, rightResult);
+        }
+    }
+
+    static Subtree differenceNodes(Subtree first, Subtree second, std::vector<Node*>& droppedNodes, int parallelDepth) {
+        if (first.rootNode == Node::nilNode) {
+            collectSubtree(second.rootNode, droppedNodes);
+            return first;
+        } else if (second.rootNode == Node::nilNode) {
+            return first;
+        }
+
+        auto node = first.rootNode;
+        auto firstLeft = getLeftSubtree(first);
+        auto firstRight = getRightSubtree(first);
+        auto secondSplit = splitNodes(second, node->value, droppedNodes);
+
+        auto [leftResult, rightResult] = runBranches(
+            (first.blackHeight >= minParallelBlackHeight) ? parallelDepth : 0,
+            droppedNodes,
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return differenceNodes(firstLeft, secondSplit.left, branchDroppedNodes, branchParallelDepth);
+            },
+            [&](std::vector<Node*>& branchDroppedNodes, int branchParallelDepth) {
+                return differenceNodes(firstRight, secondSplit.right, branchDroppedNodes, branchParallelDepth);
+            }
+        );
+
+        if (secondSplit.isFound) {
+            droppedNodes.push_back(node);
+            return joinSubtrees(leftResult, rightResult);
+        } else {
+            return joinNodes(leftResult, node, rightResult);
+        }
+    }
+
+    template <typename Operation>
+    static RBTree runSetOperation(RBTree&& firstTree, RBTree&& secondTree, Operation operation) {
+        auto returnValue = RBTree(std::move(firstTree));
+        returnValue.nodeAllocator.adoptSlabs(std::move(secondTree.nodeAllocator));
+
+        auto droppedNodes = std::vector<Node*>();
+        auto result = operation(
+            Subtree{returnValue.rootNode, getBlackHeight(returnValue.rootNode)},
+            Subtree{secondTree.rootNode, getBlackHeight(secondTree.rootNode)},
+            droppedNodes,
+            RBTree::getParallelDepth()
+        );
+        returnValue.rootNode = detachAsRoot(result.rootNode);
+        secondTree.rootNode = Node::nilNode;
+
+        // Deallocating on this thread only, since the allocator is not thread-safe.
+        for (auto node: droppedNodes) {
+            returnValue.nodeAllocator.deallocate(node);
+        }
+
+        return returnValue;
+    }
+
+public:
+    /*
+     * Set operations with set semantics: both trees should hold distinct keys.
+     * Where both trees hold a key, the node (and payload) of `firstTree` is kept and the other one is deleted.
+     *
+     * Both trees are consumed and must be different objects.
+     * O(m log(n/m + 1)) work for trees of sizes m <= n, with independent subtrees processed in parallel.
+     */
+
+    /// Keys in either tree.
+    static RBTree setUnion(RBTree&& firstTree, RBTree&& secondTree) {
+        return runSetOperation(std::move(firstTree), std::move(secondTree), RBTree::unionNodes);
+    }
+
+    /// Keys in both trees.
+    static RBTree setIntersection(RBTree&& firstTree, RBTree&& secondTree) {
+        return runSetOperation(std::move(firstTree), std::move(secondTree), RBTree::intersectionNodes);
+    }
+
+    /// Keys in `firstTree` but not in `secondTree`.
+    static RBTree setDifference(RBTree&& firstTree, RBTree&& secondTree) {
+        return runSetOperation(std::move(firstTree), std::move(secondTree), RBTree::differenceNodes);
+    }
+};
+
+
+/// Red black tree with subtree sizes, answering order statistic queries in O(log n) (CLRS 14.1).
+template <typename T, typename Payload = RBNoPayload, typename Compare = std::less<T>, template <typename> typename NodeAllocator = NodePool>
+class OrderStatisticTree: public RBTree<T, Payload, Compare, RBSubtreeSize, NodeAllocator> {
+private:
+    using Base = RBTree<T, Payload, Compare, RBSubtreeSize, NodeAllocator>;
+
+public:
+    using typename Base::Node;
+    using Base::Base;
+
+    OrderStatisticTree() = default;
+
+public:
+    std::size_t getSize() const {
+        return this->rootNode->size;
+    }
+
+    /// @return The node with the `k`th smallest key, counting from 0, or the sentinel if `k` is out of range.
+    Node* select(std::size_t k) const {
+        auto currentNode = this->rootNode;
+        while (currentNode != Node::nilNode) {
+            auto leftSize = currentNode->leftChild->size;
+            if (k < leftSize) {
+                currentNode = currentNode->leftChild;
+            } else if (k == leftSize) {
+                return currentNode;
+            } else {
+                k -= leftSize + 1;
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return Node::nilNode;
+    }
+
+    /// @return Number of keys less than `value`, which is also the position `value` would be inserted at.
+    template <typename Key>
+    std::size_t rank(const Key& value) const {
+        std::size_t returnValue = 0;
+
+        auto currentNode = this->rootNode;
+        while (currentNode != Node::nilNode) {
+            if (Base::isLess(currentNode->value, value)) {
+                returnValue += currentNode->leftChild->size + 1;
+                currentNode = currentNode->rightChild;
+            } else {
+                currentNode = currentNode->leftChild;
+            }
+        }
+
+        return returnValue;
+    }
+
+    /// Position of `node` in an in-order walk, counting from 0. Refer to OS-RANK in section 14.1 of "Introduction to Algorithms".
+    static std::size_t getRankOfNode(Node* node) {
+        auto returnValue = node->leftChild->size;
+        while (node->parent != Node::nilNode) {
+            if (node == node->parent->rightChild) {
+                returnValue += node->parent->leftChild->size + 1;
+            }
+            node = node->parent;
+        }
+
+        return returnValue;
+    }
+
+    /// @return Number of keys in `[lowValue, highValue)`.
+    template <typename Key>
+    std::size_t countInRange(const Key& lowValue, const Key& highValue) const {
+        auto lowRank = rank(lowValue);
+        auto highRank = rank(highValue);
+        return (highRank > lowRank) ? (highRank - lowRank) : 0;
+    }
+
+    /// @param fraction In `[0, 1]`. Nearest-rank percentile; the sentinel for an empty tree.
+    Node* getPercentile(double fraction) const {
+        auto size = getSize();
+        if (size == 0) {
+            return Node::nilNode;
+        }
+
+        auto k = static_cast<std::size_t>(fraction * (size - 1) + 0.5);
+        return select(std::min(k, size - 1));
+    }
+
+
+#pragma mark Split & Join
+private:
+    /// The sizes are already maintained by `Base`, so nothing needs recomputing.
+    explicit OrderStatisticTree(Base&& tree): Base(std::move(tree)) {
+    }
+
+public:
+    /// Same as `RBTree::join`, keeping order statistics on the result.
+    static OrderStatisticTree join(OrderStatisticTree&& leftTree, const T& value, OrderStatisticTree&& rightTree, const Payload& payload = Payload()) {
+        return OrderStatisticTree(Base::join(std::move(leftTree), value, std::move(rightTree), payload));
+    }
+
+    /// Same as `RBTree::split`, keeping order statistics on both halves.
+    template <typename Key>
+    static std::tuple<OrderStatisticTree, bool, OrderStatisticTree> split(OrderStatisticTree&& tree, const Key& value) {
+        auto [leftTree, isFound, rightTree] = Base::split(std::move(tree), value);
+        return {OrderStatisticTree(std::move(leftTree)), isFound, OrderStatisticTree(std::move(rightTree))};
+    }
+
+    static OrderStatisticTree setUnion(OrderStatisticTree&& firstTree, OrderStatisticTree&& secondTree) {
+        return OrderStatisticTree(Base::setUnion(std::move(firstTree), std::move(secondTree)));
+    }
+
+    static OrderStatisticTree setIntersection(OrderStatisticTree&& firstTree, OrderStatisticTree&& secondTree) {
+        return OrderStatisticTree(Base::setIntersection(std::move(firstTree), std::move(secondTree)));
+    }
+
+    static OrderStatisticTree setDifference(OrderStatisticTree&& firstTree, OrderStatisticTree&& secondTree) {
+        return OrderStatisticTree(Base::setDifference(std::move(firstTree), std::move(secondTree)));
+    }
+};
+
+
+/// The key of an interval tree node is the low endpoint. The rest of the interval lives in the payload.
+template <typename T, typename Payload>
+struct RBIntervalPayload {
+    T highEndpoint;
+    Payload data;
+};
+
+/// Red black tree of closed intervals `[low, high]`, keyed by the low endpoint (CLRS 14.3).
+template <typename T, typename Payload = RBNoPayload, template <typename> typename NodeAllocator = NodePool>
+class IntervalTree: public RBTree<T, RBIntervalPayload<T, Payload>, std::less<T>, RBMaxHighEndpoint<T>, NodeAllocator> {
+private:
+    using Base = RBTree<T, RBIntervalPayload<T, Payload>, std::less<T>, RBMaxHighEndpoint<T>, NodeAllocator>;
+
+public:
+    using typename Base::Node;
+
+public:
+    Node* insertInterval(const T& lowEndpoint, const T& highEndpoint, const Payload& data = Payload()) {
+        return this->insertValue(lowEndpoint, {highEndpoint, data});
+    }
+
+    static bool isOverlapping(const Node* node, const T& lowEndpoint, const T& highEndpoint) {
+        return (node->value <= highEndpoint) && (lowEndpoint <= node->payload.highEndpoint);
+    }
+
+    /**
+     * Refer to INTERVAL-SEARCH in section 14.3 of "Introduction to Algorithms". O(log n).
+     *
+     * @return Any node overlapping `[lowEndpoint, highEndpoint]`, or the sentinel.
+     */
+    Node* searchForOverlap(const T& lowEndpoint, const T& highEndpoint) const {
+        auto currentNode = this->rootNode;
+        while ((currentNode != Node::nilNode) && (!isOverlapping(currentNode, lowEndpoint, highEndpoint))) {
+            if ((currentNode->leftChild != Node::nilNode) && (currentNode->leftChild->maxHighEndpoint >= lowEndpoint)) {
+                // If the left subtree has no overlap, the right one has none either.
+                currentNode = currentNode->leftChild;
+            } else {
+                currentNode = currentNode->rightChild;
+            }
+        }
+
+        return currentNode;
+    }
+
+    /**
+     * Calls `visitor(node)` for every node overlapping `[lowEndpoint, highEndpoint]`, in order of low endpoints.
+     *
+     * Subtrees whose maximum high endpoint is below `lowEndpoint`, and right subtrees of nodes starting after `highEndpoint`, are skipped.
+     * Every other visited node lies on the path to a reported node, so the cost is O(min(n, k log n)) for k results.
+     */
+    template <typename Visitor>
+    void forEachOverlap(const T& lowEndpoint, const T& highEndpoint, Visitor visitor) const {
+        IntervalTree::visitOverlaps(this->rootNode, lowEndpoint, highEndpoint, visitor);
+    }
+
+private:
+    template <typename Visitor>
+    static void visitOverlaps(Node* node, const T& lowEndpoint, const T& highEndpoint, Visitor& visitor) {
+        if ((node == Node::nilNode) || (node->maxHighEndpoint < lowEndpoint)) {
+            return;
+        }
+
+        visitOverlaps(node->leftChild, lowEndpoint, highEndpoint, visitor);
+
+        if (node->value > highEndpoint) {
+            // Everything to the right starts even later.
+            return;
+        }
+        if (lowEndpoint <= node->payload.highEndpoint) {
+            visitor(node);
+        }
+
+        visitOverlaps(node->rightChild, lowEndpoint, highEndpoint, visitor);
+    }
+};
+
+
+/// Payload of a `CountedRBTree` node: how many copies of its key the tree holds.
+struct RBMultiplicity {
+    std::size_t count = 1;
+};
+
+/**
+ * Multiset that keeps one node per distinct key, with a count, instead of one node per copy.
+ *
+ * Duplicate-heavy data (few distinct keys, large counts) then takes memory and height for its distinct keys only.
+ * Iterators and `inOrderWalk` still visit every copy: each key is repeated as many times as it is counted, without copying anything ahead of time.
+ * Node-level operations of `RBTree` (`searchForValue`, `lowerBound`, `forEachInRange`, ...) see each distinct key once.
+ */
+template <typename T, typename Compare = std::less<T>, template <typename> typename NodeAllocator = NodePool>
+class CountedRBTree: public RBTree<T, RBMultiplicity, Compare, RBNoAugmentation, NodeAllocator> {
+private:
+    using Base = RBTree<T, RBMultiplicity, Compare, RBNoAugmentation, NodeAllocator>;
+
+    /// Copies of all keys.
+    std::size_t size = 0;
+
+public:
+    using typename Base::Node;
+
+    CountedRBTree() = default;
+
+    /// Builds the tree from keys sorted by `Compare`, which may repeat, in O(n) time.
+    template <typename Iterator>
+    CountedRBTree(Iterator first, Iterator last): CountedRBTree(collapseRuns(first, last)) {
+    }
+
+private:
+    explicit CountedRBTree(const std::vector<std::pair<T, RBMultiplicity>>& countedKeys): Base(countedKeys.begin(), countedKeys.end()) {
+        for (const auto& countedKey: countedKeys) {
+            size += countedKey.second.count;
+        }
+    }
+
+    /// Turns each run of equivalent keys into one `(key, count)` pair.
+    template <typename Iterator>
+    static std::vector<std::pair<T, RBMultiplicity>> collapseRuns(Iterator first, Iterator last) {
+        auto returnValue = std::vector<std::pair<T, RBMultiplicity>>();
+        for (auto it = first; it != last; ++it) {
+            if (!returnValue.empty() && !Base::isLess(returnValue.back().first, *it)) {
+                returnValue.back().second.count += 1;
+            } else {
+                returnValue.push_back({*it, RBMultiplicity()});
+            }
+        }
+        return returnValue;
+    }
+
+public:
+    std::size_t getSize() const {
+        return size;
+    }
+
+    /// @return Copies of `value` in the tree. O(log n). Heterogeneous if `Compare` is transparent, like `searchForValue`.
+    template <typename Key>
+    std::size_t count(const Key& value) {
+        auto node = this->searchForValue(value);
+        return (node == Node::nilNode) ? 0 : node->payload.count;
+    }
+
+    /// Adds a copy of `newValue`: to the count of its node when there is one, to a new node otherwise.
+    Node* insertValue(const T& newValue) {
+        size += 1;
+
+        auto node = this->searchForValue(newValue);
+        if (node != Node::nilNode) {
+            node->payload.count += 1;
+            return node;
+        }
+
+        return Base::insertValue(newValue);
+    }
+
+    /// Removes one copy of `value`. The node goes once its count drops to 0.
+    bool deleteValue(const T& value) {
+        auto node = this->searchForValue(value);
+        if (node == Node::nilNode) {
+            return false;
+        }
+
+        if (node->payload.count > 1) {
+            node->payload.count -= 1;
+            size -= 1;
+        } else {
+            deleteNode(node);
+        }
+        return true;
+    }
+
+    /// Removes `node` with all its copies.
+    void deleteNode(Node* node) {
+        size -= node->payload.count;
+        Base::deleteNode(node);
+    }
+
+    void clear() {
+        Base::clear();
+        size = 0;
+    }
+
+    /// The payload is the count, so there is nothing to construct in place.
+    template <typename... Args>
+    Node* emplaceValue(Args&&...) = delete;
+
+    /// `RBTree`'s versions would return a plain `RBTree`, dropping the counts' meaning, and leave the consumed tree's size stale.
+    template <typename... Args>
+    static void join(Args&&...) = delete;
+    template <typename... Args>
+    static void split(Args&&...) = delete;
+    template <typename... Args>
+    static void setUnion(Args&&...) = delete;
+    template <typename... Args>
+    static void setIntersection(Args&&...) = delete;
+    template <typename... Args>
+    static void setDifference(Args&&...) = delete;
+
+
+#pragma mark Node Handles
+public:
+    /// Takes `node` out of the tree with all its copies.
+    typename Base::NodeHandle extractNode(Node* node) {
+        size -= node->payload.count;
+        return Base::extractNode(node);
+    }
+
+    typename Base::NodeHandle extractValue(const T& value) {
+        auto node = this->searchForValue(value);
+        if (node == Node::nilNode) {
+            return typename Base::NodeHandle();
+        }
+        return extractNode(node);
+    }
+
+    /// Adds every copy `handle` holds. If the key is already in the tree, the counts are merged and the handle's node is destroyed.
+    Node* insertNode(typename Base::NodeHandle&& handle) {
+        if (handle.isEmpty()) {
+            return Node::nilNode;
+        }
+
+        size += handle.getPayload().count;
+
+        auto node = this->searchForValue(handle.getValue());
+        if (node != Node::nilNode) {
+            node->payload.count += handle.getPayload().count;
+            handle = typename Base::NodeHandle();
+            return node;
+        }
+
+        return Base::insertNode(std::move(handle));
+    }
+
+
+#pragma mark Iteration
+public:
+    /// Bidirectional iterator over every copy of every key. A step within a node's copies touches no other node.
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+    private:
+        typename Base::Iterator nodeIterator;
+        /// Which copy of the current key, counting from 0.
+        std::size_t copyIndex;
+
+    public:
+        Iterator(typename Base::Iterator nodeIterator, std::size_t copyIndex): nodeIterator(nodeIterator), copyIndex(copyIndex) {
+        }
+
+        Node* getNode() const {
+            return nodeIterator.getNode();
+        }
+
+        reference operator*() const {
+            return *nodeIterator;
+        }
+
+        pointer operator->() const {
+            return &(*nodeIterator);
+        }
+
+        Iterator& operator++() {
+            if (copyIndex + 1 < nodeIterator.getNode()->payload.count) {
+                copyIndex += 1;
+            } else {
+                ++nodeIterator;
+                copyIndex = 0;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        Iterator& operator--() {
+            if (copyIndex > 0) {
+                copyIndex -= 1;
+            } else {
+                --nodeIterator;
+                copyIndex = nodeIterator.getNode()->payload.count - 1;
+            }
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto returnValue = *this;
+            --(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return (nodeIterator == other.nodeIterator) && (copyIndex == other.copyIndex);
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const {
+        return Iterator(Base::begin(), 0);
+    }
+
+    Iterator end() const {
+        return Iterator(Base::end(), 0);
+    }
+
+    ReverseIterator rbegin() const {
+        return ReverseIterator(end());
+    }
+
+    ReverseIterator rend() const {
+        return ReverseIterator(begin());
+    }
+
+    std::vector<T> inOrderWalk() const {
+        auto returnValue = std::vector<T>();
+        returnValue.reserve(size);
+        for (auto it = Base::begin(); it != Base::end(); ++it) {
+            returnValue.insert(returnValue.end(), it.getNode()->payload.count, *it);
+        }
+        return returnValue;
+    }
+};
+
+
+/**
+ * Keys-only red black tree with small nodes, for large sets of small keys.
+ *
+ * An `RBNode` spends 3 pointers and a padded `bool` on links: 40 bytes for a 4-byte key.
+ * Here nodes live in one array and refer to each other by 32-bit indices, and the color takes the lowest bit of the parent index.
+ * That is 16 bytes for a 4-byte key, so 2.5 times as many nodes share the cache, and a lookup touches fewer cache lines.
+ *
+ * Index 0 is the black sentinel and is never written to. Deleted slots are chained into a free list through `leftChild` and reused first.
+ * Growing the array moves the nodes, so unlike `RBTree` nothing hands out node pointers: iterators and handles hold indices.
+ *
+ * The algorithms are exactly those of `RBTree` (CLRS chapter 13) with `->` replaced by array accesses.
+ */
+template <typename T, typename Compare = std::less<T>>
+class CompactRBTree {
+public:
+    using Index = std::uint32_t;
+    using ValueCompare = Compare;
+
+    static constexpr Index nilIndex = 0;
+
+    /// One bit of every parent index holds the color.
+    static constexpr std::size_t maxNodeCount = (std::size_t(1) << 31) - 1;
+
+    static_assert(std::is_empty_v<Compare>, "The comparator must be stateless.");
+
+    class Node {
+    public:
+        T value;
+        Index leftChild;
+        Index rightChild;
+
+    private:
+        /// `(parent << 1) | isRed`.
+        Index parentAndColor;
+
+    public:
+        Node(const T& value, Index parent, bool isRed): value(value), leftChild(nilIndex), rightChild(nilIndex), parentAndColor((parent << 1) | Index(isRed)) {
+        }
+
+        Index getParent() const {
+            return parentAndColor >> 1;
+        }
+
+        bool isRed() const {
+            return parentAndColor & 1;
+        }
+
+        void setParent(Index parent) {
+            parentAndColor = (parent << 1) | (parentAndColor & 1);
+        }
+
+        void setRed(bool isRed) {
+            parentAndColor = (parentAndColor & ~Index(1)) | Index(isRed);
+        }
+    };
+
+private:
+    /// `nodes[0]` is the sentinel.
+    std::vector<Node> nodes;
+
+    Index rootIndex;
+
+    /// Head of the deleted slots, linked through `leftChild`.
+    Index freeIndex;
+
+    std::size_t size;
+
+public:
+    CompactRBTree() {
+        nodes.emplace_back(T(), nilIndex, false);
+        rootIndex = nilIndex;
+        freeIndex = nilIndex;
+        size = 0;
+    }
+
+    /// Makes room for `count` keys, so that inserting them never moves the array.
+    void reserve(std::size_t count) {
+        nodes.reserve(count + 1);
+    }
+
+    std::size_t getSize() const {
+        return size;
+    }
+
+    /// Bytes held by the node array, including the sentinel, free slots and spare capacity.
+    std::size_t getNodeBytes() const {
+        return nodes.capacity() * sizeof(Node);
+    }
+
+    Index getRootIndex() const {
+        return rootIndex;
+    }
+
+    /// @param index A live node, or `nilIndex` for the sentinel.
+    const Node& getNode(Index index) const {
+        return nodes[index];
+    }
+
+
+#pragma mark Comparison
+private:
+    template <typename A, typename B>
+    static bool isLess(const A& a, const B& b) {
+        return Compare()(a, b);
+    }
+
+    static constexpr bool isEquivalenceEquality = std::is_arithmetic_v<T> && (
+        std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>> ||
+        std::is_same_v<Compare, std::greater<T>> || std::is_same_v<Compare, std::greater<>>
+    );
+
+
+#pragma mark Min & Max
+private:
+    Index getMinIndexOfSubtree(Index index) const {
+        if (index == nilIndex) {
+            return nilIndex;
+        }
+
+        while (nodes[index].leftChild != nilIndex) {
+            index = nodes[index].leftChild;
+        }
+
+        return index;
+    }
+
+    Index getMaxIndexOfSubtree(Index index) const {
+        if (index == nilIndex) {
+            return nilIndex;
+        }
+
+        while (nodes[index].rightChild != nilIndex) {
+            index = nodes[index].rightChild;
+        }
+
+        return index;
+    }
+
+
+#pragma mark Predecessor & Successor
+private:
+    Index getPredecessor(Index index) const {
+        if (index == nilIndex) {
+            return nilIndex;
+        }
+
+        if (nodes[index].leftChild != nilIndex) {
+            return getMaxIndexOfSubtree(nodes[index].leftChild);
+        }
+
+        auto ancestor = nodes[index].getParent();
+        while ((ancestor != nilIndex) && (nodes[ancestor].leftChild == index)) {
+            index = ancestor;
+            ancestor = nodes[ancestor].getParent();
+        }
+
+        return ancestor;
+    }
+
+    Index getSuccessor(Index index) const {
+        if (index == nilIndex) {
+            return nilIndex;
+        }
+
+        if (nodes[index].rightChild != nilIndex) {
+            return getMinIndexOfSubtree(nodes[index].rightChild);
+        }
+
+        auto ancestor = nodes[index].getParent();
+        while ((ancestor != nilIndex) && (nodes[ancestor].rightChild == index)) {
+            index = ancestor;
+            ancestor = nodes[ancestor].getParent();
+        }
+
+        return ancestor;
+    }
+
+
+#pragma mark Iteration
+public:
+    /// Bidirectional in-order iterator. Stays valid until its key is deleted, even when the array grows.
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+    private:
+        const CompactRBTree* tree;
+        /// `nilIndex` represents `end()`.
+        Index index;
+
+    public:
+        Iterator(const CompactRBTree* tree, Index index): tree(tree), index(index) {
+        }
+
+        Index getIndex() const {
+            return index;
+        }
+
+        reference operator*() const {
+            return tree->nodes[index].value;
+        }
+
+        pointer operator->() const {
+            return &(tree->nodes[index].value);
+        }
+
+        Iterator& operator++() {
+            index = tree->getSuccessor(index);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        Iterator& operator--() {
+            if (index == nilIndex) {
+                index = tree->getMaxIndexOfSubtree(tree->rootIndex);
+            } else {
+                index = tree->getPredecessor(index);
+            }
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto returnValue = *this;
+            --(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
+    };
+
+    Iterator begin() const {
+        return Iterator(this, getMinIndexOfSubtree(rootIndex));
+    }
+
+    Iterator end() const {
+        return Iterator(this, nilIndex);
+    }
+
+    std::vector<T> inOrderWalk() const {
+        auto returnValue = std::vector<T>();
+        returnValue.reserve(size);
+        returnValue.insert(returnValue.end(), begin(), end());
+        return returnValue;
+    }
+
+
+#pragma mark Search
+public:
+    /// @return An iterator to a key equivalent to `value`, or `end()`.
+    template <typename Key>
+    Iterator searchForValue(const Key& value) const {
+        auto index = rootIndex;
+        while (index != nilIndex) {
+            const auto& node = nodes[index];
+            if constexpr (isEquivalenceEquality && std::is_same_v<Key, T>) {
+                if (node.value == value) {
+                    break;
+                }
+                index = isLess(value, node.value) ? node.leftChild : node.rightChild;
+            } else {
+                if (isLess(value, node.value)) {
+                    index = node.leftChild;
+                } else if (isLess(node.value, value)) {
+                    index = node.rightChild;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        return Iterator(this, index);
+    }
+
+    /// @return The first key not less than `value`.
+    template <typename Key>
+    Iterator lowerBound(const Key& value) const {
+        auto candidate = nilIndex;
+        auto index = rootIndex;
+        while (index != nilIndex) {
+            if (!isLess(nodes[index].value, value)) {
+                candidate = index;
+                index = nodes[index].leftChild;
+            } else {
+                index = nodes[index].rightChild;
+            }
+        }
+
+        return Iterator(this, candidate);
+    }
+
+
+#pragma mark Rotation
+private:
+    void rotateLeft(Index x) {
+        auto y = nodes[x].rightChild;
+
+        // Move beta.
+        nodes[x].rightChild = nodes[y].leftChild;
+        if (nodes[y].leftChild != nilIndex) {
+            nodes[nodes[y].leftChild].setParent(x);
+        }
+
+        // Move x and y.
+        auto xParent = nodes[x].getParent();
+        nodes[y].setParent(xParent);
+        if (xParent == nilIndex) {
+            rootIndex = y;
+        } else if (x == nodes[xParent].leftChild) {
+            nodes[xParent].leftChild = y;
+        } else {
+            nodes[xParent].rightChild = y;
+        }
+
+        nodes[x].setParent(y);
+        nodes[y].leftChild = x;
+    }
+
+    void rotateRight(Index y) {
+        auto x = nodes[y].leftChild;
+
+        nodes[y].leftChild = nodes[x].rightChild;
+        if (nodes[x].rightChild != nilIndex) {
+            nodes[nodes[x].rightChild].setParent(y);
+        }
+
+        auto yParent = nodes[y].getParent();
+        nodes[x].setParent(yParent);
+        if (yParent == nilIndex) {
+            rootIndex = x;
+        } else if (y == nodes[yParent].leftChild) {
+            nodes[yParent].leftChild = x;
+        } else {
+            nodes[yParent].rightChild = x;
+        }
+
+        nodes[y].setParent(x);
+        nodes[x].rightChild = y;
+    }
+
+
+#pragma mark Insertion
+private:
+    /// @return Index of a red node holding `value`, taken from the free list if possible.
+    Index allocateNode(const T& value) {
+        if (freeIndex != nilIndex) {
+            auto index = freeIndex;
+            freeIndex = nodes[index].leftChild;
+            nodes[index] = Node(value, nilIndex, true);
+            return index;
+        }
+
+        if (nodes.size() > maxNodeCount) {
+            throw std::length_error("CompactRBTree: too many nodes for 31-bit indices.");
+        }
+        nodes.emplace_back(value, nilIndex, true);
+        return static_cast<Index>(nodes.size() - 1);
+    }
+
+    void fixUpInsertion(Index z) {
+        while (nodes[nodes[z].getParent()].isRed()) {
+            auto parent = nodes[z].getParent();
+            // The parent is red, so it is not the root and the grandparent exists.
+            auto grandparent = nodes[parent].getParent();
+
+            if (parent == nodes[grandparent].leftChild) {
+                /// Uncle of z.
+                auto y = nodes[grandparent].rightChild;
+
+                if (nodes[y].isRed()) {
+                    // Case 1. Parent and uncle are red.
+                    nodes[parent].setRed(false);
+                    nodes[y].setRed(false);
+                    nodes[grandparent].setRed(true);
+                    z = grandparent;
+                } else {
+                    if (z == nodes[parent].rightChild) {
+                        // Case 2. z is the right child.
+                        z = parent;
+                        rotateLeft(z);
+                        parent = nodes[z].getParent();
+                    }
+
+                    // Case 3.
+                    nodes[parent].setRed(false);
+                    nodes[grandparent].setRed(true);
+                    rotateRight(grandparent);
+                    break;
+                }
+            } else {
+                auto y = nodes[grandparent].leftChild;
+
+                if (nodes[y].isRed()) {
+                    nodes[parent].setRed(false);
+                    nodes[y].setRed(false);
+                    nodes[grandparent].setRed(true);
+                    z = grandparent;
+                } else {
+                    if (z == nodes[parent].leftChild) {
+                        z = parent;
+                        rotateRight(z);
+                        parent = nodes[z].getParent();
+                    }
+
+                    nodes[parent].setRed(false);
+                    nodes[grandparent].setRed(true);
+                    rotateLeft(grandparent);
+                    break;
+                }
+            }
+        }
+
+        nodes[rootIndex].setRed(false);
+    }
+
+public:
+    /// Duplicate keys are allowed and go after their equivalents.
+    Iterator insertValue(const T& newValue) {
+        // Allocate first: growing the array moves every node.
+        // `newValue` may be a key of this tree, so the descent compares the new node's copy.
+        auto newIndex = allocateNode(newValue);
+        size += 1;
+        const auto& newKey = nodes[newIndex].value;
+
+        auto parentIndex = nilIndex;
+        auto index = rootIndex;
+        bool isLeftChild = false;
+        while (index != nilIndex) {
+            parentIndex = index;
+            isLeftChild = isLess(newKey, nodes[index].value);
+            index = isLeftChild ? nodes[index].leftChild : nodes[index].rightChild;
+        }
+
+        nodes[newIndex].setParent(parentIndex);
+        if (parentIndex == nilIndex) {
+            rootIndex = newIndex;
+        } else if (isLeftChild) {
+            nodes[parentIndex].leftChild = newIndex;
+        } else {
+            nodes[parentIndex].rightChild = newIndex;
+        }
+
+        fixUpInsertion(newIndex);
+
+        return Iterator(this, newIndex);
+    }
+
+
+#pragma mark - Deletion
+private:
+    void transplantDuringDeletion(Index oldIndex, Index newIndex) {
+        auto oldParent = nodes[oldIndex].getParent();
+        if (oldParent == nilIndex) {
+            rootIndex = newIndex;
+        } else if (oldIndex == nodes[oldParent].leftChild) {
+            nodes[oldParent].leftChild = newIndex;
+        } else {
+            nodes[oldParent].rightChild = newIndex;
+        }
+
+        // The sentinel is never written. `deleteNode` keeps track of x's parent itself.
+        if (newIndex != nilIndex) {
+            nodes[newIndex].setParent(oldParent);
+        }
+    }
+
+    /// Same as `RBTree::fixUpDeletion`.
+    void fixUpDeletion(Index x, Index xParent) {
+        while ((x != rootIndex) && (!nodes[x].isRed())) {
+            if (x == nodes[xParent].leftChild) {
+                auto sibling = nodes[xParent].rightChild;
+
+                if (nodes[sibling].isRed()) {
+                    // Case 1.
+                    nodes[sibling].setRed(false);
+                    nodes[xParent].setRed(true);
+                    rotateLeft(xParent);
+                    sibling = nodes[xParent].rightChild;
+                }
+
+                if ((!nodes[nodes[sibling].leftChild].isRed()) && (!nodes[nodes[sibling].rightChild].isRed())) {
+                    // Case 2.
+                    nodes[sibling].setRed(true);
+                    x = xParent;
+                    xParent = nodes[x].getParent();
+                } else {
+                    if (!nodes[nodes[sibling].rightChild].isRed()) {
+                        // Case 3.
+                        nodes[nodes[sibling].leftChild].setRed(false);
+                        nodes[sibling].setRed(true);
+                        rotateRight(sibling);
+                        sibling = nodes[xParent].rightChild;
+                    }
+
+                    // Case 4.
+                    nodes[sibling].setRed(nodes[xParent].isRed());
+                    nodes[xParent].setRed(false);
+                    nodes[nodes[sibling].rightChild].setRed(false);
+                    rotateLeft(xParent);
+
+                    x = rootIndex;
+                }
+            } else {
+                auto sibling = nodes[xParent].leftChild;
+
+                if (nodes[sibling].isRed()) {
+                    nodes[sibling].setRed(false);
+                    nodes[xParent].setRed(true);
+                    rotateRight(xParent);
+                    sibling = nodes[xParent].leftChild;
+                }
+
+                if ((!nodes[nodes[sibling].leftChild].isRed()) && (!nodes[nodes[sibling].rightChild].isRed())) {
+                    nodes[sibling].setRed(true);
+                    x = xParent;
+                    xParent = nodes[x].getParent();
+                } else {
+                    if (!nodes[nodes[sibling].leftChild].isRed()) {
+                        nodes[nodes[sibling].rightChild].setRed(false);
+                        nodes[sibling].setRed(true);
+                        rotateLeft(sibling);
+                        sibling = nodes[xParent].leftChild;
+                    }
+
+                    nodes[sibling].setRed(nodes[xParent].isRed());
+                    nodes[xParent].setRed(false);
+                    nodes[nodes[sibling].leftChild].setRed(false);
+                    rotateRight(xParent);
+
+                    x = rootIndex;
+                }
+            }
+        }
+
+        if (x != nilIndex) {
+            nodes[x].setRed(false);
+        }
+    }
+
+public:
+    /// @param z A live node of this tree, e.g. `searchForValue(value).getIndex()`.
+    void deleteNode(Index z) {
+        Index x = nilIndex;
+        Index xParent = nilIndex;
+
+        auto y = z;
+        bool isYOriginallyRed = nodes[y].isRed();
+
+        if (nodes[z].leftChild == nilIndex) {
+            x = nodes[z].rightChild;
+            xParent = nodes[z].getParent();
+            transplantDuringDeletion(z, x);
+        } else if (nodes[z].rightChild == nilIndex) {
+            x = nodes[z].leftChild;
+            xParent = nodes[z].getParent();
+            transplantDuringDeletion(z, x);
+        } else {
+            y = getMinIndexOfSubtree(nodes[z].rightChild);
+            isYOriginallyRed = nodes[y].isRed();
+            x = nodes[y].rightChild;
+
+            if (nodes[y].getParent() == z) {
+                xParent = y;
+            } else {
+                xParent = nodes[y].getParent();
+                transplantDuringDeletion(y, x);
+                nodes[y].rightChild = nodes[z].rightChild;
+                nodes[nodes[y].rightChild].setParent(y);
+            }
+
+            transplantDuringDeletion(z, y);
+            nodes[y].leftChild = nodes[z].leftChild;
+            nodes[nodes[y].leftChild].setParent(y);
+            nodes[y].setRed(nodes[z].isRed());
+        }
+
+        if (!isYOriginallyRed) {
+            fixUpDeletion(x, xParent);
+        }
+
+        // Release what the key owns now rather than when the slot is reused.
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            nodes[z].value = T();
+        }
+        nodes[z].leftChild = freeIndex;
+        freeIndex = z;
+        size -= 1;
+    }
+
+    template <typename Key>
+    bool deleteValue(const Key& value) {
+        auto it = searchForValue(value);
+        if (it == end()) {
+            return false;
+        } else {
+            deleteNode(it.getIndex());
+            return true;
+        }
+    }
+};
+
+
+/**
+ * Red black tree whose nodes are never modified after construction.
+ *
+ * An update copies the path from the root to the change and shares every other node with the previous version.
+ * Readers take a `Snapshot` of the current root and read it without locks for as long as they like, while the writer keeps publishing new versions.
+ * A version is freed when the last snapshot referring to it is gone, by reference counting.
+ *
+ * Nodes have no parent pointers since a node is shared by many versions, so the in-place CLRS rotations cannot be used.
+ * Insertion rebalances as in "Red-black trees in a functional setting" by Chris Okasaki, and deletion as in "Red-black trees with types" by Stefan Kahrs.
+ *
+ * Writers are serialized by a mutex. Taking a snapshot copies one `std::shared_ptr` atomically; nothing else is shared between readers.
+ */
+template <typename T, typename Payload = RBNoPayload, typename Compare = std::less<T>>
+class PersistentRBTree {
+public:
+    class Node {
+    public:
+        const T value;
+        const Payload payload;
+        const bool isRed;
+
+        /// `nullptr` for leaves. There is no shared sentinel: empty `std::shared_ptr`s cost nothing to copy.
+        const std::shared_ptr<const Node> leftChild;
+        const std::shared_ptr<const Node> rightChild;
+
+    public:
+        Node(const T& value, const Payload& payload, bool isRed, std::shared_ptr<const Node> leftChild, std::shared_ptr<const Node> rightChild): value(value), payload(payload), isRed(isRed), leftChild(std::move(leftChild)), rightChild(std::move(rightChild)) {}
+    };
+
+    using NodePointer = std::shared_ptr<const Node>;
+    using ValueCompare = Compare;
+
+    static_assert(std::is_empty_v<Compare>, "Comparators are default-constructed at every comparison, so they must be stateless.");
+
+private:
+    /// Only accessed through `std::atomic_load` and `std::atomic_store`.
+    NodePointer rootNode;
+
+    std::mutex writerMutex;
+
+public:
+    PersistentRBTree() = default;
+
+    PersistentRBTree(const PersistentRBTree&) = delete;
+    PersistentRBTree& operator=(const PersistentRBTree&) = delete;
+
+
+#pragma mark Snapshots
+public:
+    /// In-order iterator over a snapshot. Keeps the path to the current node on a stack since nodes have no parents.
+    class Iterator {
+    private:
+        std::vector<const Node*> path;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        Iterator() = default;
+
+        explicit Iterator(const Node* rootNode) {
+            pushLeftPath(rootNode);
+        }
+
+        const T& operator*() const {
+            return path.back()->value;
+        }
+
+        const T* operator->() const {
+            return &(path.back()->value);
+        }
+
+        const Node* getNode() const {
+            return path.empty() ? nullptr : path.back();
+        }
+
+        Iterator& operator++() {
+            auto node = path.back();
+            path.pop_back();
+            pushLeftPath(node->rightChild.get());
+
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto returnValue = *this;
+            ++(*this);
+            return returnValue;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return getNode() == other.getNode();
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return getNode() != other.getNode();
+        }
+
+    private:
+        void pushLeftPath(const Node* node) {
+            for (; node != nullptr; node = node->leftChild.get()) {
+                path.push_back(node);
+            }
+        }
+    };
+
+    /// An immutable version of the tree. Cheap to copy, and safe to read from any number of threads.
+    class Snapshot {
+    private:
+        NodePointer rootNode;
+
+    public:
+        Snapshot() = default;
+
+        explicit Snapshot(NodePointer rootNode): rootNode(std::move(rootNode)) {}
+
+        const Node* getRootNode() const {
+            return rootNode.get();
+        }
+
+        bool isEmpty() const {
+            return rootNode == nullptr;
+        }
+
+        Iterator begin() const {
+            return Iterator(rootNode.get());
+        }
+
+        Iterator end() const {
+            return Iterator();
+        }
+
+        std::vector<T> inOrderWalk() const {
+            return std::vector<T>(begin(), end());
+        }
+
+        /// @return A node with a key equivalent to `value`, or `nullptr`.
+        template <typename Key>
+        const Node* searchForValue(const Key& value) const {
+            auto currentNode = rootNode.get();
+            while (currentNode != nullptr) {
+                if (isLess(value, currentNode->value)) {
+                    currentNode = currentNode->leftChild.get();
+                } else if (isLess(currentNode->value, value)) {
+                    currentNode = currentNode->rightChild.get();
+                } else {
+                    return currentNode;
+                }
+            }
+
+            return nullptr;
+        }
+
+        /// Calls `visitor(node)` for every node with a key in `[lowValue, highValue)`, in order. O(log n + k).
+        template <typename Key, typename Visitor>
+        void forEachInRange(const Key& lowValue, const Key& highValue, Visitor visitor) const {
+            Snapshot::visitRange(rootNode.get(), lowValue, highValue, visitor);
+        }
+
+    private:
+        template <typename Key, typename Visitor>
+        static void visitRange(const Node* node, const Key& lowValue, const Key& highValue, Visitor& visitor) {
+            if (node == nullptr) {
+                return;
+            }
+
+            auto isAboveLow = !isLess(node->value, lowValue);
+            auto isBelowHigh = isLess(node->value, highValue);
+            if (isAboveLow) {
+                visitRange(node->leftChild.get(), lowValue, highValue, visitor);
+            }
+            if (isAboveLow && isBelowHigh) {
+                visitor(node);
+            }
+            if (isBelowHigh) {
+                visitRange(node->rightChild.get(), lowValue, highValue, visitor);
+            }
+        }
+    };
+
+    Snapshot getSnapshot() const {
+        return Snapshot(std::atomic_load(&rootNode));
+    }
+
+
+#pragma mark Comparison
+private:
+    template <typename A, typename B>
+    static bool isLess(const A& a, const B& b) {
+        return Compare()(a, b);
+    }
+
+
+#pragma mark Node Construction
+private:
+    static bool isRedNode(const NodePointer& node) {
+        return (node != nullptr) && node->isRed;
+    }
+
+    static bool isBlackNode(const NodePointer& node) {
+        return (node != nullptr) && (!node->isRed);
+    }
+
+    /// A copy of `source` with new children and color.
+    static NodePointer makeRedNode(NodePointer leftChild, const Node& source, NodePointer rightChild) {
+        return std::make_shared<const Node>(source.value, source.payload, true, std::move(leftChild), std::move(rightChild));
+    }
+
+    static NodePointer makeBlackNode(NodePointer leftChild, const Node& source, NodePointer rightChild) {
+        return std::make_shared<const Node>(source.value, source.payload, false, std::move(leftChild), std::move(rightChild));
+    }
+
+    static NodePointer blacken(const NodePointer& node) {
+        if (isRedNode(node)) {
+            return makeBlackNode(node->leftChild, *node, node->rightChild);
+        } else {
+            return node;
+        }
+    }
+
+    /// Only called on black nodes, whose black height has to drop by 1.
+    static NodePointer redden(const NodePointer& node) {
+        return makeRedNode(node->leftChild, *node, node->rightChild);
+    }
+
+
+#pragma mark Insertion
+private:
+    /**
+     * Builds a black node over `leftChild` and `rightChild`, resolving a red child with a red child below it.
+     *
+     * All four red-red shapes become a red node with two black children.
+     */
+    static NodePointer balance(const NodePointer& leftChild, const Node& node, const NodePointer& rightChild) {
+        if (isRedNode(leftChild) && isRedNode(rightChild)) {
+            return makeRedNode(blacken(leftChild), node, blacken(rightChild));
+        }
+
+        if (isRedNode(leftChild)) {
+            if (isRedNode(leftChild->leftChild)) {
+                return makeRedNode(blacken(leftChild->leftChild), *leftChild, makeBlackNode(leftChild->rightChild, node, rightChild));
+            }
+            if (isRedNode(leftChild->rightChild)) {
+                auto& middle = leftChild->rightChild;
+                return makeRedNode(makeBlackNode(leftChild->leftChild, *leftChild, middle->leftChild), *middle, makeBlackNode(middle->rightChild, node, rightChild));
+            }
+        }
+
+        if (isRedNode(rightChild)) {
+            if (isRedNode(rightChild->rightChild)) {
+                return makeRedNode(makeBlackNode(leftChild, node, rightChild->leftChild), *rightChild, blacken(rightChild->rightChild));
+            }
+            if (isRedNode(rightChild->leftChild)) {
+                auto& middle = rightChild->leftChild;
+                return makeRedNode(makeBlackNode(leftChild, node, middle->leftChild), *middle, makeBlackNode(middle->rightChild, *rightChild, rightChild->rightChild));
+            }
+        }
+
+        return makeBlackNode(leftChild, node, rightChild);
+    }
+
+    /// Equal keys go to the left, as in `RBTree::insertValue`, so both trees keep duplicates in the same order.
+    static NodePointer insertIntoSubtree(const NodePointer& node, const T& value, const Payload& payload) {
+        if (node == nullptr) {
+            return std::make_shared<const Node>(value, payload, true, nullptr, nullptr);
+        }
+
+        if (!isLess(node->value, value)) {
+            auto leftChild = insertIntoSubtree(node->leftChild, value, payload);
+            return node->isRed ? makeRedNode(std::move(leftChild), *node, node->rightChild) : balance(leftChild, *node, node->rightChild);
+        } else {
+            auto rightChild = insertIntoSubtree(node->rightChild, value, payload);
+            return node->isRed ? makeRedNode(node->leftChild, *node, std::move(rightChild)) : balance(node->leftChild, *node, rightChild);
+        }
+    }
+
+public:
+    /// Publishes a new version with `value` added. Copies O(log n) nodes.
+    void insertValue(const T& value, const Payload& payload = Payload()) {
+        auto lock = std::lock_guard<std::mutex>(writerMutex);
+
+        auto newRootNode = blacken(insertIntoSubtree(std::atomic_load(&rootNode), value, payload));
+        std::atomic_store(&rootNode, std::move(newRootNode));
+    }
+
+
+#pragma mark - Deletion
+private:
+    /// `leftChild` has a black height 1 lower than `rightChild`. Restores the balance.
+    static NodePointer balanceLeft(const NodePointer& leftChild, const Node& node, const NodePointer& rightChild) {
+        if (isRedNode(leftChild)) {
+            return makeRedNode(blacken(leftChild), node, rightChild);
+        } else if (isBlackNode(rightChild)) {
+            return balance(leftChild, node, redden(rightChild));
+        } else {
+            // `rightChild` is red with black children, each 1 black level above `leftChild`'s.
+            auto& middle = rightChild->leftChild;
+            return makeRedNode(makeBlackNode(leftChild, node, middle->leftChild), *middle, balance(middle->rightChild, *rightChild, redden(rightChild->rightChild)));
+        }
+    }
+
+    /// Mirror image of `balanceLeft`.
+    static NodePointer balanceRight(const NodePointer& leftChild, const Node& node, const NodePointer& rightChild) {
+        if (isRedNode(rightChild)) {
+            return makeRedNode(leftChild, node, blacken(rightChild));
+        } else if (isBlackNode(leftChild)) {
+            return balance(redden(leftChild), node, rightChild);
+        } else {
+            auto& middle = leftChild->rightChild;
+            return makeRedNode(balance(redden(leftChild->leftChild), *leftChild, middle->leftChild), *middle, makeBlackNode(middle->rightChild, node, rightChild));
+        }
+    }
+
+    /// Merges two subtrees of equal black height, where keys in `leftNode` <= keys in `rightNode`, replacing their deleted parent.
+    static NodePointer append(const NodePointer& leftNode, const NodePointer& rightNode) {
+        if (leftNode == nullptr) {
+            return rightNode;
+        } else if (rightNode == nullptr) {
+            return leftNode;
+        }
+
+        if (leftNode->isRed && rightNode->isRed) {
+            auto middle = append(leftNode->rightChild, rightNode->leftChild);
+            if (isRedNode(middle)) {
+                return makeRedNode(makeRedNode(leftNode->leftChild, *leftNode, middle->leftChild), *middle, makeRedNode(middle->rightChild, *rightNode, rightNode->rightChild));
+            } else {
+                return makeRedNode(leftNode->leftChild, *leftNode, makeRedNode(middle, *rightNode, rightNode->rightChild));
+            }
+        } else if ((!leftNode->isRed) && (!rightNode->isRed)) {
+            auto middle = append(leftNode->rightChild, rightNode->leftChild);
+            if (isRedNode(middle)) {
+                return makeRedNode(makeBlackNode(leftNode->leftChild, *leftNode, middle->leftChild), *middle, makeBlackNode(middle->rightChild, *rightNode, rightNode->rightChild));
+            } else {
+                return balanceLeft(leftNode->leftChild, *leftNode, makeBlackNode(middle, *rightNode, rightNode->rightChild));
+            }
+        } else if (rightNode->isRed) {
+            return makeRedNode(append(leftNode, rightNode->leftChild), *rightNode, rightNode->rightChild);
+        } else {
+            return makeRedNode(leftNode->leftChild, *leftNode, append(leftNode->rightChild, rightNode));
+        }
+    }
+
+    /**
+     * Removes the first node equivalent to `value` on the search path, which must exist.
+     *
+     * A subtree that lost a black node comes back with black height 1 lower, and `balanceLeft` or `balanceRight` makes up for it.
+     */
+    template <typename Key>
+    static NodePointer deleteFromSubtree(const NodePointer& node, const Key& value) {
+        if (isLess(value, node->value)) {
+            auto leftChild = deleteFromSubtree(node->leftChild, value);
+            if (isBlackNode(node->leftChild)) {
+                return balanceLeft(leftChild, *node, node->rightChild);
+            } else {
+                return makeRedNode(std::move(leftChild), *node, node->rightChild);
+            }
+        } else if (isLess(node->value, value)) {
+            auto rightChild = deleteFromSubtree(node->rightChild, value);
+            if (isBlackNode(node->rightChild)) {
+                return balanceRight(node->leftChild, *node, rightChild);
+            } else {
+                return makeRedNode(node->leftChild, *node, std::move(rightChild));
+            }
+        } else {
+            return append(node->leftChild, node->rightChild);
+        }
+    }
+
+public:
+    /// Publishes a new version without one node equivalent to `value`. Copies O(log n) nodes.
+    template <typename Key>
+    bool deleteValue(const Key& value) {
+        auto lock = std::lock_guard<std::mutex>(writerMutex);
+
+        auto currentRootNode = std::atomic_load(&rootNode);
+        if (Snapshot(currentRootNode).searchForValue(value) == nullptr) {
+            // `deleteFromSubtree` relies on finding the key.
+            return false;
+        }
+
+        auto newRootNode = blacken(deleteFromSubtree(currentRootNode, value));
+        std::atomic_store(&rootNode, std::move(newRootNode));
+        return true;
+    }
+};
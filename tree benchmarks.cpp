@@ -0,0 +1,431 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <set>
+#include <string>
+
+#include <malloc.h>
+
+#include "binary search tree.hpp"
+#include "red black tree.hpp"
+
+
+/**
+ * Benchmarks `SearchTreeNode` and `RBTree` against `std::multiset` and `std::set`.
+ *
+ * Every container runs every workload in 3 phases: inserting every key, looking up as many keys from the same distribution, and deleting every inserted key.
+ * Each result is one JSON object per line, so that runs can be compared by scripts.
+ *
+ * Usage: `tree_benchmarks [keyCount] [seed]`. The same arguments produce the same keys and queries on every machine.
+ */
+
+
+// MARK: - Heap Accounting
+// Every allocation of this program goes through these, so that each case can report the most heap it held at once.
+
+static std::atomic<std::size_t> allocatedBytes = 0;
+static std::atomic<std::size_t> peakAllocatedBytes = 0;
+
+void* operator new(std::size_t size) {
+    auto pointer = std::malloc((size == 0) ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    auto currentBytes = allocatedBytes.fetch_add(malloc_usable_size(pointer), std::memory_order_relaxed) + malloc_usable_size(pointer);
+    auto peakBytes = peakAllocatedBytes.load(std::memory_order_relaxed);
+    while ((currentBytes > peakBytes) && !peakAllocatedBytes.compare_exchange_weak(peakBytes, currentBytes, std::memory_order_relaxed)) {
+    }
+
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    if (pointer != nullptr) {
+        allocatedBytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+        std::free(pointer);
+    }
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+// Node pools allocate their slabs as arrays.
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+
+// MARK: - Workloads
+/// Ranks follow Zipf's law with exponent `theta`: rank `r` is drawn with probability proportional to `1 / r^theta`.
+class ZipfianDistribution {
+private:
+    std::vector<double> cumulativeProbabilities;
+    std::uniform_real_distribution<double> uniformDistribution;
+
+public:
+    ZipfianDistribution(std::size_t rankCount, double theta): cumulativeProbabilities(rankCount), uniformDistribution(0, 1) {
+        double sum = 0;
+        for (std::size_t rank = 0; rank < rankCount; rank += 1) {
+            sum += 1 / std::pow(static_cast<double>(rank + 1), theta);
+            cumulativeProbabilities[rank] = sum;
+        }
+        for (auto& probability: cumulativeProbabilities) {
+            probability /= sum;
+        }
+    }
+
+    /// @return A 0-based rank.
+    template <typename Generator>
+    std::size_t operator()(Generator& generator) {
+        auto rank = std::lower_bound(cumulativeProbabilities.begin(), cumulativeProbabilities.end(), uniformDistribution(generator)) - cumulativeProbabilities.begin();
+        return std::min(static_cast<std::size_t>(rank), cumulativeProbabilities.size() - 1);
+    }
+};
+
+struct Workload {
+    std::string name;
+    /// Turns a tree without balancing into a long chain: ascending keys, or thousands of copies of the same key.
+    bool isDegenerate;
+    /// In insertion order.
+    std::vector<int> keys;
+    std::vector<int> queries;
+};
+
+/// Spreads ranks over the key space, so that the popular keys are not neighbors in the tree. A bijection on 32 bits.
+int scrambleRank(std::size_t rank) {
+    return static_cast<int>((static_cast<std::uint32_t>(rank) * 2654435761u) >> 1);
+}
+
+std::vector<Workload> makeWorkloads(std::size_t keyCount, unsigned int seed) {
+    auto workloads = std::vector<Workload>();
+    auto generator = std::mt19937_64(seed);
+
+    // Ascending keys: the worst case of an unbalanced tree, and the best case for caches.
+    {
+        auto workload = Workload({"sequential", true, std::vector<int>(keyCount), std::vector<int>(keyCount)});
+        std::iota(workload.keys.begin(), workload.keys.end(), 0);
+        auto distribution = std::uniform_int_distribution<int>(0, static_cast<int>(keyCount) - 1);
+        for (auto& query: workload.queries) {
+            query = distribution(generator);
+        }
+        workloads.push_back(std::move(workload));
+    }
+
+    // Uniformly random keys. Every query hits.
+    {
+        auto workload = Workload({"random", false, std::vector<int>(keyCount), {}});
+        auto distribution = std::uniform_int_distribution<int>(0, std::numeric_limits<int>::max());
+        for (auto& key: workload.keys) {
+            key = distribution(generator);
+        }
+        workload.queries = workload.keys;
+        std::shuffle(workload.queries.begin(), workload.queries.end(), generator);
+        workloads.push_back(std::move(workload));
+    }
+
+    // Skewed keys, as in YCSB: a few keys take most insertions and queries.
+    {
+        auto workload = Workload({"zipfian", true, std::vector<int>(keyCount), std::vector<int>(keyCount)});
+        auto distribution = ZipfianDistribution(keyCount, 0.99);
+        for (auto& key: workload.keys) {
+            key = scrambleRank(distribution(generator));
+        }
+        for (auto& query: workload.queries) {
+            query = scrambleRank(distribution(generator));
+        }
+        workloads.push_back(std::move(workload));
+    }
+
+    // About 100 copies of each key.
+    {
+        auto workload = Workload({"duplicate-heavy", false, std::vector<int>(keyCount), std::vector<int>(keyCount)});
+        auto distribution = std::uniform_int_distribution<int>(0, std::max(1, static_cast<int>(keyCount / 100)) - 1);
+        for (auto& key: workload.keys) {
+            key = distribution(generator);
+        }
+        for (auto& query: workload.queries) {
+            query = distribution(generator);
+        }
+        workloads.push_back(std::move(workload));
+    }
+
+    return workloads;
+}
+
+
+// MARK: - Containers
+// The same 3 operations on every container. `deleteValue` removes one copy of a key.
+
+class SearchTreeNodeContainer {
+private:
+    using Node = SearchTreeNode<int>;
+
+    Node* rootNode = nullptr;
+
+public:
+    static constexpr const char* name = "SearchTreeNode";
+    /// Degenerate workloads take quadratic time, so they are cut short.
+    static constexpr std::size_t maxDegenerateKeyCount = 20000;
+
+    ~SearchTreeNodeContainer() {
+        // Stack-free: degenerate workloads leave a tree about as deep as it is large.
+        Node::clear(&rootNode);
+    }
+
+    void insertValue(int value) {
+        if (rootNode == nullptr) {
+            rootNode = new Node(value);
+        } else {
+            Node::insertIteratively(rootNode, value);
+        }
+    }
+
+    bool containsValue(int value) {
+        return Node::searchForValueIteratively(rootNode, value) != nullptr;
+    }
+
+    void deleteValue(int value) {
+        auto node = Node::searchForValueIteratively(rootNode, value);
+        if (node != nullptr) {
+            Node::deleteNode(&rootNode, node);
+            delete node;
+        }
+    }
+};
+
+class RBTreeContainer {
+private:
+    RBTree<int> tree;
+
+public:
+    static constexpr const char* name = "RBTree";
+    static constexpr std::size_t maxDegenerateKeyCount = SIZE_MAX;
+
+    void insertValue(int value) {
+        tree.insertValue(value);
+    }
+
+    bool containsValue(int value) {
+        return tree.searchForValue(value) != RBTree<int>::Node::nilNode;
+    }
+
+    void deleteValue(int value) {
+        tree.deleteValue(value);
+    }
+};
+
+class SplayTreeContainer {
+private:
+    SplayTree<int> tree;
+
+public:
+    static constexpr const char* name = "SplayTree";
+    /// Ascending keys make a chain, but splaying keeps every operation amortized O(log n).
+    static constexpr std::size_t maxDegenerateKeyCount = SIZE_MAX;
+
+    void insertValue(int value) {
+        tree.insertValue(value);
+    }
+
+    bool containsValue(int value) {
+        return tree.searchForValue(value) != nullptr;
+    }
+
+    void deleteValue(int value) {
+        tree.deleteValue(value);
+    }
+};
+
+class MultisetContainer {
+private:
+    std::multiset<int> container;
+
+public:
+    static constexpr const char* name = "std::multiset";
+    static constexpr std::size_t maxDegenerateKeyCount = SIZE_MAX;
+
+    void insertValue(int value) {
+        container.insert(value);
+    }
+
+    bool containsValue(int value) {
+        return container.find(value) != container.end();
+    }
+
+    void deleteValue(int value) {
+        auto it = container.find(value);
+        if (it != container.end()) {
+            container.erase(it);
+        }
+    }
+};
+
+/// Keeps one copy of each key, so duplicate-heavy workloads do less work here than in the other containers.
+class SetContainer {
+private:
+    std::set<int> container;
+
+public:
+    static constexpr const char* name = "std::set";
+    static constexpr std::size_t maxDegenerateKeyCount = SIZE_MAX;
+
+    void insertValue(int value) {
+        container.insert(value);
+    }
+
+    bool containsValue(int value) {
+        return container.find(value) != container.end();
+    }
+
+    void deleteValue(int value) {
+        container.erase(value);
+    }
+};
+
+
+// MARK: - Measurement
+struct PhaseResult {
+    const char* operation;
+    std::size_t operationCount;
+    double seconds;
+    /// Sorted.
+    std::vector<std::uint64_t> latencies;
+};
+
+/**
+ * Runs `operation(i)` for every `i < count`.
+ *
+ * The throughput run has no clock reads inside the loop. Latencies come from a second run on a fresh container, since reading the clock around each operation costs about as much as a cached lookup.
+ */
+template <typename Operation>
+double getSeconds(std::size_t count, Operation operation) {
+    auto startTime = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i += 1) {
+        operation(i);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+template <typename Operation>
+void recordLatencies(std::size_t count, std::vector<std::uint64_t>& latencies, Operation operation) {
+    for (std::size_t i = 0; i < count; i += 1) {
+        auto startTime = std::chrono::steady_clock::now();
+        operation(i);
+        latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    std::sort(latencies.begin(), latencies.end());
+}
+
+std::uint64_t getPercentile(const std::vector<std::uint64_t>& sortedValues, double percentile) {
+    if (sortedValues.empty()) {
+        return 0;
+    }
+    auto index = static_cast<std::size_t>(std::ceil(percentile / 100 * sortedValues.size()));
+    return sortedValues[std::min(sortedValues.size(), std::max<std::size_t>(index, 1)) - 1];
+}
+
+template <typename Container>
+void runCase(const Workload& workload, std::size_t keyCount, unsigned int seed) {
+    if (workload.isDegenerate) {
+        keyCount = std::min(keyCount, Container::maxDegenerateKeyCount);
+    }
+    const auto& keys = workload.keys;
+    // Every inserted key, in a different order. A shortened run only deletes the keys it inserted.
+    auto deletions = std::vector<int>(keys.begin(), keys.begin() + keyCount);
+    std::shuffle(deletions.begin(), deletions.end(), std::mt19937_64(seed));
+
+    // A shortened run draws its queries from the keys it inserted, so they follow the workload's distribution over that prefix instead of mostly missing.
+    auto queries = std::vector<int>(workload.queries.begin(), workload.queries.begin() + keyCount);
+    if (keyCount < workload.keys.size()) {
+        auto generator = std::mt19937_64(seed);
+        auto distribution = std::uniform_int_distribution<std::size_t>(0, keyCount - 1);
+        for (auto& query: queries) {
+            query = keys[distribution(generator)];
+        }
+    }
+
+    auto results = std::vector<PhaseResult>({
+        {"insert", keyCount, 0, std::vector<std::uint64_t>(keyCount)},
+        {"search", keyCount, 0, std::vector<std::uint64_t>(keyCount)},
+        {"delete", keyCount, 0, std::vector<std::uint64_t>(keyCount)},
+    });
+    std::size_t foundCount = 0;
+
+    // Throughput and memory.
+    auto baselineBytes = allocatedBytes.load();
+    peakAllocatedBytes.store(baselineBytes);
+    {
+        auto container = Container();
+        results[0].seconds = getSeconds(keyCount, [&](std::size_t i) {
+            container.insertValue(keys[i]);
+        });
+        results[1].seconds = getSeconds(keyCount, [&](std::size_t i) {
+            foundCount += container.containsValue(queries[i]);
+        });
+        results[2].seconds = getSeconds(keyCount, [&](std::size_t i) {
+            container.deleteValue(deletions[i]);
+        });
+    }
+    auto peakBytes = peakAllocatedBytes.load() - baselineBytes;
+
+    // Latency.
+    {
+        auto container = Container();
+        recordLatencies(keyCount, results[0].latencies, [&](std::size_t i) {
+            container.insertValue(keys[i]);
+        });
+        recordLatencies(keyCount, results[1].latencies, [&](std::size_t i) {
+            foundCount += container.containsValue(queries[i]);
+        });
+        recordLatencies(keyCount, results[2].latencies, [&](std::size_t i) {
+            container.deleteValue(deletions[i]);
+        });
+    }
+
+    for (const auto& result: results) {
+        std::cout << "{\"container\": \"" << Container::name << "\", \"workload\": \"" << workload.name << "\", \"operation\": \"" << result.operation << "\"";
+        std::cout << ", \"keyCount\": " << keyCount << ", \"seed\": " << seed;
+        std::cout << ", \"opsPerSecond\": " << static_cast<std::uint64_t>(result.operationCount / std::max(result.seconds, 1e-9));
+        std::cout << ", \"p50Ns\": " << getPercentile(result.latencies, 50) << ", \"p90Ns\": " << getPercentile(result.latencies, 90);
+        std::cout << ", \"p99Ns\": " << getPercentile(result.latencies, 99) << ", \"p999Ns\": " << getPercentile(result.latencies, 99.9);
+        std::cout << ", \"maxNs\": " << (result.latencies.empty() ? 0 : result.latencies.back());
+        std::cout << ", \"peakHeapBytes\": " << peakBytes << ", \"foundCount\": " << foundCount / 2;
+        std::cout << ", \"searchHitRate\": " << static_cast<double>(foundCount / 2) / std::max<std::size_t>(keyCount, 1) << "}" << std::endl;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    std::size_t keyCount = (argc > 1) ? std::stoull(argv[1]) : 1000000;
+    unsigned int seed = (argc > 2) ? static_cast<unsigned int>(std::stoul(argv[2])) : 42;
+
+    for (const auto& workload: makeWorkloads(keyCount, seed)) {
+        runCase<SearchTreeNodeContainer>(workload, keyCount, seed);
+        runCase<RBTreeContainer>(workload, keyCount, seed);
+        runCase<SplayTreeContainer>(workload, keyCount, seed);
+        runCase<MultisetContainer>(workload, keyCount, seed);
+        runCase<SetContainer>(workload, keyCount, seed);
+    }
+
+    return 0;
+}
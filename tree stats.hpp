@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+
+/**
+ * Opt-in counters for the hot paths of `RBTree` and `SearchTreeNode`: comparisons, rotations, fix-up cases and per-operation latency.
+ *
+ * Define `TREE_STATS` (CMake: `-DTREE_STATS=ON`) to turn them on.
+ * Otherwise the `TREE_STATS_*` macros expand to nothing, so the trees compile to exactly what they were without them, and every snapshot is zero.
+ *
+ * Counters are kept per thread, so that counting never contends between threads. A snapshot covers the calling thread only.
+ * Subtrees that bulk construction or set operations hand to other threads are not counted.
+ */
+class TreeStats {
+public:
+    enum Operation {
+        search,
+        insertion,
+        deletion,
+        operationCount,
+    };
+
+    /// Bucket `b` holds operations that took `[2^b, 2^(b + 1))` nanoseconds. The last one also holds everything slower.
+    static constexpr std::size_t latencyBucketCount = 32;
+
+    struct Snapshot {
+        std::uint64_t comparisonCount = 0;
+
+        std::uint64_t leftRotationCount = 0;
+        std::uint64_t rightRotationCount = 0;
+
+        /// Loop iterations of `fixUpInsertion` by CLRS case (1 to 3). Index 0 is unused.
+        std::array<std::uint64_t, 4> insertionFixUpCaseCounts = {};
+        /// Loop iterations of `fixUpDeletion` by CLRS case (1 to 4). Index 0 is unused.
+        std::array<std::uint64_t, 5> deletionFixUpCaseCounts = {};
+
+        std::array<std::uint64_t, operationCount> operationCounts = {};
+        /// Comparisons made within each kind of operation, e.g. divided by `operationCounts[search]` for comparisons per search.
+        std::array<std::uint64_t, operationCount> operationComparisonCounts = {};
+        std::array<std::uint64_t, operationCount> maxOperationComparisonCounts = {};
+        std::array<std::array<std::uint64_t, latencyBucketCount>, operationCount> latencyHistograms = {};
+
+        /// One JSON object, in the style of the benchmark output.
+        void writeJSON(std::ostream& stream) const {
+            auto writeArray = [&](const auto& values) {
+                stream << "[";
+                for (std::size_t i = 0; i < values.size(); i += 1) {
+                    stream << ((i == 0) ? "" : ", ") << values[i];
+                }
+                stream << "]";
+            };
+
+            static constexpr const char* operationNames[operationCount] = {"search", "insertion", "deletion"};
+
+            stream << "{\"comparisonCount\": " << comparisonCount;
+            stream << ", \"leftRotationCount\": " << leftRotationCount << ", \"rightRotationCount\": " << rightRotationCount;
+            stream << ", \"insertionFixUpCaseCounts\": ";
+            writeArray(insertionFixUpCaseCounts);
+            stream << ", \"deletionFixUpCaseCounts\": ";
+            writeArray(deletionFixUpCaseCounts);
+            for (int operation = 0; operation < operationCount; operation += 1) {
+                stream << ", \"" << operationNames[operation] << "\": {\"count\": " << operationCounts[operation];
+                stream << ", \"comparisonCount\": " << operationComparisonCounts[operation] << ", \"maxComparisonCount\": " << maxOperationComparisonCounts[operation];
+                stream << ", \"latencyHistogramNs\": ";
+                writeArray(latencyHistograms[operation]);
+                stream << "}";
+            }
+            stream << "}";
+        }
+    };
+
+public:
+    static Snapshot& getCounters() {
+        static thread_local Snapshot counters;
+        return counters;
+    }
+
+    static Snapshot getSnapshot() {
+        return getCounters();
+    }
+
+    static void reset() {
+        getCounters() = Snapshot();
+    }
+
+    /// Counts one operation, with its comparisons and its latency, from construction to destruction.
+    class OperationScope {
+    private:
+        Operation operation;
+        std::uint64_t startComparisonCount;
+        std::chrono::steady_clock::time_point startTime;
+
+    public:
+        explicit OperationScope(Operation operation): operation(operation) {
+            startComparisonCount = getCounters().comparisonCount;
+            startTime = std::chrono::steady_clock::now();
+        }
+
+        ~OperationScope() {
+            auto nanoseconds = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
+            std::size_t bucket = 0;
+            while ((bucket + 1 < latencyBucketCount) && ((nanoseconds >> (bucket + 1)) != 0)) {
+                bucket += 1;
+            }
+
+            auto& counters = getCounters();
+            auto comparisonCount = counters.comparisonCount - startComparisonCount;
+            counters.operationCounts[operation] += 1;
+            counters.operationComparisonCounts[operation] += comparisonCount;
+            if (comparisonCount > counters.maxOperationComparisonCounts[operation]) {
+                counters.maxOperationComparisonCounts[operation] = comparisonCount;
+            }
+            counters.latencyHistograms[operation][bucket] += 1;
+        }
+
+        OperationScope(const OperationScope&) = delete;
+        OperationScope& operator=(const OperationScope&) = delete;
+    };
+};
+
+
+#ifdef TREE_STATS
+/// e.g. `TREE_STATS_COUNT(insertionFixUpCaseCounts[1])`.
+#define TREE_STATS_COUNT(counter) (TreeStats::getCounters().counter += 1)
+/// Counts the rest of the enclosing scope as one operation of the given kind.
+#define TREE_STATS_OPERATION(operation) TreeStats::OperationScope treeStatsOperationScope(TreeStats::operation)
+#else
+#define TREE_STATS_COUNT(counter) ((void) 0)
+#define TREE_STATS_OPERATION(operation) ((void) 0)
+#endif